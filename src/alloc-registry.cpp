@@ -0,0 +1,94 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "alloc-registry.h"
+
+const size_t INITIAL_SLOTS = 64;
+
+// device pointers are aligned and clustered, so mix all bits into the low ones (murmur3 fmix64)
+static inline uint64_t hash_ptr(uint64_t ptr) {
+  ptr ^= ptr >> 33;
+  ptr *= 0xff51afd7ed558ccdULL;
+  ptr ^= ptr >> 33;
+  ptr *= 0xc4ceb9fe1a85ec53ULL;
+  ptr ^= ptr >> 33;
+  return ptr;
+}
+
+AllocationRegistry::AllocationRegistry() : slots_(INITIAL_SLOTS, -1) {}
+
+size_t AllocationRegistry::slot_of(uint64_t ptr) const {
+  size_t mask = slots_.size() - 1;
+  size_t i = hash_ptr(ptr) & mask;
+  while (slots_[i] >= 0 && pool_[slots_[i]].ptr != ptr) i = (i + 1) & mask;
+  return i;
+}
+
+// double the table, keeping the load factor at most 1/2
+void AllocationRegistry::grow() {
+  slots_.assign(slots_.size() * 2, -1);
+  for (size_t idx = 0; idx < pool_.size(); idx++) slots_[slot_of(pool_[idx].ptr)] = idx;
+}
+
+void AllocationRegistry::insert(const allocation_t &alloc) {
+  if ((pool_.size() + 1) * 2 > slots_.size()) grow();
+  size_t s = slot_of(alloc.ptr);
+  if (slots_[s] >= 0) {
+    pool_[slots_[s]] = alloc;
+  } else {
+    slots_[s] = pool_.size();
+    pool_.push_back(alloc);
+  }
+}
+
+const allocation_t *AllocationRegistry::find(uint64_t ptr) const {
+  int32_t idx = slots_[slot_of(ptr)];
+  return idx < 0 ? nullptr : &pool_[idx];
+}
+
+bool AllocationRegistry::erase(uint64_t ptr, allocation_t *removed) {
+  size_t mask = slots_.size() - 1;
+  size_t hole = slot_of(ptr);
+  int32_t idx = slots_[hole];
+  if (idx < 0) return false;
+  if (removed != nullptr) *removed = pool_[idx];
+
+  // backward-shift deletion: move later entries of the probe sequence into the hole, unless
+  // their home slot lies cyclically in (hole, j]
+  for (size_t j = (hole + 1) & mask; slots_[j] >= 0; j = (j + 1) & mask) {
+    size_t home = hash_ptr(pool_[slots_[j]].ptr) & mask;
+    bool stays = hole < j ? (hole < home && home <= j) : (hole < home || home <= j);
+    if (stays) continue;
+    slots_[hole] = slots_[j];
+    hole = j;
+  }
+  slots_[hole] = -1;
+
+  // keep the pool dense by moving the last allocation into the freed position
+  size_t last = pool_.size() - 1;
+  if ((size_t)idx != last) {
+    pool_[idx] = pool_[last];
+    slots_[slot_of(pool_[idx].ptr)] = idx;
+  }
+  pool_.pop_back();
+  return true;
+}
+
+size_t AllocationRegistry::size() const { return pool_.size(); }
+
+const allocation_t *AllocationRegistry::begin() const { return pool_.data(); }
+
+const allocation_t *AllocationRegistry::end() const { return pool_.data() + pool_.size(); }
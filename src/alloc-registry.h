@@ -0,0 +1,57 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ALLOC_REGISTRY_H
+#define ALLOC_REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// a GPU memory allocation made through the hook library
+struct allocation_t {
+  uint64_t ptr;  // CUdeviceptr, or the handle of an array
+  size_t size;
+  int device;    // CUdevice of managed memory
+  bool managed;  // prefetched to host on SIGINT and back on SIGCONT
+};
+
+// Live allocations keyed by device pointer.
+// Allocations are stored densely in a pool, so that iterating them (prefetching on SIGINT/SIGCONT)
+// walks contiguous memory; an open-addressing hash table with linear probing maps pointers to
+// pool positions. Insert, find and erase are O(1) expected. Not thread-safe.
+class AllocationRegistry {
+ public:
+  AllocationRegistry();
+  // add an allocation, replacing the one with the same pointer if any
+  void insert(const allocation_t &alloc);
+  // @return the allocation of ptr, nullptr if unknown
+  const allocation_t *find(uint64_t ptr) const;
+  // remove the allocation of ptr, copying it to removed if not null
+  // @return whether ptr was known
+  bool erase(uint64_t ptr, allocation_t *removed = nullptr);
+  size_t size() const;
+  const allocation_t *begin() const;
+  const allocation_t *end() const;
+
+ private:
+  size_t slot_of(uint64_t ptr) const;  // slot holding ptr, or the empty slot ending its probe
+  void grow();
+  std::vector<allocation_t> pool_;
+  std::vector<int32_t> slots_;  // pool position, -1 if empty; size is a power of 2
+};
+
+#endif
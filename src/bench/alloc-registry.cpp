@@ -0,0 +1,127 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Allocation bookkeeping of the hook library with many live allocations.
+ * Every round frees a random live allocation and makes a new one, as a framework allocating per
+ * iteration does; then all managed allocations are walked once, as the SIGINT handler does.
+ * Compares std::map plus the managed std::list used before with AllocationRegistry.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "../alloc-registry.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int LIVE = 10000;
+const int ROUNDS = 100000;
+
+struct Event {
+  size_t victim;  // index into the live pointers
+  size_t size;
+};
+
+uint64_t new_ptr(std::mt19937_64 &gen) { return (gen() & 0xffffffffff) << 8; }  // 256 B aligned
+
+struct Result {
+  double churn_ns;  // per free + alloc
+  double walk_ns;   // per allocation walked
+  uint64_t checksum;
+};
+
+Result bench_map(const std::vector<Event> &events) {
+  std::map<uint64_t, size_t> allocation_map;
+  std::list<std::tuple<uint64_t, size_t, int>> devptrs_mngr;
+  std::mt19937_64 gen(1);
+  std::vector<uint64_t> live;
+  for (int i = 0; i < LIVE; i++) {
+    live.push_back(new_ptr(gen));
+    allocation_map[live.back()] = i + 1;
+    devptrs_mngr.push_back(std::make_tuple(live.back(), i + 1, 0));
+  }
+  uint64_t sum = 0;
+  auto begin = steady_clock::now();
+  for (const Event &e : events) {
+    uint64_t ptr = live[e.victim];
+    if (allocation_map.find(ptr) != allocation_map.end()) {
+      sum += allocation_map[ptr];
+      allocation_map.erase(ptr);
+      devptrs_mngr.erase(std::remove_if(devptrs_mngr.begin(), devptrs_mngr.end(),
+                                        [ptr](std::tuple<uint64_t, size_t, int> &x) {
+                                          return std::get<0>(x) == ptr;
+                                        }));
+    }
+    live[e.victim] = new_ptr(gen);
+    allocation_map[live[e.victim]] = e.size;
+    devptrs_mngr.push_back(std::make_tuple(live[e.victim], e.size, 0));
+  }
+  auto mid = steady_clock::now();
+  for (auto &x : devptrs_mngr) sum += std::get<1>(x);
+  auto end = steady_clock::now();
+  return {(double)duration_cast<nanoseconds>(mid - begin).count() / ROUNDS,
+          (double)duration_cast<nanoseconds>(end - mid).count() / LIVE, sum};
+}
+
+Result bench_registry(const std::vector<Event> &events) {
+  AllocationRegistry allocations;
+  std::mt19937_64 gen(1);
+  std::vector<uint64_t> live;
+  for (int i = 0; i < LIVE; i++) {
+    live.push_back(new_ptr(gen));
+    allocations.insert({live.back(), (size_t)i + 1, 0, true});
+  }
+  uint64_t sum = 0;
+  auto begin = steady_clock::now();
+  for (const Event &e : events) {
+    allocation_t freed;
+    if (allocations.erase(live[e.victim], &freed)) sum += freed.size;
+    live[e.victim] = new_ptr(gen);
+    allocations.insert({live[e.victim], e.size, 0, true});
+  }
+  auto mid = steady_clock::now();
+  for (const allocation_t &alloc : allocations) sum += alloc.managed ? alloc.size : 0;
+  auto end = steady_clock::now();
+  return {(double)duration_cast<nanoseconds>(mid - begin).count() / ROUNDS,
+          (double)duration_cast<nanoseconds>(end - mid).count() / LIVE, sum};
+}
+
+int main() {
+  std::mt19937 gen(2);
+  std::uniform_int_distribution<size_t> victim(0, LIVE - 1);
+  std::uniform_int_distribution<size_t> size(1, 1 << 20);
+  std::vector<Event> events(ROUNDS);
+  for (auto &e : events) e = {victim(gen), size(gen)};
+
+  Result map = bench_map(events);
+  Result registry = bench_registry(events);
+  printf("%d live allocations, %d rounds\n", LIVE, ROUNDS);
+  printf("%-9s %10.1f ns/free+alloc %8.2f ns/walked\n", "map+list", map.churn_ns, map.walk_ns);
+  printf("%-9s %10.1f ns/free+alloc %8.2f ns/walked\n", "registry", registry.churn_ns,
+         registry.walk_ns);
+  if (map.checksum != registry.checksum)
+    printf("result mismatch: %lu vs %lu\n", map.checksum, registry.checksum);
+  return map.checksum != registry.checksum;
+}
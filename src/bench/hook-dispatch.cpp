@@ -0,0 +1,93 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Cost of forwarding an intercepted cuLaunchKernel to the driver, against the stub libcuda with a
+ * kernel taking no time.
+ * Reproduces the dispatch of the interceptors in hook.cpp without pre/post hooks: the former
+ * pthread_once plus dlsym(RTLD_NEXT) on every call, and the function table resolved once.
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+#include "cuda.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+#define LAUNCH_PARAMS                                                                              \
+  (CUfunction f, unsigned int gridDimX, unsigned int gridDimY, unsigned int gridDimZ,              \
+   unsigned int blockDimX, unsigned int blockDimY, unsigned int blockDimZ,                         \
+   unsigned int sharedMemBytes, CUstream hStream, void **kernelParams, void **extra)
+#define LAUNCH_ARGS                                                                                \
+  f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ, sharedMemBytes, hStream,       \
+      kernelParams, extra
+typedef CUresult(*launch_func_t) LAUNCH_PARAMS;
+
+const long CALLS = 5000000;
+
+static pthread_once_t init_done = PTHREAD_ONCE_INIT;
+static std::atomic<bool> init_finished(false);
+static void *func_actual[1];
+
+static void initialize() {
+  func_actual[0] = dlsym(RTLD_NEXT, "cuLaunchKernel");
+  init_finished.store(true, std::memory_order_release);
+}
+
+// interceptor as generated by CU_HOOK_GENERATE_INTERCEPT before
+__attribute__((noinline)) CUresult launch_dlsym LAUNCH_PARAMS {
+  pthread_once(&init_done, initialize);
+  static void *real_func;
+  real_func = dlsym(RTLD_NEXT, "cuLaunchKernel");
+  return ((launch_func_t)real_func)(LAUNCH_ARGS);
+}
+
+// interceptor with the real function resolved once
+__attribute__((noinline)) CUresult launch_cached LAUNCH_PARAMS {
+  if (__builtin_expect(!init_finished.load(std::memory_order_acquire), 0))
+    pthread_once(&init_done, initialize);
+  return ((launch_func_t)func_actual[0])(LAUNCH_ARGS);
+}
+
+double bench(launch_func_t launch, CUfunction kernel) {
+  auto begin = steady_clock::now();
+  for (long i = 0; i < CALLS; i++) launch(kernel, 1, 1, 1, 32, 1, 1, 0, nullptr, nullptr, nullptr);
+  return (double)duration_cast<nanoseconds>(steady_clock::now() - begin).count() / CALLS;
+}
+
+int main() {
+  CUfunction kernel = stub_function(0.0);
+  // warm up symbol binding and the function table
+  launch_dlsym(kernel, 1, 1, 1, 32, 1, 1, 0, nullptr, nullptr, nullptr);
+  launch_cached(kernel, 1, 1, 1, 32, 1, 1, 0, nullptr, nullptr, nullptr);
+
+  bench(cuLaunchKernel, kernel);  // and the stub driver
+  double direct_ns = bench(cuLaunchKernel, kernel);
+  double dlsym_ns = bench(launch_dlsym, kernel);
+  double cached_ns = bench(launch_cached, kernel);
+  printf("%ld cuLaunchKernel calls\n", CALLS);
+  printf("%-16s %8.1f ns/call\n", "direct", direct_ns);
+  printf("%-16s %8.1f ns/call\n", "dlsym per call", dlsym_ns);
+  printf("%-16s %8.1f ns/call\n", "resolved once", cached_ns);
+  return stub_launch_count() == 4 * CALLS + 2 ? 0 : 1;
+}
@@ -0,0 +1,223 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Hook connections served by HookServer and by a replica of the former thread per connection,
+ * which read with blocking recv() and gave up after recv() returned <= 0 six times. 64 hooks
+ * connect over a unix socket and
+ * - make memory requests one after another (round trip),
+ * - close while idle (time until their accounting is reclaimed),
+ * - close while a quota request of theirs waits WAIT_MS for the Pod quota (same).
+ */
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../comm.h"
+#include "../hook-server.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+char *log_name = (char *)"hook-server";
+
+const int CLIENTS = 64;
+const int PINGS = 20000;  // memory requests, round-robin among the hooks
+const int WAIT_MS = 50;   // a quota request waiting for the Pod quota
+
+pthread_mutex_t reclaim_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<steady_clock::time_point> reclaimed;  // when the accounting of a hook was reclaimed
+
+size_t handle(int client, char *request, char *response) {
+  comm_request_t type;
+  reqid_t id;
+  parse_request(request, nullptr, nullptr, &id, &type);
+  if (type == REQ_QUOTA) {
+    usleep(WAIT_MS * 1000);
+    return prepare_response(response, REQ_QUOTA, id, 10.0);
+  }
+  return prepare_response(response, REQ_MEM_LIMIT, id, (size_t)0, (size_t)1 << 30);
+}
+
+bool blocks(char *request) {
+  comm_request_t type;
+  parse_request(request, nullptr, nullptr, nullptr, &type);
+  return type == REQ_QUOTA;
+}
+
+void open_client(int client) {}
+
+void close_client(int client) {
+  pthread_mutex_lock(&reclaim_mutex);
+  reclaimed.push_back(steady_clock::now());
+  pthread_mutex_unlock(&reclaim_mutex);
+}
+
+/* the former hook_thread_func() */
+void *legacy_thread(void *args) {
+  int fd = (int)(long)args;
+  char rbuf[REQ_MSG_LEN], sbuf[RSP_MSG_LEN];
+  int recv_zero_times = 0;
+  while (recv_zero_times <= 5) {
+    if (recv(fd, rbuf, REQ_MSG_LEN, 0) <= 0) {
+      recv_zero_times++;
+      continue;
+    }
+    bzero(sbuf, RSP_MSG_LEN);
+    if (handle(fd, rbuf, sbuf) > 0) send(fd, sbuf, RSP_MSG_LEN, 0);
+  }
+  close_client(fd);
+  close(fd);
+  return nullptr;
+}
+
+void *legacy_server(void *args) {
+  int accept_sockfd = (int)(long)args, fd;
+  while ((fd = accept(accept_sockfd, nullptr, nullptr)) != -1) {
+    open_client(fd);
+    pthread_t tid;
+    pthread_create(&tid, nullptr, legacy_thread, (void *)(long)fd);
+    pthread_detach(tid);
+  }
+  return nullptr;
+}
+
+void *epoll_server(void *args) {
+  HookServer server(handle, blocks, open_client, close_client);
+  server.run((int)(long)args);
+  return nullptr;
+}
+
+int listen_on(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  listen(fd, SOMAXCONN);
+  return fd;
+}
+
+std::vector<int> connect_clients(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  std::vector<int> fds(CLIENTS);
+  for (int &fd : fds) {
+    fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  return fds;
+}
+
+int threads() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line))
+    if (line.compare(0, 8, "Threads:") == 0) return std::stoi(line.substr(8));
+  return 0;
+}
+
+// close the hooks and @return the time (us) until the accounting of half and all of them is
+// reclaimed
+std::pair<double, double> close_clients(const std::vector<int> &fds) {
+  pthread_mutex_lock(&reclaim_mutex);
+  reclaimed.clear();
+  pthread_mutex_unlock(&reclaim_mutex);
+  auto begin = steady_clock::now();
+  for (int fd : fds) close(fd);
+  while (true) {
+    pthread_mutex_lock(&reclaim_mutex);
+    bool done = reclaimed.size() == fds.size();
+    pthread_mutex_unlock(&reclaim_mutex);
+    if (done) break;
+    usleep(100);
+  }
+  std::sort(reclaimed.begin(), reclaimed.end());
+  auto us = [&](steady_clock::time_point tp) {
+    return duration_cast<nanoseconds>(tp - begin).count() / 1e3;
+  };
+  return std::make_pair(us(reclaimed[fds.size() / 2]), us(reclaimed.back()));
+}
+
+void run(const char *label, void *(*server)(void *)) {
+  std::string path = std::string("/tmp/hook-server-bench.") + label;
+  pthread_t tid;
+  pthread_create(&tid, nullptr, server, (void *)(long)listen_on(path.c_str()));
+  pthread_detach(tid);
+  usleep(10000);
+  int base_threads = threads();
+
+  // memory requests
+  std::vector<int> fds = connect_clients(path.c_str());
+  std::vector<double> rtt;
+  rtt.reserve(PINGS);
+  char sbuf[REQ_MSG_LEN], rbuf[RSP_MSG_LEN];
+  for (int i = 0; i < PINGS; i++) {
+    bzero(sbuf, REQ_MSG_LEN);
+    prepare_request(sbuf, REQ_MEM_LIMIT);
+    auto begin = steady_clock::now();
+    send(fds[i % CLIENTS], sbuf, REQ_MSG_LEN, 0);
+    recv(fds[i % CLIENTS], rbuf, RSP_MSG_LEN, 0);
+    rtt.push_back(duration_cast<nanoseconds>(steady_clock::now() - begin).count() / 1e3);
+  }
+  std::sort(rtt.begin(), rtt.end());
+  int idle_threads = threads() - base_threads;
+  auto idle = close_clients(fds);
+
+  // close while quota requests wait
+  fds = connect_clients(path.c_str());
+  for (int fd : fds) {
+    bzero(sbuf, REQ_MSG_LEN);
+    prepare_request(sbuf, REQ_QUOTA, 0.0, 1.0);
+    send(fd, sbuf, REQ_MSG_LEN, 0);
+  }
+  usleep(WAIT_MS * 1000 / 5);
+  int waiting_threads = threads() - base_threads;
+  auto waiting = close_clients(fds);
+  usleep(WAIT_MS * 1000 * 2);  // let the requests in flight end before the next run
+
+  printf("%-8s %8.1f %8.1f %8d %8d %10.0f %10.0f %10.0f %10.0f\n", label, rtt[rtt.size() / 2],
+         rtt[rtt.size() * 99 / 100], idle_threads, waiting_threads, idle.first, idle.second,
+         waiting.first, waiting.second);
+  unlink(path.c_str());
+}
+
+int main() {
+  freopen("/dev/null", "w", stderr);  // connections are logged, one line each
+  printf("%d hooks, %d memory requests, quota requests wait %d ms\n", CLIENTS, PINGS, WAIT_MS);
+  printf("%-8s %17s %17s %21s %21s\n", "", "round trip us", "threads", "reclaim idle us",
+         "reclaim waiting us");
+  printf("%-8s %8s %8s %8s %8s %10s %10s %10s %10s\n", "", "p50", "p99", "idle", "waiting", "half",
+         "all", "half", "all");
+  run("epoll", epoll_server);
+  run("thread", legacy_server);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Burst prediction at token expiration against the stub CUDA driver. An application repeats a
+ * burst of kernels of different lengths, then synchronizes and idles briefly; the token expires at
+ * a random launch in each burst. Compares the estimate from the sync-point predictors, as used
+ * before, with the rest of the burst predicted by KernelModel, against the kernel time actually
+ * left in the burst. Also reports the host time KernelModel adds to a launch.
+ */
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../kernel-model.h"
+#include "../predictor.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int BURSTS = 300;
+const int WARMUP = 5;
+const double SCHD_OVERHEAD = 2.0;  // ms, as in hook.cpp
+const int GAP_US = 3000;  // longer than SCHD_OVERHEAD, bursts are not merged
+
+struct launch_t {
+  CUfunction func;
+  uint32_t grid;
+  double ms;
+};
+
+// the estimate used before KernelModel, see estimate_full_burst() in hook.cpp
+double estimate_from_sync_points(double measured_burst, double measured_window) {
+  if (measured_burst < 1e-9) return 0.0;
+  return measured_window < SCHD_OVERHEAD ? measured_burst * 2 : measured_burst;
+}
+
+int main() {
+  // a forward pass: many short kernels, a few long ones, repeated layers
+  std::vector<launch_t> burst;
+  CUfunction small = stub_function(0.05), gemm = stub_function(0.6), norm = stub_function(0.2);
+  for (int layer = 0; layer < 8; layer++) {
+    burst.push_back({gemm, 64, 0.6});
+    for (int i = 0; i < 4; i++) burst.push_back({small, 32, 0.05});
+    burst.push_back({norm, 16, 0.2});
+  }
+
+  Predictor burst_predictor("burst", SCHD_OVERHEAD), window_predictor("window");
+  KernelModel model;
+  srand(1);
+  double old_error = 0.0, model_error = 0.0, old_over = 0.0, model_over = 0.0;
+  int predicted = 0, unknown = 0;
+  long long hook_ns = 0, launches = 0;
+  for (int b = 0; b < BURSTS; b++) {
+    int cut = rand() % burst.size();
+    for (size_t k = 0; k < burst.size(); k++) {
+      window_predictor.record_stop();
+      if (b >= WARMUP && (int)k == cut) {
+        double actual = 0.0;
+        for (size_t r = k; r < burst.size(); r++) actual += burst[r].ms;
+        double old_est = estimate_from_sync_points(burst_predictor.predict_merged(),
+                                                   window_predictor.predict_merged());
+        double model_est = model.predict_remaining();
+        old_error += std::fabs(old_est - actual);
+        old_over += std::max(0.0, actual - old_est);
+        if (model_est < 0.0) {
+          unknown++;
+          model_est = old_est;
+        }
+        model_error += std::fabs(model_est - actual);
+        model_over += std::max(0.0, actual - model_est);
+        predicted++;
+        window_predictor.interrupt();  // as the hook does on a new token
+      }
+      burst_predictor.record_start();
+
+      uint32_t grid[3] = {burst[k].grid, 1, 1}, block[3] = {256, 1, 1};
+      auto begin = steady_clock::now();
+      model.launch_begin(burst[k].func, grid, block, nullptr);
+      hook_ns += duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+      cuLaunchKernel(burst[k].func, grid[0], 1, 1, 256, 1, 1, 0, nullptr, nullptr, nullptr);
+      begin = steady_clock::now();
+      model.launch_end();
+      hook_ns += duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+      launches++;
+    }
+    cuCtxSynchronize();
+    burst_predictor.record_stop();
+    window_predictor.record_start();
+    model.burst_end();
+    usleep(GAP_US);
+  }
+
+  double full = 0.0;
+  for (const launch_t &l : burst) full += l.ms;
+  printf("%d bursts of %zu kernels (%.2f ms), token expires at a random launch\n", BURSTS,
+         burst.size(), full);
+  printf("%-12s %14s %16s\n", "", "mean error ms", "mean overshoot ms");
+  printf("%-12s %14.3f %16.3f\n", "sync points", old_error / predicted, old_over / predicted);
+  printf("%-12s %14.3f %16.3f\n", "kernel model", model_error / predicted,
+         model_over / predicted);
+  printf("%d of %d predictions fell back, %zu kernels, %.1f ns added per launch\n", unknown,
+         predicted, model.kernels(), (double)hook_ns / launches);
+  return 0;
+}
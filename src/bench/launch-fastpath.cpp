@@ -0,0 +1,115 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host cost of the launch prehook while a token is valid, with several threads launching at once.
+ * "locked" replays the path before: a predictor mutex around the window stop, the expiration mutex
+ * around the quota check, the burst start and the stream registration, and a predictor mutex
+ * around the burst start. "fast path" runs the Predictor and OveruseTracker of the hook behind the
+ * atomic deadline check. Built against the stub CUDA runtime.
+ */
+
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+#include "../overuse-tracker.h"
+#include "../predictor.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int LAUNCHES = 200000;  // per thread
+
+// the path before
+pthread_mutex_t window_mutex = PTHREAD_MUTEX_INITIALIZER, burst_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t expiration_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t tracker_mutex = PTHREAD_MUTEX_INITIALIZER;
+bool window_ongoing = false, burst_ongoing = true;
+steady_clock::time_point progress_start = steady_clock::now();
+double quota_time = 1e9;
+cudaStream_t registered = nullptr;
+
+void locked_prehook(cudaStream_t stream) {
+  pthread_mutex_lock(&window_mutex);
+  if (window_ongoing) window_ongoing = false;
+  pthread_mutex_unlock(&window_mutex);
+  pthread_mutex_lock(&expiration_mutex);
+  if (duration_cast<nanoseconds>(steady_clock::now() - progress_start).count() / 1e6 >= quota_time)
+    quota_time *= 2;  // never taken
+  pthread_mutex_lock(&burst_mutex);
+  if (!burst_ongoing) burst_ongoing = true;
+  pthread_mutex_unlock(&burst_mutex);
+  pthread_mutex_lock(&tracker_mutex);
+  if (registered != stream) registered = stream;
+  pthread_mutex_unlock(&tracker_mutex);
+  pthread_mutex_unlock(&expiration_mutex);
+}
+
+// the fast path
+Predictor window_predictor("window"), burst_predictor("burst", 2.0);
+OveruseTracker tracker;
+std::atomic<int64_t> token_deadline_ns(INT64_MAX);
+
+void fast_prehook(cudaStream_t stream) {
+  window_predictor.record_stop();
+  int64_t now = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+  if (now >= token_deadline_ns.load(std::memory_order_acquire)) return;  // never taken
+  burst_predictor.record_start();
+  tracker.kernel_launched(stream);
+}
+
+struct thread_arg_t {
+  void (*prehook)(cudaStream_t);
+  double ns;
+};
+
+void *launch_thread(void *p) {
+  thread_arg_t *arg = (thread_arg_t *)p;
+  auto begin = steady_clock::now();
+  for (int i = 0; i < LAUNCHES; i++) arg->prehook(nullptr);
+  arg->ns = (double)duration_cast<nanoseconds>(steady_clock::now() - begin).count() / LAUNCHES;
+  return nullptr;
+}
+
+// @return ns per launch, mean over threads
+double run(void (*prehook)(cudaStream_t), int threads) {
+  pthread_t tids[64];
+  thread_arg_t args[64];
+  for (int t = 0; t < threads; t++) {
+    args[t] = {prehook, 0.0};
+    pthread_create(&tids[t], nullptr, launch_thread, &args[t]);
+  }
+  double sum = 0.0;
+  for (int t = 0; t < threads; t++) {
+    pthread_join(tids[t], nullptr);
+    sum += args[t].ns;
+  }
+  return sum / threads;
+}
+
+int main() {
+  burst_predictor.record_start();  // a burst goes on under a valid token
+  tracker.token_started();
+  printf("%-8s %12s %12s  (ns per launch)\n", "threads", "locked", "fast path");
+  for (int threads = 1; threads <= 16; threads *= 2)
+    printf("%-8d %12.1f %12.1f\n", threads, run(locked_prehook, threads),
+           run(fast_prehook, threads));
+  return 0;
+}
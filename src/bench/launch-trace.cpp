@@ -0,0 +1,94 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Cost of recording a kernel launch into the launch trace ring, with several launching threads.
+ * Each thread issues bursts of launches separated by a sync and a short gap, and asks for a token
+ * every few bursts, like a hooked application. Pass a path to keep the ring for
+ * tools/decode-launch-trace.py.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../launch-trace.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int THREADS = 4;
+const int BURSTS = 2000;  // per thread
+const int KERNELS = 50;   // per burst
+const int GAP_US = 100;   // between bursts
+const int BURSTS_PER_TOKEN = 10;
+
+void *launch_thread(void *arg) {
+  double *ns = (double *)arg;
+  long long spent = 0;
+  uint64_t stream = (uint64_t)pthread_self();
+  for (int b = 0; b < BURSTS; b++) {
+    if (b % BURSTS_PER_TOKEN == 0) {
+      launch_trace_record(TRACE_TOKEN_REQUEST, 0, 0, nullptr, nullptr, 5.0);
+      usleep(GAP_US);
+      launch_trace_record(TRACE_TOKEN_GRANT, 0, 0, nullptr, nullptr, 20.0);
+    }
+    auto begin = steady_clock::now();
+    for (int k = 0; k < KERNELS; k++) {
+      uint32_t grid[3] = {(uint32_t)(k + 1) * 8, 1, 1}, block[3] = {256, 1, 1};
+      launch_trace_record(TRACE_LAUNCH, 0x1000 + k % 5, stream, grid, block);
+    }
+    spent += duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+    launch_trace_record(TRACE_SYNC);
+    usleep(GAP_US);
+  }
+  *ns = (double)spent / BURSTS / KERNELS;
+  return nullptr;
+}
+
+double run() {
+  pthread_t tids[THREADS];
+  double ns[THREADS], worst = 0.0;
+  for (int t = 0; t < THREADS; t++) pthread_create(&tids[t], nullptr, launch_thread, &ns[t]);
+  for (int t = 0; t < THREADS; t++) {
+    pthread_join(tids[t], nullptr);
+    if (ns[t] > worst) worst = ns[t];
+  }
+  return worst;
+}
+
+int main(int argc, char *argv[]) {
+  char path[] = "/tmp/launch-trace.XXXXXX";
+  const char *trace_path = argc > 1 ? argv[1] : path;
+  if (argc <= 1) close(mkstemp(path));
+
+  double off_ns = run();
+  if (launch_trace_open(trace_path, 1 << 18) != 0) {
+    perror(trace_path);
+    return 1;
+  }
+  double on_ns = run();
+  if (argc <= 1) unlink(path);
+
+  printf("%d threads x %d bursts x %d kernels\n", THREADS, BURSTS, KERNELS);
+  printf("%-9s %8.1f ns/launch\n", "disabled", off_ns);
+  printf("%-9s %8.1f ns/launch\n", "recording", on_ns);
+  return 0;
+}
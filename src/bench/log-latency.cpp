@@ -0,0 +1,131 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Cost of one hook log message on the calling thread, as paid by every intercepted CUDA call in
+ * debug mode. Compares opening, writing and closing the log file per message, as done before,
+ * with the ring buffer drained by a background thread. Several threads log at once; every
+ * message must reach the file.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../debug.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int THREADS = 4;
+const int MESSAGES = 20000;  // per thread, paced so that the rings rarely fill
+const int BURST = 64;        // messages between pauses
+const int PAUSE_US = 200;
+
+// the logger used before
+void hINFO_sync_file(const char *log_name, const char *file, long line, const char *format, ...) {
+  char buf[DEBUG_MSG_LEN], date_buf[100];
+  va_list args;
+  time_t timer = time(nullptr);
+  struct tm *tm_info = localtime(&timer);
+  struct timespec ts;
+  strftime(date_buf, 100, "%F %T", tm_info);
+  char ms_buf[10];
+  clock_gettime(CLOCK_REALTIME, &ts);
+  snprintf(ms_buf, 10, ".%06d", (int)(ts.tv_nsec / 1000 % 1000000));
+  strncat(date_buf, ms_buf, 10);
+  va_start(args, format);
+  vsnprintf(buf, DEBUG_MSG_LEN, format, args);
+  va_end(args);
+  std::ofstream logger;
+  logger.open(log_name, std::ios::out | std::ios::app);
+  logger << date_buf << " " << "INFO" << ":" << file << ":" << line << " " << buf << std::endl;
+  logger.close();
+}
+
+typedef void (*log_func_t)(const char *, const char *, long, const char *, ...);
+
+struct thread_arg_t {
+  log_func_t func;
+  const char *log_name;
+  int id;
+  double ns;  // spent in the log call per message
+};
+
+void *log_thread(void *p) {
+  thread_arg_t *arg = (thread_arg_t *)p;
+  long long spent = 0;
+  for (int i = 0; i < MESSAGES; i += BURST) {
+    auto begin = steady_clock::now();
+    for (int j = i; j < i + BURST && j < MESSAGES; j++)
+      arg->func(arg->log_name, __FILE__, (long)__LINE__, "hooked function: cuLaunchKernel %d %d",
+                arg->id, j);
+    spent += duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+    usleep(PAUSE_US);
+  }
+  arg->ns = (double)spent / MESSAGES;
+  return nullptr;
+}
+
+// @return ns per message on the calling thread, worst thread
+double run(log_func_t func, const char *log_name) {
+  pthread_t tids[THREADS];
+  thread_arg_t args[THREADS];
+  for (int t = 0; t < THREADS; t++) {
+    args[t] = {func, log_name, t, 0.0};
+    pthread_create(&tids[t], nullptr, log_thread, &args[t]);
+  }
+  double worst = 0.0;
+  for (int t = 0; t < THREADS; t++) {
+    pthread_join(tids[t], nullptr);
+    worst = std::max(worst, args[t].ns);
+  }
+  log_flush();
+  return worst;
+}
+
+long count_lines(const char *path) {
+  std::ifstream fin(path);
+  std::string line;
+  long n = 0;
+  while (std::getline(fin, line)) n++;
+  return n;
+}
+
+int main() {
+  char sync_path[] = "/tmp/log-latency-sync.XXXXXX", async_path[] = "/tmp/log-latency-async.XXXXXX";
+  close(mkstemp(sync_path));
+  close(mkstemp(async_path));
+
+  double sync_ns = run(hINFO_sync_file, sync_path);
+  double async_ns = run(hINFO, async_path);
+  long sync_lines = count_lines(sync_path), async_lines = count_lines(async_path);
+  unlink(sync_path);
+  unlink(async_path);
+
+  printf("%d threads x %d messages\n", THREADS, MESSAGES);
+  printf("%-10s %10.1f ns/message %8ld lines\n", "sync file", sync_ns, sync_lines);
+  printf("%-10s %10.1f ns/message %8ld lines\n", "ring", async_ns, async_lines);
+  return sync_lines != async_lines;
+}
@@ -0,0 +1,151 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Overuse measurement at token expiration against the stub CUDA runtime: a burst of simulated
+ * kernels is spread over the legacy default stream, a blocking stream and non-blocking streams,
+ * then the tracking thread waits for them. Compares an event recorded on the default stream and
+ * synchronized, as done before, with OveruseTracker, also with the longest kernel of each burst on a
+ * stream destroyed before the token expires. Reports how long after the last kernel retired the
+ * wait returned, the error of the measured duration, and the events left alive.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "../overuse-tracker.h"
+
+const int CYCLES = 500;
+const int KERNELS = 24;  // per burst, mostly on the non-blocking streams
+const int STREAMS = 4;   // legacy default, blocking, 2 non-blocking
+
+long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct result_t {
+  std::vector<double> reaction_us;  // wait returned after the last kernel completed
+  double error_ms = 0.0;            // sum of |measured - actual|
+  int missed = 0;                   // returned before the last kernel completed
+};
+
+// @return completion time of the last kernel
+long long launch_burst(cudaStream_t *streams, OveruseTracker *tracker) {
+  long long last = 0;
+  for (int k = 0; k < KERNELS; k++) {
+    cudaStream_t stream = streams[k % 8 < 2 ? k % 8 : 2 + k % 2];
+    if (tracker != nullptr) tracker->kernel_launched(stream);
+    last = std::max(last, stub_kernel(stream, 0.05 + (rand() % 100) / 1000.0));
+  }
+  return last;
+}
+
+void record(result_t *res, long long start, long long last, double measured_ms) {
+  long long returned = now_ns();
+  if (returned < last) res->missed++;
+  res->reaction_us.push_back(std::max(0LL, returned - last) / 1e3);
+  res->error_ms += std::abs(measured_ms - (last - start) / 1e6);
+}
+
+// the tracking before: an event per token, synchronized on the legacy default stream
+result_t run_default_sync(cudaStream_t *streams) {
+  result_t res;
+  cudaEvent_t start;
+  cudaEventCreate(&start);
+  for (int c = 0; c < CYCLES; c++) {
+    cudaDeviceSynchronize();
+    cudaEventRecord(start, 0);
+    long long start_ns = now_ns();
+    long long last = launch_burst(streams, nullptr);
+
+    cudaEvent_t event;
+    cudaEventCreate(&event);
+    cudaEventRecord(event);
+    cudaEventSynchronize(event);
+    float elapsed_ms;
+    cudaEventElapsedTime(&elapsed_ms, start, event);
+    record(&res, start_ns, last, elapsed_ms);
+  }
+  return res;
+}
+
+// destroy: a stream is created per burst, runs its longest kernel and is destroyed at once
+result_t run_tracker(cudaStream_t *streams, OveruseTracker *tracker, bool destroy) {
+  result_t res;
+  for (int c = 0; c < CYCLES; c++) {
+    cudaDeviceSynchronize();
+    tracker->token_started();
+    long long start_ns = now_ns();
+    long long last = launch_burst(streams, tracker);
+    if (destroy) {
+      cudaStream_t stream;
+      cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking);
+      tracker->kernel_launched(stream);
+      last = std::max(last, stub_kernel(stream, 2.0));
+      tracker->stream_destroyed(stream);
+      cudaStreamDestroy(stream);
+    }
+    record(&res, start_ns, last, tracker->wait_completion());
+  }
+  return res;
+}
+
+void report(const char *name, result_t res, long events) {
+  std::sort(res.reaction_us.begin(), res.reaction_us.end());
+  double sum = 0.0;
+  for (double us : res.reaction_us) sum += us;
+  printf("%-14s %10.1f %10.1f %12.3f %8d %8ld\n", name, sum / CYCLES,
+         res.reaction_us[CYCLES * 99 / 100], res.error_ms / CYCLES, res.missed, events);
+}
+
+int main() {
+  cudaStream_t streams[STREAMS] = {0};
+  cudaStreamCreate(&streams[1]);
+  cudaStreamCreateWithFlags(&streams[2], cudaStreamNonBlocking);
+  cudaStreamCreateWithFlags(&streams[3], cudaStreamNonBlocking);
+
+  srand(1);
+  long before = stub_live_events();
+  result_t sync_res = run_default_sync(streams);
+  long sync_events = stub_live_events() - before;
+
+  srand(1);
+  OveruseTracker tracker;
+  before = stub_live_events();
+  result_t trk_res = run_tracker(streams, &tracker, false);
+  long trk_events = stub_live_events() - before;
+
+  srand(1);
+  OveruseTracker dst_tracker;
+  before = stub_live_events();
+  result_t dst_res = run_tracker(streams, &dst_tracker, true);
+  long dst_events = stub_live_events() - before;
+
+  printf("%d bursts x %d kernels over %d streams\n", CYCLES, KERNELS, STREAMS);
+  printf("%-14s %10s %10s %12s %8s %8s\n", "", "mean us", "p99 us", "error ms", "missed",
+         "events");
+  report("default sync", sync_res, sync_events);
+  report("tracker", trk_res, trk_events);
+  report("destroyed", dst_res, dst_events);
+  return trk_res.missed != 0 || (size_t)trk_events > STREAMS + 1 || dst_res.missed != 0 ||
+         (size_t)dst_events > STREAMS + 2;
+}
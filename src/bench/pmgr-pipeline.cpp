@@ -0,0 +1,127 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * REQ_QUOTA round trips through RequestPipeline with 1 to 64 requests in flight.
+ * A responder stands in for the scheduler: it reads whatever requests have arrived, takes
+ * DECIDE_US to decide on them, then answers all of them.
+ */
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "../comm.h"
+#include "../request-pipeline.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+char *log_name = (char *)"pmgr-pipeline";
+
+const int CALLS = 20000;     // per run, split among the callers
+const int DECIDE_US = 50;    // scheduling decision per batch of requests
+long responder_batches = 0;  // recv() calls that returned requests
+
+void *responder(void *args) {
+  int fd = *(int *)args;
+  std::vector<char> rbuf(REQ_MSG_LEN * 64), sbuf;
+  size_t len = 0;
+  ssize_t rc;
+  while ((rc = recv(fd, rbuf.data() + len, rbuf.size() - len, 0)) > 0) {
+    len += rc;
+    size_t pos = 0;
+    sbuf.clear();
+    for (; len - pos >= REQ_MSG_LEN; pos += REQ_MSG_LEN) {
+      reqid_t id;
+      char rsp[RSP_MSG_LEN];
+      parse_request(rbuf.data() + pos, nullptr, nullptr, &id, nullptr);
+      prepare_response(rsp, REQ_QUOTA, id, 10.0);
+      sbuf.insert(sbuf.end(), rsp, rsp + RSP_MSG_LEN);
+    }
+    std::copy(rbuf.begin() + pos, rbuf.begin() + len, rbuf.begin());
+    len -= pos;
+    if (sbuf.empty()) continue;
+    responder_batches++;
+    usleep(DECIDE_US);
+    if (send(fd, sbuf.data(), sbuf.size(), MSG_NOSIGNAL) == -1) break;
+  }
+  close(fd);
+  return nullptr;
+}
+
+struct caller_t {
+  RequestPipeline *pipeline;
+  int calls;
+  std::vector<double> latency_us;
+};
+
+void *caller(void *args) {
+  caller_t *c = (caller_t *)args;
+  char sbuf[REQ_MSG_LEN], rbuf[RSP_MSG_LEN];
+  for (int i = 0; i < c->calls; i++) {
+    auto begin = steady_clock::now();
+    reqid_t id = prepare_request(sbuf, REQ_QUOTA, 0.0, 1.0);
+    if (!c->pipeline->call(sbuf, id, rbuf)) break;
+    c->latency_us.push_back(duration_cast<nanoseconds>(steady_clock::now() - begin).count() / 1e3);
+  }
+  return nullptr;
+}
+
+void bench(int callers) {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  pthread_t responder_tid;
+  responder_batches = 0;
+  pthread_create(&responder_tid, nullptr, responder, &fds[1]);
+  RequestPipeline *pipeline = new RequestPipeline();  // its threads outlive the run
+  pipeline->start(fds[0]);
+
+  std::vector<caller_t> c(callers);
+  std::vector<pthread_t> tids(callers);
+  auto begin = steady_clock::now();
+  for (int i = 0; i < callers; i++) {
+    c[i].pipeline = pipeline;
+    c[i].calls = CALLS / callers;
+    pthread_create(&tids[i], nullptr, caller, &c[i]);
+  }
+  std::vector<double> latency;
+  for (int i = 0; i < callers; i++) {
+    pthread_join(tids[i], nullptr);
+    latency.insert(latency.end(), c[i].latency_us.begin(), c[i].latency_us.end());
+  }
+  double wall_s = duration_cast<nanoseconds>(steady_clock::now() - begin).count() / 1e9;
+  shutdown(fds[0], SHUT_RDWR);
+  pthread_join(responder_tid, nullptr);
+
+  std::sort(latency.begin(), latency.end());
+  printf("%8d %10.0f %10.2f %10.2f %10.1f\n", callers, latency.size() / wall_s,
+         latency[latency.size() / 2], latency[latency.size() * 99 / 100],
+         (double)latency.size() / responder_batches);
+}
+
+int main() {
+  printf("%d calls per run, %d us per scheduling decision\n", CALLS, DECIDE_US);
+  printf("%8s %10s %10s %10s %10s\n", "callers", "calls/s", "p50 us", "p99 us", "batch");
+  for (int callers : {1, 4, 16, 64}) bench(callers);
+  return 0;
+}
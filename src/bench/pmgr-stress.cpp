@@ -0,0 +1,210 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Pod manager quota checks under 64 concurrent hook clients, one serving thread each, as in
+ * gem-pmgr. Compares a replica of the former quota_state/sleeping_count barrier with PodQuota.
+ * Renewal sleeps for a scheduler round trip and grants a fixed quota. A scheme that stops making
+ * progress for a second is reported as stalled.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "../pod-quota.h"
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int CLIENTS = 64;
+const double SECONDS = 2.0;
+const int RENEW_US = 200;     // scheduler round trip
+const double QUOTA_MS = 5.0;  // granted per renewal
+const double BURST_MS = 0.5;  // predicted burst of every client
+const int THINK_US = 100;     // between two requests of a client
+
+/* renewal shared by both schemes, as renew_pod_quota() */
+pthread_mutex_t quota_renew_mutex = PTHREAD_MUTEX_INITIALIZER;
+double pod_quota = 0.0;
+steady_clock::time_point quota_updated_tp;
+PodQuota pod_quota_state;
+
+double elapsed_ms() {
+  return duration_cast<microseconds>(steady_clock::now() - quota_updated_tp).count() / 1e3;
+}
+
+void renew_pod_quota(double burst) {
+  pthread_mutex_lock(&quota_renew_mutex);
+  if (elapsed_ms() + burst > pod_quota) {
+    usleep(RENEW_US);
+    pod_quota = QUOTA_MS;
+    quota_updated_tp = steady_clock::now();
+  }
+  pod_quota_state.publish(
+      duration_cast<nanoseconds>(quota_updated_tp.time_since_epoch()).count(), pod_quota);
+  pthread_mutex_unlock(&quota_renew_mutex);
+}
+
+/* the former hook_kernel_launch() */
+int quota_state = 0;
+pthread_mutex_t quota_state_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t quota_state_cond = PTHREAD_COND_INITIALIZER;
+int kernel_launch_count = 0, sleeping_count = 0;
+pthread_mutex_t kernel_launch_count_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t sleeping_count_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t sleeping_count_cond = PTHREAD_COND_INITIALIZER;
+std::atomic<int> barrier_renewals(0);
+
+double barrier_kernel_launch(double burst) {
+  pthread_mutex_lock(&kernel_launch_count_mutex);
+  kernel_launch_count += 1;
+  pthread_mutex_unlock(&kernel_launch_count_mutex);
+
+  pthread_mutex_lock(&quota_state_mutex);
+  while (quota_state != 0) {
+    pthread_mutex_lock(&sleeping_count_mutex);
+    sleeping_count += 1;
+    pthread_mutex_unlock(&sleeping_count_mutex);
+    pthread_cond_wait(&quota_state_cond, &quota_state_mutex);
+  }
+  pthread_mutex_unlock(&quota_state_mutex);
+
+  double elapsed_time = elapsed_ms();
+  if (elapsed_time + burst > pod_quota) {
+    pthread_mutex_lock(&quota_state_mutex);
+    quota_state = 1;
+    pthread_mutex_unlock(&quota_state_mutex);
+
+    renew_pod_quota(burst);
+    barrier_renewals++;
+    elapsed_time = elapsed_ms();
+
+    pthread_mutex_lock(&quota_state_mutex);
+    pthread_mutex_lock(&sleeping_count_mutex);
+    sleeping_count += 1;
+    pthread_mutex_unlock(&sleeping_count_mutex);
+    quota_state = 0;
+    pthread_mutex_lock(&sleeping_count_mutex);
+    while (sleeping_count < kernel_launch_count)
+      pthread_cond_wait(&sleeping_count_cond, &sleeping_count_mutex);
+    pthread_cond_broadcast(&quota_state_cond);
+    pthread_mutex_unlock(&sleeping_count_mutex);
+    pthread_mutex_lock(&sleeping_count_mutex);
+    sleeping_count = 0;
+    pthread_mutex_unlock(&sleeping_count_mutex);
+    pthread_mutex_unlock(&quota_state_mutex);
+  }
+
+  pthread_mutex_lock(&kernel_launch_count_mutex);
+  kernel_launch_count -= 1;
+  pthread_mutex_unlock(&kernel_launch_count_mutex);
+  return pod_quota - elapsed_time;
+}
+
+double epoch_kernel_launch(double burst) {
+  return pod_quota_state.acquire(burst, [&] { renew_pod_quota(burst); });
+}
+
+typedef double (*launch_func_t)(double);
+
+struct client_t {
+  launch_func_t launch;
+  std::atomic<bool> *stop;
+  std::atomic<long> *progress;
+  std::atomic<int> *finished;
+  std::vector<double> latency_us;
+};
+
+void *client_thread(void *arg) {
+  client_t *client = (client_t *)arg;
+  while (!client->stop->load()) {
+    auto begin = steady_clock::now();
+    client->launch(BURST_MS);
+    client->latency_us.push_back(duration_cast<nanoseconds>(steady_clock::now() - begin).count() /
+                                 1e3);
+    client->progress->fetch_add(1);
+    usleep(THINK_US);
+  }
+  client->finished->fetch_add(1);
+  return nullptr;
+}
+
+void run(const char *label, launch_func_t launch, std::atomic<int> *renewals) {
+  pod_quota = 0.0;
+  quota_updated_tp = steady_clock::now();
+  std::atomic<bool> stop(false);
+  std::atomic<long> progress(0);
+  std::atomic<int> finished(0);
+  std::vector<client_t> clients(CLIENTS);
+  std::vector<pthread_t> tids(CLIENTS);
+  for (int c = 0; c < CLIENTS; c++) {
+    clients[c].launch = launch;
+    clients[c].stop = &stop;
+    clients[c].progress = &progress;
+    clients[c].finished = &finished;
+    clients[c].latency_us.reserve(SECONDS * 1e6 / THINK_US);
+    pthread_create(&tids[c], nullptr, client_thread, &clients[c]);
+  }
+
+  // stop after SECONDS, or earlier if no request completed for a second; clients still inside a
+  // quota check a second after the stop are stalled as well
+  auto begin = steady_clock::now();
+  long last = -1;
+  bool stalled = false;
+  for (int ms = 0; ms < SECONDS * 1000 && !stalled; ms += 1000) {
+    usleep(1000000);
+    long now = progress.load();
+    stalled = now == last;
+    last = now;
+  }
+  double wall_s = duration_cast<microseconds>(steady_clock::now() - begin).count() / 1e6;
+  stop = true;
+  for (int ms = 0; ms < 1000 && finished.load() < CLIENTS; ms++) usleep(1000);
+  if (finished.load() < CLIENTS) {
+    // threads stuck in the barrier never return, leave them behind
+    printf("%-8s %12s %10s %10s %10s %10d  stalled, %d clients stuck after %ld checks\n", label,
+           "-", "-", "-", "-", renewals ? renewals->load() : (int)pod_quota_state.renewals(),
+           CLIENTS - finished.load(), progress.load());
+    return;
+  }
+  std::vector<double> latency;
+  for (int c = 0; c < CLIENTS; c++) {
+    pthread_join(tids[c], nullptr);
+    latency.insert(latency.end(), clients[c].latency_us.begin(), clients[c].latency_us.end());
+  }
+  std::sort(latency.begin(), latency.end());
+  printf("%-8s %12.0f %10.2f %10.2f %10.2f %10d\n", label, latency.size() / wall_s,
+         latency[latency.size() / 2], latency[latency.size() * 99 / 100], latency.back(),
+         renewals ? renewals->load() : (int)pod_quota_state.renewals());
+}
+
+int main() {
+  printf("%d clients, %g s, renewal %d us, quota %g ms, burst %g ms\n", CLIENTS, SECONDS, RENEW_US,
+         QUOTA_MS, BURST_MS);
+  printf("%-8s %12s %10s %10s %10s %10s\n", "", "checks/s", "p50 us", "p99 us", "max us",
+         "renewals");
+  run("epoch", epoch_kernel_launch, nullptr);
+  run("barrier", barrier_kernel_launch, &barrier_renewals);
+  return 0;
+}
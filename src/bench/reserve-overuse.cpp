@@ -0,0 +1,126 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/**
+ * Overuse reported with reservations, against the scheduler core on a virtual clock. A client
+ * reserves each token while it holds the one before, as the Pod manager does, with the overuse of
+ * its previous token; another client's plain request takes over its pending reservation. Reports
+ * the GPU time each client is charged in the window against what it was granted and reported.
+ */
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../scheduler.h"
+
+const char *log_name = "reserve-overuse";
+
+const double TOKEN_MS = 10.0;  // QUOTA, granted as is without bursts
+const double OVERUSE_MS = 1.5;
+const double AHEAD_MS = 2.0;  // reservations are sent before the token expires
+const int TOKENS = 50;
+
+class VirtualClock : public Clock {
+ public:
+  double now() { return now_; }
+  void advance(double t) { now_ = t; }
+
+ private:
+  double now_ = 0.0;
+};
+VirtualClock virtual_clock;
+
+struct grant_t {
+  reqid_t req_id;
+  double quota;
+};
+std::vector<grant_t> grants;
+
+void deliver_token(const candidate_t &token, double quota) { grants.push_back({token.req_id, quota}); }
+
+double charged(client_id_t client) {
+  return client_table[client]->window.usage(ms_since_start() - WINDOW_SIZE);
+}
+
+void report(const char *name, double expected, double actual) {
+  printf("%-12s %12.3f %12.3f\n", name, expected, actual);
+}
+
+int main() {
+  char config[] = "/tmp/reserve-overuse.XXXXXX";
+  int fd = mkstemp(config);
+  FILE *f = fdopen(fd, "w");
+  fprintf(f, "2\nreserving 0.5 1.0 50 1073741824\ntakeover 0.5 1.0 50 1073741824\n");
+  fclose(f);
+  QUOTA = TOKEN_MS;
+  MIN_QUOTA = TOKEN_MS;
+  schd_clock = &virtual_clock;
+  int rc = read_resource_config(config);
+  unlink(config);
+  if (rc != 0) return 1;
+  reqid_t req_id = 0;
+  virtual_clock.advance(WINDOW_SIZE);  // limits are fractions of the time elapsed before
+
+  // reserving: tokens back to back, each reservation reports the overuse of the token before
+  enqueue_request(0, 0, ++req_id, 0.0, 0.0);
+  schedule_step();
+  double expiry = ms_since_start() + TOKEN_MS;
+  for (int t = 1; t < TOKENS; t++) {
+    virtual_clock.advance(expiry - AHEAD_MS);
+    reserve_request(0, 0, ++req_id, OVERUSE_MS, 0.0);
+    schedule_step();
+    virtual_clock.advance(expiry);
+    schedule_step();
+    expiry += TOKEN_MS;
+  }
+  double reserving = charged(0);
+  double reserving_expected = TOKENS * TOKEN_MS + (TOKENS - 1) * OVERUSE_MS;
+
+  // takeover: a quota request while a reservation is pending returns the token early
+  double start = ms_since_start();
+  enqueue_request(1, 1, ++req_id, 0.0, 0.0);
+  schedule_step();
+  virtual_clock.advance(start + TOKEN_MS - 2 * AHEAD_MS);
+  reserve_request(1, 1, ++req_id, OVERUSE_MS, 0.0);
+  schedule_step();
+  virtual_clock.advance(start + TOKEN_MS - AHEAD_MS);
+  size_t before = grants.size();
+  reqid_t plain = ++req_id;
+  enqueue_request(1, 1, plain, 0.0, 0.0);
+  size_t pending = 0;
+  for (auto &c : candidates) pending += c.socket == 1;
+  schedule_step();
+  double takeover = charged(1);
+  double takeover_expected = (TOKEN_MS - AHEAD_MS) + OVERUSE_MS + TOKEN_MS;
+  // the reservation is answered without quota, then the request is granted
+  bool answered = grants.size() == before + 2 && grants[before].req_id == plain - 1 &&
+                  grants[before].quota == 0.0 && grants[before + 1].req_id == plain;
+
+  printf("%d tokens of %.1f ms, %.1f ms overuse reported with each reservation\n", TOKENS, TOKEN_MS,
+         OVERUSE_MS);
+  printf("%-12s %12s %12s\n", "", "expected ms", "charged ms");
+  report("reserving", reserving_expected, reserving);
+  report("takeover", takeover_expected, takeover);
+  printf("takeover: %zu candidate(s) of the connection, reservation %s\n", pending,
+         answered ? "answered" : "not answered");
+  return std::fabs(reserving - reserving_expected) > 1e-6 ||
+         std::fabs(takeover - takeover_expected) > 1e-6 || pending != 1 || !answered;
+}
@@ -0,0 +1,90 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * SM partition granted per decision by first-fit and by packing mode, and the cost of packing.
+ * Each decision draws waiting candidates from a partition mix, with random usage, and an already
+ * occupied SM share, then both policies choose from the same candidates in schd_priority order.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "../scheduler.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int DECISIONS = 20000;
+
+struct Mix {
+  const char *name;
+  std::vector<size_t> partitions;
+};
+
+void bench(const Mix &mix, int max_waiting, std::mt19937 &gen) {
+  std::uniform_int_distribution<int> waiting(1, max_waiting);
+  std::uniform_int_distribution<size_t> pick(0, mix.partitions.size() - 1);
+  std::uniform_real_distribution<double> usage(0.0, 1000.0), require(0.0, 1000.0);
+  std::uniform_int_distribution<int> occupied(0, 5);
+  unsigned long first_fit = 0, packed = 0;
+  double pack_ns = 0.0;
+
+  for (int d = 0; d < DECISIONS; d++) {
+    int n = waiting(gen);
+    std::list<candidate_t> dummy(1);
+    std::vector<valid_candidate_t> cands;
+    std::vector<size_t> sm;
+    for (int i = 0; i < n; i++) {
+      double u = usage(gen), missing = require(gen) - u;
+      cands.push_back({missing, 1000.0 - u, u, 0.0, dummy.begin()});
+    }
+    std::sort(cands.begin(), cands.end(), schd_priority);
+    for (int i = 0; i < n; i++) sm.push_back(mix.partitions[pick(gen)]);
+    size_t capacity = SM_GLOBAL_LIMIT - occupied(gen) * 10;
+
+    size_t selected = 0;
+    for (int i = 0; i < n; i++)
+      if (selected + sm[i] <= capacity) selected += sm[i];
+    first_fit += selected;
+
+    auto begin = steady_clock::now();
+    std::vector<bool> chosen = schd_pack(cands, sm, capacity);
+    pack_ns += duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+    for (int i = 0; i < n; i++)
+      if (chosen[i]) packed += sm[i];
+  }
+  printf("%-22s %4d %10.2f %10.2f %+8.2f %10.2f\n", mix.name, max_waiting,
+         (double)first_fit / DECISIONS, (double)packed / DECISIONS,
+         ((double)packed - first_fit) / DECISIONS, pack_ns / DECISIONS / 1e3);
+}
+
+int main() {
+  std::mt19937 gen(1);
+  std::vector<Mix> mixes = {{"halves+thirds", {50, 33, 34, 60}},
+                            {"mixed 10..70", {10, 20, 25, 30, 40, 50, 60, 70}},
+                            {"large (40..80)", {40, 45, 60, 70, 80}},
+                            {"uniform 20", {20}}};
+  printf("granted SM %% per decision, %d decisions\n", DECISIONS);
+  printf("%-22s %4s %10s %10s %8s %10s\n", "mix", "max", "first-fit", "packing", "gain", "pack(us)");
+  for (auto &mix : mixes)
+    for (int max_waiting : {4, 16, 64}) bench(mix, max_waiting, gen);
+  return 0;
+}
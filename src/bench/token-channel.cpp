@@ -0,0 +1,92 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Quota check and renewal latency through the shared-memory token channel.
+ * A forked process plays Pod manager and grants an empty share for every request, so each
+ * renewal is a full cross-process round trip. Compare with bench/transport-latency.
+ */
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "../token-channel.h"
+
+const int WARMUP = 1000;
+const int ROUNDS = 100000;
+
+void report(const char *label, std::vector<double> &latency) {
+  std::sort(latency.begin(), latency.end());
+  double sum = 0.0;
+  for (double l : latency) sum += l;
+  printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", label, sum / latency.size(),
+         latency[latency.size() / 2], latency[latency.size() * 99 / 100], latency.back());
+  latency.clear();
+}
+
+int main() {
+  char name[64];
+  snprintf(name, sizeof(name), "/gemini-bench-%d", getpid());
+  token_channel_t *ch = token_channel_create(name);
+  if (ch == nullptr) {
+    perror("token_channel_create");
+    return 1;
+  }
+  int slot = token_channel_join(ch);
+  std::vector<double> latency;
+  latency.reserve(ROUNDS);
+  printf("token channel, %d rounds (us)\n", ROUNDS);
+  printf("%-8s %10s %10s %10s %10s\n", "", "mean", "p50", "p99", "max");
+
+  // quota still valid: atomic loads only
+  token_channel_grant(ch, slot, 3600 * 1000.0);
+  for (int i = 0; i < WARMUP + ROUNDS; i++) {
+    uint64_t begin = monotonic_ns();
+    token_channel_acquire(ch, slot, 0.0, 5.0);
+    if (i >= WARMUP) latency.push_back((monotonic_ns() - begin) / 1e3);
+  }
+  report("check", latency);
+
+  // quota expired: renewed by the other process
+  token_channel_grant(ch, slot, 0.0);
+  fflush(stdout);
+  pid_t server = fork();
+  if (server == 0) {
+    token_channel_t *sch = token_channel_open(name);
+    uint32_t seen = 0;
+    while (true) {
+      seen = token_channel_wait_slot(sch, slot, seen);
+      token_channel_grant(sch, slot, 0.0);
+    }
+  }
+  for (int i = 0; i < WARMUP + ROUNDS; i++) {
+    uint64_t begin = monotonic_ns();
+    token_channel_acquire(ch, slot, 0.0, 5.0);
+    if (i >= WARMUP) latency.push_back((monotonic_ns() - begin) / 1e3);
+  }
+  report("renew", latency);
+
+  kill(server, SIGKILL);
+  waitpid(server, nullptr, 0);
+  shm_unlink(name);
+  return 0;
+}
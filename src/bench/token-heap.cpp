@@ -0,0 +1,116 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Token bookkeeping cost per scheduling round with many concurrent token holders.
+ * Every round a holder returns its token early, expired tokens are cleared, the next expiration
+ * is looked up and a new token is delivered, as schedule_step() does. Compares the list scan used
+ * before with TokenHeap.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <list>
+#include <random>
+#include <vector>
+
+#include "../scheduler.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int HOLDERS = 1000;
+const int ROUNDS = 200000;
+const double STEP = 0.01;  // ms between rounds
+
+struct Event {
+  client_id_t returned;  // client returning its token early
+  double quota;          // quota of the new token
+};
+
+// token bookkeeping as done by update_tokens() and remove_ifexists() before
+double bench_list(const std::vector<Event> &events, double *checksum) {
+  std::list<candidate_t> tokens;
+  for (int c = 0; c < HOLDERS; c++) tokens.push_back({0, c, 0, 0.0, events[c].quota});
+  double sum = 0.0;
+  auto begin = steady_clock::now();
+  for (int r = 0; r < ROUNDS; r++) {
+    double now = r * STEP;
+    const Event &e = events[r];
+    for (auto it = tokens.begin(); it != tokens.end(); it++) {
+      if (it->client == e.returned) {
+        tokens.erase(it);
+        break;
+      }
+    }
+    double next = std::numeric_limits<double>::infinity();
+    for (auto it = tokens.begin(); it != tokens.end();) {
+      if (it->expired_time <= now) {
+        sum += it->client;
+        tokens.erase(it++);
+      } else {
+        next = std::min(next, it->expired_time - now);
+        it++;
+      }
+    }
+    sum += next;
+    tokens.push_back({0, e.returned, 0, now, now + e.quota});
+  }
+  auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+  *checksum = sum;
+  return (double)elapsed / ROUNDS;
+}
+
+double bench_heap(const std::vector<Event> &events, double *checksum) {
+  TokenHeap tokens;
+  for (int c = 0; c < HOLDERS; c++) tokens.push({0, c, 0, 0.0, events[c].quota});
+  double sum = 0.0;
+  auto begin = steady_clock::now();
+  for (int r = 0; r < ROUNDS; r++) {
+    double now = r * STEP;
+    const Event &e = events[r];
+    tokens.remove(e.returned);
+    while (!tokens.empty() && tokens.top().expired_time <= now) {
+      sum += tokens.top().client;
+      tokens.pop();
+    }
+    sum += tokens.empty() ? std::numeric_limits<double>::infinity() : tokens.top().expired_time - now;
+    tokens.push({0, e.returned, 0, now, now + e.quota});
+  }
+  auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+  *checksum = sum;
+  return (double)elapsed / ROUNDS;
+}
+
+int main() {
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<client_id_t> client(0, HOLDERS - 1);
+  std::uniform_real_distribution<double> quota(5.0, 100.0);
+  std::vector<Event> events(ROUNDS);
+  for (auto &e : events) e = {client(gen), quota(gen)};
+
+  double list_sum, heap_sum;
+  double list_ns = bench_list(events, &list_sum);
+  double heap_ns = bench_heap(events, &heap_sum);
+  printf("%d token holders, %d rounds\n", HOLDERS, ROUNDS);
+  printf("%-6s %10.1f ns/round\n", "list", list_ns);
+  printf("%-6s %10.1f ns/round\n", "heap", heap_ns);
+  if (list_sum != heap_sum) printf("result mismatch: %f vs %f\n", list_sum, heap_sum);
+  return list_sum != heap_sum;
+}
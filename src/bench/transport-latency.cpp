@@ -0,0 +1,109 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * REQ_QUOTA round-trip latency over loopback TCP and unix domain sockets.
+ * A responder thread answers every request with a quota, the way a Pod manager or the scheduler
+ * does, so only the transport differs between the two runs.
+ */
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../comm.h"
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const int WARMUP = 1000;
+const int ROUNDS = 100000;
+
+void *responder(void *args) {
+  int listen_fd = *(int *)args;
+  int fd = accept(listen_fd, nullptr, nullptr);
+  char rbuf[REQ_MSG_LEN], sbuf[RSP_MSG_LEN];
+  reqid_t id;
+  while (recv(fd, rbuf, REQ_MSG_LEN, MSG_WAITALL) == (ssize_t)REQ_MSG_LEN) {
+    parse_request(rbuf, nullptr, nullptr, &id, nullptr);
+    prepare_response(sbuf, REQ_QUOTA, id, 10.0);
+    if (send(fd, sbuf, RSP_MSG_LEN, 0) == -1) break;
+  }
+  close(fd);
+  return nullptr;
+}
+
+void bench(const char *label, const char *unix_path, uint16_t port) {
+  comm_addr_t listen_addr, addr;
+  comm_resolve(&listen_addr, unix_path, nullptr, port);
+  comm_resolve(&addr, unix_path, "127.0.0.1", port);
+
+  int listen_fd = comm_socket(&listen_addr);
+  int opt = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  if (listen_fd < 0 || comm_bind(listen_fd, &listen_addr) != 0 || listen(listen_fd, 1) != 0) {
+    perror(label);
+    exit(1);
+  }
+  pthread_t tid;
+  pthread_create(&tid, nullptr, responder, &listen_fd);
+
+  int fd = comm_socket(&addr);
+  if (connect(fd, (struct sockaddr *)&addr.addr, addr.len) != 0) {
+    perror(label);
+    exit(1);
+  }
+
+  char sbuf[REQ_MSG_LEN], rbuf[RSP_MSG_LEN];
+  std::vector<double> latency;
+  latency.reserve(ROUNDS);
+  for (int i = 0; i < WARMUP + ROUNDS; i++) {
+    auto begin = steady_clock::now();
+    prepare_request(sbuf, REQ_QUOTA, 0.0, 5.0);
+    send(fd, sbuf, REQ_MSG_LEN, 0);
+    recv(fd, rbuf, RSP_MSG_LEN, MSG_WAITALL);
+    if (i >= WARMUP)
+      latency.push_back(duration_cast<nanoseconds>(steady_clock::now() - begin).count() / 1e3);
+  }
+  close(fd);
+  pthread_join(tid, nullptr);
+  close(listen_fd);
+  if (unix_path != nullptr) unlink(unix_path);
+
+  std::sort(latency.begin(), latency.end());
+  double sum = 0.0;
+  for (double l : latency) sum += l;
+  printf("%-6s %10.2f %10.2f %10.2f %10.2f\n", label, sum / ROUNDS, latency[ROUNDS / 2],
+         latency[ROUNDS * 99 / 100], latency[ROUNDS - 1]);
+}
+
+int main() {
+  char unix_path[64];
+  snprintf(unix_path, sizeof(unix_path), "/tmp/gemini-bench-%d.sock", getpid());
+  printf("REQ_QUOTA round trip, %d rounds (us)\n", ROUNDS);
+  printf("%-6s %10s %10s %10s %10s\n", "", "mean", "p50", "p99", "max");
+  bench("tcp", nullptr, 50151);
+  bench("unix", unix_path, 0);
+  return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Scheduling decision latency against the number of quota grants in the time window.
+ * Compares the per-decision history scan used before (prune the global history list and rebuild
+ * a usage map) with the incremental per-client WindowUsage accounting.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../scheduler.h"
+
+using std::string;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+const double WINDOW = 10000.0;  // ms
+const int CLIENTS = 16;
+const int DECISIONS = 2000;
+
+struct NamedHistory {
+  string name;
+  double start;
+  double end;
+};
+
+// usage calculation as done by select_candidates() before incremental accounting
+double bench_scan(int history_size, const std::vector<string> &names) {
+  std::list<NamedHistory> history;
+  double step = WINDOW / history_size, sink = 0.0;
+  long long n = 0;
+  for (; n < history_size; n++)
+    history.push_back({names[n % CLIENTS], n * step, n * step + step * CLIENTS / 2});
+
+  auto begin = steady_clock::now();
+  for (int d = 0; d < DECISIONS; d++, n++) {
+    double now = n * step, window_start = now - WINDOW;
+    history.push_back({names[n % CLIENTS], now, now + step * CLIENTS / 2});
+    std::map<string, double> usage;
+    history.remove_if([=](const NamedHistory &h) -> bool { return h.end < window_start; });
+    for (auto &h : history) usage[h.name] += h.end - std::max(h.start, window_start);
+    for (auto &name : names) sink += usage[name];
+  }
+  auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+  if (sink < 0) puts("");  // keep the computation alive
+  return (double)elapsed / DECISIONS / 1e3;
+}
+
+// usage calculation with WindowUsage
+double bench_incremental(int history_size) {
+  std::vector<WindowUsage> windows(CLIENTS);
+  double step = WINDOW / history_size, sink = 0.0;
+  long long n = 0;
+  for (; n < history_size; n++) windows[n % CLIENTS].add(n * step, n * step + step * CLIENTS / 2);
+
+  auto begin = steady_clock::now();
+  for (int d = 0; d < DECISIONS; d++, n++) {
+    double now = n * step, window_start = now - WINDOW;
+    windows[n % CLIENTS].add(now, now + step * CLIENTS / 2);
+    for (auto &w : windows) sink += w.usage(window_start);
+  }
+  auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - begin).count();
+  if (sink < 0) puts("");
+  return (double)elapsed / DECISIONS / 1e3;
+}
+
+int main() {
+  std::vector<string> names;
+  for (int i = 0; i < CLIENTS; i++) names.push_back("client-" + std::to_string(i));
+
+  printf("%d clients, %.0f ms window, %d decisions per run\n", CLIENTS, WINDOW, DECISIONS);
+  printf("%12s %16s %16s\n", "history", "scan (us)", "incremental (us)");
+  for (int size : {100, 1000, 10000, 50000, 100000}) {
+    printf("%12d %16.3f %16.3f\n", size, bench_scan(size, names), bench_incremental(size));
+  }
+  return 0;
+}
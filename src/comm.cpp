@@ -21,12 +21,20 @@
 
 #include "comm.h"
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+
 #include "debug.h"
 
 reqid_t prepare_request(char *buf, comm_request_t type, ...) {
   static char *client_name = nullptr;
   static size_t client_name_len = 0;
-  static reqid_t id = 0;
+  static std::atomic<reqid_t> next_id(0);  // requests are prepared by many threads
   size_t pos = 0;
   va_list vl;
 
@@ -39,6 +47,8 @@ reqid_t prepare_request(char *buf, comm_request_t type, ...) {
     client_name_len = strlen(client_name);
   }
 
+  reqid_t id = next_id++;
+
   append_msg_data(buf, pos, client_name_len);
   strncpy(buf + pos, client_name, client_name_len);
   pos += client_name_len;
@@ -47,7 +57,7 @@ reqid_t prepare_request(char *buf, comm_request_t type, ...) {
   append_msg_data(buf, pos, type);
 
   // extra information for specific types
-  if (type == REQ_QUOTA) {
+  if (type == REQ_QUOTA || type == REQ_QUOTA_RESERVE) {
     va_start(vl, 3);
     append_msg_data(buf, pos, va_arg(vl, double));  // overuse
     append_msg_data(buf, pos, va_arg(vl, double));  // burst duration
@@ -57,9 +67,25 @@ reqid_t prepare_request(char *buf, comm_request_t type, ...) {
     append_msg_data(buf, pos, va_arg(vl, size_t));  // bytes
     append_msg_data(buf, pos, va_arg(vl, int));     // is_allocate
     va_end(vl);
+  } else if (type == REQ_MEM_LEASE) {
+    va_start(vl, type);
+    append_msg_data(buf, pos, va_arg(vl, size_t));  // bytes needed
+    append_msg_data(buf, pos, va_arg(vl, size_t));  // bytes wanted
+    append_msg_data(buf, pos, va_arg(vl, size_t));  // bytes released
+    va_end(vl);
+  } else if (type == REQ_PROCESS_INFO) {
+    va_start(vl, type);
+    append_msg_data(buf, pos, va_arg(vl, int));     // pid
+    append_msg_data(buf, pos, va_arg(vl, double));  // weight
+    va_end(vl);
+  } else if (type == REQ_PROCESS_USAGE) {
+    va_start(vl, type);
+    append_msg_data(buf, pos, va_arg(vl, int));     // pid
+    append_msg_data(buf, pos, va_arg(vl, double));  // quota used (ms)
+    va_end(vl);
   }
 
-  return id++;
+  return id;
 }
 
 // fill corresponding data into passed arguments
@@ -103,6 +129,11 @@ size_t prepare_response(char *buf, comm_request_t type, reqid_t id, ...) {
     append_msg_data(buf, pos, va_arg(vl, size_t));  // used memory
     append_msg_data(buf, pos, va_arg(vl, size_t));  // total memory
     va_end(vl);
+  } else if (type == REQ_MEM_LEASE) {
+    va_start(vl, id);
+    append_msg_data(buf, pos, va_arg(vl, size_t));  // bytes granted
+    append_msg_data(buf, pos, va_arg(vl, int));     // memory pressure
+    va_end(vl);
   }
 
   return pos;
@@ -119,6 +150,52 @@ char *parse_response(char *buf, reqid_t *id) {
   return buf + pos;
 }
 
+/**
+ * Fill the address of a component.
+ * @param unix_path path of a unix domain socket, TCP is used if it is null or empty
+ * @param ip IPv4 address for TCP, any address if null (for binding)
+ * @param port port for TCP
+ */
+void comm_resolve(comm_addr_t *addr, const char *unix_path, const char *ip, uint16_t port) {
+  memset(addr, 0, sizeof(comm_addr_t));
+  if (unix_path != nullptr && unix_path[0] != '\0') {
+    struct sockaddr_un *un = (struct sockaddr_un *)&addr->addr;
+    un->sun_family = AF_UNIX;
+    strncpy(un->sun_path, unix_path, sizeof(un->sun_path) - 1);
+    addr->family = AF_UNIX;
+    addr->type = SOCK_SEQPACKET;
+    addr->len = sizeof(struct sockaddr_un);
+  } else {
+    struct sockaddr_in *in = (struct sockaddr_in *)&addr->addr;
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = ip == nullptr ? INADDR_ANY : inet_addr(ip);
+    in->sin_port = htons(port);
+    addr->family = AF_INET;
+    addr->type = SOCK_STREAM;
+    addr->len = sizeof(struct sockaddr_in);
+  }
+}
+
+// create a socket matching the transport of addr
+int comm_socket(const comm_addr_t *addr) { return socket(addr->family, addr->type, 0); }
+
+// bind a socket to addr, a stale unix domain socket file left by a previous run is removed first
+int comm_bind(int sockfd, const comm_addr_t *addr) {
+  if (addr->family == AF_UNIX) unlink(((struct sockaddr_un *)&addr->addr)->sun_path);
+  return bind(sockfd, (const struct sockaddr *)&addr->addr, addr->len);
+}
+
+// human readable address for logging
+const char *comm_describe(const comm_addr_t *addr, char *buf, size_t len) {
+  if (addr->family == AF_UNIX) {
+    snprintf(buf, len, "unix:%s", ((struct sockaddr_un *)&addr->addr)->sun_path);
+  } else {
+    struct sockaddr_in *in = (struct sockaddr_in *)&addr->addr;
+    snprintf(buf, len, "%s:%u", inet_ntoa(in->sin_addr), ntohs(in->sin_port));
+  }
+  return buf;
+}
+
 // Attempt a function several times. Non-zero return of func is treated as an error. If func return
 // -1, errno will be returned.
 int multiple_attempt(std::function<int()> func, int max_attempt, int interval) {
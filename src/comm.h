@@ -17,16 +17,32 @@
 #ifndef _CUHOOK_COMM_H_
 #define _CUHOOK_COMM_H_
 
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <climits>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
 
 typedef int32_t reqid_t;
-enum comm_request_t { REQ_QUOTA, REQ_MEM_LIMIT, REQ_MEM_UPDATE };
+// REQ_MEM_LEASE reserves GPU memory budget in chunks, so that most allocations are charged by the
+// hook library locally; REQ_MEM_UPDATE reports every allocation and is kept for older hooks.
+// REQ_PROCESS_INFO tells the Pod manager the pid and weight of a hook process, which splits Pod
+// quota among processes; REQ_PROCESS_USAGE reports the quota a process used to scheduler, which
+// does not respond to it. REQ_QUOTA_RESERVE asks scheduler for the quota to follow the current one,
+// which the Pod keeps using until it expires; it is answered like REQ_QUOTA.
+enum comm_request_t {
+  REQ_QUOTA,
+  REQ_MEM_LIMIT,
+  REQ_MEM_UPDATE,
+  REQ_MEM_LEASE,
+  REQ_PROCESS_INFO,
+  REQ_PROCESS_USAGE,
+  REQ_QUOTA_RESERVE
+};
 const size_t REQ_MSG_LEN = 80;
 const size_t RSP_MSG_LEN = 40;
 
@@ -54,6 +70,23 @@ size_t append_msg_data(char *buf, size_t &pos, T data) {
   return (pos = pos + sizeof(T));
 }
 
+// Address of a scheduling component. Components on the same host can talk through a unix domain
+// socket (SOCK_SEQPACKET, so message boundaries are kept), otherwise TCP is used.
+struct comm_addr_t {
+  int family;
+  int type;
+  socklen_t len;
+  struct sockaddr_storage addr;
+};
+
+void comm_resolve(comm_addr_t *addr, const char *unix_path, const char *ip, uint16_t port);
+
+int comm_socket(const comm_addr_t *addr);
+
+int comm_bind(int sockfd, const comm_addr_t *addr);
+
+const char *comm_describe(const comm_addr_t *addr, char *buf, size_t len);
+
 // Attempt a function several times. Non-zero return of func is treated as an error
 int multiple_attempt(std::function<int()> func, int max_attempt, int interval = 0);
 
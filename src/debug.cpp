@@ -14,62 +14,287 @@
  * limitations under the License.
  */
 
+// every level is defined here, callers drop those below their own LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
 #include "debug.h"
-#include<iostream>
-#include<fstream>
-void sprint_date(char *buf, const size_t len) {
-  time_t timer;
-  struct tm *tm_info;
-  struct timespec ts;
 
-  timer = time(nullptr);
-  tm_info = localtime(&timer);
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
-  strftime(buf, len, "%F %T", tm_info);
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
 
-  char ms_buf[10];
-  clock_gettime(CLOCK_REALTIME, &ts);
-  snprintf(ms_buf, 10, ".%06ld", ts.tv_nsec / 1000);
+using std::memory_order_acq_rel;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
 
-  strncat(buf, ms_buf, 10);
+const uint32_t LOG_RING_SIZE = 1024;  // messages queued per thread, power of 2
+const int LOG_MAX_FILES = 8;
+const long LOG_DRAIN_MIN_US = 1000, LOG_DRAIN_MAX_US = 50000;  // drain thread polling interval
+const int LOG_LOCK_ATTEMPTS = 1000;  // before a warning is written without draining the rings
+
+struct log_record_t {
+  struct timespec time;
+  const char *level;
+  const char *file;
+  long line;
+  const char *log_name;  // file to append to, nullptr for stderr
+  char msg[DEBUG_MSG_LEN];
+};
+
+// single-producer single-consumer ring, reused by another thread after its owner exits
+struct log_ring_t {
+  log_record_t records[LOG_RING_SIZE];
+  std::atomic<uint32_t> head;  // advanced by the drain thread
+  std::atomic<uint32_t> tail;  // advanced by the owner
+  std::atomic<bool> owned;
+  log_ring_t *next;
+};
+
+struct log_file_t {
+  const char *log_name;
+  FILE *fp;  // nullptr if it cannot be opened
+};
+
+static std::atomic<log_ring_t *> log_rings(nullptr);
+static std::atomic<bool> drainer_running(false);
+static pthread_mutex_t drainer_mutex = PTHREAD_MUTEX_INITIALIZER;  // starting the drain thread
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;    // one writer at a time
+static pthread_mutex_t wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup_cond = PTHREAD_COND_INITIALIZER;  // a ring is half full
+static log_file_t log_files[LOG_MAX_FILES];  // entries are never changed once counted
+static std::atomic<int> log_file_num(0);
+
+// releases the ring of a thread when it exits
+struct ring_owner_t {
+  log_ring_t *ring = nullptr;
+  ~ring_owner_t() {
+    if (ring != nullptr) ring->owned.store(false, memory_order_release);
+  }
+};
+static thread_local ring_owner_t ring_owner;
+
+static log_ring_t *thread_ring() {
+  if (ring_owner.ring != nullptr) return ring_owner.ring;
+  log_ring_t *ring = log_rings.load(memory_order_acquire);
+  for (; ring != nullptr; ring = ring->next) {
+    bool released = false;
+    if (ring->owned.compare_exchange_strong(released, true, memory_order_acq_rel)) break;
+  }
+  if (ring == nullptr) {
+    ring = new log_ring_t();
+    ring->owned.store(true, memory_order_relaxed);
+    ring->next = log_rings.load(memory_order_relaxed);
+    while (!log_rings.compare_exchange_weak(ring->next, ring, memory_order_release,
+                                            memory_order_relaxed)) {
+    }
+  }
+  return (ring_owner.ring = ring);
+}
+
+static FILE *log_file(const char *log_name) {
+  if (log_name == nullptr) return stderr;
+  int num = log_file_num.load(memory_order_relaxed);
+  for (int i = 0; i < num; i++)
+    if (log_files[i].log_name == log_name || strcmp(log_files[i].log_name, log_name) == 0)
+      return log_files[i].fp;
+  FILE *fp = fopen(log_name, "a");
+  if (num < LOG_MAX_FILES) {
+    log_files[num] = {log_name, fp};
+    log_file_num.store(num + 1, memory_order_release);
+  } else if (fp != nullptr) {
+    fclose(fp);  // too many files, drop the messages as if it could not be opened
+    fp = nullptr;
+  }
+  return fp;
+}
+
+// the date part changes once a second, so format it once a second
+static void write_record(const log_record_t &rec) {
+  static time_t date_sec = -1;
+  static char date_buf[32];
+  FILE *fp = log_file(rec.log_name);
+  if (fp == nullptr) return;
+  if (rec.time.tv_sec != date_sec) {
+    struct tm tm_info;
+    localtime_r(&rec.time.tv_sec, &tm_info);
+    strftime(date_buf, sizeof(date_buf), "%F %T", &tm_info);
+    date_sec = rec.time.tv_sec;
+  }
+  fprintf(fp, "%s.%06ld %s:%s:%ld %s\n", date_buf, rec.time.tv_nsec / 1000, rec.level, rec.file,
+          rec.line, rec.msg);
 }
 
-#define GENERATE_PRINT(func, level)                              \
-  void func(const char* log_name, const char* file, long line, const char *format, ...) {                           \
-    char buf[DEBUG_MSG_LEN], date_buf[100];                      \
-    va_list args;                                                \
-                                                                 \
-    sprint_date(date_buf, 100);                                  \
-    va_start(args, format);                                      \
-    vsnprintf(buf, DEBUG_MSG_LEN, format, args);                 \
-   fprintf(stderr, "%s " level ":%s:%ld %s\n", date_buf, file, line, buf); \
+// write out queued messages of every thread, caller holds drain_mutex
+// @return number of messages written
+static int drain_rings() {
+  int written = 0;
+  for (log_ring_t *ring = log_rings.load(memory_order_acquire); ring != nullptr; ring = ring->next) {
+    uint32_t head = ring->head.load(memory_order_relaxed);
+    uint32_t tail = ring->tail.load(memory_order_acquire);
+    for (; head != tail; head++, written++) write_record(ring->records[head & (LOG_RING_SIZE - 1)]);
+    ring->head.store(head, memory_order_release);
   }
+  if (written > 0)
+    for (int i = 0; i < log_file_num.load(memory_order_relaxed); i++)
+      if (log_files[i].fp != nullptr) fflush(log_files[i].fp);
+  fflush(stderr);
+  return written;
+}
+
+static void *drain_thread_func(void *args) {
+  long interval_us = LOG_DRAIN_MIN_US;
+  while (true) {
+    pthread_mutex_lock(&drain_mutex);
+    int written = drain_rings();
+    pthread_mutex_unlock(&drain_mutex);
+    // poll less often while nothing is logged, a filling ring wakes the thread up early
+    interval_us = written > 0 ? LOG_DRAIN_MIN_US : std::min(interval_us * 2, LOG_DRAIN_MAX_US);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += interval_us * 1000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    pthread_mutex_lock(&wakeup_mutex);
+    pthread_cond_timedwait(&wakeup_cond, &wakeup_mutex, &deadline);
+    pthread_mutex_unlock(&wakeup_mutex);
+  }
+  return nullptr;
+}
+
+// the drain thread does not survive fork(), the child starts its own
+static void restart_after_fork() {
+  drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+  drainer_mutex = PTHREAD_MUTEX_INITIALIZER;
+  wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+  wakeup_cond = PTHREAD_COND_INITIALIZER;
+  drainer_running.store(false, memory_order_relaxed);
+}
+
+static void start_drainer() {
+  static bool handlers_installed = false;
+  if (drainer_running.load(memory_order_acquire)) return;
+  pthread_mutex_lock(&drainer_mutex);
+  if (!drainer_running.load(memory_order_relaxed)) {
+    if (!handlers_installed) {
+      atexit(log_flush);
+      pthread_atfork(nullptr, nullptr, restart_after_fork);
+      handlers_installed = true;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, drain_thread_func, nullptr) == 0) pthread_detach(tid);
+    drainer_running.store(true, memory_order_release);
+  }
+  pthread_mutex_unlock(&drainer_mutex);
+}
+
+// a signal handler may interrupt the drain thread, so never wait for it indefinitely
+static bool lock_drain() {
+  for (int i = 0; i < LOG_LOCK_ATTEMPTS; i++) {
+    if (pthread_mutex_trylock(&drain_mutex) == 0) return true;
+    sched_yield();
+  }
+  return false;
+}
+
+void log_flush() {
+  if (!lock_drain()) return;
+  drain_rings();
+  pthread_mutex_unlock(&drain_mutex);
+}
+
+static void fill_record(log_record_t &rec, const char *log_name, const char *level,
+                        const char *file, long line, const char *format, va_list args) {
+  clock_gettime(CLOCK_REALTIME, &rec.time);
+  rec.level = level;
+  rec.file = file;
+  rec.line = line;
+  rec.log_name = log_name;
+  vsnprintf(rec.msg, DEBUG_MSG_LEN, format, args);
+}
+
+// queue a message for the drain thread; if the ring of this thread is full, drain it here rather
+// than lose messages
+static void log_async(const char *log_name, const char *level, const char *file, long line,
+                      const char *format, va_list args) {
+  log_ring_t *ring = thread_ring();
+  uint32_t tail = ring->tail.load(memory_order_relaxed);
+  if (tail - ring->head.load(memory_order_acquire) >= LOG_RING_SIZE) {
+    pthread_mutex_lock(&drain_mutex);
+    drain_rings();
+    pthread_mutex_unlock(&drain_mutex);
+  }
+  fill_record(ring->records[tail & (LOG_RING_SIZE - 1)], log_name, level, file, line, format, args);
+  ring->tail.store(tail + 1, memory_order_release);
+  start_drainer();
+  if (tail + 1 - ring->head.load(memory_order_relaxed) == LOG_RING_SIZE / 2)
+    pthread_cond_signal(&wakeup_cond);
+}
+
+/**
+ * Write a message with a single write() and without drain_mutex, for when the drain thread cannot
+ * be waited for. The file table and the date cache are left alone: the message goes to the file
+ * if it is open already, to stderr otherwise.
+ */
+static void write_record_unlocked(const log_record_t &rec) {
+  int fd = STDERR_FILENO;
+  if (rec.log_name != nullptr) {
+    int num = log_file_num.load(memory_order_acquire);
+    for (int i = 0; i < num; i++) {
+      if (log_files[i].log_name != rec.log_name && strcmp(log_files[i].log_name, rec.log_name) != 0)
+        continue;
+      if (log_files[i].fp == nullptr) return;  // dropped, as it cannot be opened
+      fd = fileno(log_files[i].fp);
+      break;
+    }
+  }
+  char date_buf[32], buf[DEBUG_MSG_LEN + 256];
+  struct tm tm_info;
+  localtime_r(&rec.time.tv_sec, &tm_info);
+  strftime(date_buf, sizeof(date_buf), "%F %T", &tm_info);
+  int len = snprintf(buf, sizeof(buf), "%s.%06ld %s:%s:%ld %s\n", date_buf, rec.time.tv_nsec / 1000,
+                     rec.level, rec.file, rec.line, rec.msg);
+  if (len < 0) return;
+  if ((size_t)len >= sizeof(buf)) {
+    len = sizeof(buf) - 1;
+    buf[len - 1] = '\n';
+  }
+  ssize_t rc = write(fd, buf, len);
+  (void)rc;  // nowhere to report a failure to
+}
+
+// write a message after everything queued before it
+static void log_sync(const char *log_name, const char *level, const char *file, long line,
+                     const char *format, va_list args) {
+  log_record_t rec;
+  fill_record(rec, log_name, level, file, line, format, args);
+  if (!lock_drain()) {
+    write_record_unlocked(rec);
+    return;
+  }
+  drain_rings();
+  write_record(rec);
+  fflush(log_file(log_name));
+  pthread_mutex_unlock(&drain_mutex);
+}
 
-#define GENERATE_f(func, level)                              \
-  void func(const char* log_name, const char* file, long line, const char *format, ...) {                           \
-    char buf[DEBUG_MSG_LEN], date_buf[100];                      \
-    va_list args;                                                \
-                                                                 \
-    sprint_date(date_buf, 100);                                  \
-    va_start(args, format);                                      \
-    vsnprintf(buf, DEBUG_MSG_LEN, format, args);                 \
-    std::ofstream logger;                                        \
-    logger.open ("/kubeshare/log/hook.log", std::ios::out | std::ios::app);\
-    logger<<date_buf<<" "<<level<<":"<<file<<":"<<line<<" "<<buf<<std::endl; \
-    logger.close(); \
+#define GENERATE_LOG(func, dest, level, writer)                                             \
+  void func(const char *log_name, const char *file, long line, const char *format, ...) { \
+    va_list args;                                                                         \
+    va_start(args, format);                                                               \
+    writer(dest, level, file, line, format, args);                                        \
+    va_end(args);                                                                         \
   }
 
-#ifdef _DEBUG
-GENERATE_PRINT(DEBUG, "DEBU")
-GENERATE_f(hDEBUG, "DEBU")
-#else
-void DEBUG(const char* log_name, const char* file, long line, const char *format, ...) {}
-void hDEBUG(const char* file, long line, const char *format, ...) {}
-#endif
-GENERATE_PRINT(INFO, "INFO")
-GENERATE_PRINT(WARNING, "WARN")
-GENERATE_PRINT(ERROR, "ERRO")
-GENERATE_f(hINFO, "INFO")
-GENERATE_f(hWARNING, "WARN")
-GENERATE_f(hERROR, "ERRO")
-//fprintf(stderr, "%s " level "%s:%ld %s\n", date_buf, file, line, buf); 
\ No newline at end of file
+GENERATE_LOG(DEBUG, nullptr, "DEBU", log_async)
+GENERATE_LOG(INFO, nullptr, "INFO", log_async)
+GENERATE_LOG(WARNING, nullptr, "WARN", log_sync)
+GENERATE_LOG(ERROR, nullptr, "ERRO", log_sync)
+GENERATE_LOG(hDEBUG, log_name, "DEBU", log_async)
+GENERATE_LOG(hINFO, log_name, "INFO", log_async)
+GENERATE_LOG(hWARNING, log_name, "WARN", log_sync)
+GENERATE_LOG(hERROR, log_name, "ERRO", log_sync)
@@ -26,13 +26,49 @@
 
 #define DEBUG_MSG_LEN 256
 
+// Messages are formatted by the calling thread into a ring of its own and written out by a
+// background thread, so that logging stays off the latency of intercepted CUDA calls. Warnings and
+// errors are written before returning. DEBUG/INFO/WARNING/ERROR print to stderr; the h* variants
+// of the hook library append to the file named by log_name.
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+
+// calls below LOG_LEVEL are removed at compile time, arguments included
+#ifndef LOG_LEVEL
+#ifdef _DEBUG
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#if LOG_LEVEL > LOG_LEVEL_DEBUG
+#define DEBUG(...) ((void)0)
+#define hDEBUG(...) ((void)0)
+#else
 void DEBUG(const char* log_name, const char* file, long line, const char *format, ...);
-void INFO(const char* log_name, const char* file, long line, const char *format, ...);
-void WARNING(const char* log_name, const char* file, long line, const char *format, ...);
-void ERROR(const char* log_name, const char* file, long line, const char *format, ...);
 void hDEBUG(const char* log_name, const char* file, long line, const char *format, ...);
+#endif
+#if LOG_LEVEL > LOG_LEVEL_INFO
+#define INFO(...) ((void)0)
+#define hINFO(...) ((void)0)
+#else
+void INFO(const char* log_name, const char* file, long line, const char *format, ...);
 void hINFO(const char* log_name, const char* file, long line, const char *format, ...);
+#endif
+#if LOG_LEVEL > LOG_LEVEL_WARNING
+#define WARNING(...) ((void)0)
+#define hWARNING(...) ((void)0)
+#else
+void WARNING(const char* log_name, const char* file, long line, const char *format, ...);
 void hWARNING(const char* log_name, const char* file, long line, const char *format, ...);
+#endif
+void ERROR(const char* log_name, const char* file, long line, const char *format, ...);
 void hERROR(const char* log_name, const char* file, long line, const char *format, ...);
 
+// write out every queued message
+void log_flush();
+
 #endif
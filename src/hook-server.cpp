@@ -0,0 +1,192 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hook-server.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "debug.h"
+
+extern char *log_name;
+
+// events returned by one epoll_wait() at most
+static const int EPOLL_BATCH = 64;
+
+HookServer::HookServer(handler_t handle, blocking_t blocking, event_t open, event_t close)
+    : handle_(handle),
+      blocking_(blocking),
+      open_(open),
+      close_(close),
+      epfd_(-1),
+      accept_sockfd_(-1),
+      waiting_workers_(0) {
+  pthread_mutex_init(&mutex_, nullptr);
+  pthread_cond_init(&queue_cond_, nullptr);
+}
+
+int HookServer::run(int accept_sockfd) {
+  accept_sockfd_ = accept_sockfd;
+  fcntl(accept_sockfd_, F_SETFL, fcntl(accept_sockfd_, F_GETFL) | O_NONBLOCK);
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.ptr = nullptr;  // the accept socket
+  if (epfd_ == -1 || epoll_ctl(epfd_, EPOLL_CTL_ADD, accept_sockfd_, &ev) == -1) {
+    ERROR(log_name, __FILE__, (long)__LINE__, "failed to set up epoll: %s", strerror(errno));
+    return -1;
+  }
+
+  struct epoll_event events[EPOLL_BATCH];
+  while (true) {
+    int n = epoll_wait(epfd_, events, EPOLL_BATCH, -1);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      ERROR(log_name, __FILE__, (long)__LINE__, "epoll_wait() failed: %s", strerror(errno));
+      return -1;
+    }
+    for (int i = 0; i < n; i++) {
+      conn_t *conn = (conn_t *)events[i].data.ptr;
+      if (conn == nullptr) {
+        accept_clients();
+      } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        hang_up(conn);
+      } else {
+        pthread_mutex_lock(&mutex_);
+        bool busy = conn->busy;
+        pthread_mutex_unlock(&mutex_);
+        // data after a request in flight is read once the worker is done with it
+        if (!busy) read_requests(conn);
+      }
+    }
+  }
+}
+
+void HookServer::accept_clients() {
+  int fd;
+  while ((fd = accept4(accept_sockfd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    conn_t *conn = new conn_t();
+    conn->fd = fd;
+    open_(fd);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev);
+    INFO(log_name, __FILE__, (long)__LINE__, "hook connected, fd %d.", fd);
+  }
+  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    ERROR(log_name, __FILE__, (long)__LINE__, "accept() failed: %s", strerror(errno));
+}
+
+void HookServer::read_requests(conn_t *conn) {
+  char response[RSP_MSG_LEN];
+  while (true) {
+    ssize_t rc = recv(conn->fd, conn->request + conn->filled, REQ_MSG_LEN - conn->filled, 0);
+    if (rc == -1 && errno == EINTR) continue;
+    if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (rc <= 0) {
+      hang_up(conn);
+      return;
+    }
+    conn->filled += rc;
+    if (conn->filled < REQ_MSG_LEN) continue;
+    conn->filled = 0;
+
+    if (blocking_(conn->request)) {
+      pthread_mutex_lock(&mutex_);
+      conn->busy = true;
+      queue_.push_back(conn);
+      if (queue_.size() > waiting_workers_) {
+        pthread_t tid;
+        pthread_create(&tid, nullptr, worker_thread, this);
+        pthread_detach(tid);
+      } else {
+        pthread_cond_signal(&queue_cond_);
+      }
+      pthread_mutex_unlock(&mutex_);
+      return;
+    }
+
+    bzero(response, RSP_MSG_LEN);
+    if (handle_(conn->fd, conn->request, response) > 0 &&
+        send(conn->fd, response, RSP_MSG_LEN, 0) == -1)
+      ERROR(log_name, __FILE__, (long)__LINE__, "failed to send message to hook library!");
+  }
+}
+
+void HookServer::hang_up(conn_t *conn) {
+  INFO(log_name, __FILE__, (long)__LINE__, "connection closed by peer, fd %d.", conn->fd);
+  epoll_ctl(epfd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+  // reclaim what the hook held before its request in flight, if any, is done
+  close_(conn->fd);
+
+  pthread_mutex_lock(&mutex_);
+  conn->gone = true;
+  bool release = !conn->busy;
+  pthread_mutex_unlock(&mutex_);
+  // the descriptor is not reused while a worker still refers to it
+  if (release) {
+    close(conn->fd);
+    delete conn;
+  }
+}
+
+void HookServer::finish(conn_t *conn, const char *response, size_t len) {
+  pthread_mutex_lock(&mutex_);
+  bool release = conn->gone;
+  if (!release) {
+    if (len > 0 && send(conn->fd, response, RSP_MSG_LEN, 0) == -1)
+      ERROR(log_name, __FILE__, (long)__LINE__, "failed to send message to hook library!");
+    conn->busy = false;
+    // readiness is reported again, edges seen while busy were skipped
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (release) {
+    close(conn->fd);
+    delete conn;
+  }
+}
+
+void *HookServer::worker_thread(void *server) {
+  HookServer *self = (HookServer *)server;
+  char response[RSP_MSG_LEN];
+  pthread_mutex_lock(&self->mutex_);
+  while (true) {
+    while (self->queue_.empty()) {
+      self->waiting_workers_++;
+      pthread_cond_wait(&self->queue_cond_, &self->mutex_);
+      self->waiting_workers_--;
+    }
+    conn_t *conn = self->queue_.front();
+    self->queue_.pop_front();
+    pthread_mutex_unlock(&self->mutex_);
+
+    bzero(response, RSP_MSG_LEN);
+    size_t len = self->handle_(conn->fd, conn->request, response);
+    self->finish(conn, response, len);
+    pthread_mutex_lock(&self->mutex_);
+  }
+  return nullptr;
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HOOK_SERVER_H
+#define HOOK_SERVER_H
+
+#include <pthread.h>
+
+#include <deque>
+#include <functional>
+
+#include "comm.h"
+
+/**
+ * Connections from hook libraries, served by a single epoll thread. Sockets are non-blocking and
+ * edge-triggered, and a peer closing its end (EPOLLRDHUP) is handled as soon as it is reported.
+ * Requests that may block, such as quota requests, are handed to worker threads, which are started
+ * when none is idle and kept for later requests. A hook has one request in flight at most, so a
+ * connection is not read while a worker handles its request.
+ */
+class HookServer {
+ public:
+  // handle a request of client into response, @return response length, 0 if none is sent
+  typedef std::function<size_t(int client, char *request, char *response)> handler_t;
+  typedef std::function<bool(char *request)> blocking_t;
+  typedef std::function<void(int client)> event_t;
+  /**
+   * @param handle handles requests, on the epoll thread unless they may block
+   * @param blocking whether a request may block, it is then handled by a worker thread
+   * @param open a client connected
+   * @param close the peer of a client is gone; called at once, even if a worker still handles a
+   *        request of the client, whose socket is only closed after that
+   */
+  HookServer(handler_t handle, blocking_t blocking, event_t open, event_t close);
+  // serve clients connecting to accept_sockfd, @return -1 if epoll fails
+  int run(int accept_sockfd);
+
+ private:
+  struct conn_t {
+    int fd = -1;
+    char request[REQ_MSG_LEN];
+    size_t filled = 0;  // bytes of request received, a TCP read may return part of it
+    bool busy = false;  // a worker handles its request
+    bool gone = false;  // peer closed, the socket is closed once not busy
+  };
+  static void *worker_thread(void *server);
+  void accept_clients();
+  // read and handle requests until no more data is available or one is handed to a worker
+  void read_requests(conn_t *conn);
+  void hang_up(conn_t *conn);
+  // send the response of a worker and watch the connection again
+  void finish(conn_t *conn, const char *response, size_t len);
+
+  handler_t handle_;
+  blocking_t blocking_;
+  event_t open_, close_;
+  int epfd_;
+  int accept_sockfd_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t queue_cond_;
+  std::deque<conn_t *> queue_;  // requests waiting for a worker
+  size_t waiting_workers_;      // workers waiting for a request
+};
+
+#endif
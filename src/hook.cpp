@@ -39,6 +39,7 @@
 #include <signal.h>
 
 
+#include <atomic>
 #include <climits>
 #include <cmath>
 #include <cstdio>
@@ -46,16 +47,20 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
-#include <map>
 #include <queue>
-#include <list>
 #include <random>
 #include <sstream>
 #include <algorithm>
 
+#include "alloc-registry.h"
 #include "comm.h"
 #include "debug.h"
+#include "kernel-model.h"
+#include "launch-queue.h"
+#include "launch-trace.h"
+#include "overuse-tracker.h"
 #include "predictor.h"
+#include "token-channel.h"
 #include "util.h"
 #include <chrono>
 using std::string;
@@ -73,6 +78,21 @@ CUresult CUDAAPI cuMemAlloc_hook( CUdeviceptr* dptr, size_t bytesize) {
 }
 
 
+#define STRINGIFY(x) #x
+#define CUDA_SYMBOL_STRING(x) STRINGIFY(x)
+typedef void *(*fnDlsym)(void *, const char *);
+CUresult CUDAAPI cuGetProcAddress(const char *symbol, void **pfn, int cudaVersion, cuuint64_t flags);
+
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34)
+// glibc 2.34 merged libdl into libc and no longer exports __libc_dlsym and __libc_dlopen_mode;
+// dlvsym is not intercepted, so it finds the real dlsym
+void *libcudaHandle = dlopen("libcuda.so", RTLD_LAZY);
+void *libcudnnHandle = dlopen("libcudnn.so", RTLD_LAZY);
+static void *real_dlsym(void *handle, const char *symbol) {
+  static fnDlsym internal_dlsym = (fnDlsym)dlvsym(RTLD_NEXT, "dlsym", "GLIBC_2.2.5");
+  return (*internal_dlsym)(handle, symbol);
+}
+#else
 extern "C" {
 void *__libc_dlsym(void *map, const char *name);
 }
@@ -80,23 +100,21 @@ extern "C" {
 void *__libc_dlopen_mode(const char *name, int mode);
 }
 
-#define STRINGIFY(x) #x
-#define CUDA_SYMBOL_STRING(x) STRINGIFY(x)
 void *libdlHandle = __libc_dlopen_mode("libdl.so", RTLD_LAZY);
 void *libcudaHandle = __libc_dlopen_mode("libcuda.so", RTLD_LAZY);
 void *libcudnnHandle = __libc_dlopen_mode("libcudnn.so", RTLD_LAZY);
-typedef void *(*fnDlsym)(void *, const char *);
-CUresult CUDAAPI cuGetProcAddress(const char *symbol, void **pfn, int cudaVersion, cuuint64_t flags);
 static void *real_dlsym(void *handle, const char *symbol) {
   typedef void *(*fnDlsym)(void *, const char *);
       static fnDlsym internal_dlsym = (fnDlsym)__libc_dlsym(libdlHandle, "dlsym");
   return (*internal_dlsym)(handle, symbol);
 }
+#endif
 
 struct hookInfo {
   int debug_mode = 0;
   void *preHooks[NUM_HOOK_SYMBOLS];
   void *postHooks[NUM_HOOK_SYMBOLS];
+  void *failHooks[NUM_HOOK_SYMBOLS];  // called instead of postHooks when the real function fails
   int call_count[NUM_HOOK_SYMBOLS];
   void *func_actual[NUM_HOOK_SYMBOLS];
  
@@ -107,75 +125,23 @@ struct hookInfo {
     if (envHookDebug && envHookDebug[0] == '1')
       debug_mode = 1;
     else
-      debug_mode = 1;
+      debug_mode = 0;
   }
 };
 
 static struct hookInfo hook_inf;
 char* log_name = "/kubeshare/log/hook.log";
-/*
- ** interposed functions
- */
-void *dlsym(void *handle, const char *symbol) {
-  // Early out if not a CUDA driver symbol
-  if (strncmp(symbol, "cu", 2) != 0) {
-    return (real_dlsym(handle, symbol));
-  }
-  if (strcmp(symbol, CUDA_SYMBOL_STRING(cuGetProcAddress)) == 0) {
-        return (void *)(&cuGetProcAddress);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemAlloc)) == 0) {
-    return (void *)(&cuMemAlloc);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemAllocManaged)) == 0) {
-    return (void *)(&cuMemAllocManaged);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemAllocPitch)) == 0) {
-    return (void *)(&cuMemAllocPitch);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemFree)) == 0) {
-    return (void *)(&cuMemFree);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuArrayCreate)) == 0) {
-    return (void *)(&cuArrayCreate);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuArray3DCreate)) == 0) {
-    return (void *)(&cuArray3DCreate);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuArrayDestroy)) == 0) {
-    return (void *)(&cuArrayDestroy);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMipmappedArrayCreate)) == 0) {
-    return (void *)(&cuMipmappedArrayCreate);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMipmappedArrayDestroy)) == 0) {
-    return (void *)(&cuMipmappedArrayDestroy);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuLaunchKernel)) == 0) {
-    return (void *)(&cuLaunchKernel);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuLaunchCooperativeKernel)) == 0) {
-    return (void *)(&cuLaunchCooperativeKernel);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemGetInfo)) == 0) {
-    return (void *)(&cuMemGetInfo);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuCtxSynchronize)) == 0) {
-    return (void *)(&cuCtxSynchronize);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyAtoH)) == 0) {
-    return (void *)(&cuMemcpyAtoH);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyAtoHAsync)) == 0) {
-    return (void *)(&cuMemcpyAtoHAsync);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyDtoH)) == 0) {
-    return (void *)(&cuMemcpyDtoH);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyDtoHAsync)) == 0) {
-    return (void *)(&cuMemcpyDtoHAsync);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyHtoA)) == 0) {
-    return (void *)(&cuMemcpyHtoA);
-  } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyHtoD)) == 0) {
-    return (void *)(&cuMemcpyHtoD);
-  }
-  
-  // omit cuDeviceTotalMem here so there won't be a deadlock in cudaEventCreate when we are in
-  // initialize(). Functions called by client are still being intercepted.
-  return (real_dlsym(handle, symbol));
-}
-
 /* connection with Pod manager */
 std::string scheduler_ip_file = "/kubeshare/library/schedulerIP.txt";
 std::string scheduler_port_file = "/kubeshare/schedulerPort.txt";
 char pod_manager_ip[20] = "127.0.0.1";
 uint16_t pod_manager_port = 50052;                       // default value
+char pod_manager_socket[PATH_MAX] = "";  // use unix domain socket if set
 pthread_mutex_t comm_mutex = PTHREAD_MUTEX_INITIALIZER;  // one communication at a time
 const int NET_OP_MAX_ATTEMPT = 5;  // maximum time retrying failed network operations
 const int NET_OP_RETRY_INTV = 10;  // seconds between two retries
+token_channel_t *token_channel = nullptr;  // shared-memory quota channel, if Pod manager provides one
+int token_slot = -1;
 
 /* GPU computation resource usage */
 double quota_time = 0;  // time quota from scheduler
@@ -187,24 +153,35 @@ pthread_mutex_t request_time_mutex = PTHREAD_MUTEX_INITIALIZER;
 const double SCHD_OVERHEAD = 2.0;                   // ms
 Predictor burst_predictor("burst", SCHD_OVERHEAD);  // predicted burst may not be the full burst
 Predictor window_predictor("window");
+KernelModel kernel_model;  // per-kernel execution time, predicts the rest of a burst
 
 pthread_mutex_t expiration_status_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_once_t init_done = PTHREAD_ONCE_INIT;
-cudaEvent_t cuevent_start;      // the time receive new token
+static std::atomic<bool> init_finished(false);  // lets intercepted calls skip pthread_once
+OveruseTracker overuse_tracker;  // kernels launched under the current token
 struct timespec request_start;  // the time receive new token
 
 pthread_mutex_t overuse_trk_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t overuse_trk_strt_cond = PTHREAD_COND_INITIALIZER;
 pthread_cond_t overuse_trk_cmpl_cond = PTHREAD_COND_INITIALIZER;
 pthread_cond_t overuse_trk_intr_cond;  // initialize it with CLOCK_MONOTONIC
-bool overuse_trk_cmpl;
+bool overuse_trk_cmpl = true;  // bypass first overuse tracking to prevent deadlock
+bool overuse_trk_intr = false;  // token needed before expiration, measure now
+
+// launches held back while a token is obtained, env CU_HOOK_DEFER_LAUNCHES
+LaunchQueue launch_queue;
+// set on hook threads and while renewing the token: their stream work must not wait for launches
+// held back, which may need this very thread to be issued
+static thread_local bool internal_cuda_call = false;
 
 // GPU memory allocation information
 pthread_mutex_t allocation_mutex = PTHREAD_MUTEX_INITIALIZER;
-std::map<CUdeviceptr, size_t> allocation_map;
-std::list<std::tuple<CUdeviceptr, size_t, CUdevice>> devptrs_mngr;
-size_t gpu_mem_used = 0;  // local accounting only
+AllocationRegistry allocations;
+size_t gpu_mem_used = 0;    // charged to the lease by allocations of this process
+size_t gpu_mem_leased = 0;  // reserved at Pod manager, at least gpu_mem_used
+size_t mem_lease_chunk = 64UL << 20;  // spare budget leased ahead, env GPU_MEM_LEASE_CHUNK
+bool mem_pressure = false;  // Pod manager is short of budget as of the last lease exchange
 
 /**
  * get elapsed us since certain time
@@ -222,6 +199,29 @@ inline double ms_since_start() {
   return duration_cast<microseconds>(steady_clock::now() - PROGRESS_START).count() / 1e3;
 }
 
+// token expiration in steady_clock nanoseconds, lets launches check the token without a lock
+std::atomic<int64_t> token_deadline_ns(0);
+
+inline int64_t steady_ns() {
+  return duration_cast<std::chrono::nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// let a call ordered after the launches on stream see those held back issued first
+inline void wait_deferred_launches(CUstream stream) {
+  if (launch_queue.enabled() && !internal_cuda_call) launch_queue.wait(stream);
+}
+
+/**
+ * wait_deferred_launches(), for calls that report the failures of earlier launches
+ * @return the first launch held back on stream that failed and was not reported yet, otherwise
+ *         CUDA_SUCCESS to go on with the call
+ */
+inline CUresult collect_deferred_launches(CUstream stream) {
+  if (!launch_queue.enabled() || internal_cuda_call) return CUDA_SUCCESS;
+  launch_queue.wait(stream);
+  return launch_queue.take_error(stream);
+}
+
 /**
  * get connection information from environment variables
  */
@@ -242,20 +242,29 @@ inline double ms_since_start() {
  * get connection information from file
  */
 void configure_connection() {
-  // get Pod manager IP, default 127.0.0.1
-  /*char *ip = getenv("POD_MANAGER_IP");
-  if (ip != NULL) strcpy(pod_manager_ip, ip);
-  */
- 
-  std::ifstream ifs_ip(scheduler_ip_file, std::ios::in);
-  if(!ifs_ip.is_open()){
-    hERROR(log_name, __FILE__, (long)__LINE__, "Failed to open the ip file");
-    exit(-1);
+  // a unix domain socket shared with Pod manager takes precedence over TCP
+  char *socket_path = getenv("POD_MANAGER_SOCKET");
+  if (socket_path != NULL && socket_path[0] != '\0') {
+    strncpy(pod_manager_socket, socket_path, PATH_MAX - 1);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "Pod manager: unix:%s", pod_manager_socket);
+    return;
+  }
+
+  // get Pod manager IP from the environment, or else from the ip file
+  char *ip = getenv("POD_MANAGER_IP");
+  if (ip != NULL && ip[0] != '\0') {
+    strncpy(pod_manager_ip, ip, sizeof(pod_manager_ip) - 1);
+  } else {
+    std::ifstream ifs_ip(scheduler_ip_file, std::ios::in);
+    if(!ifs_ip.is_open()){
+      hERROR(log_name, __FILE__, (long)__LINE__, "Failed to open the ip file");
+      exit(-1);
+    }
+    std::string line;
+    getline(ifs_ip,line);
+    if(line != "") strcpy(pod_manager_ip, line.c_str());
+    ifs_ip.close();
   }
-  std::string line;
-  getline(ifs_ip,line);
-  if(line != "") strcpy(pod_manager_ip, line.c_str());
-  ifs_ip.close();
   // get Pod manager port, default 50052
  /* std::ifstream ifs_port(scheduler_port_file, std::ios::in);
   if(!ifs_port.is_open()){
@@ -272,30 +281,26 @@ void configure_connection() {
   //INFO(log_name, __FILE__, (long)__LINE__, "Pod manager: %s:%u", pod_manager_ip, pod_manager_port);
 }
 
-int attempt_connection(int __fd, __CONST_SOCKADDR_ARG __addr, socklen_t __len) {
+int attempt_connection(int __fd, comm_addr_t *addr) {
   configure_connection();
-  return connect(__fd, __addr, __len);
+  comm_resolve(addr, pod_manager_socket, pod_manager_ip, pod_manager_port);
+  return connect(__fd, (struct sockaddr *)&addr->addr, addr->len);
 }
 /**
  * establish connection with scheduler.
  * @return connected socket file descriptor
  */
 int establish_connection() {
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  comm_addr_t info;
+  comm_resolve(&info, pod_manager_socket, pod_manager_ip, pod_manager_port);
+  int sockfd = comm_socket(&info);
   if (sockfd == -1) {
     hERROR(log_name, __FILE__, (long)__LINE__, "Failed to create socket.");
     exit(-1);
   }
 
-  struct sockaddr_in info;
-  bzero(&info, sizeof(info));
-  info.sin_family = PF_INET;
-  info.sin_addr.s_addr = inet_addr(pod_manager_ip);
-  info.sin_port = htons(pod_manager_port);
-
-  // connect(sockfd, (struct sockaddr *)&info, sizeof(info));
   int rc = multiple_attempt(
-      [&]() -> int { return attempt_connection(sockfd, (struct sockaddr *)&info, sizeof(info));},
+      [&]() -> int { return attempt_connection(sockfd, &info); },
       NET_OP_MAX_ATTEMPT, NET_OP_RETRY_INTV);
   if (rc != 0) {
     hERROR(log_name, __FILE__, (long)__LINE__, "Connection error: %s", strerror(rc));
@@ -347,13 +352,16 @@ int communicate(char *sbuf, char *rbuf, int socket_timeout) {
 /**
  * Record a host-side synchronous call and update predictor statistics.
  * @param func_name name of synchronous call
+ * @param ends_burst whether the application synchronized, so that its burst is complete
  */
-void host_sync_call(const char *func_name) {
+void host_sync_call(const char *func_name, bool ends_burst = true) {
 #ifdef SYNCP_MESSAGE
   DEBUG(log_name, __FILE__, (long)__LINE__, "SYNC (%s)", func_name);
 #endif
   burst_predictor.record_stop();
   window_predictor.record_start();
+  if (ends_burst) kernel_model.burst_end();
+  launch_trace_record(TRACE_SYNC);
 }
 
 /**
@@ -380,46 +388,96 @@ std::pair<size_t, size_t> get_gpu_memory_info() {
   used = get_msg_data<size_t>(attached, rpos);
   total = get_msg_data<size_t>(attached, rpos);
 
+  // spare lease of this process is counted as used by Pod manager, but still available here
+  pthread_mutex_lock(&allocation_mutex);
+  used -= std::min(used, gpu_mem_leased - gpu_mem_used);
+  pthread_mutex_unlock(&allocation_mutex);
   return std::make_pair(total - used, total);
 }
 
 /**
- * send memory allocate/free information to Pod manager/scheduler
- * @param bytes memory size
- * @param is_allocate 1 for allocation, 0 for free
- * @return request succeed or not
+ * tell Pod manager the pid of this process and its weight in the Pod quota
+ * @param weight relative to the other processes of the Pod
+ */
+void register_process(double weight) {
+  char sbuf[REQ_MSG_LEN], rbuf[RSP_MSG_LEN];
+  int rc;
+
+  bzero(sbuf, REQ_MSG_LEN);
+  prepare_request(sbuf, REQ_PROCESS_INFO, (int)getpid(), weight);
+
+  rc = communicate(sbuf, rbuf, NET_OP_RETRY_INTV);
+  if (rc != 0) {
+    hERROR(log_name, __FILE__, (long)__LINE__, "failed to register process: %s", strerror(rc));
+    exit(rc);
+  }
+}
+
+/**
+ * exchange GPU memory lease with Pod manager, caller holds allocation_mutex
+ * @param need bytes that must be added to the lease
+ * @param want need plus the spare kept, added unless Pod manager is under pressure
+ * @param release bytes of the lease given back
+ * @return bytes added to the lease, 0 if need cannot be met
  */
-int update_memory_usage(size_t bytes, int is_allocate) {
+size_t exchange_memory_lease(size_t need, size_t want, size_t release) {
   char sbuf[REQ_MSG_LEN], rbuf[RSP_MSG_LEN], *attached;
   size_t rpos = 0;
   int rc;
-  int verdict;
+  size_t granted;
 
   bzero(sbuf, REQ_MSG_LEN);
-  prepare_request(sbuf, REQ_MEM_UPDATE, bytes, is_allocate);
+  prepare_request(sbuf, REQ_MEM_LEASE, need, want, release);
 
-  // get verdict from Pod manager
   rc = communicate(sbuf, rbuf, NET_OP_RETRY_INTV);
   if (rc != 0) {
-    hERROR(log_name, __FILE__, (long)__LINE__, "failed to update GPU memory usage: %s", strerror(rc));
+    hERROR(log_name, __FILE__, (long)__LINE__, "failed to lease GPU memory: %s", strerror(rc));
     exit(rc);
   }
   attached = parse_response(rbuf, nullptr);
-  verdict = get_msg_data<int>(attached, rpos);
+  granted = get_msg_data<size_t>(attached, rpos);
+  mem_pressure = get_msg_data<int>(attached, rpos);
+  gpu_mem_leased = gpu_mem_leased - release + granted;
 
-  return verdict;
+  return granted;
+}
+
+/**
+ * make sure the lease covers an allocation, leasing a spare chunk ahead unless under pressure.
+ * caller holds allocation_mutex
+ * @param bytes size of the allocation
+ * @return whether Pod memory limit allows the allocation
+ */
+bool cover_memory_lease(size_t bytes) {
+  if (gpu_mem_used + bytes <= gpu_mem_leased) return true;
+  size_t need = gpu_mem_used + bytes - gpu_mem_leased;
+  return exchange_memory_lease(need, need + mem_lease_chunk, 0) > 0;
+}
+
+/**
+ * give spare lease back once it exceeds two chunks, keeping one; give all of it back under
+ * pressure. caller holds allocation_mutex
+ */
+void trim_memory_lease() {
+  size_t spare = gpu_mem_leased - gpu_mem_used;
+  size_t keep = mem_pressure ? 0 : mem_lease_chunk;
+  if (spare > 2 * keep) exchange_memory_lease(0, mem_lease_chunk, spare - keep);
 }
 
 /**
  * estimate the length of a complete burst
  * @param measured_burst the length of a kernel burst measured by Predictor
  * @param measured_window the length of a window period measured by Predictor
+ * @param modeled_burst the rest of the burst predicted by KernelModel, negative if unknown
  * @return estimated length of a complete burst
  */
-double estimate_full_burst(double measured_burst, double measured_window) {
+double estimate_full_burst(double measured_burst, double measured_window, double modeled_burst) {
   double full_burst;
 
-  if (measured_burst < 1e-9) {
+  if (modeled_burst >= 0.0) {
+    // the kernels left in this burst are known, no need to guess how much of it was measured
+    full_burst = modeled_burst;
+  } else if (measured_burst < 1e-9) {
     // no valid burst data
     full_burst = 0.0;
   } else {
@@ -429,8 +487,9 @@ double estimate_full_burst(double measured_burst, double measured_window) {
     if (measured_window < SCHD_OVERHEAD) full_burst *= 2;  // '2' can be changed to any value > 1
   }
 
-  DEBUG(log_name, __FILE__, (long)__LINE__, "measured burst: %.3f ms, window: %.3f ms, estimated full burst: %.3f ms", measured_burst,
-        measured_window, full_burst);
+  DEBUG(log_name, __FILE__, (long)__LINE__,
+        "measured burst: %.3f ms, window: %.3f ms, modeled: %.3f ms, estimated full burst: %.3f ms",
+        measured_burst, measured_window, modeled_burst, full_burst);
   return full_burst;
 }
 
@@ -447,6 +506,12 @@ double get_token_from_scheduler(double next_burst) {
 
   bzero(sbuf, REQ_MSG_LEN);
   bzero(rbuf, RSP_MSG_LEN); //RSP_MSG_LEN
+  if (token_channel != nullptr) {
+    new_quota = token_channel_acquire(token_channel, token_slot, overuse, next_burst);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "Get token from token channel, quota: %f", new_quota);
+    return new_quota;
+  }
+
   prepare_request(sbuf, REQ_QUOTA, overuse, next_burst);
 
   // retrieve token from scheduler
@@ -463,20 +528,20 @@ double get_token_from_scheduler(double next_burst) {
 }
 
 /**
- * wait for all active kernels to complete, and update overuse statistics. note that cuda default
- * stream has an additional characteristic of implicit synchronization, which roughly means that a
- * CUDA operation issued into the default stream will not begin executing until all prior issued
- * CUDA activity to that device has completed. (from https://stackoverflow.com/a/49331700 by Robert
- * Crovella)
+ * wait for all active kernels to complete, and update overuse statistics. kernels are waited for on
+ * every stream launched into under the token, since streams created with cudaStreamNonBlocking do
+ * not synchronize with the default stream. completion is polled, so the token is returned as soon
+ * as the last kernel retires.
  * @param args not in use now
  */
 void *wait_cuda_kernels(void *args) {
   struct timespec ts;
   double nsec;
+  internal_cuda_call = true;
   while (true) {
     // wait for tracking request
     pthread_mutex_lock(&overuse_trk_mutex);
-    pthread_cond_wait(&overuse_trk_strt_cond, &overuse_trk_mutex);
+    while (overuse_trk_cmpl) pthread_cond_wait(&overuse_trk_strt_cond, &overuse_trk_mutex);
     pthread_mutex_unlock(&overuse_trk_mutex);
 
     // calculate token expiration time
@@ -489,24 +554,22 @@ void *wait_cuda_kernels(void *args) {
 
     // sleep until token expired or being notified
     pthread_mutex_lock(&overuse_trk_mutex);
-    int rc = pthread_cond_timedwait(&overuse_trk_intr_cond, &overuse_trk_mutex, &ts);
-    if (rc != ETIMEDOUT) {
+    int rc = 0;
+    while (!overuse_trk_intr && rc != ETIMEDOUT)
+      rc = pthread_cond_timedwait(&overuse_trk_intr_cond, &overuse_trk_mutex, &ts);
+    if (overuse_trk_intr) {
       DEBUG(log_name, __FILE__, (long)__LINE__, "overuse tracking thread interrupted");
     }
+    overuse_trk_intr = false;
     pthread_mutex_unlock(&overuse_trk_mutex);
 
-    // synchronize all running kernels
-    cudaEvent_t event;
-    cudaEventCreate(&event);
-    cudaEventRecord(event);
-    cudaEventSynchronize(event);
+    // wait for all running kernels
+    double elapsed_ms = overuse_tracker.wait_completion();
 
     // notify predictor we've done a synchronize
-    host_sync_call("overuse measurement");
+    host_sync_call("overuse measurement", false);
 
-    float elapsed_ms;
-    cudaEventElapsedTime(&elapsed_ms, cuevent_start, event);
-    overuse = std::max(0.0, (double)elapsed_ms - quota_time);
+    overuse = std::max(0.0, elapsed_ms - quota_time);
 
     DEBUG(log_name, __FILE__, (long)__LINE__, "overuse: %.3f ms", overuse);
     // notify tracking complete
@@ -522,43 +585,46 @@ void *wait_cuda_kernels(void *args) {
  * pre-hooks and post-hooks
  */
 
-CUresult cuLaunchKernel_prehook(CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
-                                unsigned int gridDimZ, unsigned int blockDimX,
-                                unsigned int blockDimY, unsigned int blockDimZ,
-                                unsigned int sharedMemBytes, CUstream hStream, void **kernelParams,
-                                void **extra) {
+/**
+ * obtain a new token once the current one expired; launches of other threads wait meanwhile
+ */
+void renew_token() {
   double new_quota, next_burst;
 
-  window_predictor.record_stop();
   pthread_mutex_lock(&expiration_status_mutex);
-  // allow the kernel to launch if kernel burst already begins;
-  // otherwise, obtain a new token if this kernel burst may cause overuse
+  bool internal = internal_cuda_call;
+  internal_cuda_call = true;
+  // another thread may have renewed it while this one waited for the lock
   //DEBUG(log_name, __FILE__, (long)__LINE__, "estimitaed_burst_time: %ld with the addr: %x", request_start.tv_sec, &request_start);
   //if(us_since(request_start) / 1e3 + burst_predictor.predict_unmerged() >= quota_time) {
   if(ms_since_start() >= quota_time) {
     // estimate the duration of next kernel burst (merged)
-    next_burst =
-        estimate_full_burst(burst_predictor.predict_merged(), window_predictor.predict_merged());
+    next_burst = estimate_full_burst(burst_predictor.predict_merged(),
+                                     window_predictor.predict_merged(),
+                                     kernel_model.predict_remaining());
 
     // wait for all kernels finish
     pthread_mutex_lock(&overuse_trk_mutex);
     if (!overuse_trk_cmpl) {
       // notify overuse tracking thread to perform sync eariler
+      overuse_trk_intr = true;
       pthread_cond_signal(&overuse_trk_intr_cond);
-      pthread_cond_wait(&overuse_trk_cmpl_cond, &overuse_trk_mutex);
+      while (!overuse_trk_cmpl) pthread_cond_wait(&overuse_trk_cmpl_cond, &overuse_trk_mutex);
     }
     pthread_mutex_unlock(&overuse_trk_mutex);
 
     // interrupt the window which is started when overuse tracking completes
     window_predictor.interrupt();
 
+    launch_trace_record(TRACE_TOKEN_REQUEST, 0, 0, nullptr, nullptr, next_burst);
     new_quota = get_token_from_scheduler(next_burst);
+    launch_trace_record(TRACE_TOKEN_GRANT, 0, 0, nullptr, nullptr, new_quota);
 
     // ensure predicted kernel burst is always less than quota
     burst_predictor.set_upperbound(new_quota - 1.0);
 
     //DEBUG(log_name, __FILE__, (long)__LINE__, "2us since request time: %ld with the addr: %x", us_since(request_start) / 1e3, &request_start);
-    cudaEventRecord(cuevent_start, 0);
+    overuse_tracker.token_started();
     PROGRESS_START = steady_clock::now();
     clock_gettime(CLOCK_MONOTONIC, &request_start);  // time
     DEBUG(log_name, __FILE__, (long)__LINE__, "Got the time elapsed:%f", ms_since_start());
@@ -570,36 +636,124 @@ CUresult cuLaunchKernel_prehook(CUfunction f, unsigned int gridDimX, unsigned in
     overuse_trk_cmpl = false;
     pthread_cond_signal(&overuse_trk_strt_cond);
     pthread_mutex_unlock(&overuse_trk_mutex);
+
+    token_deadline_ns.store(
+        duration_cast<std::chrono::nanoseconds>(PROGRESS_START.time_since_epoch()).count() +
+            (int64_t)(quota_time * 1e6),
+        std::memory_order_release);
   }
-  burst_predictor.record_start();
+  internal_cuda_call = internal;
   pthread_mutex_unlock(&expiration_status_mutex);
+}
+
+// account a launch about to be issued under the token, renewing the token first if it expired
+void account_launch(CUfunction f, const uint32_t grid[3], const uint32_t block[3], CUstream hStream) {
+  if (launch_trace_enabled())
+    launch_trace_record(TRACE_LAUNCH, (uint64_t)f, (uint64_t)hStream, grid, block);
+  window_predictor.record_stop();
+  // the token is valid until the deadline, otherwise obtain a new one; the predictors and the
+  // tracker skip their locks too while a burst goes on under the same token
+  if (steady_ns() >= token_deadline_ns.load(std::memory_order_acquire)) renew_token();
+  burst_predictor.record_start();
+  overuse_tracker.kernel_launched((cudaStream_t)hStream);
+  kernel_model.launch_begin(f, grid, block, (cudaStream_t)hStream);
+}
 
+CUresult cuLaunchKernel_prehook(CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
+                                unsigned int gridDimZ, unsigned int blockDimX,
+                                unsigned int blockDimY, unsigned int blockDimZ,
+                                unsigned int sharedMemBytes, CUstream hStream, void **kernelParams,
+                                void **extra) {
+  uint32_t grid[3] = {gridDimX, gridDimY, gridDimZ}, block[3] = {blockDimX, blockDimY, blockDimZ};
+  if (launch_queue.enabled()) {
+    // hold the launch back instead of waiting for a token, and behind launches held back already;
+    // a capturing stream records the launch into its graph, which must see it before EndCapture
+    if (!is_default_stream(hStream) &&
+        (!launch_queue.empty() ||
+         steady_ns() >= token_deadline_ns.load(std::memory_order_acquire)) &&
+        !is_capturing(hStream) &&
+        launch_queue.push(f, grid, block, sharedMemBytes, hStream, kernelParams, extra))
+      return CU_HOOK_HANDLED;
+    launch_queue.wait(hStream);
+  }
+  account_launch(f, grid, block, hStream);
   return CUDA_SUCCESS;
 }
 
+CUresult cuLaunchKernel_posthook(CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
+                                 unsigned int gridDimZ, unsigned int blockDimX,
+                                 unsigned int blockDimY, unsigned int blockDimZ,
+                                 unsigned int sharedMemBytes, CUstream hStream,
+                                 void **kernelParams, void **extra) {
+  kernel_model.launch_end();
+  return CUDA_SUCCESS;
+}
+
+// cooperative launches are never held back, the device checks co-residency when they are issued
 CUresult cuLaunchCooperativeKernel_prehook(CUfunction f, unsigned int gridDimX,
                                            unsigned int gridDimY, unsigned int gridDimZ,
                                            unsigned int blockDimX, unsigned int blockDimY,
                                            unsigned int blockDimZ, unsigned int sharedMemBytes,
                                            CUstream hStream, void **kernelParams) {
-  return cuLaunchKernel_prehook(f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
-                                sharedMemBytes, hStream, kernelParams, NULL);
+  uint32_t grid[3] = {gridDimX, gridDimY, gridDimZ}, block[3] = {blockDimX, blockDimY, blockDimZ};
+  wait_deferred_launches(hStream);
+  account_launch(f, grid, block, hStream);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuLaunchCooperativeKernel_posthook(CUfunction f, unsigned int gridDimX,
+                                            unsigned int gridDimY, unsigned int gridDimZ,
+                                            unsigned int blockDimX, unsigned int blockDimY,
+                                            unsigned int blockDimZ, unsigned int sharedMemBytes,
+                                            CUstream hStream, void **kernelParams) {
+  kernel_model.launch_end();
+  return CUDA_SUCCESS;
+}
+
+/**
+ * issue the launches held back, in order, accounting them as the launching threads would have
+ * @param args not in use now
+ */
+void *dispatch_deferred_launches(void *args) {
+  typedef CUresult (*launch_func_t)(CUfunction, unsigned int, unsigned int, unsigned int,
+                                    unsigned int, unsigned int, unsigned int, unsigned int,
+                                    CUstream, void **, void **);
+  internal_cuda_call = true;
+  CUcontext current = nullptr;
+  while (true) {
+    deferred_launch_t &launch = launch_queue.front();
+    if (launch.context != current && cuCtxSetCurrent(launch.context) == CUDA_SUCCESS)
+      current = launch.context;
+    size_t args_size = launch.args.size();
+    void *extra[] = {CU_LAUNCH_PARAM_BUFFER_POINTER, launch.args.data(),
+                     CU_LAUNCH_PARAM_BUFFER_SIZE, &args_size, CU_LAUNCH_PARAM_END};
+
+    account_launch(launch.func, launch.grid, launch.block, launch.stream);
+    CUresult rc = ((launch_func_t)hook_inf.func_actual[CU_HOOK_LAUNCH_KERNEL])(
+        launch.func, launch.grid[0], launch.grid[1], launch.grid[2], launch.block[0],
+        launch.block[1], launch.block[2], launch.shared_mem, launch.stream, nullptr,
+        launch.args.empty() ? nullptr : extra);
+    kernel_model.launch_end();
+    // the launching thread has returned already, the next call ordered after it gets the error
+    if (rc != CUDA_SUCCESS) {
+      hERROR(log_name, __FILE__, (long)__LINE__, "deferred launch failed: %d", rc);
+      launch_queue.fail(rc);
+    }
+    launch_queue.pop();
+  }
+  pthread_exit(NULL);
 }
 
 // update memory usage
 CUresult cuMemFree_prehook(CUdeviceptr ptr) {
+  wait_deferred_launches(nullptr);  // a launch held back may use the memory
   pthread_mutex_lock(&allocation_mutex);
-  if (allocation_map.find(ptr) == allocation_map.end()) {
+  allocation_t freed;
+  if (!allocations.erase(ptr, &freed)) {
     DEBUG(log_name, __FILE__, (long)__LINE__, "Freeing unknown memory! %zx", ptr);
   } else {
-    gpu_mem_used -= allocation_map[ptr];
-    update_memory_usage(allocation_map[ptr], 0);
-    allocation_map.erase(ptr);
-    devptrs_mngr.erase(
-      std::remove_if(devptrs_mngr.begin(), devptrs_mngr.end(),
-        [ptr](std::tuple<CUdeviceptr, size_t, CUdevice>& x) { return (std::get<0>(x) == ptr); }
-      )
-    );
+    gpu_mem_used -= freed.size;
+    trim_memory_lease();
   }
   pthread_mutex_unlock(&allocation_mutex);
   return CUDA_SUCCESS;
@@ -611,45 +765,49 @@ CUresult cuMipmappedArrayDestroy_prehook(CUmipmappedArray hMipmappedArray) {
   return cuMemFree_prehook((CUdeviceptr)hMipmappedArray);
 }
 
-// ask backend whether there's enough memory or not
+// charge the allocation to the memory lease before the driver allocates
 CUresult cuMemAlloc_prehook(CUdeviceptr *dptr, size_t bytesize) {
-  size_t remain, limit;
-  std::tie(remain, limit) = get_gpu_memory_info();
+  pthread_mutex_lock(&allocation_mutex);
+  bool ok = cover_memory_lease(bytesize);
+  if (ok) gpu_mem_used += bytesize;
+  pthread_mutex_unlock(&allocation_mutex);
 
   // block allocation request before over-allocate
-  if (bytesize > remain) {
-    hERROR(log_name, __FILE__, (long)__LINE__, "Allocate too much memory! (request: %lu B, remain: %lu B)", bytesize, remain);
+  if (!ok) {
+    hERROR(log_name, __FILE__, (long)__LINE__, "Allocate too much memory! (request: %lu B)", bytesize);
     return CUDA_ERROR_OUT_OF_MEMORY;
   }
 
   return CUDA_SUCCESS;
 }
 
-// push memory allocation information to backend
+// record the allocation charged by the prehook
 CUresult cuMemAlloc_posthook(CUdeviceptr *dptr, size_t bytesize) {
-  // send memory usage update to backend
-  if (!update_memory_usage(bytesize, 1)) {
-    hERROR(log_name, __FILE__, (long)__LINE__, "Allocate too much memory!");
-    return CUDA_ERROR_OUT_OF_MEMORY;
-  }
-
   pthread_mutex_lock(&allocation_mutex);
-  allocation_map[*dptr] = bytesize;
-  gpu_mem_used += bytesize;
+  allocations.insert({*dptr, bytesize, 0, false});
   pthread_mutex_unlock(&allocation_mutex);
 
   return CUDA_SUCCESS;
 }
 
+// the driver did not allocate, give the charge of the prehook back
+CUresult cuMemAlloc_failhook(CUdeviceptr *dptr, size_t bytesize) {
+  pthread_mutex_lock(&allocation_mutex);
+  gpu_mem_used -= bytesize;
+  trim_memory_lease();
+  pthread_mutex_unlock(&allocation_mutex);
+  return CUDA_SUCCESS;
+}
+
 CUresult cuMemAllocManaged_prehook(CUdeviceptr *dptr, size_t bytesize, unsigned int flags) {
   // TODO: This function access the unified memory. Behavior needs clarification.
-  cuMemAlloc_prehook(dptr, bytesize);
-  return CUDA_SUCCESS;
+  return cuMemAlloc_prehook(dptr, bytesize);
 }
 
 CUresult cuMemAllocManaged_posthook(CUdeviceptr *dptr, size_t bytesize, unsigned int flags) {
   // TODO: This function access the unified memory. Behavior needs clarification.
-  cuMemAlloc_posthook(dptr, bytesize);
+  CUresult result = cuMemAlloc_posthook(dptr, bytesize);
+  if (result != CUDA_SUCCESS) return result;
   int deviceNum;
   cudaError_t err = cudaGetDevice(&deviceNum);
   if (err != cudaSuccess) {
@@ -657,19 +815,57 @@ CUresult cuMemAllocManaged_posthook(CUdeviceptr *dptr, size_t bytesize, unsigned
       exit(EXIT_FAILURE);
   }
   CUdevice currentDevice;
-  CUresult result = cuDeviceGet(&currentDevice, deviceNum);
-  if (result == CUDA_SUCCESS)
-    devptrs_mngr.push_back(std::make_tuple(*dptr, bytesize, currentDevice));
+  result = cuDeviceGet(&currentDevice, deviceNum);
+  if (result == CUDA_SUCCESS) {
+    pthread_mutex_lock(&allocation_mutex);
+    allocations.insert({*dptr, bytesize, currentDevice, true});
+    pthread_mutex_unlock(&allocation_mutex);
+  }
   return result;
 }
 
+CUresult cuMemAllocManaged_failhook(CUdeviceptr *dptr, size_t bytesize, unsigned int flags) {
+  return cuMemAlloc_failhook(dptr, bytesize);
+}
+
+// rows are padded to the pitch, which the driver aligns to PITCH_ALIGNMENT bytes at most
+const size_t PITCH_ALIGNMENT = 512;
+
+inline size_t max_pitch(size_t WidthInBytes) {
+  return (WidthInBytes + PITCH_ALIGNMENT - 1) / PITCH_ALIGNMENT * PITCH_ALIGNMENT;
+}
+
+// the pitch is not known yet, charge the most it can be
 CUresult cuMemAllocPitch_prehook(CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes,
                                  size_t Height, unsigned int ElementSizeBytes) {
-  return cuMemAlloc_prehook(dptr, (*pPitch) * Height);
+  return cuMemAlloc_prehook(dptr, max_pitch(WidthInBytes) * Height);
 }
+
+// settle the charge to the pitch the driver chose
 CUresult cuMemAllocPitch_posthook(CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes,
                                   size_t Height, unsigned int ElementSizeBytes) {
-  return cuMemAlloc_posthook(dptr, (*pPitch) * Height);
+  size_t charged = max_pitch(WidthInBytes) * Height, bytesize = (*pPitch) * Height;
+  pthread_mutex_lock(&allocation_mutex);
+  bool ok = bytesize <= charged || cover_memory_lease(bytesize - charged);
+  if (ok) {
+    gpu_mem_used = gpu_mem_used - charged + bytesize;
+    allocations.insert({*dptr, bytesize, 0, false});
+  } else {
+    gpu_mem_used -= charged;
+  }
+  pthread_mutex_unlock(&allocation_mutex);
+
+  if (!ok) {
+    ((CUresult CUDAAPI(*)(CUdeviceptr))hook_inf.func_actual[CU_HOOK_MEM_FREE])(*dptr);
+    hERROR(log_name, __FILE__, (long)__LINE__, "Allocate too much memory! (request: %lu B)", bytesize);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemAllocPitch_failhook(CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes,
+                                  size_t Height, unsigned int ElementSizeBytes) {
+  return cuMemAlloc_failhook(dptr, max_pitch(WidthInBytes) * Height);
 }
 
 inline size_t CUarray_format_to_size_t(CUarray_format Format) {
@@ -702,6 +898,13 @@ CUresult cuArrayCreate_posthook(CUarray *pHandle, const CUDA_ARRAY_DESCRIPTOR *p
   return cuMemAlloc_posthook((CUdeviceptr *)pHandle, totalMemoryNumber * formatSize);
 }
 
+CUresult cuArrayCreate_failhook(CUarray *pHandle, const CUDA_ARRAY_DESCRIPTOR *pAllocateArray) {
+  size_t totalMemoryNumber =
+      pAllocateArray->Width * pAllocateArray->Height * pAllocateArray->NumChannels;
+  size_t formatSize = CUarray_format_to_size_t(pAllocateArray->Format);
+  return cuMemAlloc_failhook((CUdeviceptr *)pHandle, totalMemoryNumber * formatSize);
+}
+
 CUresult cuArray3DCreate_prehook(CUarray *pHandle, const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray) {
   size_t totalMemoryNumber = pAllocateArray->Width * pAllocateArray->Height *
                              pAllocateArray->Depth * pAllocateArray->NumChannels;
@@ -716,6 +919,13 @@ CUresult cuArray3DCreate_posthook(CUarray *pHandle, const CUDA_ARRAY3D_DESCRIPTO
   return cuMemAlloc_posthook((CUdeviceptr *)pHandle, totalMemoryNumber * formatSize);
 }
 
+CUresult cuArray3DCreate_failhook(CUarray *pHandle, const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray) {
+  size_t totalMemoryNumber = pAllocateArray->Width * pAllocateArray->Height *
+                             pAllocateArray->Depth * pAllocateArray->NumChannels;
+  size_t formatSize = CUarray_format_to_size_t(pAllocateArray->Format);
+  return cuMemAlloc_failhook((CUdeviceptr *)pHandle, totalMemoryNumber * formatSize);
+}
+
 CUresult cuMipmappedArrayCreate_prehook(CUmipmappedArray *pHandle,
                                         const CUDA_ARRAY3D_DESCRIPTOR *pMipmappedArrayDesc,
                                         unsigned int numMipmapLevels) {
@@ -730,6 +940,179 @@ CUresult cuMipmappedArrayCreate_posthook(CUmipmappedArray *pHandle,
   return CUDA_SUCCESS;
 }
 
+// synchronous calls are ordered after every launch, held back or not
+CUresult cuCtxSynchronize_prehook(void) {
+  return collect_deferred_launches(nullptr);
+}
+
+CUresult cuMemcpyAtoH_prehook(void *dstHost, CUarray srcArray, size_t srcOffset,
+                              size_t ByteCount) {
+  return collect_deferred_launches(nullptr);
+}
+
+CUresult cuMemcpyDtoH_prehook(void *dstHost, CUdeviceptr srcDevice, size_t ByteCount) {
+  return collect_deferred_launches(nullptr);
+}
+
+CUresult cuMemcpyHtoA_prehook(CUarray dstArray, size_t dstOffset, const void *srcHost,
+                              size_t ByteCount) {
+  return collect_deferred_launches(nullptr);
+}
+
+CUresult cuMemcpyHtoD_prehook(CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount) {
+  return collect_deferred_launches(nullptr);
+}
+
+// stream work is ordered after the launches held back on its stream
+CUresult cuStreamSynchronize_prehook(CUstream hStream) {
+  return collect_deferred_launches(hStream);
+}
+
+CUresult cuStreamQuery_prehook(CUstream hStream) {
+  if (!launch_queue.enabled() || internal_cuda_call) return CUDA_SUCCESS;
+  if (launch_queue.pending(hStream)) return CUDA_ERROR_NOT_READY;
+  return launch_queue.take_error(hStream);
+}
+
+CUresult cuEventRecord_prehook(CUevent hEvent, CUstream hStream) {
+  return collect_deferred_launches(hStream);
+}
+
+CUresult cuMemcpyHtoDAsync_prehook(CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount,
+                                   CUstream hStream) {
+  return collect_deferred_launches(hStream);
+}
+
+CUresult cuMemcpyDtoHAsync_prehook(void *dstHost, CUdeviceptr srcDevice, size_t ByteCount,
+                                   CUstream hStream) {
+  return collect_deferred_launches(hStream);
+}
+
+// launches held back on a stream are issued before it is destroyed, and waited for at the end of
+// the token through an event recorded on it
+CUresult cuStreamDestroy_prehook(CUstream hStream) {
+  // a failure not reported yet goes with the stream, the handle may be reused
+  collect_deferred_launches(hStream);
+  overuse_tracker.stream_destroyed((cudaStream_t)hStream);
+  return CUDA_SUCCESS;
+}
+
+// launches held back are issued before the context is destroyed, their failures go with it
+CUresult cuCtxDestroy_prehook(CUcontext ctx) {
+  wait_deferred_launches(nullptr);
+  if (launch_queue.enabled()) launch_queue.discard_errors(ctx);
+  return CUDA_SUCCESS;
+}
+
+/**
+ * Calls whose only hook is to come after the launches held back: synchronous calls and those on
+ * the default streams after every launch, those on other streams after the launches on theirs.
+ * A call fails with the first of those launches that failed and was not reported yet.
+ * Y(id, symbol, stream, params, args...)
+ *   stream  the stream the call is ordered on, nullptr if synchronous
+ */
+#define CU_HOOK_ORDERED_CALLS(Y)                                                                   \
+  Y(CU_HOOK_MEMCPY, cuMemcpy, nullptr,                                                             \
+    (CUdeviceptr dst, CUdeviceptr src, size_t ByteCount), dst, src, ByteCount)                     \
+  Y(CU_HOOK_MEMCPY_PEER, cuMemcpyPeer, nullptr,                                                    \
+    (CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice, CUcontext srcContext,     \
+     size_t ByteCount), dstDevice, dstContext, srcDevice, srcContext, ByteCount)                   \
+  Y(CU_HOOK_MEMCPY_DTOD, cuMemcpyDtoD, nullptr,                                                    \
+    (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount), dstDevice, srcDevice,        \
+    ByteCount)                                                                                     \
+  Y(CU_HOOK_MEMCPY_DTOA, cuMemcpyDtoA, nullptr,                                                    \
+    (CUarray dstArray, size_t dstOffset, CUdeviceptr srcDevice, size_t ByteCount), dstArray,       \
+    dstOffset, srcDevice, ByteCount)                                                               \
+  Y(CU_HOOK_MEMCPY_ATOD, cuMemcpyAtoD, nullptr,                                                    \
+    (CUdeviceptr dstDevice, CUarray srcArray, size_t srcOffset, size_t ByteCount), dstDevice,      \
+    srcArray, srcOffset, ByteCount)                                                                \
+  Y(CU_HOOK_MEMCPY_ATOA, cuMemcpyAtoA, nullptr,                                                    \
+    (CUarray dstArray, size_t dstOffset, CUarray srcArray, size_t srcOffset, size_t ByteCount),    \
+    dstArray, dstOffset, srcArray, srcOffset, ByteCount)                                           \
+  Y(CU_HOOK_MEMCPY_2D, cuMemcpy2D, nullptr, (const CUDA_MEMCPY2D *pCopy), pCopy)                   \
+  Y(CU_HOOK_MEMCPY_2D_UNALIGNED, cuMemcpy2DUnaligned, nullptr,                                     \
+    (const CUDA_MEMCPY2D *pCopy), pCopy)                                                           \
+  Y(CU_HOOK_MEMCPY_3D, cuMemcpy3D, nullptr, (const CUDA_MEMCPY3D *pCopy), pCopy)                   \
+  Y(CU_HOOK_MEMCPY_3D_PEER, cuMemcpy3DPeer, nullptr, (const CUDA_MEMCPY3D_PEER *pCopy), pCopy)     \
+  Y(CU_HOOK_MEMSET_D8, cuMemsetD8, nullptr,                                                        \
+    (CUdeviceptr dstDevice, unsigned char uc, size_t N), dstDevice, uc, N)                         \
+  Y(CU_HOOK_MEMSET_D16, cuMemsetD16, nullptr,                                                      \
+    (CUdeviceptr dstDevice, unsigned short us, size_t N), dstDevice, us, N)                        \
+  Y(CU_HOOK_MEMSET_D32, cuMemsetD32, nullptr,                                                      \
+    (CUdeviceptr dstDevice, unsigned int ui, size_t N), dstDevice, ui, N)                          \
+  Y(CU_HOOK_MEMSET_D2D8, cuMemsetD2D8, nullptr,                                                    \
+    (CUdeviceptr dstDevice, size_t dstPitch, unsigned char uc, size_t Width, size_t Height),       \
+    dstDevice, dstPitch, uc, Width, Height)                                                        \
+  Y(CU_HOOK_MEMSET_D2D16, cuMemsetD2D16, nullptr,                                                  \
+    (CUdeviceptr dstDevice, size_t dstPitch, unsigned short us, size_t Width, size_t Height),      \
+    dstDevice, dstPitch, us, Width, Height)                                                        \
+  Y(CU_HOOK_MEMSET_D2D32, cuMemsetD2D32, nullptr,                                                  \
+    (CUdeviceptr dstDevice, size_t dstPitch, unsigned int ui, size_t Width, size_t Height),        \
+    dstDevice, dstPitch, ui, Width, Height)                                                        \
+  Y(CU_HOOK_MEMCPY_ASYNC, cuMemcpyAsync, hStream,                                                  \
+    (CUdeviceptr dst, CUdeviceptr src, size_t ByteCount, CUstream hStream), dst, src, ByteCount,   \
+    hStream)                                                                                       \
+  Y(CU_HOOK_MEMCPY_PEER_ASYNC, cuMemcpyPeerAsync, hStream,                                         \
+    (CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice, CUcontext srcContext,     \
+     size_t ByteCount, CUstream hStream), dstDevice, dstContext, srcDevice, srcContext, ByteCount, \
+    hStream)                                                                                       \
+  Y(CU_HOOK_MEMCPY_DTOD_ASYNC, cuMemcpyDtoDAsync, hStream,                                         \
+    (CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount, CUstream hStream),            \
+    dstDevice, srcDevice, ByteCount, hStream)                                                      \
+  Y(CU_HOOK_MEMCPY_HTOA_ASYNC, cuMemcpyHtoAAsync, hStream,                                         \
+    (CUarray dstArray, size_t dstOffset, const void *srcHost, size_t ByteCount,                    \
+     CUstream hStream),                                                                            \
+    dstArray, dstOffset, srcHost, ByteCount, hStream)                                              \
+  Y(CU_HOOK_MEMCPY_ATOH_ASYNC, cuMemcpyAtoHAsync, hStream,                                         \
+    (void *dstHost, CUarray srcArray, size_t srcOffset, size_t ByteCount, CUstream hStream),       \
+    dstHost, srcArray, srcOffset, ByteCount, hStream)                                              \
+  Y(CU_HOOK_MEMCPY_2D_ASYNC, cuMemcpy2DAsync, hStream,                                             \
+    (const CUDA_MEMCPY2D *pCopy, CUstream hStream), pCopy, hStream)                                \
+  Y(CU_HOOK_MEMCPY_3D_ASYNC, cuMemcpy3DAsync, hStream,                                             \
+    (const CUDA_MEMCPY3D *pCopy, CUstream hStream), pCopy, hStream)                                \
+  Y(CU_HOOK_MEMCPY_3D_PEER_ASYNC, cuMemcpy3DPeerAsync, hStream,                                    \
+    (const CUDA_MEMCPY3D_PEER *pCopy, CUstream hStream), pCopy, hStream)                           \
+  Y(CU_HOOK_MEMSET_D8_ASYNC, cuMemsetD8Async, hStream,                                             \
+    (CUdeviceptr dstDevice, unsigned char uc, size_t N, CUstream hStream), dstDevice, uc, N,       \
+    hStream)                                                                                       \
+  Y(CU_HOOK_MEMSET_D16_ASYNC, cuMemsetD16Async, hStream,                                           \
+    (CUdeviceptr dstDevice, unsigned short us, size_t N, CUstream hStream), dstDevice, us, N,      \
+    hStream)                                                                                       \
+  Y(CU_HOOK_MEMSET_D32_ASYNC, cuMemsetD32Async, hStream,                                           \
+    (CUdeviceptr dstDevice, unsigned int ui, size_t N, CUstream hStream), dstDevice, ui, N,        \
+    hStream)                                                                                       \
+  Y(CU_HOOK_MEMSET_D2D8_ASYNC, cuMemsetD2D8Async, hStream,                                         \
+    (CUdeviceptr dstDevice, size_t dstPitch, unsigned char uc, size_t Width, size_t Height,        \
+     CUstream hStream), dstDevice, dstPitch, uc, Width, Height, hStream)                           \
+  Y(CU_HOOK_MEMSET_D2D16_ASYNC, cuMemsetD2D16Async, hStream,                                       \
+    (CUdeviceptr dstDevice, size_t dstPitch, unsigned short us, size_t Width, size_t Height,       \
+     CUstream hStream), dstDevice, dstPitch, us, Width, Height, hStream)                           \
+  Y(CU_HOOK_MEMSET_D2D32_ASYNC, cuMemsetD2D32Async, hStream,                                       \
+    (CUdeviceptr dstDevice, size_t dstPitch, unsigned int ui, size_t Width, size_t Height,         \
+     CUstream hStream), dstDevice, dstPitch, ui, Width, Height, hStream)                           \
+  Y(CU_HOOK_MEM_PREFETCH_ASYNC, cuMemPrefetchAsync, hStream,                                       \
+    (CUdeviceptr devPtr, size_t count, CUdevice dstDevice, CUstream hStream), devPtr, count,       \
+    dstDevice, hStream)                                                                            \
+  Y(CU_HOOK_MEM_FREE_ASYNC, cuMemFreeAsync, hStream,                                               \
+    (CUdeviceptr dptr, CUstream hStream), dptr, hStream)                                           \
+  Y(CU_HOOK_STREAM_WAIT_EVENT, cuStreamWaitEvent, hStream,                                         \
+    (CUstream hStream, CUevent hEvent, unsigned int Flags), hStream, hEvent, Flags)                \
+  Y(CU_HOOK_STREAM_ADD_CALLBACK, cuStreamAddCallback, hStream,                                     \
+    (CUstream hStream, CUstreamCallback callback, void *userData, unsigned int flags), hStream,    \
+    callback, userData, flags)                                                                     \
+  Y(CU_HOOK_LAUNCH_HOST_FUNC, cuLaunchHostFunc, hStream,                                           \
+    (CUstream hStream, CUhostFn fn, void *userData), hStream, fn, userData)                        \
+  Y(CU_HOOK_STREAM_BEGIN_CAPTURE, cuStreamBeginCapture, hStream,                                   \
+    (CUstream hStream, CUstreamCaptureMode mode), hStream, mode)                                   \
+  Y(CU_HOOK_STREAM_END_CAPTURE, cuStreamEndCapture, hStream,                                       \
+    (CUstream hStream, CUgraph *phGraph), hStream, phGraph)                                        \
+  Y(CU_HOOK_GRAPH_LAUNCH, cuGraphLaunch, hStream,                                                  \
+    (CUgraphExec hGraphExec, CUstream hStream), hGraphExec, hStream)
+
+#define CU_HOOK_ORDERED_PREHOOK(id, symbol, stream, params, ...) \
+  CUresult symbol##_prehook params { return collect_deferred_launches(stream); }
+CU_HOOK_ORDERED_CALLS(CU_HOOK_ORDERED_PREHOOK)
+
 CUresult cuCtxSynchronize_posthook(void) {
   host_sync_call("cuCtxSynchronize");
   return CUDA_SUCCESS;
@@ -774,25 +1157,73 @@ void checkMemLocation( CUdeviceptr ptr){
 //sigint stop the program, so we advise the ptr to the host
 void sigintHandler( int signum ) {
   DEBUG(log_name, __FILE__, (long)__LINE__, "Interrupt signal ( %d ) received. STOP the program.\n", signum);
-  for(auto devptrInfo:devptrs_mngr){
-    cuMemPrefetchAsync(std::get<0>(devptrInfo), std::get<1>(devptrInfo), CU_DEVICE_CPU, 0);
+  for (const allocation_t &alloc : allocations) {
+    if (alloc.managed) cuMemPrefetchAsync(alloc.ptr, alloc.size, CU_DEVICE_CPU, 0);
   }
   cudaDeviceSynchronize();
 }
 void sigcontHandler( int signum ) {
   DEBUG(log_name, __FILE__, (long)__LINE__, "Interrupt signal ( %d ) received. CONTINUE the program.\n", signum);
-  for(auto devptrInfo:devptrs_mngr){
-    cuMemPrefetchAsync(std::get<0>(devptrInfo), std::get<1>(devptrInfo), std::get<2>(devptrInfo), 0);
+  for (const allocation_t &alloc : allocations) {
+    if (alloc.managed) cuMemPrefetchAsync(alloc.ptr, alloc.size, alloc.device, 0);
   }
   cudaDeviceSynchronize();
 }
+// Driver entry point each intercepted call forwards to, resolved once instead of per call.
+// libcuda is loaded by the time the first CUDA call is intercepted, so RTLD_NEXT finds it unless
+// it was opened privately; fall back to our own handle then.
+static void resolve_actual_functions() {
+  struct {
+    HookSymbols hook;
+    const char *name;
+  } actual[] = {
+      // device memory is allocated as managed memory, so that it can be moved to host on SIGINT
+      {CU_HOOK_MEM_ALLOC, "cuMemAllocManaged"},
+      {CU_HOOK_MEM_ALLOC_MANAGED, "cuMemAllocManaged"},
+      {CU_HOOK_MEM_ALLOC_PITCH, CUDA_SYMBOL_STRING(cuMemAllocPitch)},
+      {CU_HOOK_MEM_FREE, CUDA_SYMBOL_STRING(cuMemFree)},
+      {CU_HOOK_ARRAY_CREATE, CUDA_SYMBOL_STRING(cuArrayCreate)},
+      {CU_HOOK_ARRAY3D_CREATE, CUDA_SYMBOL_STRING(cuArray3DCreate)},
+      {CU_HOOK_MIPMAPPED_ARRAY_CREATE, CUDA_SYMBOL_STRING(cuMipmappedArrayCreate)},
+      {CU_HOOK_ARRAY_DESTROY, CUDA_SYMBOL_STRING(cuArrayDestroy)},
+      {CU_HOOK_MIPMAPPED_ARRAY_DESTROY, CUDA_SYMBOL_STRING(cuMipmappedArrayDestroy)},
+      {CU_HOOK_LAUNCH_KERNEL, CUDA_SYMBOL_STRING(cuLaunchKernel)},
+      {CU_HOOK_LAUNCH_COOPERATIVE_KERNEL, CUDA_SYMBOL_STRING(cuLaunchCooperativeKernel)},
+      {CU_HOOK_CTX_SYNC, CUDA_SYMBOL_STRING(cuCtxSynchronize)},
+      {CU_HOOK_MEMCPY_ATOH, CUDA_SYMBOL_STRING(cuMemcpyAtoH)},
+      {CU_HOOK_MEMCPY_DTOH, CUDA_SYMBOL_STRING(cuMemcpyDtoH)},
+      {CU_HOOK_MEMCPY_HTOA, CUDA_SYMBOL_STRING(cuMemcpyHtoA)},
+      {CU_HOOK_MEMCPY_HTOD, CUDA_SYMBOL_STRING(cuMemcpyHtoD)},
+      {CU_HOOK_MEMCPY_HTOD_ASYNC, CUDA_SYMBOL_STRING(cuMemcpyHtoDAsync)},
+      {CU_HOOK_MEMCPY_DTOH_ASYNC, CUDA_SYMBOL_STRING(cuMemcpyDtoHAsync)},
+      {CU_HOOK_STREAM_SYNC, CUDA_SYMBOL_STRING(cuStreamSynchronize)},
+      {CU_HOOK_STREAM_QUERY, CUDA_SYMBOL_STRING(cuStreamQuery)},
+      {CU_HOOK_EVENT_RECORD, CUDA_SYMBOL_STRING(cuEventRecord)},
+      {CU_HOOK_STREAM_DESTROY, CUDA_SYMBOL_STRING(cuStreamDestroy)},
+      {CU_HOOK_CTX_DESTROY, CUDA_SYMBOL_STRING(cuCtxDestroy)},
+#define CU_HOOK_ORDERED_ACTUAL(id, symbol, ...) {id, CUDA_SYMBOL_STRING(symbol)},
+      CU_HOOK_ORDERED_CALLS(CU_HOOK_ORDERED_ACTUAL)
+#undef CU_HOOK_ORDERED_ACTUAL
+  };
+  for (auto &entry : actual) {
+    void *func = real_dlsym(RTLD_NEXT, entry.name);
+    if (func == nullptr) func = real_dlsym(libcudaHandle, entry.name);
+    if (func == nullptr) hERROR(log_name, __FILE__, (long)__LINE__, "cannot resolve %s", entry.name);
+    hook_inf.func_actual[entry.hook] = func;
+  }
+}
+
 void initialize() {
+  resolve_actual_functions();
+
   // place post-hooks
   hook_inf.postHooks[CU_HOOK_MEMCPY_ATOH] = (void *)cuMemcpyAtoH_posthook;
   hook_inf.postHooks[CU_HOOK_MEMCPY_DTOH] = (void *)cuMemcpyDtoH_posthook;
   hook_inf.postHooks[CU_HOOK_MEMCPY_HTOA] = (void *)cuMemcpyHtoA_posthook;
   hook_inf.postHooks[CU_HOOK_MEMCPY_HTOD] = (void *)cuMemcpyHtoD_posthook;
   hook_inf.postHooks[CU_HOOK_CTX_SYNC] = (void *)cuCtxSynchronize_posthook;
+  hook_inf.postHooks[CU_HOOK_LAUNCH_KERNEL] = (void *)cuLaunchKernel_posthook;
+  hook_inf.postHooks[CU_HOOK_LAUNCH_COOPERATIVE_KERNEL] = (void *)cuLaunchCooperativeKernel_posthook;
 
   hook_inf.postHooks[CU_HOOK_MEM_ALLOC] = (void *)cuMemAlloc_posthook;
   hook_inf.postHooks[CU_HOOK_MEM_ALLOC_MANAGED] = (void *)cuMemAllocManaged_posthook;
@@ -800,6 +1231,13 @@ void initialize() {
   hook_inf.postHooks[CU_HOOK_ARRAY_CREATE] = (void *)cuArrayCreate_posthook;
   hook_inf.postHooks[CU_HOOK_ARRAY3D_CREATE] = (void *)cuArray3DCreate_posthook;
   hook_inf.postHooks[CU_HOOK_MIPMAPPED_ARRAY_CREATE] = (void *)cuMipmappedArrayCreate_posthook;
+
+  // give back what the prehooks charged when the driver fails to allocate
+  hook_inf.failHooks[CU_HOOK_MEM_ALLOC] = (void *)cuMemAlloc_failhook;
+  hook_inf.failHooks[CU_HOOK_MEM_ALLOC_MANAGED] = (void *)cuMemAllocManaged_failhook;
+  hook_inf.failHooks[CU_HOOK_MEM_ALLOC_PITCH] = (void *)cuMemAllocPitch_failhook;
+  hook_inf.failHooks[CU_HOOK_ARRAY_CREATE] = (void *)cuArrayCreate_failhook;
+  hook_inf.failHooks[CU_HOOK_ARRAY3D_CREATE] = (void *)cuArray3DCreate_failhook;
   // place pre-hooks
   hook_inf.preHooks[CU_HOOK_MEM_FREE] = (void *)cuMemFree_prehook;
   hook_inf.preHooks[CU_HOOK_ARRAY_DESTROY] = (void *)cuArrayDestroy_prehook;
@@ -813,11 +1251,53 @@ void initialize() {
   hook_inf.preHooks[CU_HOOK_ARRAY_CREATE] = (void *)cuArrayCreate_prehook;
   hook_inf.preHooks[CU_HOOK_ARRAY3D_CREATE] = (void *)cuArray3DCreate_prehook;
   hook_inf.preHooks[CU_HOOK_MIPMAPPED_ARRAY_CREATE] = (void *)cuMipmappedArrayCreate_prehook;
+  // order synchronization and stream work after launches held back
+  hook_inf.preHooks[CU_HOOK_CTX_SYNC] = (void *)cuCtxSynchronize_prehook;
+  hook_inf.preHooks[CU_HOOK_MEMCPY_ATOH] = (void *)cuMemcpyAtoH_prehook;
+  hook_inf.preHooks[CU_HOOK_MEMCPY_DTOH] = (void *)cuMemcpyDtoH_prehook;
+  hook_inf.preHooks[CU_HOOK_MEMCPY_HTOA] = (void *)cuMemcpyHtoA_prehook;
+  hook_inf.preHooks[CU_HOOK_MEMCPY_HTOD] = (void *)cuMemcpyHtoD_prehook;
+  hook_inf.preHooks[CU_HOOK_MEMCPY_HTOD_ASYNC] = (void *)cuMemcpyHtoDAsync_prehook;
+  hook_inf.preHooks[CU_HOOK_MEMCPY_DTOH_ASYNC] = (void *)cuMemcpyDtoHAsync_prehook;
+  hook_inf.preHooks[CU_HOOK_STREAM_SYNC] = (void *)cuStreamSynchronize_prehook;
+  hook_inf.preHooks[CU_HOOK_STREAM_QUERY] = (void *)cuStreamQuery_prehook;
+  hook_inf.preHooks[CU_HOOK_EVENT_RECORD] = (void *)cuEventRecord_prehook;
+  hook_inf.preHooks[CU_HOOK_STREAM_DESTROY] = (void *)cuStreamDestroy_prehook;
+  hook_inf.preHooks[CU_HOOK_CTX_DESTROY] = (void *)cuCtxDestroy_prehook;
+#define CU_HOOK_ORDERED_REGISTER(id, symbol, ...) hook_inf.preHooks[id] = (void *)symbol##_prehook;
+  CU_HOOK_ORDERED_CALLS(CU_HOOK_ORDERED_REGISTER)
+#undef CU_HOOK_ORDERED_REGISTER
   //save_port_number();
   configure_connection();
-  pthread_mutex_lock(&request_time_mutex);
-  cudaEventCreate(&cuevent_start);
+  char *lease_chunk = getenv("GPU_MEM_LEASE_CHUNK");
+  if (lease_chunk != NULL) mem_lease_chunk = strtoull(lease_chunk, NULL, 10);
+  char *defer_launches = getenv("CU_HOOK_DEFER_LAUNCHES");
+  if (defer_launches != NULL) launch_queue.set_capacity(strtoull(defer_launches, NULL, 10));
+
+  // opt-in launch trace, one ring file per process
+  char *trace_prefix = getenv("CU_HOOK_TRACE");
+  if (trace_prefix != NULL) {
+    char *trace_records = getenv("CU_HOOK_TRACE_RECORDS");
+    uint64_t capacity = trace_records != NULL ? strtoull(trace_records, NULL, 10) : 1 << 18;
+    char trace_path[PATH_MAX];
+    snprintf(trace_path, PATH_MAX, "%s.%d", trace_prefix, getpid());
+    if (launch_trace_open(trace_path, capacity) != 0)
+      hWARNING(log_name, __FILE__, (long)__LINE__, "cannot open launch trace %s: %s", trace_path,
+               strerror(errno));
+  }
 
+  // renew quota through shared memory if Pod manager provides a token channel
+  char *token_channel_name = getenv("POD_MANAGER_SHM");
+  if (token_channel_name != NULL) {
+    token_channel = token_channel_open(token_channel_name);
+    if (token_channel != nullptr) token_slot = token_channel_join(token_channel);
+    if (token_slot == -1) {
+      hWARNING(log_name, __FILE__, (long)__LINE__, "token channel %s unavailable, use socket instead",
+               token_channel_name);
+      token_channel = nullptr;
+    }
+  }
+  pthread_mutex_lock(&request_time_mutex);
   // initialize overuse_trk_intr_cond with CLOCK_MONOTONIC
   pthread_condattr_t attr_monotonic_clock;
   pthread_condattr_init(&attr_monotonic_clock);
@@ -828,8 +1308,17 @@ void initialize() {
   pthread_t overuse_trk_tid;
   pthread_create(&overuse_trk_tid, NULL, wait_cuda_kernels, NULL);
 
+  // a thread issuing the launches held back
+  if (launch_queue.enabled()) {
+    pthread_t dispatch_tid;
+    pthread_create(&dispatch_tid, NULL, dispatch_deferred_launches, NULL);
+  }
+
+  // share of this process in the Pod quota
+  char *weight = getenv("CU_HOOK_WEIGHT");
+  register_process(weight != NULL ? strtod(weight, NULL) : 1.0);
+
   // first token request
-  overuse_trk_cmpl = true;  // bypass first overuse tracking to prevent deadlock
   get_token_from_scheduler(0.0);
   clock_gettime(CLOCK_MONOTONIC, &request_start);
 
@@ -839,6 +1328,13 @@ void initialize() {
    DEBUG(log_name, __FILE__, (long)__LINE__, "Signal Registing ...");
    signal(SIGINT, sigintHandler);  
    signal(SIGCONT, sigcontHandler);  
+   init_finished.store(true, std::memory_order_release);
+}
+
+// run initialize() once; after that only a load and a well-predicted branch
+static inline void ensure_initialized() {
+  if (__builtin_expect(!init_finished.load(std::memory_order_acquire), 0))
+    pthread_once(&init_done, initialize);
 }
 
 CUstream hStream;  // redundent variable used for macro expansion
@@ -854,44 +1350,44 @@ CUstream hStream;  // redundent variable used for macro expansion
 #define CU_HOOK_GENERATE_INTERCEPT(hook_name, hooksymbol, funcname, params, ...)                     \
   CUresult CUDAAPI hook_name params {                                                      \
     if (hook_inf.debug_mode) hDEBUG(log_name, __FILE__, (long)__LINE__, "hooked function: " CUDA_SYMBOL_STRING(hooksymbol));   \
-    pthread_once(&init_done, initialize);                                                 \
-                                                                                          \
-    static void *real_func;                                                               \
-    real_func = (void *)real_dlsym(RTLD_NEXT, CUDA_SYMBOL_STRING(funcname));              \
+    ensure_initialized();                                                                 \
+    void *real_func = hook_inf.func_actual[hooksymbol];                                   \
     CUresult result = CUDA_SUCCESS;                                                       \
                                                                                           \
     if (hook_inf.debug_mode) hook_inf.call_count[hooksymbol]++;                           \
                                                                                           \
     if (hook_inf.preHooks[hooksymbol])                                                    \
       result = ((CUresult CUDAAPI(*) params)hook_inf.preHooks[hooksymbol])(__VA_ARGS__);  \
-    if (result != CUDA_SUCCESS) return (result);                                          \
+    if (result != CUDA_SUCCESS) return (result == CU_HOOK_HANDLED ? CUDA_SUCCESS : result); \
                                                                                           \
     result = ((CUresult CUDAAPI(*) params)real_func)(__VA_ARGS__);                        \
                                                                                           \
     if (hook_inf.postHooks[hooksymbol] && result == CUDA_SUCCESS)                         \
       result = ((CUresult CUDAAPI(*) params)hook_inf.postHooks[hooksymbol])(__VA_ARGS__); \
+    else if (hook_inf.failHooks[hooksymbol] && result != CUDA_SUCCESS)                    \
+      ((CUresult CUDAAPI(*) params)hook_inf.failHooks[hooksymbol])(__VA_ARGS__);          \
                                                                                           \
     return (result);                                                                      \
   }                                                                                       
 #define CU_HOOK_GENERATE_INTERCEPT_managed(hook_name, hooksymbol, funcname, oldparams, params, ...)                     \
   CUresult CUDAAPI hook_name oldparams {                                                      \
     if (hook_inf.debug_mode) hDEBUG(log_name, __FILE__, (long)__LINE__, "hooked function: " CUDA_SYMBOL_STRING(hooksymbol));   \
-    pthread_once(&init_done, initialize);                                                 \
-                                                                                          \
-    static void *real_func;                                                               \
-    real_func = (void *)real_dlsym(RTLD_NEXT, "cuMemAllocManaged");          \
+    ensure_initialized();                                                                 \
+    void *real_func = hook_inf.func_actual[hooksymbol];                                   \
     CUresult result = CUDA_SUCCESS;                                                       \
                                                                                           \
     if (hook_inf.debug_mode) hook_inf.call_count[hooksymbol]++;                           \
                                                                                           \
     if (hook_inf.preHooks[hooksymbol])                                                    \
       result = ((CUresult CUDAAPI(*) params)hook_inf.preHooks[hooksymbol])(__VA_ARGS__);  \
-    if (result != CUDA_SUCCESS) return (result);                                          \
+    if (result != CUDA_SUCCESS) return (result == CU_HOOK_HANDLED ? CUDA_SUCCESS : result); \
                                                                                           \
     result = ((CUresult CUDAAPI(*) params)real_func)(__VA_ARGS__);                        \
                                                                                           \
     if (hook_inf.postHooks[hooksymbol] && result == CUDA_SUCCESS)                         \
       result = ((CUresult CUDAAPI(*) params)hook_inf.postHooks[hooksymbol])(__VA_ARGS__); \
+    else if (hook_inf.failHooks[hooksymbol] && result != CUDA_SUCCESS)                    \
+      ((CUresult CUDAAPI(*) params)hook_inf.failHooks[hooksymbol])(__VA_ARGS__);          \
                                                                                           \
     return (result);                                                                      \
   }
@@ -909,6 +1405,31 @@ CU_HOOK_GENERATE_INTERCEPT(hook_cuMemcpyHtoD, CU_HOOK_MEMCPY_HTOD, cuMemcpyHtoD,
                            (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount),
                            dstDevice, srcHost, ByteCount)
 CU_HOOK_GENERATE_INTERCEPT(hook_cuCtxSynchronize, CU_HOOK_CTX_SYNC, cuCtxSynchronize, (void))
+CU_HOOK_GENERATE_INTERCEPT(hook_cuMemcpyHtoDAsync, CU_HOOK_MEMCPY_HTOD_ASYNC, cuMemcpyHtoDAsync,
+                           (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount,
+                            CUstream hStream),
+                           dstDevice, srcHost, ByteCount, hStream)
+CU_HOOK_GENERATE_INTERCEPT(hook_cuMemcpyDtoHAsync, CU_HOOK_MEMCPY_DTOH_ASYNC, cuMemcpyDtoHAsync,
+                           (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount,
+                            CUstream hStream),
+                           dstHost, srcDevice, ByteCount, hStream)
+
+// cuda driver stream/event APIs
+CU_HOOK_GENERATE_INTERCEPT(hook_cuStreamSynchronize, CU_HOOK_STREAM_SYNC, cuStreamSynchronize,
+                           (CUstream hStream), hStream)
+CU_HOOK_GENERATE_INTERCEPT(hook_cuStreamQuery, CU_HOOK_STREAM_QUERY, cuStreamQuery,
+                           (CUstream hStream), hStream)
+CU_HOOK_GENERATE_INTERCEPT(hook_cuEventRecord, CU_HOOK_EVENT_RECORD, cuEventRecord,
+                           (CUevent hEvent, CUstream hStream), hEvent, hStream)
+CU_HOOK_GENERATE_INTERCEPT(hook_cuStreamDestroy, CU_HOOK_STREAM_DESTROY, cuStreamDestroy,
+                           (CUstream hStream), hStream)
+CU_HOOK_GENERATE_INTERCEPT(hook_cuCtxDestroy, CU_HOOK_CTX_DESTROY, cuCtxDestroy, (CUcontext ctx),
+                           ctx)
+
+#define CU_HOOK_ORDERED_INTERCEPT(id, symbol, stream, params, ...) \
+  CU_HOOK_GENERATE_INTERCEPT(hook_##symbol, id, symbol, params, __VA_ARGS__)
+CU_HOOK_ORDERED_CALLS(CU_HOOK_ORDERED_INTERCEPT)
+#undef CU_HOOK_ORDERED_INTERCEPT
 
 // cuda driver alloc/free APIs
 CU_HOOK_GENERATE_INTERCEPT_managed(hook_cuMemAlloc, CU_HOOK_MEM_ALLOC_MANAGED, cuMemAlloc, (CUdeviceptr * dptr, size_t bytesize),
@@ -957,7 +1478,7 @@ CU_HOOK_GENERATE_INTERCEPT(hook_cuLaunchCooperativeKernel, CU_HOOK_LAUNCH_COOPER
 
 // cuda driver mem info APIs
 CUresult CUDAAPI cuDeviceTotalMem(size_t *bytes, CUdevice dev) {
-  pthread_once(&init_done, initialize);
+  ensure_initialized();
   auto mem_info = get_gpu_memory_info();
   if (hook_inf.debug_mode) hook_inf.call_count[CU_HOOK_DEVICE_TOTOAL_MEM]++;
   *bytes = mem_info.second;
@@ -965,7 +1486,7 @@ CUresult CUDAAPI cuDeviceTotalMem(size_t *bytes, CUdevice dev) {
 }
 
 CUresult CUDAAPI cuMemGetInfo(size_t *gpu_mem_free, size_t *gpu_mem_total) {
-  pthread_once(&init_done, initialize);
+  ensure_initialized();
   auto mem_info = get_gpu_memory_info();
   if (hook_inf.debug_mode) hook_inf.call_count[CU_HOOK_MEM_INFO]++;
   *gpu_mem_free = mem_info.first;
@@ -974,133 +1495,158 @@ CUresult CUDAAPI cuMemGetInfo(size_t *gpu_mem_free, size_t *gpu_mem_total) {
 }
 
 
-CUresult CUDAAPI cuGetProcAddress(const char *symbol, void **pfn, int cudaVersion, cuuint64_t flags) {
+/*
+ ** symbol tables of dlsym() and cuGetProcAddress(), generated from CU_HOOK_SYMBOLS
+ */
+const int SYMBOL_TABLE_SIZE = 1024;  // power of 2, sparse enough for a perfect seed to come soon
 
-    typedef decltype(&cuGetProcAddress) funcType;
-    funcType actualFunc;
-    if(!hook_inf.func_actual[CU_HOOK_GET_PROC_ADDRESS])
-        actualFunc = (funcType)real_dlsym(libcudaHandle, CUDA_SYMBOL_STRING(cuGetProcAddress));
-    else
-        actualFunc = (funcType)hook_inf.func_actual[CU_HOOK_GET_PROC_ADDRESS];
-    CUresult result = actualFunc(symbol, pfn, cudaVersion, flags);
-
-    if(strcmp(symbol, CUDA_SYMBOL_STRING(cuGetProcAddress)) == 0) {
-        hook_inf.func_actual[CU_HOOK_GET_PROC_ADDRESS] = *pfn;
-        *pfn = (void*)(&cuGetProcAddress);
-
-#pragma push_macro("cuMemAlloc")
-#undef cuMemAlloc
-    } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemAlloc)) == 0) {
-#pragma pop_macro("cuMemAlloc")
-        hook_inf.func_actual[CU_HOOK_MEM_ALLOC] = *pfn;
-        *pfn = (void *)(&hook_cuMemAlloc);
-#pragma push_macro("cuMemAllocManaged")
-#undef cuMemAllocManaged
-    } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemAllocManaged)) == 0) {
-#pragma pop_macro("cuMemAllocManaged")
-        *pfn = (void *)(&hook_cuMemAllocManaged);
-#pragma push_macro("cuMemAllocPitch")
-#undef cuMemAllocPitch
-    } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemAllocPitch)) == 0) {
-#pragma pop_macro("cuMemAllocPitch")
-        *pfn = (void *)(&hook_cuMemAllocPitch);
-#pragma push_macro("cuMemFree")
-#undef cuMemFree
-    } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemFree)) == 0) {
-#pragma pop_macro("cuMemFree")
-        *pfn = (void *)(&hook_cuMemFree);
-#pragma push_macro("cuCtxSynchronize")
-#undef cuCtxSynchronize
-    } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuCtxSynchronize)) == 0) {
-#pragma pop_macro("cuCtxSynchronize")
-        *pfn = (void *)(&hook_cuCtxSynchronize);
-#pragma push_macro("cuMemcpyHtoD")
-#undef cuMemcpyHtoD
-    } else if (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyHtoD)) == 0) {
-#pragma pop_macro("cuMemcpyHtoD")
-        *pfn = (void *)(&hook_cuMemcpyHtoD);
-#pragma push_macro("cuMemcpyDtoH")
-#undef cuMemcpyDtoH
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyDtoH)) == 0) {
-#pragma pop_macro("cuMemcpyDtoH")
-        *pfn = (void *)(&hook_cuMemcpyDtoH);
-#pragma push_macro("cuMemcpyAtoH")
-#undef cuMemcpyDtoH
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyAtoH)) == 0) {
-#pragma pop_macro("cuMemcpyAtoH")
-        *pfn = (void *)(&cuMemcpyAtoH);
-#pragma push_macro("cuMemcpyHtoA")
-#undef cuMemcpyHtoA
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuMemcpyHtoA)) == 0) {
-#pragma pop_macro("cuMemcpyHtoA")
-        *pfn = (void *)(&hook_cuMemcpyHtoA);
-#pragma push_macro("cuLaunchKernel")
-#undef cuLaunchKernel
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuLaunchKernel)) == 0) { 
-#pragma pop_macro("cuLaunchKernel")
-        *pfn = (void *)(&hook_cuLaunchKernel);
-#pragma push_macro("cuLaunchCooperativeKernel")
-#undef cuLaunchCooperativeKernel
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuLaunchCooperativeKernel)) == 0) {
-#pragma pop_macro("cuLaunchCooperativeKernel")
-        *pfn = (void *)(&hook_cuLaunchCooperativeKernel);
-#pragma push_macro("cuArrayCreate")
-#undef cuArrayCreate
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuArrayCreate)) == 0) {
-#pragma pop_macro("cuArrayCreate")
-        *pfn = (void *)(&hook_cuArrayCreate);
-#pragma push_macro("cuArray3DCreate")
-#undef cuArray3DCreate
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuArray3DCreate)) == 0) {
-#pragma pop_macro("cuArray3DCreate")
-        *pfn = (void *)(&hook_cuArray3DCreate);
-#pragma push_macro("cuMipmappedArrayCreate")
-#undef cuMipmappedArrayCreate
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuMipmappedArrayCreate)) == 0) {
-#pragma pop_macro("cuMipmappedArrayCreate")
-        *pfn = (void *)(&hook_cuMipmappedArrayCreate);
-#pragma push_macro("cuArrayDestroy")
-#undef cuArrayDestroy
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuArrayDestroy)) == 0) {
-#pragma pop_macro("cuArrayDestroy")
-        *pfn = (void *)(&hook_cuArrayDestroy);
-#pragma push_macro("cuMipmappedArrayDestroy")
-#undef cuMipmappedArrayDestroy
-    } else if  (strcmp(symbol, CUDA_SYMBOL_STRING(cuMipmappedArrayDestroy)) == 0) {
-#pragma pop_macro("cuMipmappedArrayDestroy")
-        *pfn = (void *)(&cuMipmappedArrayDestroy);
-    }
+struct hook_symbol_t {
+  const char *name;       // as asked from cuGetProcAddress()
+  const char *versioned;  // as asked from dlsym(), with the version suffix of cuda.h
+  int since;
+};
 
+#define CU_HOOK_SYMBOL_ENTRY(id, symbol, since, interceptor) \
+  {#symbol, CUDA_SYMBOL_STRING(symbol), since},
+#define CU_HOOK_SYMBOL_INTERCEPTOR(id, symbol, since, interceptor) (void *)(interceptor),
+#define CU_HOOK_SYMBOL_EXPORTED(id, symbol, since, interceptor) (void *)(&symbol),
+constexpr hook_symbol_t hook_symbols[] = {CU_HOOK_SYMBOLS(CU_HOOK_SYMBOL_ENTRY)};
+static void *const proc_interceptors[] = {CU_HOOK_SYMBOLS(CU_HOOK_SYMBOL_INTERCEPTOR)};
+static void *const exported_functions[] = {CU_HOOK_SYMBOLS(CU_HOOK_SYMBOL_EXPORTED)};
 
+constexpr const char *symbol_key(int id, bool versioned) {
+  return versioned ? hook_symbols[id].versioned : hook_symbols[id].name;
+}
 
+// seeded FNV-1a, folded so that the low bits used as slot depend on the whole hash
+constexpr uint32_t symbol_hash(const char *s, uint32_t h) {
+  return *s ? symbol_hash(s + 1, (h ^ (unsigned char)*s) * 16777619u) : h ^ (h >> 16);
+}
 
-    
-#ifdef _DEBUG
-    //printf("Leave %s\n", SYMBOL_STRING(cuGetProcAddress));
-#endif
-    return (result);
+constexpr int symbol_slot(const char *s, uint32_t seed) {
+  return symbol_hash(s, 2166136261u ^ seed) & (SYMBOL_TABLE_SIZE - 1);
+}
+
+// whether the slot of symbol i differs from those of symbols j, j + 1, ...
+constexpr bool slot_differs(bool versioned, uint32_t seed, int i, int j) {
+  return j >= NUM_HOOK_SYMBOLS ||
+         (symbol_slot(symbol_key(i, versioned), seed) !=
+              symbol_slot(symbol_key(j, versioned), seed) &&
+          slot_differs(versioned, seed, i, j + 1));
+}
+
+constexpr bool is_perfect(bool versioned, uint32_t seed, int i = 0) {
+  return i >= NUM_HOOK_SYMBOLS ||
+         (slot_differs(versioned, seed, i, i + 1) && is_perfect(versioned, seed, i + 1));
+}
+
+// first seed that maps every symbol to a slot of its own
+constexpr uint32_t perfect_seed(bool versioned, uint32_t seed = 0) {
+  return is_perfect(versioned, seed) ? seed : perfect_seed(versioned, seed + 1);
+}
+
+constexpr uint32_t PROC_SEED = perfect_seed(false);
+constexpr uint32_t DLSYM_SEED = perfect_seed(true);
+
+// slot of every symbol, hashed once instead of once per slot filled
+#define CU_HOOK_SYMBOL_PROC_SLOT(id, symbol, since, interceptor) \
+  symbol_slot(symbol_key(id, false), PROC_SEED),
+#define CU_HOOK_SYMBOL_DLSYM_SLOT(id, symbol, since, interceptor) \
+  symbol_slot(symbol_key(id, true), DLSYM_SEED),
+constexpr int proc_slot_of[] = {CU_HOOK_SYMBOLS(CU_HOOK_SYMBOL_PROC_SLOT)};
+constexpr int dlsym_slot_of[] = {CU_HOOK_SYMBOLS(CU_HOOK_SYMBOL_DLSYM_SLOT)};
+
+// symbol id stored in a slot, -1 if empty
+constexpr int slot_symbol(bool versioned, int slot, int id = 0) {
+  return id >= NUM_HOOK_SYMBOLS ? -1
+         : (versioned ? dlsym_slot_of : proc_slot_of)[id] == slot
+             ? id
+             : slot_symbol(versioned, slot, id + 1);
+}
+
+#define SYMBOL_SLOTS_4(v, b) \
+  slot_symbol(v, b), slot_symbol(v, b + 1), slot_symbol(v, b + 2), slot_symbol(v, b + 3)
+#define SYMBOL_SLOTS_32(v, b)                                                                     \
+  SYMBOL_SLOTS_4(v, b), SYMBOL_SLOTS_4(v, b + 4), SYMBOL_SLOTS_4(v, b + 8),                     \
+      SYMBOL_SLOTS_4(v, b + 12), SYMBOL_SLOTS_4(v, b + 16), SYMBOL_SLOTS_4(v, b + 20),          \
+      SYMBOL_SLOTS_4(v, b + 24), SYMBOL_SLOTS_4(v, b + 28)
+#define SYMBOL_SLOTS_256(v, b)                                                                    \
+  SYMBOL_SLOTS_32(v, b), SYMBOL_SLOTS_32(v, b + 32), SYMBOL_SLOTS_32(v, b + 64),                \
+      SYMBOL_SLOTS_32(v, b + 96), SYMBOL_SLOTS_32(v, b + 128), SYMBOL_SLOTS_32(v, b + 160),     \
+      SYMBOL_SLOTS_32(v, b + 192), SYMBOL_SLOTS_32(v, b + 224)
+#define SYMBOL_SLOTS(v)                                                                           \
+  SYMBOL_SLOTS_256(v, 0), SYMBOL_SLOTS_256(v, 256), SYMBOL_SLOTS_256(v, 512),                   \
+      SYMBOL_SLOTS_256(v, 768)
+
+static const signed char proc_slots[SYMBOL_TABLE_SIZE] = {SYMBOL_SLOTS(false)};
+static const signed char dlsym_slots[SYMBOL_TABLE_SIZE] = {SYMBOL_SLOTS(true)};
+static_assert(sizeof(hook_symbols) / sizeof(hook_symbol_t) == NUM_HOOK_SYMBOLS &&
+                  NUM_HOOK_SYMBOLS < 128 && SYMBOL_TABLE_SIZE == 1024,
+              "symbol tables out of sync with CU_HOOK_SYMBOLS");
+
+/**
+ * Look a driver symbol up in CU_HOOK_SYMBOLS with a single probe.
+ * @param versioned whether symbol carries the version suffix (dlsym) or not (cuGetProcAddress)
+ * @return its HookSymbols id, -1 if it is not listed
+ */
+static int find_symbol(const char *symbol, bool versioned) {
+  const signed char *slots = versioned ? dlsym_slots : proc_slots;
+  int id = slots[symbol_slot(symbol, versioned ? DLSYM_SEED : PROC_SEED)];
+  if (id < 0 || strcmp(symbol, symbol_key(id, versioned)) != 0) return -1;
+  return id;
+}
+
+/*
+ ** interposed functions
+ */
+void *dlsym(void *handle, const char *symbol) {
+  // Early out if not a CUDA driver symbol
+  if (strncmp(symbol, "cu", 2) != 0) {
+    return (real_dlsym(handle, symbol));
+  }
+  int id = find_symbol(symbol, true);
+  if (id >= 0 && proc_interceptors[id] != nullptr) return exported_functions[id];
+  return (real_dlsym(handle, symbol));
+}
+
+CUresult CUDAAPI cuGetProcAddress(const char *symbol, void **pfn, int cudaVersion, cuuint64_t flags) {
+  typedef decltype(&cuGetProcAddress) funcType;
+  funcType actualFunc;
+  if (!hook_inf.func_actual[CU_HOOK_GET_PROC_ADDRESS])
+    actualFunc = (funcType)real_dlsym(libcudaHandle, CUDA_SYMBOL_STRING(cuGetProcAddress));
+  else
+    actualFunc = (funcType)hook_inf.func_actual[CU_HOOK_GET_PROC_ADDRESS];
+  CUresult result = actualFunc(symbol, pfn, cudaVersion, flags);
+  if (result != CUDA_SUCCESS) return (result);
+
+  int id = find_symbol(symbol, false);
+  if (id < 0 || proc_interceptors[id] == nullptr || cudaVersion < hook_symbols[id].since)
+    return (result);  // not intercepted, or an older version of the function is asked for
+  if (id == CU_HOOK_GET_PROC_ADDRESS) hook_inf.func_actual[CU_HOOK_GET_PROC_ADDRESS] = *pfn;
+  *pfn = proc_interceptors[id];
+  return (result);
 }
 
 //generate hook for cuda >= 11.3
 #define CU_HOOK_GENERATE_INTERCEPT_v1(hooksymbol, funcname, params, ...)                     \
   CUresult CUDAAPI funcname params {                                                      \
     if (hook_inf.debug_mode) hDEBUG(log_name, __FILE__, (long)__LINE__, "hooked function: " CUDA_SYMBOL_STRING(hooksymbol));   \
-    pthread_once(&init_done, initialize);                                                 \
-                                                                                          \
-    static void *real_func;                                                               \
-    real_func = (void *)real_dlsym(RTLD_NEXT, CUDA_SYMBOL_STRING(funcname));          \
+    ensure_initialized();                                                                 \
+    void *real_func = hook_inf.func_actual[hooksymbol];                                   \
     CUresult result = CUDA_SUCCESS;                                                       \
                                                                                           \
     if (hook_inf.debug_mode) hook_inf.call_count[hooksymbol]++;                           \
                                                                                           \
     if (hook_inf.preHooks[hooksymbol])                                                    \
       result = ((CUresult CUDAAPI(*) params)hook_inf.preHooks[hooksymbol])(__VA_ARGS__);  \
-    if (result != CUDA_SUCCESS) return (result);                                          \
+    if (result != CUDA_SUCCESS) return (result == CU_HOOK_HANDLED ? CUDA_SUCCESS : result); \
                                                                                           \
     result = ((CUresult CUDAAPI(*) params)real_func)(__VA_ARGS__);                        \
                                                                                           \
     if (hook_inf.postHooks[hooksymbol] && result == CUDA_SUCCESS)                         \
       result = ((CUresult CUDAAPI(*) params)hook_inf.postHooks[hooksymbol])(__VA_ARGS__); \
+    else if (hook_inf.failHooks[hooksymbol] && result != CUDA_SUCCESS)                    \
+      ((CUresult CUDAAPI(*) params)hook_inf.failHooks[hooksymbol])(__VA_ARGS__);          \
                                                                                           \
     return (result);                                                                      \
   }
@@ -1109,21 +1655,22 @@ CUresult CUDAAPI cuGetProcAddress(const char *symbol, void **pfn, int cudaVersio
 #define CU_HOOK_GENERATE_INTERCEPT_v1_managed(hooksymbol, funcname, oldparams, params, ...)                     \
   CUresult CUDAAPI funcname oldparams {                                                   \
     if (hook_inf.debug_mode) hDEBUG(log_name, __FILE__, (long)__LINE__, "hooked function: " CUDA_SYMBOL_STRING(hooksymbol));   \
-    pthread_once(&init_done, initialize);                                                 \
-                                                                                          \
-    static void *real_func = (void *)real_dlsym(RTLD_NEXT, "cuMemAllocManaged");          \
+    ensure_initialized();                                                                 \
+    void *real_func = hook_inf.func_actual[hooksymbol];                                   \
     CUresult result = CUDA_SUCCESS;                                                       \
                                                                                           \
     if (hook_inf.debug_mode) hook_inf.call_count[hooksymbol]++;                           \
                                                                                           \
     if (hook_inf.preHooks[hooksymbol])                                                    \
       result = ((CUresult CUDAAPI(*) params)hook_inf.preHooks[hooksymbol])(__VA_ARGS__);  \
-    if (result != CUDA_SUCCESS) return (result);                                          \
+    if (result != CUDA_SUCCESS) return (result == CU_HOOK_HANDLED ? CUDA_SUCCESS : result); \
                                                                                           \
     result = ((CUresult CUDAAPI(*) params)real_func)(__VA_ARGS__);                        \
                                                                                           \
     if (hook_inf.postHooks[hooksymbol] && result == CUDA_SUCCESS)                         \
       result = ((CUresult CUDAAPI(*) params)hook_inf.postHooks[hooksymbol])(__VA_ARGS__); \
+    else if (hook_inf.failHooks[hooksymbol] && result != CUDA_SUCCESS)                    \
+      ((CUresult CUDAAPI(*) params)hook_inf.failHooks[hooksymbol])(__VA_ARGS__);          \
                                                                                           \
     return (result);                                                                      \
   }
@@ -1143,6 +1690,27 @@ CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_MEMCPY_HTOD, cuMemcpyHtoD,
                            (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount),
                            dstDevice, srcHost, ByteCount)
 CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_CTX_SYNC, cuCtxSynchronize, (void))
+CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_MEMCPY_HTOD_ASYNC, cuMemcpyHtoDAsync,
+                           (CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount,
+                            CUstream hStream),
+                           dstDevice, srcHost, ByteCount, hStream)
+CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_MEMCPY_DTOH_ASYNC, cuMemcpyDtoHAsync,
+                           (void *dstHost, CUdeviceptr srcDevice, size_t ByteCount,
+                            CUstream hStream),
+                           dstHost, srcDevice, ByteCount, hStream)
+
+// cuda driver stream/event APIs
+CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_STREAM_SYNC, cuStreamSynchronize, (CUstream hStream), hStream)
+CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_STREAM_QUERY, cuStreamQuery, (CUstream hStream), hStream)
+CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_EVENT_RECORD, cuEventRecord,
+                           (CUevent hEvent, CUstream hStream), hEvent, hStream)
+CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_STREAM_DESTROY, cuStreamDestroy, (CUstream hStream), hStream)
+CU_HOOK_GENERATE_INTERCEPT_v1(CU_HOOK_CTX_DESTROY, cuCtxDestroy, (CUcontext ctx), ctx)
+
+#define CU_HOOK_ORDERED_INTERCEPT_v1(id, symbol, stream, params, ...) \
+  CU_HOOK_GENERATE_INTERCEPT_v1(id, symbol, params, __VA_ARGS__)
+CU_HOOK_ORDERED_CALLS(CU_HOOK_ORDERED_INTERCEPT_v1)
+#undef CU_HOOK_ORDERED_INTERCEPT_v1
 
 // cuda driver alloc/free APIs
 CU_HOOK_GENERATE_INTERCEPT_v1_managed(CU_HOOK_MEM_ALLOC, cuMemAlloc, (CUdeviceptr * dptr, size_t bytesize),
@@ -18,30 +18,94 @@
 #define _CUHOOK_H_
 #include <cuda.h>
 
+/**
+ * Driver API symbols known to the hook library, the single source of HookSymbols and of the
+ * symbol tables used by dlsym() and cuGetProcAddress() in hook.cpp.
+ * X(id, symbol, since, interceptor)
+ *   symbol       name in cuda.h without version suffix
+ *   since        lowest cudaVersion for which cuGetProcAddress() returns the version intercepted
+ *   interceptor  function given to cuGetProcAddress() callers, nullptr if not intercepted; dlsym()
+ *                callers get the exported function of the same name
+ */
+#define CU_HOOK_SYMBOLS(X)                                                                         \
+  X(CU_HOOK_GET_PROC_ADDRESS, cuGetProcAddress, 0, &cuGetProcAddress)                              \
+  X(CU_HOOK_MEM_ALLOC, cuMemAlloc, 3020, &hook_cuMemAlloc)                                         \
+  X(CU_HOOK_MEM_ALLOC_MANAGED, cuMemAllocManaged, 0, &hook_cuMemAllocManaged)                      \
+  X(CU_HOOK_MEM_ALLOC_PITCH, cuMemAllocPitch, 3020, &hook_cuMemAllocPitch)                         \
+  X(CU_HOOK_MEM_FREE, cuMemFree, 3020, &hook_cuMemFree)                                            \
+  X(CU_HOOK_ARRAY_CREATE, cuArrayCreate, 3020, &hook_cuArrayCreate)                                \
+  X(CU_HOOK_ARRAY3D_CREATE, cuArray3DCreate, 3020, &hook_cuArray3DCreate)                          \
+  X(CU_HOOK_MIPMAPPED_ARRAY_CREATE, cuMipmappedArrayCreate, 0, &hook_cuMipmappedArrayCreate)       \
+  X(CU_HOOK_ARRAY_DESTROY, cuArrayDestroy, 0, &hook_cuArrayDestroy)                                \
+  X(CU_HOOK_MIPMAPPED_ARRAY_DESTROY, cuMipmappedArrayDestroy, 0, &hook_cuMipmappedArrayDestroy)    \
+  X(CU_HOOK_CTX_GET_CURRENT, cuCtxGetCurrent, 0, nullptr)                                          \
+  X(CU_HOOK_CTX_SET_CURRENT, cuCtxSetCurrent, 0, nullptr)                                          \
+  X(CU_HOOK_CTX_DESTROY, cuCtxDestroy, 4000, &hook_cuCtxDestroy)                                   \
+  X(CU_HOOK_LAUNCH_KERNEL, cuLaunchKernel, 0, &hook_cuLaunchKernel)                                \
+  X(CU_HOOK_LAUNCH_COOPERATIVE_KERNEL, cuLaunchCooperativeKernel, 0,                               \
+    &hook_cuLaunchCooperativeKernel)                                                               \
+  /* not intercepted, or cudaEventCreate() in initialize() would deadlock */                       \
+  X(CU_HOOK_DEVICE_TOTOAL_MEM, cuDeviceTotalMem, 3020, nullptr)                                    \
+  X(CU_HOOK_MEM_INFO, cuMemGetInfo, 3020, &cuMemGetInfo)                                           \
+  X(CU_HOOK_CTX_SYNC, cuCtxSynchronize, 0, &hook_cuCtxSynchronize)                                 \
+  X(CU_HOOK_MEMCPY_ATOH, cuMemcpyAtoH, 3020, &hook_cuMemcpyAtoH)                                   \
+  X(CU_HOOK_MEMCPY_DTOH, cuMemcpyDtoH, 3020, &hook_cuMemcpyDtoH)                                   \
+  X(CU_HOOK_MEMCPY_HTOA, cuMemcpyHtoA, 3020, &hook_cuMemcpyHtoA)                                   \
+  X(CU_HOOK_MEMCPY_HTOD, cuMemcpyHtoD, 3020, &hook_cuMemcpyHtoD)                                   \
+  X(CU_HOOK_MEMCPY_HTOD_ASYNC, cuMemcpyHtoDAsync, 3020, &hook_cuMemcpyHtoDAsync)                   \
+  X(CU_HOOK_MEMCPY_DTOH_ASYNC, cuMemcpyDtoHAsync, 3020, &hook_cuMemcpyDtoHAsync)                   \
+  X(CU_HOOK_STREAM_SYNC, cuStreamSynchronize, 0, &hook_cuStreamSynchronize)                        \
+  X(CU_HOOK_STREAM_QUERY, cuStreamQuery, 0, &hook_cuStreamQuery)                                   \
+  X(CU_HOOK_EVENT_RECORD, cuEventRecord, 0, &hook_cuEventRecord)                                   \
+  X(CU_HOOK_STREAM_DESTROY, cuStreamDestroy, 4000, &hook_cuStreamDestroy)                          \
+  /* ordered after the launches held back only, see CU_HOOK_ORDERED_CALLS in hook.cpp */           \
+  X(CU_HOOK_MEMCPY, cuMemcpy, 0, &hook_cuMemcpy)                                                   \
+  X(CU_HOOK_MEMCPY_PEER, cuMemcpyPeer, 0, &hook_cuMemcpyPeer)                                      \
+  X(CU_HOOK_MEMCPY_DTOD, cuMemcpyDtoD, 3020, &hook_cuMemcpyDtoD)                                   \
+  X(CU_HOOK_MEMCPY_DTOA, cuMemcpyDtoA, 3020, &hook_cuMemcpyDtoA)                                   \
+  X(CU_HOOK_MEMCPY_ATOD, cuMemcpyAtoD, 3020, &hook_cuMemcpyAtoD)                                   \
+  X(CU_HOOK_MEMCPY_ATOA, cuMemcpyAtoA, 3020, &hook_cuMemcpyAtoA)                                   \
+  X(CU_HOOK_MEMCPY_2D, cuMemcpy2D, 3020, &hook_cuMemcpy2D)                                         \
+  X(CU_HOOK_MEMCPY_2D_UNALIGNED, cuMemcpy2DUnaligned, 3020, &hook_cuMemcpy2DUnaligned)             \
+  X(CU_HOOK_MEMCPY_3D, cuMemcpy3D, 3020, &hook_cuMemcpy3D)                                         \
+  X(CU_HOOK_MEMCPY_3D_PEER, cuMemcpy3DPeer, 0, &hook_cuMemcpy3DPeer)                               \
+  X(CU_HOOK_MEMSET_D8, cuMemsetD8, 3020, &hook_cuMemsetD8)                                         \
+  X(CU_HOOK_MEMSET_D16, cuMemsetD16, 3020, &hook_cuMemsetD16)                                      \
+  X(CU_HOOK_MEMSET_D32, cuMemsetD32, 3020, &hook_cuMemsetD32)                                      \
+  X(CU_HOOK_MEMSET_D2D8, cuMemsetD2D8, 3020, &hook_cuMemsetD2D8)                                   \
+  X(CU_HOOK_MEMSET_D2D16, cuMemsetD2D16, 3020, &hook_cuMemsetD2D16)                                \
+  X(CU_HOOK_MEMSET_D2D32, cuMemsetD2D32, 3020, &hook_cuMemsetD2D32)                                \
+  X(CU_HOOK_MEMCPY_ASYNC, cuMemcpyAsync, 0, &hook_cuMemcpyAsync)                                   \
+  X(CU_HOOK_MEMCPY_PEER_ASYNC, cuMemcpyPeerAsync, 0, &hook_cuMemcpyPeerAsync)                      \
+  X(CU_HOOK_MEMCPY_DTOD_ASYNC, cuMemcpyDtoDAsync, 3020, &hook_cuMemcpyDtoDAsync)                   \
+  X(CU_HOOK_MEMCPY_HTOA_ASYNC, cuMemcpyHtoAAsync, 3020, &hook_cuMemcpyHtoAAsync)                   \
+  X(CU_HOOK_MEMCPY_ATOH_ASYNC, cuMemcpyAtoHAsync, 3020, &hook_cuMemcpyAtoHAsync)                   \
+  X(CU_HOOK_MEMCPY_2D_ASYNC, cuMemcpy2DAsync, 3020, &hook_cuMemcpy2DAsync)                         \
+  X(CU_HOOK_MEMCPY_3D_ASYNC, cuMemcpy3DAsync, 3020, &hook_cuMemcpy3DAsync)                         \
+  X(CU_HOOK_MEMCPY_3D_PEER_ASYNC, cuMemcpy3DPeerAsync, 0, &hook_cuMemcpy3DPeerAsync)               \
+  X(CU_HOOK_MEMSET_D8_ASYNC, cuMemsetD8Async, 0, &hook_cuMemsetD8Async)                            \
+  X(CU_HOOK_MEMSET_D16_ASYNC, cuMemsetD16Async, 0, &hook_cuMemsetD16Async)                         \
+  X(CU_HOOK_MEMSET_D32_ASYNC, cuMemsetD32Async, 0, &hook_cuMemsetD32Async)                         \
+  X(CU_HOOK_MEMSET_D2D8_ASYNC, cuMemsetD2D8Async, 0, &hook_cuMemsetD2D8Async)                      \
+  X(CU_HOOK_MEMSET_D2D16_ASYNC, cuMemsetD2D16Async, 0, &hook_cuMemsetD2D16Async)                   \
+  X(CU_HOOK_MEMSET_D2D32_ASYNC, cuMemsetD2D32Async, 0, &hook_cuMemsetD2D32Async)                   \
+  X(CU_HOOK_MEM_PREFETCH_ASYNC, cuMemPrefetchAsync, 0, &hook_cuMemPrefetchAsync)                   \
+  X(CU_HOOK_MEM_FREE_ASYNC, cuMemFreeAsync, 0, &hook_cuMemFreeAsync)                               \
+  X(CU_HOOK_STREAM_WAIT_EVENT, cuStreamWaitEvent, 0, &hook_cuStreamWaitEvent)                      \
+  X(CU_HOOK_STREAM_ADD_CALLBACK, cuStreamAddCallback, 0, &hook_cuStreamAddCallback)                \
+  X(CU_HOOK_LAUNCH_HOST_FUNC, cuLaunchHostFunc, 0, &hook_cuLaunchHostFunc)                         \
+  X(CU_HOOK_STREAM_BEGIN_CAPTURE, cuStreamBeginCapture, 10010, &hook_cuStreamBeginCapture)       \
+  X(CU_HOOK_STREAM_END_CAPTURE, cuStreamEndCapture, 0, &hook_cuStreamEndCapture)                   \
+  X(CU_HOOK_GRAPH_LAUNCH, cuGraphLaunch, 0, &hook_cuGraphLaunch)
+
+#define CU_HOOK_SYMBOL_ENUM(id, symbol, since, interceptor) id,
 typedef enum HookSymbolsEnum {
-  CU_HOOK_GET_PROC_ADDRESS,
-  CU_HOOK_MEM_ALLOC,
-  CU_HOOK_MEM_ALLOC_MANAGED,
-  CU_HOOK_MEM_ALLOC_PITCH,
-  CU_HOOK_MEM_FREE,
-  CU_HOOK_ARRAY_CREATE,
-  CU_HOOK_ARRAY3D_CREATE,
-  CU_HOOK_MIPMAPPED_ARRAY_CREATE,
-  CU_HOOK_ARRAY_DESTROY,
-  CU_HOOK_MIPMAPPED_ARRAY_DESTROY,
-  CU_HOOK_CTX_GET_CURRENT,
-  CU_HOOK_CTX_SET_CURRENT,
-  CU_HOOK_CTX_DESTROY,
-  CU_HOOK_LAUNCH_KERNEL,
-  CU_HOOK_LAUNCH_COOPERATIVE_KERNEL,
-  CU_HOOK_DEVICE_TOTOAL_MEM,
-  CU_HOOK_MEM_INFO,
-  CU_HOOK_CTX_SYNC,
-  CU_HOOK_MEMCPY_ATOH,
-  CU_HOOK_MEMCPY_DTOH,
-  CU_HOOK_MEMCPY_HTOA,
-  CU_HOOK_MEMCPY_HTOD,
+  CU_HOOK_SYMBOLS(CU_HOOK_SYMBOL_ENUM)
   NUM_HOOK_SYMBOLS,
 } HookSymbols;
+#undef CU_HOOK_SYMBOL_ENUM
+
+// returned by a pre-hook that took the call over: the driver is not called, the caller gets success
+const CUresult CU_HOOK_HANDLED = (CUresult)1000;
 
 #endif /* _CUHOOK_H_ */
@@ -0,0 +1,200 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kernel-model.h"
+
+#include <algorithm>
+#include <cstring>
+
+const int MAX_KERNELS = 4096;               // kernels past this many are not modeled
+const size_t MAX_BURST_LAUNCHES = 1 << 16;  // longer bursts are not predicted
+const size_t MAX_PENDING_SAMPLES = 64;
+const uint64_t MIN_SAMPLES = 3;  // time every launch of a kernel until it was launched this often
+const int KEY_CACHE_SIZE = 64;   // per thread, direct-mapped
+
+// sample being launched by this thread
+static thread_local int sampled_kernel = -1;
+static thread_local cudaEvent_t sample_start;
+static thread_local cudaStream_t sample_stream;
+
+// kernels this thread looked up recently, saves taking mutex_ to read the index
+static thread_local struct {
+  const KernelModel *owner;
+  kernel_key_t key;
+  int kernel;
+} key_cache[KEY_CACHE_SIZE];
+
+bool kernel_key_t::operator==(const kernel_key_t &other) const {
+  return func == other.func && memcmp(grid, other.grid, sizeof(grid)) == 0 &&
+         memcmp(block, other.block, sizeof(block)) == 0;
+}
+
+size_t kernel_key_hash::operator()(const kernel_key_t &key) const {
+  uint64_t h = (uint64_t)key.func;
+  for (int i = 0; i < 3; i++) h = (h ^ key.grid[i]) * 0x100000001b3ULL;
+  for (int i = 0; i < 3; i++) h = (h ^ key.block[i]) * 0x100000001b3ULL;
+  return h ^ (h >> 32);
+}
+
+KernelModel::KernelModel(double alpha, unsigned sample_period)
+    : ALPHA(alpha),
+      SAMPLE_PERIOD(sample_period),
+      stats_(new stats_t[MAX_KERNELS]),
+      kernels_(0),
+      current_burst_(new std::atomic<int>[MAX_BURST_LAUNCHES]),
+      current_size_(0),
+      last_overflow_(true) {
+  pthread_mutex_init(&mutex_, nullptr);
+  for (int i = 0; i < MAX_KERNELS; i++) {
+    stats_[i].ms = 0.0;
+    stats_[i].samples = 0;
+    stats_[i].launches = 0;
+  }
+}
+
+// @return index of the kernel in stats_, -1 if there is no room for it
+int KernelModel::lookup(const kernel_key_t &key) {
+  size_t hash = kernel_key_hash()(key);
+  auto &cached = key_cache[hash % KEY_CACHE_SIZE];
+  if (cached.owner == this && cached.key == key) return cached.kernel;
+
+  pthread_mutex_lock(&mutex_);
+  int kernel;
+  auto found = index_.find(key);
+  if (found != index_.end()) {
+    kernel = found->second;
+  } else {
+    kernel = kernels_.load(std::memory_order_relaxed);
+    if (kernel < MAX_KERNELS) {
+      index_.emplace(key, kernel);
+      kernels_.store(kernel + 1, std::memory_order_release);
+    } else {
+      kernel = -1;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  cached.owner = this;
+  cached.key = key;
+  cached.kernel = kernel;
+  return kernel;
+}
+
+// caller holds mutex_
+cudaEvent_t KernelModel::acquire_event() {
+  if (!pool_.empty()) {
+    cudaEvent_t event = pool_.back();
+    pool_.pop_back();
+    return event;
+  }
+  cudaEvent_t event;
+  if (cudaEventCreate(&event) != cudaSuccess) return nullptr;
+  return event;
+}
+
+// fold completed samples into the averages; caller holds mutex_
+void KernelModel::harvest() {
+  size_t kept = 0;
+  for (sample_t &sample : pending_) {
+    cudaError_t rc = cudaEventQuery(sample.end);
+    if (rc == cudaErrorNotReady) {
+      pending_[kept++] = sample;
+      continue;
+    }
+    float ms;
+    if (rc == cudaSuccess && cudaEventElapsedTime(&ms, sample.start, sample.end) == cudaSuccess) {
+      stats_t &stats = stats_[sample.kernel];
+      stats.ms = stats.samples == 0 ? ms : (1.0 - ALPHA) * stats.ms + ALPHA * ms;
+      stats.samples++;
+    }
+    pool_.push_back(sample.start);
+    pool_.push_back(sample.end);
+  }
+  pending_.resize(kept);
+}
+
+void KernelModel::launch_begin(CUfunction func, const uint32_t *grid, const uint32_t *block,
+                               cudaStream_t stream) {
+  kernel_key_t key = {func, {grid[0], grid[1], grid[2]}, {block[0], block[1], block[2]}};
+  int kernel = lookup(key);
+  size_t position = current_size_.fetch_add(1, std::memory_order_relaxed);
+  if (position < MAX_BURST_LAUNCHES)
+    current_burst_[position].store(kernel, std::memory_order_relaxed);
+  if (kernel < 0) return;
+
+  uint64_t launches = stats_[kernel].launches.fetch_add(1, std::memory_order_relaxed);
+  if (launches >= MIN_SAMPLES && launches % SAMPLE_PERIOD != 0) return;
+  if (pthread_mutex_trylock(&mutex_) != 0) return;  // skip this sample rather than wait
+  if (sampled_kernel >= 0) pool_.push_back(sample_start);  // the last launch failed
+  sampled_kernel = -1;
+  if (!pending_.empty()) harvest();
+  if (pending_.size() < MAX_PENDING_SAMPLES) {
+    cudaEvent_t start = acquire_event();
+    if (start != nullptr && cudaEventRecord(start, stream) == cudaSuccess) {
+      sampled_kernel = kernel;
+      sample_start = start;
+      sample_stream = stream;
+    } else if (start != nullptr) {
+      pool_.push_back(start);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void KernelModel::launch_end() {
+  if (sampled_kernel < 0) return;
+  pthread_mutex_lock(&mutex_);
+  cudaEvent_t end = acquire_event();
+  if (end != nullptr && cudaEventRecord(end, sample_stream) == cudaSuccess) {
+    pending_.push_back({sampled_kernel, sample_start, end});
+  } else {
+    pool_.push_back(sample_start);
+    if (end != nullptr) pool_.push_back(end);
+  }
+  sampled_kernel = -1;
+  pthread_mutex_unlock(&mutex_);
+}
+
+void KernelModel::burst_end() {
+  pthread_mutex_lock(&mutex_);
+  size_t size = current_size_.exchange(0, std::memory_order_acq_rel);
+  if (size > 0) {
+    last_overflow_ = size > MAX_BURST_LAUNCHES;
+    last_burst_.resize(std::min(size, MAX_BURST_LAUNCHES));
+    for (size_t i = 0; i < last_burst_.size(); i++)
+      last_burst_[i] = current_burst_[i].load(std::memory_order_relaxed);
+  }
+  harvest();
+  pthread_mutex_unlock(&mutex_);
+}
+
+double KernelModel::predict_remaining() {
+  double remaining = 0.0;
+  pthread_mutex_lock(&mutex_);
+  harvest();
+  size_t position = current_size_.load(std::memory_order_relaxed);
+  if (last_overflow_ || last_burst_.empty() || position >= last_burst_.size()) {
+    remaining = -1.0;  // no burst to follow, or this one already went past it
+  } else {
+    for (size_t i = position; i < last_burst_.size() && remaining >= 0.0; i++) {
+      int kernel = last_burst_[i];
+      remaining = kernel >= 0 && stats_[kernel].samples > 0 ? remaining + stats_[kernel].ms : -1.0;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return remaining;
+}
+
+size_t KernelModel::kernels() { return kernels_.load(std::memory_order_acquire); }
@@ -0,0 +1,100 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUHOOK_KERNEL_MODEL_H_
+#define _CUHOOK_KERNEL_MODEL_H_
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+struct kernel_key_t {
+  CUfunction func;
+  uint32_t grid[3];
+  uint32_t block[3];
+  bool operator==(const kernel_key_t &other) const;
+};
+
+struct kernel_key_hash {
+  size_t operator()(const kernel_key_t &key) const;
+};
+
+/**
+ * Execution time of each kernel, keyed by function and launch dimensions, learned from events
+ * recorded around a sample of its launches. Launches between two sync points form a burst; as
+ * applications repeat the same bursts, the rest of the current burst is predicted as the kernels
+ * that followed the same position in the last complete burst. Samples are recorded on the calling
+ * thread between launch_begin() and launch_end(). Launches not sampled take no lock, and sampling
+ * is skipped rather than waited for when the lock is busy.
+ */
+class KernelModel {
+ public:
+  /**
+   * @param alpha weight of a new sample in the moving average of a kernel's time
+   * @param sample_period time one in this many launches of a known kernel
+   */
+  KernelModel(double alpha = 0.25, unsigned sample_period = 16);
+  // a kernel is about to be launched, after any wait for a token
+  void launch_begin(CUfunction func, const uint32_t *grid, const uint32_t *block,
+                    cudaStream_t stream);
+  // the kernel from launch_begin() on this thread was launched successfully
+  void launch_end();
+  // the host synchronized with the device, the current burst is complete
+  void burst_end();
+  /**
+   * Predict the time the rest of the current burst will keep the GPU busy, from the next launch.
+   * @return ms, or a negative value if the last burst was not seen or has kernels never timed
+   */
+  double predict_remaining();
+  // number of distinct kernels seen
+  size_t kernels();
+
+ private:
+  struct stats_t {
+    double ms;         // moving average, guarded by mutex_
+    uint32_t samples;  // timed launches, guarded by mutex_
+    std::atomic<uint64_t> launches;
+  };
+  struct sample_t {
+    int kernel;
+    cudaEvent_t start, end;
+  };
+
+  int lookup(const kernel_key_t &key);
+  cudaEvent_t acquire_event();
+  void harvest();
+  const double ALPHA;
+  const unsigned SAMPLE_PERIOD;
+  pthread_mutex_t mutex_;
+  std::unordered_map<kernel_key_t, int, kernel_key_hash> index_;  // guarded by mutex_
+  std::unique_ptr<stats_t[]> stats_;                              // fixed capacity, never moves
+  std::atomic<int> kernels_;
+  // kernels in launch order; launches claim positions in the current burst without a lock
+  std::unique_ptr<std::atomic<int>[]> current_burst_;
+  std::atomic<size_t> current_size_;
+  std::vector<int> last_burst_;  // guarded by mutex_
+  bool last_overflow_;           // last burst too long to keep
+  std::vector<sample_t> pending_;                // recorded, not completed yet
+  std::vector<cudaEvent_t> pool_;                // idle events
+};
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "launch-queue.h"
+
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// cuFuncGetParamInfo() of CUDA 12.4, looked up at run time since older headers lack it
+typedef CUresult (*param_info_func_t)(CUfunction, size_t, size_t *, size_t *);
+static param_info_func_t param_info = nullptr;
+static pthread_once_t param_info_once = PTHREAD_ONCE_INIT;
+
+static void resolve_param_info() {
+  param_info = (param_info_func_t)dlsym(RTLD_DEFAULT, "cuFuncGetParamInfo");
+}
+
+bool is_default_stream(CUstream stream) {
+  return (uintptr_t)stream <= 2;  // 0, CU_STREAM_LEGACY or CU_STREAM_PER_THREAD
+}
+
+bool is_capturing(CUstream stream) {
+  CUstreamCaptureStatus status;
+  // an invalidated capture still ends with cuStreamEndCapture(), which reports the error
+  return cuStreamIsCapturing(stream, &status) == CUDA_SUCCESS &&
+         status != CU_STREAM_CAPTURE_STATUS_NONE;
+}
+
+LaunchQueue::LaunchQueue() : pending_(0), failed_(0), capacity_(0) {
+  pthread_mutex_init(&mutex_, nullptr);
+  pthread_cond_init(&queued_cond_, nullptr);
+  pthread_cond_init(&issued_cond_, nullptr);
+}
+
+void LaunchQueue::set_capacity(size_t capacity) { capacity_ = capacity; }
+
+bool LaunchQueue::enabled() const { return capacity_ > 0; }
+
+bool LaunchQueue::empty() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+// caller holds mutex_
+bool LaunchQueue::copy_arguments(CUfunction f, void **kernel_params, void **extra,
+                                 std::vector<char> *args) {
+  if (kernel_params != nullptr) {
+    auto it = layouts_.find(f);
+    if (it == layouts_.end()) {
+      pthread_once(&param_info_once, resolve_param_info);
+      if (param_info == nullptr) return false;
+      std::vector<std::pair<size_t, size_t>> layout;
+      size_t offset, size;
+      while (param_info(f, layout.size(), &offset, &size) == CUDA_SUCCESS)
+        layout.emplace_back(offset, size);
+      it = layouts_.emplace(f, std::move(layout)).first;
+    }
+    size_t total = 0;
+    for (auto &param : it->second) total = std::max(total, param.first + param.second);
+    args->assign(total, 0);
+    for (size_t i = 0; i < it->second.size(); i++)
+      memcpy(args->data() + it->second[i].first, kernel_params[i], it->second[i].second);
+    return true;
+  }
+  if (extra != nullptr) {
+    // only the packed buffer form is understood
+    void *buffer = nullptr;
+    size_t *size = nullptr;
+    for (int i = 0; extra[i] != CU_LAUNCH_PARAM_END; i += 2) {
+      if (extra[i] == CU_LAUNCH_PARAM_BUFFER_POINTER)
+        buffer = extra[i + 1];
+      else if (extra[i] == CU_LAUNCH_PARAM_BUFFER_SIZE)
+        size = (size_t *)extra[i + 1];
+      else
+        return false;
+    }
+    if (buffer == nullptr || size == nullptr) return false;
+    args->assign((char *)buffer, (char *)buffer + *size);
+  }
+  return true;
+}
+
+bool LaunchQueue::push(CUfunction f, const unsigned int grid[3], const unsigned int block[3],
+                       unsigned int shared_mem, CUstream stream, void **kernel_params,
+                       void **extra) {
+  deferred_launch_t launch;
+  cuCtxGetCurrent(&launch.context);
+  launch.func = f;
+  std::copy(grid, grid + 3, launch.grid);
+  std::copy(block, block + 3, launch.block);
+  launch.shared_mem = shared_mem;
+  launch.stream = stream;
+
+  pthread_mutex_lock(&mutex_);
+  if (!copy_arguments(f, kernel_params, extra, &launch.args)) {
+    pthread_mutex_unlock(&mutex_);
+    return false;
+  }
+  while (launches_.size() >= capacity_) pthread_cond_wait(&issued_cond_, &mutex_);
+  launches_.push_back(std::move(launch));
+  per_stream_[stream]++;
+  pending_.fetch_add(1, std::memory_order_release);
+  pthread_cond_signal(&queued_cond_);
+  pthread_mutex_unlock(&mutex_);
+  return true;
+}
+
+deferred_launch_t &LaunchQueue::front() {
+  pthread_mutex_lock(&mutex_);
+  while (launches_.empty()) pthread_cond_wait(&queued_cond_, &mutex_);
+  // push_back() keeps references to the other elements valid
+  deferred_launch_t &launch = launches_.front();
+  pthread_mutex_unlock(&mutex_);
+  return launch;
+}
+
+void LaunchQueue::pop() {
+  pthread_mutex_lock(&mutex_);
+  auto it = per_stream_.find(launches_.front().stream);
+  if (--it->second == 0) per_stream_.erase(it);
+  launches_.pop_front();
+  pending_.fetch_sub(1, std::memory_order_release);
+  pthread_cond_broadcast(&issued_cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+bool LaunchQueue::pending(CUstream stream) {
+  if (empty()) return false;
+  pthread_mutex_lock(&mutex_);
+  bool held = is_default_stream(stream) ? !launches_.empty() : per_stream_.count(stream) > 0;
+  pthread_mutex_unlock(&mutex_);
+  return held;
+}
+
+void LaunchQueue::wait(CUstream stream) {
+  if (empty()) return;
+  pthread_mutex_lock(&mutex_);
+  if (is_default_stream(stream)) {
+    while (!launches_.empty()) pthread_cond_wait(&issued_cond_, &mutex_);
+  } else {
+    while (per_stream_.count(stream) > 0) pthread_cond_wait(&issued_cond_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void LaunchQueue::fail(CUresult rc) {
+  pthread_mutex_lock(&mutex_);
+  const deferred_launch_t &launch = launches_.front();
+  auto same_stream = [&](const launch_error_t &error) {
+    return error.context == launch.context && error.stream == launch.stream;
+  };
+  if (std::none_of(errors_.begin(), errors_.end(), same_stream)) {
+    errors_.push_back({launch.context, launch.stream, rc});
+    failed_.store(errors_.size(), std::memory_order_release);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+CUresult LaunchQueue::take_error(CUstream stream) {
+  if (failed_.load(std::memory_order_acquire) == 0) return CUDA_SUCCESS;
+  bool whole_context = is_default_stream(stream);
+  CUcontext context = nullptr;
+  if (whole_context) cuCtxGetCurrent(&context);
+  auto taken = [&](const launch_error_t &error) {
+    return whole_context ? error.context == context : error.stream == stream;
+  };
+  pthread_mutex_lock(&mutex_);
+  auto first = std::find_if(errors_.begin(), errors_.end(), taken);
+  CUresult rc = first != errors_.end() ? first->rc : CUDA_SUCCESS;
+  errors_.erase(std::remove_if(errors_.begin(), errors_.end(), taken), errors_.end());
+  failed_.store(errors_.size(), std::memory_order_release);
+  pthread_mutex_unlock(&mutex_);
+  return rc;
+}
+
+void LaunchQueue::discard_errors(CUcontext context) {
+  if (failed_.load(std::memory_order_acquire) == 0) return;
+  auto in_context = [&](const launch_error_t &error) { return error.context == context; };
+  pthread_mutex_lock(&mutex_);
+  errors_.erase(std::remove_if(errors_.begin(), errors_.end(), in_context), errors_.end());
+  failed_.store(errors_.size(), std::memory_order_release);
+  pthread_mutex_unlock(&mutex_);
+}
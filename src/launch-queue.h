@@ -0,0 +1,108 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUHOOK_LAUNCH_QUEUE_H_
+#define _CUHOOK_LAUNCH_QUEUE_H_
+
+#include <cuda.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+// a kernel launch held back by the hook, with a copy of its arguments
+struct deferred_launch_t {
+  CUcontext context;  // current on the launching thread
+  CUfunction func;
+  unsigned int grid[3], block[3], shared_mem;
+  CUstream stream;
+  std::vector<char> args;  // argument buffer laid out as the kernel expects it, empty if none
+};
+
+// a launch held back that failed when the dispatcher issued it
+struct launch_error_t {
+  CUcontext context;
+  CUstream stream;
+  CUresult rc;
+};
+
+// whether stream is one of the default streams, which launches are not held back on
+bool is_default_stream(CUstream stream);
+
+// whether work on stream is being captured into a graph, which launches are not held back on
+bool is_capturing(CUstream stream);
+
+/**
+ * Launches held back while the hook waits for a token, so that the launching thread can go on
+ * with host work. Launches are issued by a single dispatcher thread in the order they were held
+ * back, which keeps the order of every stream; callers that have to observe earlier launches on
+ * a stream wait for that stream only. Arguments given as kernelParams are copied with the layout
+ * from cuFuncGetParamInfo (CUDA 12.4), launches that cannot be copied are left to the caller.
+ */
+class LaunchQueue {
+ public:
+  LaunchQueue();
+  // hold back at most capacity launches, 0 disables the queue
+  void set_capacity(size_t capacity);
+  bool enabled() const;
+  // whether no launch is held back; no lock
+  bool empty() const;
+  /**
+   * Hold a launch back until the dispatcher issues it, waiting while the queue is full.
+   * @return false if the arguments cannot be copied, the caller has to launch it
+   */
+  bool push(CUfunction f, const unsigned int grid[3], const unsigned int block[3],
+            unsigned int shared_mem, CUstream stream, void **kernel_params, void **extra);
+  // oldest launch held back, waits for one; for the dispatcher thread only
+  deferred_launch_t &front();
+  // the front launch was issued
+  void pop();
+  // whether launches on stream are held back
+  bool pending(CUstream stream);
+  // wait until the launches held back on stream are issued; the default streams wait for all
+  void wait(CUstream stream);
+  // the front launch failed when issued, keep the failure for the next call ordered after it
+  void fail(CUresult rc);
+  /**
+   * Take the failures of launches issued on stream that were not reported yet.
+   * @return the first of them, CUDA_SUCCESS if none; the default streams take those of every
+   *         stream in the current context
+   */
+  CUresult take_error(CUstream stream);
+  // forget the failures not reported yet of launches in context
+  void discard_errors(CUcontext context);
+
+ private:
+  // copy the arguments into a single buffer, @return false if their layout is unknown
+  bool copy_arguments(CUfunction f, void **kernel_params, void **extra, std::vector<char> *args);
+  pthread_mutex_t mutex_;
+  pthread_cond_t queued_cond_;  // a launch was held back
+  pthread_cond_t issued_cond_;  // a launch was issued
+  std::deque<deferred_launch_t> launches_;
+  std::map<CUstream, size_t> per_stream_;  // launches held back on each stream
+  std::map<CUfunction, std::vector<std::pair<size_t, size_t>>> layouts_;  // offset, size per param
+  // first failure on each stream not reported yet, in the order they occurred
+  std::vector<launch_error_t> errors_;
+  std::atomic<size_t> pending_;
+  std::atomic<size_t> failed_;  // size of errors_, lets callers skip the lock
+  size_t capacity_;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUHOOK_LAUNCH_TRACE_H_
+#define _CUHOOK_LAUNCH_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+
+// File layout is read by tools/decode-launch-trace.py, keep both in sync.
+const uint64_t LAUNCH_TRACE_MAGIC = 0x4543415254534c47ULL;  // "GLSTRACE"
+const uint32_t LAUNCH_TRACE_VERSION = 1;
+
+enum launch_trace_type_t : uint16_t {
+  TRACE_LAUNCH = 1,         // kernel launch
+  TRACE_SYNC = 2,           // host-side synchronization, ends a burst
+  TRACE_TOKEN_REQUEST = 3,  // value: estimated burst (ms)
+  TRACE_TOKEN_GRANT = 4,    // value: quota (ms)
+};
+
+struct launch_trace_record_t {
+  uint64_t time_ns;  // CLOCK_MONOTONIC
+  uint64_t seq;      // index of the record plus 1, written last; a mismatch marks a torn record
+  uint64_t func;     // CUfunction
+  uint64_t stream;   // CUstream
+  double value;
+  uint32_t grid[3];
+  uint16_t block[3];
+  uint16_t type;  // launch_trace_type_t
+  uint32_t tid;
+};
+static_assert(sizeof(launch_trace_record_t) == 64, "trace records are one cache line");
+
+struct launch_trace_header_t {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;             // records in the ring
+  std::atomic<uint64_t> next;    // records ever written; the ring keeps the last capacity ones
+  uint64_t realtime_offset_ns;   // CLOCK_REALTIME - CLOCK_MONOTONIC when the file was created
+  int32_t pid;
+  uint8_t reserved[20];
+};
+static_assert(sizeof(launch_trace_header_t) == 64, "trace header is one cache line");
+
+/**
+ * Open a ring of the given number of records, memory-mapped at path.
+ * @return 0 on success, -1 on failure (recording stays off)
+ */
+int launch_trace_open(const char *path, uint64_t capacity);
+
+// whether a ring is open
+bool launch_trace_enabled();
+
+// append a record: an atomic increment and stores into the mapped ring, no system call
+void launch_trace_record(launch_trace_type_t type, uint64_t func = 0, uint64_t stream = 0,
+                         const uint32_t *grid = nullptr, const uint32_t *block = nullptr,
+                         double value = 0.0);
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "overuse-tracker.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <ctime>
+
+// polling backoff: a few yields for kernels about to retire, then sleeps doubling up to the max
+const int POLL_SPINS = 16;
+const long POLL_MIN_NS = 2000, POLL_MAX_NS = 50000;
+
+// the last stream this thread reported, and the token it was reported under
+static thread_local uint64_t reported_epoch = 0;
+static thread_local cudaStream_t reported_stream;
+
+OveruseTracker::OveruseTracker() : epoch_(1), started_(false), created_(0) {
+  pthread_mutex_init(&mutex_, nullptr);
+}
+
+// caller holds mutex_
+cudaEvent_t OveruseTracker::acquire_event() {
+  if (!pool_.empty()) {
+    cudaEvent_t event = pool_.back();
+    pool_.pop_back();
+    return event;
+  }
+  cudaEvent_t event;
+  cudaEventCreate(&event);
+  created_++;
+  return event;
+}
+
+void OveruseTracker::token_started() {
+  pthread_mutex_lock(&mutex_);
+  if (!started_) start_ = acquire_event();
+  started_ = true;
+  cudaEventRecord(start_, 0);
+  streams_.clear();
+  pool_.insert(pool_.end(), retired_.begin(), retired_.end());
+  retired_.clear();
+  epoch_.fetch_add(1, std::memory_order_release);
+  pthread_mutex_unlock(&mutex_);
+}
+
+void OveruseTracker::kernel_launched(cudaStream_t stream) {
+  uint64_t epoch = epoch_.load(std::memory_order_acquire);
+  if (reported_epoch == epoch && reported_stream == stream) return;
+  pthread_mutex_lock(&mutex_);
+  if (std::find(streams_.begin(), streams_.end(), stream) == streams_.end())
+    streams_.push_back(stream);
+  reported_epoch = epoch_.load(std::memory_order_relaxed);
+  reported_stream = stream;
+  pthread_mutex_unlock(&mutex_);
+}
+
+void OveruseTracker::stream_destroyed(cudaStream_t stream) {
+  pthread_mutex_lock(&mutex_);
+  auto it = std::find(streams_.begin(), streams_.end(), stream);
+  if (it != streams_.end()) {
+    streams_.erase(it);
+    cudaEvent_t event = acquire_event();
+    if (cudaEventRecord(event, stream) == cudaSuccess)
+      retired_.push_back(event);
+    else
+      pool_.push_back(event);
+  }
+  // a stream created later with the same handle is reported again
+  epoch_.fetch_add(1, std::memory_order_release);
+  pthread_mutex_unlock(&mutex_);
+}
+
+double OveruseTracker::wait_completion() {
+  std::vector<cudaEvent_t> events;
+  pthread_mutex_lock(&mutex_);
+  if (!started_) {
+    pthread_mutex_unlock(&mutex_);
+    return 0.0;
+  }
+  events.swap(retired_);
+  // nothing launched, measure the default stream
+  if (streams_.empty() && events.empty()) streams_.push_back(0);
+  for (cudaStream_t stream : streams_) {
+    cudaEvent_t event = acquire_event();
+    if (cudaEventRecord(event, stream) == cudaSuccess)
+      events.push_back(event);
+    else
+      pool_.push_back(event);
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  // events complete in any order, but all of them are needed; wait for them one by one
+  int polls = 0;
+  long sleep_ns = POLL_MIN_NS;
+  for (size_t done = 0; done < events.size();) {
+    if (cudaEventQuery(events[done]) != cudaErrorNotReady) {
+      done++;
+    } else if (polls++ < POLL_SPINS) {
+      sched_yield();
+    } else {
+      struct timespec ts = {0, sleep_ns};
+      nanosleep(&ts, nullptr);
+      sleep_ns = std::min(sleep_ns * 2, POLL_MAX_NS);
+    }
+  }
+
+  double last_ms = 0.0;
+  float elapsed_ms;
+  for (cudaEvent_t event : events)
+    if (cudaEventElapsedTime(&elapsed_ms, start_, event) == cudaSuccess)
+      last_ms = std::max(last_ms, (double)elapsed_ms);
+
+  pthread_mutex_lock(&mutex_);
+  pool_.insert(pool_.end(), events.begin(), events.end());
+  pthread_mutex_unlock(&mutex_);
+  return last_ms;
+}
+
+size_t OveruseTracker::events_created() const { return created_; }
@@ -0,0 +1,63 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUHOOK_OVERUSE_TRACKER_H_
+#define _CUHOOK_OVERUSE_TRACKER_H_
+
+#include <cuda_runtime.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Completion tracking of the kernels launched under a token.
+ * Streams launched into since the token was granted are remembered, and measuring records an event
+ * on each of them and polls the events until all have completed, so that kernels on non-default
+ * streams are waited for too and the caller learns the moment the last one retires. Events are
+ * recycled through a pool instead of created per token.
+ */
+class OveruseTracker {
+ public:
+  OveruseTracker();
+  // a token was granted: record the start event on the default stream, forget used streams
+  void token_started();
+  // a kernel is about to be launched on stream; no lock once this thread reported the stream
+  void kernel_launched(cudaStream_t stream);
+  // stream is about to be destroyed: its kernels are waited for through an event recorded now
+  void stream_destroyed(cudaStream_t stream);
+  /**
+   * Wait until every kernel launched since token_started() has completed.
+   * @return milliseconds from the start of the token to the completion of its last kernel
+   */
+  double wait_completion();
+  // events created so far, the pool keeps it bounded by the number of streams used per token
+  size_t events_created() const;
+
+ private:
+  cudaEvent_t acquire_event();
+  pthread_mutex_t mutex_;  // launches race with measurement at token expiration
+  std::atomic<uint64_t> epoch_;  // tokens started and streams destroyed, a handle may be reused
+  std::vector<cudaStream_t> streams_;  // used since the token was granted
+  std::vector<cudaEvent_t> retired_;   // recorded on those of them destroyed since
+  std::vector<cudaEvent_t> pool_;      // idle events
+  cudaEvent_t start_;
+  bool started_;
+  size_t created_;
+};
+
+#endif
@@ -31,6 +31,8 @@
 #include <unistd.h>
 // #include <fcntl.h> 
 #include <string>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <chrono>
@@ -40,15 +42,20 @@
 #include <cstring>
 #include <functional>
 #include <map>
-#include <queue>
 #include <iostream>
 #include <fstream>
 #include "comm.h"
 #include "debug.h"
+#include "hook-server.h"
+#include "pod-quota.h"
+#include "pod-share.h"
+#include "request-pipeline.h"
+#include "token-channel.h"
 #include "util.h"
 std::ofstream myfile ("/tmp/pod.txt");
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
+using std::chrono::nanoseconds;
 using std::chrono::steady_clock;
 using std::chrono::time_point;
 using std::string;
@@ -57,34 +64,25 @@ using std::string;
 char SCHEDULER_IP[20] = "127.0.0.1";
 uint16_t SCHEDULER_PORT = 50051;
 uint16_t POD_SERVER_PORT = 50052;
+char SCHEDULER_SOCKET[PATH_MAX] = "";   // use unix domain socket if set
+char POD_SERVER_SOCKET[PATH_MAX] = "";  // use unix domain socket if set
 char* log_name = "/kubeshare/log/pod-manager.log";
 void sig_handler(int);
 
-// thread interact with scheduler
-void *scheduler_thread_send_func(void *sockfd);
-void *scheduler_thread_recv_func(void *sockfd);
-// service thread for each hook library
-void *hook_thread_func(void *sockfd);
-
-/* communication between scheduler thread and hook threads */
-enum actions {
-  KERNEL_LAUNCH,
-};
-struct request {
-  reqid_t req_id;
-  char *data;
-};
-std::queue<request> request_queue;
-uint32_t req_cnt = 0;
-pthread_mutex_t req_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t req_queue_cond = PTHREAD_COND_INITIALIZER;
-
-struct response {
-  void *data;
-};
-std::map<reqid_t, response> response_map;
-pthread_mutex_t rsp_map_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t rsp_map_cond = PTHREAD_COND_INITIALIZER;
+// serve a request of a hook library, quota requests may block
+size_t hook_handle_request(int sockfd, char *rbuf, char *sbuf);
+bool hook_request_blocks(char *rbuf);
+// accounting of a hook library connection
+void hook_connected(int sockfd);
+void hook_closed(int sockfd);
+// start a thread serving each hook that asks for quota through the token channel
+void *token_channel_func(void *args);
+void *token_slot_func(void *args);
+// reserve the next Pod quota before the current one runs short
+void *quota_reserve_func(void *args);
+
+/* communication between hook threads and scheduler */
+RequestPipeline scheduler_pipeline;
 
 /* global variables to store memory limit */
 size_t gpu_mem_limit = 0, gpu_mem_used = 0;
@@ -94,24 +92,18 @@ pthread_mutex_t mem_info_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* computation utilization */
 typedef time_point<steady_clock> quota_tp;
 double pod_overuse_ms = 0.0;
-std::map<int, double> client_burst_map;
+PodShares pod_shares;  // shares of each hook connection in the Pod quota
 pthread_mutex_t client_stat_mutex = PTHREAD_MUTEX_INITIALIZER;
 double pod_quota = 0.0;
 quota_tp quota_updated_tp;
-int quota_state = 0;  // 0 means usual state, 1 means someone is updating quota
-pthread_mutex_t quota_state_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t quota_state_cond = PTHREAD_COND_INITIALIZER;
-
-/* quota_state sync*/
-int kernel_launch_count = 0, sleeping_count = 0;
-pthread_mutex_t kernel_launch_count_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t sleeping_count_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t sleeping_count_cond = PTHREAD_COND_INITIALIZER;
-
-/*scheduler recv signal sync*/
-int scheduler_recv_sync = 0;
-pthread_mutex_t scheduler_recv_sync_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t scheduler_recv_sync_cond = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t quota_renew_mutex = PTHREAD_MUTEX_INITIALIZER;  // one renewal at a time
+pthread_cond_t quota_cond;  // a new Pod quota, with quota_renew_mutex, CLOCK_MONOTONIC
+uint64_t quota_generation = 0;  // new Pod quotas so far
+bool quota_reserving = false;   // a reservation waits for scheduler to grant it
+std::atomic<uint64_t> quota_requests(0);  // of hooks, tell whether the Pod uses its quota
+const double QUOTA_RESERVE_AHEAD = 2.0;  // ms, reservations are sent before the quota runs short
+token_channel_t *token_channel = nullptr;  // shared-memory channel, enabled by POD_MANAGER_SHM
+PodQuota pod_quota_state;  // deadline checked by hook threads, one of them renews at a time
 
 
 /* communication with scheduler */
@@ -178,7 +170,10 @@ int main(int argc, char *argv[]) {
   if (pod_server_port_str != NULL) {
     POD_SERVER_PORT = atoi(pod_server_port_str);
   }
-  INFO(log_name, __FILE__, (long)__LINE__, "Pod server port = %u.", POD_SERVER_PORT);
+  char *pod_server_socket_str = getenv("POD_MANAGER_SOCKET");
+  if (pod_server_socket_str != NULL) {
+    strncpy(POD_SERVER_SOCKET, pod_server_socket_str, PATH_MAX - 1);
+  }
 
   // scheduler
   char *scheduler_ip_envstr = getenv("SCHEDULER_IP");
@@ -189,28 +184,33 @@ int main(int argc, char *argv[]) {
   if (scheduler_port_envstr != NULL) {
     SCHEDULER_PORT = atoi(scheduler_port_envstr);
   }
-  INFO(log_name, __FILE__, (long)__LINE__, "scheduler %s:%u", SCHEDULER_IP, SCHEDULER_PORT);
+  char *scheduler_socket_envstr = getenv("SCHEDULER_SOCKET");
+  if (scheduler_socket_envstr != NULL) {
+    strncpy(SCHEDULER_SOCKET, scheduler_socket_envstr, PATH_MAX - 1);
+  }
+
+  char addr_str[PATH_MAX + 8];
+  comm_addr_t schd_info, server_info;
+  comm_resolve(&schd_info, SCHEDULER_SOCKET, SCHEDULER_IP, SCHEDULER_PORT);
+  comm_resolve(&server_info, POD_SERVER_SOCKET, nullptr, POD_SERVER_PORT);
+  INFO(log_name, __FILE__, (long)__LINE__, "Pod server = %s.",
+       comm_describe(&server_info, addr_str, sizeof(addr_str)));
+  INFO(log_name, __FILE__, (long)__LINE__, "scheduler %s",
+       comm_describe(&schd_info, addr_str, sizeof(addr_str)));
 
   /* establish connection with scheduler */
   // create socket
-  int schd_sockfd = socket(PF_INET, SOCK_STREAM, 0);
+  int schd_sockfd = comm_socket(&schd_info);
   if (schd_sockfd == -1) {
     int err = errno;
     ERROR(log_name, __FILE__, (long)__LINE__, "failed to create socket: %s", strerror(err));
     exit(err);
   }
 
-  // setup socket info
-  struct sockaddr_in schd_info;
-  bzero(&schd_info, sizeof(schd_info));
-  schd_info.sin_family = AF_INET;
-  schd_info.sin_addr.s_addr = inet_addr(SCHEDULER_IP);
-  schd_info.sin_port = htons(SCHEDULER_PORT);
-
   // connect to scheduler
   rc = multiple_attempt(
       [&]() -> int {
-        return connect(schd_sockfd, (struct sockaddr *)&schd_info, sizeof(schd_info));
+        return connect(schd_sockfd, (struct sockaddr *)&schd_info.addr, schd_info.len);
       },
       NET_OP_MAX_ATTEMPT, NET_OP_RETRY_INTV);
   if (rc != 0) exit(rc);
@@ -224,63 +224,49 @@ int main(int argc, char *argv[]) {
 
   /* accept connections from hook libraries */
   // create accept socket
-  int accept_sockfd = socket(PF_INET, SOCK_STREAM, 0);
+  int accept_sockfd = comm_socket(&server_info);
   if (accept_sockfd == -1) {
     ERROR(log_name, __FILE__, (long)__LINE__, "accept_socket == -1");
     exit(-1);
   }
 
-  // setup accept socket info
-  struct sockaddr_in server_info;
-  bzero(&server_info, sizeof(server_info));
-  server_info.sin_family = AF_INET;
-  server_info.sin_addr.s_addr = INADDR_ANY;
-  server_info.sin_port = htons(POD_SERVER_PORT);
-
   rc = multiple_attempt(
-      [&]() -> int {
-        return bind(accept_sockfd, (struct sockaddr *)&server_info, sizeof(server_info));
-      },
+      [&]() -> int { return comm_bind(accept_sockfd, &server_info); },
       NET_OP_MAX_ATTEMPT, NET_OP_RETRY_INTV);
   if (rc != 0) exit(rc);
   listen(accept_sockfd, SOMAXCONN);
 
-  // start scheduler threads
-  pthread_t schd_send_tid, schd_recv_tid;
-  pthread_create(&schd_send_tid, NULL, scheduler_thread_send_func, &schd_sockfd);
-  pthread_create(&schd_recv_tid, NULL, scheduler_thread_recv_func, &schd_sockfd);
-  pthread_detach(schd_send_tid);
-  pthread_detach(schd_recv_tid);
-
-  int client_sockfd = 0;
-  struct sockaddr_in client_info;
-  int addr_len = sizeof(client_info);
-
-  // wait for incoming connections
-  while ((client_sockfd =
-              accept(accept_sockfd, (struct sockaddr *)&client_info, (socklen_t *)&addr_len))) {
-    if (client_sockfd == -1) {
-      ERROR(log_name, __FILE__, (long)__LINE__, "accept() return -1");
-      break;
+  // hooks may renew quota through shared memory instead of the accept socket
+  char *token_channel_name = getenv("POD_MANAGER_SHM");
+  if (token_channel_name != NULL) {
+    token_channel = token_channel_create(token_channel_name);
+    if (token_channel == nullptr) {
+      ERROR(log_name, __FILE__, (long)__LINE__, "failed to create token channel %s: %s", token_channel_name,
+            strerror(errno));
+      exit(-1);
     }
+    INFO(log_name, __FILE__, (long)__LINE__, "token channel = %s.", token_channel_name);
+  }
 
-    // create allocation accounting entry
-    allocation_map.insert(std::make_pair(client_sockfd, 0));
-
-    // create client statistics entries
-    pthread_mutex_lock(&client_stat_mutex);
-    client_burst_map.insert(std::make_pair(client_sockfd, 0.0));
-    pthread_mutex_unlock(&client_stat_mutex);
-
-    // create a thread for each client
-    pthread_t tid;
-    int *sockfd = new int;
-    *sockfd = client_sockfd;
-    pthread_create(&tid, NULL, hook_thread_func, (void *)sockfd);
-    pthread_detach(tid);
+  // start scheduler threads
+  pthread_condattr_t attr_monotonic_clock;
+  pthread_condattr_init(&attr_monotonic_clock);
+  pthread_condattr_setclock(&attr_monotonic_clock, CLOCK_MONOTONIC);
+  pthread_cond_init(&quota_cond, &attr_monotonic_clock);
+  pthread_condattr_destroy(&attr_monotonic_clock);
+  scheduler_pipeline.start(schd_sockfd);
+  pthread_t quota_reserve_tid;
+  pthread_create(&quota_reserve_tid, NULL, quota_reserve_func, NULL);
+  pthread_detach(quota_reserve_tid);
+  if (token_channel != nullptr) {
+    pthread_t token_channel_tid;
+    pthread_create(&token_channel_tid, NULL, token_channel_func, NULL);
+    pthread_detach(token_channel_tid);
   }
 
-  return 0;
+  // serve hook libraries until epoll fails
+  HookServer hook_server(hook_handle_request, hook_request_blocks, hook_connected, hook_closed);
+  return hook_server.run(accept_sockfd);
 }
 
 void sig_handler(int sig) {
@@ -312,309 +298,322 @@ int hook_update_memory_usage(size_t mem_size, int allocate, int sockfd) {
   return ok;
 }
 
-// handle kernel launch request, return remaining quota time (ms)
-double hook_kernel_launch(int sockfd, double overuse_ms, double burst, char* client_name) {
-  pthread_mutex_lock(&kernel_launch_count_mutex);
-  kernel_launch_count+=1;
-  DEBUG(log_name, __FILE__, (long)__LINE__, "%s kernel launch, # %d", client_name, kernel_launch_count);
-  pthread_mutex_unlock(&kernel_launch_count_mutex);
-  // wait if someone else is working with quota
-  /*
-  while (true) {
-    pthread_mutex_lock(&quota_state_mutex);
-    if (quota_state == 0) {
-      pthread_mutex_unlock(&quota_state_mutex);
-      break;
-    } else {
-      DEBUG(log_name, __FILE__, (long)__LINE__, "wait for quota operation complete.");
-      pthread_cond_wait(&quota_state_cond, &quota_state_mutex);
-      pthread_mutex_unlock(&quota_state_mutex);
-    }
-  }
+/**
+ * Exchange the memory lease of a hook: take back released bytes, then lease the wanted bytes, or
+ * only the needed bytes under pressure. Nothing is leased if none is needed.
+ * @param want needed bytes plus the spare the hook keeps
+ * @param pressure set to whether the Pod memory left would not cover another spare after the
+ *        wanted bytes, so hooks keep no spare
+ * @return bytes leased, 0 if the needed bytes are not available
  */
-  pthread_mutex_lock(&quota_state_mutex);
-
-  while(quota_state != 0) {
-
-    pthread_mutex_lock(&sleeping_count_mutex);
-    sleeping_count+=1;
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s sleeping thread %d",client_name, sleeping_count);
-    pthread_mutex_unlock(&sleeping_count_mutex);
-
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s wait for quota operation complete. quota_state: %d", client_name, quota_state);
-    
-    int id = pthread_cond_wait(&quota_state_cond, &quota_state_mutex);
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s pthread_cond_wait stop , quota_state_cond success %d", client_name, id);
-    
+size_t hook_lease_memory(size_t need, size_t want, size_t release, int sockfd, int *pressure) {
+  size_t granted = 0;
+  pthread_mutex_lock(&mem_info_mutex);
+  release = std::min(release, allocation_map[sockfd]);
+  gpu_mem_used -= release;
+  allocation_map[sockfd] -= release;
+
+  size_t available = gpu_mem_limit - std::min(gpu_mem_used, gpu_mem_limit);
+  want = std::max(want, need);
+  *pressure = available < want + (want - need);
+  if (need == 0)
+    granted = 0;
+  else if (!*pressure)
+    granted = want;
+  else if (need <= available)
+    granted = need;
+  if (granted > 0) {
+    gpu_mem_used += granted;
+    allocation_map[sockfd] += granted;
   }
+  DEBUG(log_name, __FILE__, (long)__LINE__, "GPU memory usage = %ld bytes.", gpu_mem_used);
 
-  pthread_mutex_unlock(&quota_state_mutex);
-  // update Pod overuse time
-  pod_overuse_ms = std::max(overuse_ms, pod_overuse_ms);
+  pthread_mutex_unlock(&mem_info_mutex);
+  return granted;
+}
+
+// largest burst predicted by any hook of the Pod
+double pod_max_burst() {
+  double max_burst = pod_shares.max_burst();
+  if (token_channel != nullptr)
+    max_burst = std::max(max_burst, token_channel_max_burst(token_channel));
+  return max_burst;
+}
 
-  // update statistics for this client
+/**
+ * Build a quota request to scheduler, after reporting the quota used by each process since the
+ * last one. Caller holds quota_renew_mutex.
+ * @param type REQ_QUOTA or REQ_QUOTA_RESERVE
+ * @return request id
+ */
+reqid_t prepare_quota_request(char *sbuf, comm_request_t type) {
+  // calculate estimation values
+  double max_burst = pod_max_burst();
   pthread_mutex_lock(&client_stat_mutex);
-  client_burst_map[sockfd] = burst;
+  if (token_channel != nullptr)
+    pod_overuse_ms = std::max(pod_overuse_ms, token_channel_take_overuse(token_channel));
+  // overuse reported from now on is charged to the next request
+  double overuse_ms = pod_overuse_ms;
+  pod_overuse_ms = 0.0;
   pthread_mutex_unlock(&client_stat_mutex);
- 
-  quota_tp now_tp = steady_clock::now();
-  double elapsed_time = duration_cast<microseconds>(now_tp - quota_updated_tp).count() / 1e3;
-  // ask scheduler for quota if we are expected to go over quota
-  if (elapsed_time + burst > pod_quota) {
-    /* expired, request quota from scheduler */
-    char *sbuf;
-    reqid_t req_id;
-    bool complete = false;
-    size_t rpos = 0;
-    double max_burst = 0.0;
-
-    // update quota state: updating quota
-    pthread_mutex_lock(&quota_state_mutex);
-    quota_state = 1;
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s hook_kernel_launch: quota_state = 1, req_id %d", client_name, req_id);
-    pthread_mutex_unlock(&quota_state_mutex);
-
-    // calculate estimation values
-    pthread_mutex_lock(&client_stat_mutex);
-    for (auto x : client_burst_map) max_burst = std::max(x.second, max_burst);
-    pthread_mutex_unlock(&client_stat_mutex);
-
-    // place request into request queue
-    pthread_mutex_lock(&req_queue_mutex);
-    sbuf = new char[REQ_MSG_LEN];
+
+  // report quota used by each process since the last request
+  for (auto usage : pod_shares.take_usage()) {
     bzero(sbuf, REQ_MSG_LEN);
-    req_id = prepare_request(sbuf, REQ_QUOTA, pod_overuse_ms, max_burst);
-    request_queue.push({req_id, sbuf});
-    // wake scheduler thread up  
-    int ok = pthread_cond_signal(&req_queue_cond);
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s send signal & req_queue_cond %d, req_id %d", client_name, ok, req_id);
-    int check = pthread_mutex_unlock(&req_queue_mutex);
-    
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s unlock req_queue_mutex %d, req_id %d", client_name, check, req_id);
-
-    // wait for response
-    while (true) {
-      pthread_mutex_lock(&rsp_map_mutex);
-
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s check completed status %d, req_id %d", client_name, complete, req_id);
-
-      pthread_mutex_lock(&scheduler_recv_sync_mutex);
-      scheduler_recv_sync = 1;
-      pthread_cond_signal(&scheduler_recv_sync_cond);
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s scheduler_recv_sync %d, req_id %d", client_name, scheduler_recv_sync, req_id);
-      pthread_mutex_unlock(&scheduler_recv_sync_mutex);
-
-      pthread_cond_wait(&rsp_map_cond, &rsp_map_mutex);
-
-      pthread_mutex_lock(&scheduler_recv_sync_mutex);
-      scheduler_recv_sync = 0;
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s scheduler_recv_sync %d, req_id %d", client_name, scheduler_recv_sync, req_id);
-      pthread_mutex_unlock(&scheduler_recv_sync_mutex);
-
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s wait stop and completed status %d, req_id %d", client_name, complete, req_id);
-      
-      if (response_map.find(req_id) != response_map.end()) {
-        // request completed
-        complete = true;  // exit while loop
-        DEBUG(log_name, __FILE__, (long)__LINE__, "%s process data and completed status %d, req_id %d", client_name, complete, req_id);
-        // update quota information
-        pod_quota = get_msg_data<double>((char *)response_map[req_id].data, rpos);
-        quota_updated_tp = steady_clock::now();
-        elapsed_time = 0.0;
-        pod_overuse_ms = 0.0;
-
-        delete (double *)response_map[req_id].data;
-        response_map.erase(req_id);
-      }
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s processing response data done. completed status %d, req_id %d", client_name, complete,req_id);
-      pthread_mutex_unlock(&rsp_map_mutex);
-      if(complete) break;
-  
+    prepare_request(sbuf, REQ_PROCESS_USAGE, usage.first, usage.second);
+    scheduler_pipeline.post(sbuf);
+  }
+
+  bzero(sbuf, REQ_MSG_LEN);
+  return prepare_request(sbuf, type, overuse_ms, max_burst);
+}
+
+/**
+ * Publish the Pod quota to hook threads, token channel slot threads included. Caller holds
+ * quota_renew_mutex.
+ * @param renewed whether the quota is a new one, which is split among the hooks again
+ */
+void publish_pod_quota(bool renewed) {
+  uint64_t updated_ns = duration_cast<nanoseconds>(quota_updated_tp.time_since_epoch()).count();
+  pod_quota_state.publish(updated_ns, pod_quota);
+  if (!renewed) return;
+  // hook threads waiting for their share check the new deadline
+  pod_shares.split(pod_quota);
+  quota_generation++;
+  pthread_cond_broadcast(&quota_cond);
+}
+
+/**
+ * Ask scheduler for a new Pod quota, unless it has been renewed while waiting for another renewal.
+ * A reserved quota is waited for instead, it is granted when the current one expires.
+ * @param burst burst of the requester, used to check whether the quota is still short
+ */
+void renew_pod_quota(double burst, const char *client_name) {
+  char sbuf[REQ_MSG_LEN], rbuf[RSP_MSG_LEN];
+  reqid_t req_id;
+  size_t rpos = 0;
+  bool renewed = false;
+  auto quota_short = [&]() -> bool {
+    double elapsed_time =
+        duration_cast<microseconds>(steady_clock::now() - quota_updated_tp).count() / 1e3;
+    return elapsed_time + burst > pod_quota;
+  };
+
+  pthread_mutex_lock(&quota_renew_mutex);
+  while (quota_reserving && quota_short()) pthread_cond_wait(&quota_cond, &quota_renew_mutex);
+  if (quota_short()) {
+    // send request to scheduler and wait for its response
+    req_id = prepare_quota_request(sbuf, REQ_QUOTA);
+    if (!scheduler_pipeline.call(sbuf, req_id, rbuf)) {
+      ERROR(log_name, __FILE__, (long)__LINE__, "lost connection to scheduler.");
+      exit(-1);
     }
+    pod_quota = get_msg_data<double>(parse_response(rbuf, nullptr), rpos);
+    quota_updated_tp = steady_clock::now();
+    renewed = true;
     DEBUG(log_name, __FILE__, (long)__LINE__, "%s Success to process data, %d", client_name, req_id);
-    delete[] sbuf;
-
-    // update quota state and notify threads waiting on quota state
-    pthread_mutex_lock(&quota_state_mutex);
-
-    pthread_mutex_lock(&sleeping_count_mutex);
-    sleeping_count+=1;
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s sleeping thread (special) %d, req_id %d", client_name, sleeping_count, req_id);
-    pthread_mutex_unlock(&sleeping_count_mutex);
-
-    quota_state = 0;  // usual state
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s quota_state assign 0, req_id %d", client_name, req_id);
-    
-    pthread_mutex_lock(&sleeping_count_mutex);
-    while(sleeping_count < kernel_launch_count){
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s wait sleeping count >= kernel_launch_count, req_id %d", client_name, req_id);
-      pthread_cond_wait(&sleeping_count_cond, &sleeping_count_mutex);
-    }
-
-    int id = pthread_cond_broadcast(&quota_state_cond);
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s pthread_cond_broadcast %d, req_id %d", client_name, id, req_id);
-    
-    pthread_mutex_unlock(&sleeping_count_mutex);
-
-    pthread_mutex_lock(&sleeping_count_mutex);
-    sleeping_count = 0;
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s sleeping thread clear %d", client_name, sleeping_count);
-    pthread_mutex_unlock(&sleeping_count_mutex);
-    
-    pthread_mutex_unlock(&quota_state_mutex);
   }
-  
-  pthread_mutex_lock(&kernel_launch_count_mutex);
-  kernel_launch_count -= 1;
-  DEBUG(log_name, __FILE__, (long)__LINE__, "%s delete hook thread, remaing %d", client_name, kernel_launch_count);
-  pthread_mutex_unlock(&kernel_launch_count_mutex);
+  publish_pod_quota(renewed);
+  pthread_mutex_unlock(&quota_renew_mutex);
+}
+
+// handle kernel launch request, return the quota time (ms) granted to this client
+double hook_kernel_launch(int sockfd, double overuse_ms, double burst, char* client_name) {
+  quota_requests++;
+  // update Pod overuse time and statistics for this client
+  pthread_mutex_lock(&client_stat_mutex);
+  pod_overuse_ms = std::max(overuse_ms, pod_overuse_ms);
+  pthread_mutex_unlock(&client_stat_mutex);
+  pod_shares.report(sockfd, burst, overuse_ms);
 
-  return pod_quota - elapsed_time;
+  while (true) {
+    // ask scheduler for quota if what this client may run is expected to go over quota
+    double fit = pod_shares.fit(sockfd, burst);
+    double remain = pod_quota_state.acquire(fit, [&] { renew_pod_quota(fit, client_name); });
+    uint64_t round;
+    double granted = pod_shares.take(sockfd, remain, &round);
+    if (granted > 0.0) return granted;
+    if (granted < 0.0) return 0.0;  // the hook is gone, no one reads the response
+    // others still have shares to run, wait for them or for the quota to run out
+    pod_shares.wait(round, remain);
+  }
 }
 
-// a thread interact with a hook library
-void *hook_thread_func(void *args) {
-  DEBUG(log_name, __FILE__, (long)__LINE__, "hook thread started.");
-  INFO(log_name, __FILE__, (long)__LINE__, "hook thread started.");
-  int sockfd = *((int *)args);
-  char rbuf[REQ_MSG_LEN], sbuf[RSP_MSG_LEN];
-  char  *client_name;
+bool hook_request_blocks(char *rbuf) {
+  comm_request_t req;
+  parse_request(rbuf, nullptr, nullptr, nullptr, &req);
+  return req == REQ_QUOTA;
+}
 
-  
-  //bzero(rbuf, REQ_MSG_LEN);
-  ssize_t rc;
-  int recv_zero_times = 0;
-  while (recv_zero_times <= 5) {
-    if((rc = recv(sockfd, rbuf, REQ_MSG_LEN, 0)) <= 0){
-      recv_zero_times++;
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s hook_thread_func recv - len <= 0, cnt %ld", client_name, recv_zero_times);
-      continue;
-    } 
-    comm_request_t req;
-    reqid_t rid;
-    size_t pos = 0;  // attached data reading position
-    size_t len = 0;  // length of sending data
-    
-    char *attached = parse_request(rbuf, &client_name, nullptr, &rid, &req);
-
-    bzero(sbuf, RSP_MSG_LEN);
-    if (req == REQ_MEM_LIMIT) {
-      // send gpu_mem_used and gpu_mem_limit to hook library
-      len = prepare_response(sbuf, REQ_MEM_LIMIT, rid, gpu_mem_used, gpu_mem_limit);
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s hook_thread_func recv - REQ_MEM_LIMIT, %ld", client_name, rid);
-    } else if (req == REQ_MEM_UPDATE) {
-      // update memory usage
-      size_t mem_size = get_msg_data<size_t>(attached, pos);
-      int allocate = get_msg_data<int>(attached, pos);
-      int ok = hook_update_memory_usage(mem_size, allocate, sockfd);
-      len = prepare_response(sbuf, REQ_MEM_UPDATE, rid, ok);
-     DEBUG(log_name, __FILE__, (long)__LINE__, "%s hook_thread_func recv - REQ_MEM_UPDATE, %ld", client_name, rid);
-    } else if (req == REQ_QUOTA) {
-      // check if there is available quota
-      double overuse_ms = get_msg_data<double>(attached, pos);
-      double burst = get_msg_data<double>(attached, pos);
-      
-      double quota_remain = hook_kernel_launch(sockfd, overuse_ms, burst, client_name);
-      
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s hook_thread_func recv - REQ_QUOTA, %ld", client_name, rid);
-      // return remaining quota time
-      len = prepare_response(sbuf, REQ_QUOTA, rid, quota_remain);
-    }
-    
-    if (len > 0) {
-      // have message to send
-      if (send(sockfd, sbuf, RSP_MSG_LEN, 0) == -1) {
-        ERROR(log_name, __FILE__, (long)__LINE__, "failed to send message to hook library!");
-      }
-      DEBUG(log_name, __FILE__, (long)__LINE__, "%s hook_thread_func send, %ld", client_name ,rid);
-    }
+// handle a request of a hook library, return the length of the response, 0 if none is sent
+size_t hook_handle_request(int sockfd, char *rbuf, char *sbuf) {
+  comm_request_t req;
+  reqid_t rid;
+  char *client_name;
+  size_t pos = 0;  // attached data reading position
+  size_t len = 0;  // length of sending data
+
+  char *attached = parse_request(rbuf, &client_name, nullptr, &rid, &req);
+  if (req == REQ_MEM_LIMIT) {
+    // send gpu_mem_used and gpu_mem_limit to hook library
+    len = prepare_response(sbuf, REQ_MEM_LIMIT, rid, gpu_mem_used, gpu_mem_limit);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s recv - REQ_MEM_LIMIT, %ld", client_name, rid);
+  } else if (req == REQ_MEM_UPDATE) {
+    // update memory usage
+    size_t mem_size = get_msg_data<size_t>(attached, pos);
+    int allocate = get_msg_data<int>(attached, pos);
+    int ok = hook_update_memory_usage(mem_size, allocate, sockfd);
+    len = prepare_response(sbuf, REQ_MEM_UPDATE, rid, ok);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s recv - REQ_MEM_UPDATE, %ld", client_name, rid);
+  } else if (req == REQ_PROCESS_INFO) {
+    int pid = get_msg_data<int>(attached, pos);
+    double weight = get_msg_data<double>(attached, pos);
+    pod_shares.set_process(sockfd, pid, weight);
+    len = prepare_response(sbuf, REQ_PROCESS_INFO, rid);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s recv - REQ_PROCESS_INFO, pid %d weight %.2f",
+          client_name, pid, weight);
+  } else if (req == REQ_MEM_LEASE) {
+    size_t need = get_msg_data<size_t>(attached, pos);
+    size_t want = get_msg_data<size_t>(attached, pos);
+    size_t release = get_msg_data<size_t>(attached, pos);
+    int pressure;
+    size_t granted = hook_lease_memory(need, want, release, sockfd, &pressure);
+    len = prepare_response(sbuf, REQ_MEM_LEASE, rid, granted, pressure);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s recv - REQ_MEM_LEASE, %ld", client_name, rid);
+  } else if (req == REQ_QUOTA) {
+    // check if there is available quota
+    double overuse_ms = get_msg_data<double>(attached, pos);
+    double burst = get_msg_data<double>(attached, pos);
+    double quota_remain = hook_kernel_launch(sockfd, overuse_ms, burst, client_name);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s recv - REQ_QUOTA, %ld", client_name, rid);
+    // return remaining quota time
+    len = prepare_response(sbuf, REQ_QUOTA, rid, quota_remain);
   }
-  
-  INFO(log_name, __FILE__, (long)__LINE__, "%s connetion closed by peer. recv() returns %ld.", client_name, rc);
-  // since hook library close socket only when process terminated, we can use this as an indicator
-  // of process termination, and recover memory usage
+  return len;
+}
+
+void hook_connected(int sockfd) {
+  // create allocation accounting entry
+  pthread_mutex_lock(&mem_info_mutex);
+  allocation_map[sockfd] = 0;
+  pthread_mutex_unlock(&mem_info_mutex);
+
+  // create client statistics entries
+  pod_shares.join(sockfd);
+}
+
+// since hook library close socket only when process terminated, we can use this as an indicator
+// of process termination, and recover memory usage
+void hook_closed(int sockfd) {
   pthread_mutex_lock(&mem_info_mutex);
   gpu_mem_used -= allocation_map[sockfd];
   allocation_map.erase(sockfd);
   DEBUG(log_name, __FILE__, (long)__LINE__, "GPU memory usage = %ld bytes.", gpu_mem_used);
-  
   pthread_mutex_unlock(&mem_info_mutex);
 
-  pthread_mutex_lock(&client_stat_mutex);
-  client_burst_map.erase(sockfd);
-  pthread_mutex_unlock(&client_stat_mutex);
+  pod_shares.leave(sockfd);
+}
 
-  close(sockfd);
-  delete (int *)args;
+/**
+ * Once what is left of a Pod quota only fits the predicted bursts, reserve the quota to follow it,
+ * if hooks asked for quota since the last reservation. Scheduler grants the reservation when the
+ * current quota expires, so an active Pod gets quotas back to back instead of waiting for a round
+ * trip to scheduler after each.
+ */
+void *quota_reserve_func(void *args) {
+  char sbuf[REQ_MSG_LEN], rbuf[RSP_MSG_LEN];
+  uint64_t settled = 0;  // generation of the quota whose follow-up was reserved or skipped
+  uint64_t seen = 0;     // hook requests up to the last reservation
+  pthread_mutex_lock(&quota_renew_mutex);
+  while (true) {
+    quota_tp deadline = quota_updated_tp + microseconds((long long)(pod_quota * 1e3));
+    double left = duration_cast<microseconds>(deadline - steady_clock::now()).count() / 1e3;
+    double ahead = pod_max_burst() + QUOTA_RESERVE_AHEAD;
+    if (settled == quota_generation || left <= 0.0) {
+      pthread_cond_wait(&quota_cond, &quota_renew_mutex);
+      continue;
+    }
+    if (left > ahead) {
+      // steady_clock is CLOCK_MONOTONIC
+      int64_t wake_ns = duration_cast<nanoseconds>(deadline.time_since_epoch()).count() -
+                        (int64_t)(ahead * 1e6);
+      struct timespec ts = {(time_t)(wake_ns / 1000000000), (long)(wake_ns % 1000000000)};
+      pthread_cond_timedwait(&quota_cond, &quota_renew_mutex, &ts);
+      continue;
+    }
+    settled = quota_generation;
+    uint64_t requests = quota_requests.load();
+    if (token_channel != nullptr) requests += token_channel_acquires(token_channel);
+    if (requests == seen) continue;  // the Pod is idle, let the quota expire
+    seen = requests;
+
+    reqid_t req_id = prepare_quota_request(sbuf, REQ_QUOTA_RESERVE);
+    quota_reserving = true;
+    pthread_mutex_unlock(&quota_renew_mutex);
+    bool ok = scheduler_pipeline.call(sbuf, req_id, rbuf);
+    pthread_mutex_lock(&quota_renew_mutex);
+    quota_reserving = false;
+    if (!ok) {
+      ERROR(log_name, __FILE__, (long)__LINE__, "lost connection to scheduler.");
+      exit(-1);
+    }
+    size_t rpos = 0;
+    double reserved = get_msg_data<double>(parse_response(rbuf, nullptr), rpos);
+    if (reserved <= 0.0) continue;  // taken over by a quota request, which brings the quota
+    pod_quota = reserved;
+    // the reserved quota follows the current one, which nothing renews while it is reserved
+    quota_updated_tp = std::max(steady_clock::now(), deadline);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "reserved quota %.3f ms, %.3f ms left before",
+          pod_quota, duration_cast<microseconds>(deadline - steady_clock::now()).count() / 1e3);
+    publish_pod_quota(true);
+  }
   pthread_exit(NULL);
 }
 
-// forward requests to scheduler
-void *scheduler_thread_send_func(void *args) {
-  DEBUG(log_name, __FILE__, (long)__LINE__, "scheduler_thread_send_func");
-  int sockfd = *((int *)args);
-  ssize_t send_rc;
-  /* waiting for request from hook threads */
+// start a slot thread the first time the hook in a slot asks for quota through the token channel
+void *token_channel_func(void *args) {
+  DEBUG(log_name, __FILE__, (long)__LINE__, "token_channel_func");
+  bool serving[TOKEN_CHANNEL_SLOTS] = {};
+  uint32_t seen = 0;  // requests made before this thread starts are still served
   while (true) {
-    pthread_mutex_lock(&req_queue_mutex);
-
-    pthread_cond_wait(&req_queue_cond, &req_queue_mutex);
-    if (!request_queue.empty()) {
-      // process request
-      request req = request_queue.front();
-      request_queue.pop();
-
-      if ((send_rc = send(sockfd, req.data, REQ_MSG_LEN, 0)) <= 0) {
-        ERROR(log_name, __FILE__, (long)__LINE__, "failed to send request to scheduler! return code %ld.", send_rc);
-      } else {
-        DEBUG(log_name, __FILE__, (long)__LINE__, "scheduler_thread_send_func recv > 0, %ld", send_rc);
-        DEBUG(log_name, __FILE__, (long)__LINE__, "send a kernel launch request, req_id: %d", req.req_id);
-      }
+    seen = token_channel_wait_request(token_channel, seen);
+    for (int slot = 0; slot < TOKEN_CHANNEL_SLOTS; slot++) {
+      if (serving[slot] || token_channel->slots[slot].request_seq.load() == 0) continue;
+      pthread_t tid;
+      pthread_create(&tid, NULL, token_slot_func, (void *)(intptr_t)slot);
+      pthread_detach(tid);
+      serving[slot] = true;
     }
-    pthread_mutex_unlock(&req_queue_mutex);
   }
   pthread_exit(NULL);
 }
 
-// receive response from scheduler and place responded data into response_map
-void *scheduler_thread_recv_func(void *args) {
-  int sockfd = *((int *)args);
-
-  char buf[RSP_MSG_LEN], *attached;
-  ssize_t rc;
-  DEBUG(log_name, __FILE__, (long)__LINE__, "scheduler_thread_recv_func");
-
-  //bzero(buf, RSP_MSG_LEN);
-  while (true){  
-    while ((rc = recv(sockfd, buf, RSP_MSG_LEN, 0)) > 0) {
-      
-      // process response
-      // read response data into another buffer
-      reqid_t req_id;
-      response rsp;
-
-      attached = parse_response(buf, &req_id);
-      rsp.data = new char[RSP_MSG_LEN - sizeof(reqid_t)];
-      memcpy(rsp.data, attached, RSP_MSG_LEN - sizeof(reqid_t));
-      DEBUG(log_name, __FILE__, (long)__LINE__, "scheduler_thread_recv_func recv > 0, req_id %ld", req_id);
-      DEBUG(log_name, __FILE__, (long)__LINE__, "req_id %d complete.", req_id);
-      
-      pthread_mutex_lock(&scheduler_recv_sync_mutex);
-      while(scheduler_recv_sync == 0){
-        DEBUG(log_name, __FILE__, (long)__LINE__, "scheduler_thread_recv_func scheduler_recv_sync == 0, req_id %ld",  req_id);
-        pthread_cond_wait(&scheduler_recv_sync_cond, &scheduler_recv_sync_mutex);
-      }
-      pthread_mutex_unlock(&scheduler_recv_sync_mutex);
-
-      // put response data into response_map and notify hook threads
-      pthread_mutex_lock(&rsp_map_mutex);
-      response_map.insert(std::make_pair(req_id, rsp));
-      int ok = pthread_cond_signal(&rsp_map_cond);
-      DEBUG(log_name, __FILE__, (long)__LINE__, "scheduler_thread_recv_func signal %d, req_id %ld", ok, req_id);
-      pthread_mutex_unlock(&rsp_map_mutex);
+/**
+ * Grant the hook in a token channel slot its share of the Pod quota, as hook_kernel_launch() does
+ * for a hook asking through its socket. The hook is found by the pid it registered; until it has,
+ * it gets what is left of the Pod quota.
+ * @param args the slot
+ */
+void *token_slot_func(void *args) {
+  int slot = (int)(intptr_t)args;
+  token_slot_t &s = token_channel->slots[slot];
+  char client_name[32];
+  snprintf(client_name, sizeof(client_name), "token slot %d", slot);
+  DEBUG(log_name, __FILE__, (long)__LINE__, "token_slot_func: %s", client_name);
+  uint32_t seen = 0;
+  while (true) {
+    seen = token_channel_wait_slot(token_channel, slot, seen);
+    double burst = s.burst_ns.load(std::memory_order_relaxed) / 1e6;
+    double overuse_ms = s.overuse_ns.load(std::memory_order_relaxed) / 1e6;
+    int client = pod_shares.client_of(s.pid.load(std::memory_order_relaxed));
+    double granted;
+    if (client >= 0) {
+      granted = hook_kernel_launch(client, overuse_ms, burst, client_name);
+    } else {
+      quota_requests++;
+      granted = pod_quota_state.acquire(burst, [&] { renew_pod_quota(burst, client_name); });
     }
+    token_channel_grant(token_channel, slot, granted);
   }
-  WARNING(log_name, __FILE__, (long)__LINE__, "connection closed by scheduler. recv() returns %ld.", rc);
-  close(sockfd);
   pthread_exit(NULL);
-}
\ No newline at end of file
+}
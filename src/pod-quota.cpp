@@ -0,0 +1,65 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pod-quota.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <climits>
+#include <ctime>
+
+static int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+static int futex_wake(std::atomic<uint32_t> *addr, int count) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+PodQuota::PodQuota() : deadline_ns_(0), epoch_(0) {}
+
+double PodQuota::acquire(double burst_ms, const std::function<void()> &renew) {
+  int64_t burst_ns = burst_ms * 1e6;
+  while (true) {
+    uint32_t epoch = epoch_.load(std::memory_order_acquire);
+    int64_t now = now_ns(), deadline = deadline_ns_.load(std::memory_order_acquire);
+    if (now + burst_ns <= deadline) return (deadline - now) / 1e6;
+
+    if (!(epoch & 1) && epoch_.compare_exchange_strong(epoch, epoch + 1)) {
+      renew();
+      epoch_.store(epoch + 2, std::memory_order_release);
+      futex_wake(&epoch_, INT_MAX);
+      // the renewing thread takes what it got, like a single request to scheduler would
+      return (deadline_ns_.load(std::memory_order_acquire) - now_ns()) / 1e6;
+    }
+    // another thread is renewing (epoch is reloaded by a failed exchange)
+    while (epoch & 1 && epoch_.load(std::memory_order_acquire) == epoch) futex_wait(&epoch_, epoch);
+  }
+}
+
+void PodQuota::publish(uint64_t updated_ns, double quota_ms) {
+  deadline_ns_.store((int64_t)updated_ns + (int64_t)(quota_ms * 1e6), std::memory_order_release);
+}
+
+uint32_t PodQuota::renewals() const { return epoch_.load(std::memory_order_relaxed) / 2; }
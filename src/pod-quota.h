@@ -0,0 +1,49 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef POD_QUOTA_H
+#define POD_QUOTA_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+/**
+ * Pod quota as seen by the Pod manager threads serving hook libraries. Checking it is a load of
+ * the deadline. When a burst does not fit, the first thread to make the epoch odd renews the quota
+ * and the others sleep on the epoch (futex) until it is even again, then check once more.
+ */
+class PodQuota {
+ public:
+  PodQuota();
+  /**
+   * Remaining quota for a burst, renewing the quota if the burst does not fit.
+   * @param burst_ms predicted duration of the next kernel burst
+   * @param renew asks for a new quota and publish()es it, run by one thread at a time
+   * @return remaining quota (ms)
+   */
+  double acquire(double burst_ms, const std::function<void()> &renew);
+  // a quota of quota_ms was granted at updated_ns (CLOCK_MONOTONIC)
+  void publish(uint64_t updated_ns, double quota_ms);
+  // renewals run through acquire() so far
+  uint32_t renewals() const;
+
+ private:
+  std::atomic<int64_t> deadline_ns_;  // CLOCK_MONOTONIC, before a burst has to fit
+  std::atomic<uint32_t> epoch_;       // futex word, odd while a renewal is in progress
+};
+
+#endif
@@ -0,0 +1,241 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pod-share.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+PodShares::PodShares() : round_(1) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&cond_, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&mutex_, nullptr);
+}
+
+void PodShares::join(int client) {
+  pthread_mutex_lock(&mutex_);
+  clients_[client] = client_t();
+  pthread_mutex_unlock(&mutex_);
+}
+
+void PodShares::set_process(int client, int pid, double weight) {
+  pthread_mutex_lock(&mutex_);
+  client_t &c = clients_[client];
+  c.pid = pid;
+  c.weight = weight > 0.0 ? weight : 1.0;
+  pthread_mutex_unlock(&mutex_);
+}
+
+void PodShares::leave(int client) {
+  pthread_mutex_lock(&mutex_);
+  auto it = clients_.find(client);
+  if (it != clients_.end()) {
+    if (it->second.unreported > 0.0) departed_[it->second.pid] += it->second.unreported;
+    clients_.erase(it);
+  }
+  // its share may have kept others waiting
+  pthread_cond_broadcast(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+int PodShares::client_of(int pid) {
+  int client = -1;
+  pthread_mutex_lock(&mutex_);
+  for (auto &it : clients_) {
+    if (it.second.pid == pid) {
+      client = it.first;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return client;
+}
+
+void PodShares::report(int client, double burst, double overuse_ms) {
+  pthread_mutex_lock(&mutex_);
+  auto found = clients_.find(client);
+  if (found == clients_.end()) {
+    // the hook is gone while its request was on the way
+    pthread_mutex_unlock(&mutex_);
+    return;
+  }
+  client_t &c = found->second;
+  c.burst = burst;
+  c.used += overuse_ms;
+  c.unreported += overuse_ms;
+  c.active = true;
+  c.requesting = true;
+  pthread_mutex_unlock(&mutex_);
+}
+
+double PodShares::max_burst() {
+  double max_burst = 0.0;
+  pthread_mutex_lock(&mutex_);
+  for (auto &it : clients_) max_burst = std::max(max_burst, it.second.burst);
+  pthread_mutex_unlock(&mutex_);
+  return max_burst;
+}
+
+void PodShares::split_locked(double total, const std::vector<client_t *> &members) {
+  round_++;
+  for (client_t *m : members) {
+    m->used = std::max(0.0, m->used - m->budget);  // overuse is charged to the next share
+    m->budget = 0.0;
+    m->round = round_;
+  }
+
+  // members whose burst is below their weighted share get their burst, until none is left
+  std::vector<client_t *> open(members);
+  double rest = std::max(total, 0.0);
+  bool capped = true;
+  while (capped && !open.empty()) {
+    capped = false;
+    double weights = 0.0, fair_unit;
+    for (client_t *m : open) weights += m->weight;
+    fair_unit = rest / weights;
+    for (auto it = open.begin(); it != open.end();) {
+      if ((*it)->burst > 0.0 && (*it)->burst <= fair_unit * (*it)->weight) {
+        (*it)->budget = (*it)->burst;
+        rest -= (*it)->burst;
+        it = open.erase(it);
+        capped = true;
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // the rest goes by weight, to every member if all bursts are met
+  const std::vector<client_t *> &takers = open.empty() ? members : open;
+  double weights = 0.0;
+  for (client_t *m : takers) weights += m->weight;
+  for (client_t *m : takers) m->budget += rest * m->weight / weights;
+  pthread_cond_broadcast(&cond_);
+}
+
+void PodShares::split(double quota_ms) {
+  pthread_mutex_lock(&mutex_);
+  std::vector<client_t *> members;
+  for (auto &it : clients_)
+    if (it.second.active) members.push_back(&it.second);
+  if (members.empty())
+    for (auto &it : clients_) members.push_back(&it.second);
+  for (auto &it : clients_) it.second.active = false;
+  split_locked(quota_ms, members);
+  pthread_mutex_unlock(&mutex_);
+}
+
+double PodShares::fit(int client, double burst) {
+  double fit = burst;
+  pthread_mutex_lock(&mutex_);
+  auto it = clients_.find(client);
+  if (it != clients_.end() && it->second.round == round_)
+    fit = std::min(burst, std::max(it->second.budget - it->second.used, 0.0));
+  pthread_mutex_unlock(&mutex_);
+  return fit;
+}
+
+bool PodShares::others_can_run(const client_t *self, double pod_remain_ms) {
+  for (auto &it : clients_) {
+    const client_t &c = it.second;
+    if (&c == self || c.round != round_) continue;
+    // an idle client may not come back under this quota
+    if (!c.requesting && c.taken != round_) continue;
+    double left = c.budget - c.used;
+    if (left > 0.0 && left >= std::min(c.burst, pod_remain_ms)) return true;
+  }
+  return false;
+}
+
+double PodShares::take(int client, double pod_remain_ms, uint64_t *round) {
+  pthread_mutex_lock(&mutex_);
+  auto found = clients_.find(client);
+  if (found == clients_.end()) {
+    pthread_mutex_unlock(&mutex_);
+    return -1.0;
+  }
+  client_t &c = found->second;
+  c.active = true;
+  std::vector<client_t *> members;
+  if (c.round != round_) {
+    // joining a split in progress: the unspent shares are split again, including this client
+    double unspent = 0.0;
+    for (auto &it : clients_) {
+      if (it.second.round != round_) continue;
+      members.push_back(&it.second);
+      unspent += std::max(it.second.budget - it.second.used, 0.0);
+    }
+    if (members.empty()) unspent = pod_remain_ms;
+    c.budget = 0.0;
+    members.push_back(&c);
+    split_locked(std::min(unspent, pod_remain_ms), members);
+  }
+
+  double left = c.budget - c.used;
+  if (left <= 0.0) {
+    if (others_can_run(&c, pod_remain_ms)) {
+      *round = round_;
+      pthread_mutex_unlock(&mutex_);
+      return 0.0;
+    }
+    // no busy client can run a burst on its share, split the rest of the Pod quota again
+    members.clear();
+    for (auto &it : clients_)
+      if (it.second.round == round_) members.push_back(&it.second);
+    split_locked(pod_remain_ms, members);
+    left = c.budget - c.used;
+  }
+
+  double granted = std::max(std::min(left, pod_remain_ms), 0.0);
+  c.used += granted;
+  c.unreported += granted;
+  if (granted > 0.0) {
+    c.requesting = false;
+    c.taken = round_;
+  }
+  *round = round_;
+  pthread_mutex_unlock(&mutex_);
+  return granted;
+}
+
+void PodShares::wait(uint64_t round, double timeout_ms) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  double nsec = ts.tv_nsec + std::max(timeout_ms, 0.0) * 1e6;
+  ts.tv_sec += (time_t)(nsec / 1e9);
+  ts.tv_nsec = (long)fmod(nsec, 1e9);
+
+  pthread_mutex_lock(&mutex_);
+  if (round_ == round && timeout_ms > 0.0) pthread_cond_timedwait(&cond_, &mutex_, &ts);
+  pthread_mutex_unlock(&mutex_);
+}
+
+std::vector<std::pair<int, double>> PodShares::take_usage() {
+  std::map<int, double> usage;
+  pthread_mutex_lock(&mutex_);
+  usage.swap(departed_);
+  for (auto &it : clients_) {
+    if (it.second.unreported <= 0.0) continue;
+    usage[it.second.pid] += it.second.unreported;
+    it.second.unreported = 0.0;
+  }
+  pthread_mutex_unlock(&mutex_);
+  return std::vector<std::pair<int, double>>(usage.begin(), usage.end());
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef POD_SHARE_H
+#define POD_SHARE_H
+
+#include <pthread.h>
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+/**
+ * Splits each Pod quota among the hook processes of the Pod. A split gives every active process a
+ * weighted max-min fair share of the quota: processes whose predicted burst is below their
+ * weighted share get their burst, the rest is divided by weight. A process is granted what is left
+ * of its share; once it is used up, the process waits while others that are busy, with a request in
+ * flight or quota taken under the current split, can still run a burst on theirs. When none can,
+ * the rest of the quota is split again among the same processes, so that shares of idle processes
+ * are not held back. Processes that made no request under the previous quota get no share of the
+ * next one until they ask.
+ */
+class PodShares {
+ public:
+  PodShares();
+  // a hook library connected as client
+  void join(int client);
+  // the client is process pid with weight, weight <= 0 means 1
+  void set_process(int client, int pid, double weight);
+  void leave(int client);
+  // client that is process pid, -1 if none identified itself so
+  int client_of(int pid);
+  // a request of the client came with its predicted burst and the overuse it reported, which is
+  // charged to its share; ignored once the client left
+  void report(int client, double burst, double overuse_ms);
+  // largest predicted burst of any client
+  double max_burst();
+  // split a new Pod quota among the clients active under the previous one
+  void split(double quota_ms);
+  // what the client can run of its burst on its share
+  double fit(int client, double burst);
+  /**
+   * Take what is left of the share of client.
+   * @param pod_remain_ms what is left of the Pod quota
+   * @param round set to the current split, to wait() for the next one
+   * @return quota granted (ms), 0 if the client has to wait for another split, negative if the
+   *         client left
+   */
+  double take(int client, double pod_remain_ms, uint64_t *round);
+  // wait until the split after round, a client leaves, or timeout_ms
+  void wait(uint64_t round, double timeout_ms);
+  // quota used (ms) by each process since the last call, by pid; 0 for processes not identified
+  std::vector<std::pair<int, double>> take_usage();
+
+ private:
+  struct client_t {
+    int pid = 0;
+    double weight = 1.0;
+    double burst = 0.0;       // predicted, 0 if unknown
+    double budget = 0.0;      // share of the current split
+    double used = 0.0;        // of budget, may exceed it by overuse
+    double unreported = 0.0;  // used since the last take_usage()
+    uint64_t round = 0;       // split the client has a share of, 0 if none
+    uint64_t taken = 0;       // split the client was last granted quota under
+    bool requesting = false;  // a request is in flight
+    bool active = false;      // made a request under the current Pod quota
+  };
+  // split total among members of a new round
+  void split_locked(double total, const std::vector<client_t *> &members);
+  // whether a busy client other than self can still run a burst on its share
+  bool others_can_run(const client_t *self, double pod_remain_ms);
+
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;  // CLOCK_MONOTONIC
+  std::map<int, client_t> clients_;
+  std::map<int, double> departed_;  // usage not reported of processes gone, by pid
+  uint64_t round_;
+};
+
+#endif
@@ -64,6 +64,7 @@ void RecordKeeper::clear() { records_.clear(); }
 Predictor::Predictor(const char *name, const double thres)
     : MERGE_THRES(thres), normal_records(PREDICT_MAX_KEEP), long_records(PREDICT_MAX_KEEP) {
   mutex_ = PTHREAD_MUTEX_INITIALIZER;
+  active_ = false;
   period_begin_ = timepoint_t::max();
   long_period_begin_ = timepoint_t::max();
   long_period_end_ = timepoint_t::min();
@@ -85,6 +86,7 @@ void Predictor::record_stop() {
   double duration;
   timepoint_t tp;
   char* log_name = "/kubeshare/log/predictor.log";
+  if (!active_.load(std::memory_order_acquire)) return;  // no period to stop
   pthread_mutex_lock(&mutex_);
   if (ongoing_unmerged()) {
     // record duration
@@ -97,6 +99,7 @@ void Predictor::record_stop() {
     hDEBUG(log_name, __FILE__, (long)__LINE__, "%s: record stop (length: %.3f ms)", name_, duration);
   }
   period_begin_ = timepoint_t::max();
+  active_.store(false, std::memory_order_release);
   pthread_mutex_unlock(&mutex_);
 #endif
 }
@@ -106,9 +109,11 @@ void Predictor::record_start() {
 #ifndef NO_PREDICT
   double intv;
   char* log_name = "/kubeshare/log/predictor.log";
+  if (active_.load(std::memory_order_acquire)) return;  // already started
   pthread_mutex_lock(&mutex_);
   if (!ongoing_unmerged()) {
     period_begin_ = steady_clock::now();
+    active_.store(true, std::memory_order_release);
 
     intv = duration_cast<microseconds>(period_begin_ - long_period_end_).count() / 1e3;
     // long period did not started || last long period too long ago
@@ -130,6 +135,7 @@ void Predictor::interrupt() {
   char* log_name = "/kubeshare/log/predictor.log";
   pthread_mutex_lock(&mutex_);
   period_begin_ = timepoint_t::max();
+  active_.store(false, std::memory_order_release);
   long_period_begin_ = timepoint_t::max();
   long_period_end_ = timepoint_t::min();
   hDEBUG(log_name, __FILE__, (long)__LINE__, "%s: interrupted", name_);
@@ -179,6 +185,7 @@ void Predictor::reset() {
   normal_records.clear();
   long_records.clear();
   period_begin_ = timepoint_t::max();
+  active_.store(false, std::memory_order_release);
   long_period_begin_ = timepoint_t::max();
   long_period_end_ = timepoint_t::min();
   pthread_mutex_unlock(&mutex_);
@@ -19,6 +19,7 @@
 
 #include <pthread.h>
 
+#include <atomic>
 #include <chrono>
 #include <deque>
 
@@ -58,6 +59,8 @@ class Predictor {
   // two consecutive period with interval less than this value will be merged
   const double MERGE_THRES;
   pthread_mutex_t mutex_;
+  // whether a period is ongoing, so that the calls repeated on every launch skip mutex_
+  std::atomic<bool> active_;
   timepoint_t period_begin_;
   timepoint_t long_period_begin_, long_period_end_;
   RecordKeeper normal_records, long_records;
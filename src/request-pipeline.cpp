@@ -0,0 +1,178 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "request-pipeline.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "debug.h"
+
+extern char *log_name;
+
+// responses read with one recv() at most
+static const size_t RECV_BATCH = 64;
+
+RequestPipeline::RequestPipeline() : sockfd_(-1), closed_(false) {
+  pthread_mutex_init(&mutex_, nullptr);
+  pthread_cond_init(&outbox_cond_, nullptr);
+}
+
+void RequestPipeline::start(int sockfd) {
+  sockfd_ = sockfd;
+  pthread_t send_tid, recv_tid;
+  pthread_create(&send_tid, nullptr, send_thread, this);
+  pthread_create(&recv_tid, nullptr, recv_thread, this);
+  pthread_detach(send_tid);
+  pthread_detach(recv_tid);
+}
+
+bool RequestPipeline::call(const char *request, reqid_t id, char *response) {
+  slot_t slot;
+  pthread_cond_init(&slot.cond, nullptr);
+  slot.response = response;
+  slot.done = false;
+
+  bool ok = false;
+  pthread_mutex_lock(&mutex_);
+  if (!closed_) {
+    slots_[id] = &slot;
+    // the sender is only woken for the first request of a batch
+    if (outbox_.empty()) pthread_cond_signal(&outbox_cond_);
+    outbox_.insert(outbox_.end(), request, request + REQ_MSG_LEN);
+    while (!slot.done) pthread_cond_wait(&slot.cond, &mutex_);
+    ok = slot.response != nullptr;
+  }
+  pthread_mutex_unlock(&mutex_);
+  pthread_cond_destroy(&slot.cond);
+  return ok;
+}
+
+bool RequestPipeline::post(const char *request) {
+  pthread_mutex_lock(&mutex_);
+  bool ok = !closed_;
+  if (ok) {
+    if (outbox_.empty()) pthread_cond_signal(&outbox_cond_);
+    outbox_.insert(outbox_.end(), request, request + REQ_MSG_LEN);
+  }
+  pthread_mutex_unlock(&mutex_);
+  return ok;
+}
+
+void RequestPipeline::close_pipeline() {
+  pthread_mutex_lock(&mutex_);
+  closed_ = true;
+  for (auto &it : slots_) {
+    it.second->response = nullptr;
+    it.second->done = true;
+    pthread_cond_signal(&it.second->cond);
+  }
+  slots_.clear();
+  pthread_cond_signal(&outbox_cond_);  // the sender exits
+  pthread_mutex_unlock(&mutex_);
+}
+
+void *RequestPipeline::send_thread(void *args) {
+  RequestPipeline *pipeline = (RequestPipeline *)args;
+  std::vector<char> batch;
+  std::vector<iovec> iovecs;
+  std::vector<mmsghdr> msgs;
+  while (true) {
+    pthread_mutex_lock(&pipeline->mutex_);
+    while (pipeline->outbox_.empty() && !pipeline->closed_)
+      pthread_cond_wait(&pipeline->outbox_cond_, &pipeline->mutex_);
+    if (pipeline->closed_) {
+      pthread_mutex_unlock(&pipeline->mutex_);
+      break;
+    }
+    batch.swap(pipeline->outbox_);
+    pthread_mutex_unlock(&pipeline->mutex_);
+
+    // one message per request, as unix domain sockets keep message boundaries
+    size_t num = batch.size() / REQ_MSG_LEN;
+    iovecs.resize(num);
+    msgs.assign(num, mmsghdr());
+    for (size_t i = 0; i < num; i++) {
+      iovecs[i] = {batch.data() + i * REQ_MSG_LEN, REQ_MSG_LEN};
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    DEBUG(log_name, __FILE__, (long)__LINE__, "send %lu requests to scheduler.", num);
+    for (size_t sent = 0; sent < num;) {
+      int rc = sendmmsg(pipeline->sockfd_, msgs.data() + sent, num - sent, MSG_NOSIGNAL);
+      if (rc == -1 && errno == EINTR) continue;
+      if (rc <= 0) {
+        ERROR(log_name, __FILE__, (long)__LINE__, "failed to send request to scheduler: %s",
+              strerror(errno));
+        pipeline->close_pipeline();
+        return nullptr;
+      }
+      sent += rc;
+      // a stream socket may take part of the last request only
+      mmsghdr &last = msgs[sent - 1];
+      if (last.msg_len < last.msg_hdr.msg_iov->iov_len) {
+        last.msg_hdr.msg_iov->iov_base = (char *)last.msg_hdr.msg_iov->iov_base + last.msg_len;
+        last.msg_hdr.msg_iov->iov_len -= last.msg_len;
+        sent--;
+      }
+    }
+    batch.clear();
+  }
+  return nullptr;
+}
+
+void *RequestPipeline::recv_thread(void *args) {
+  RequestPipeline *pipeline = (RequestPipeline *)args;
+  std::vector<char> buf(RSP_MSG_LEN * RECV_BATCH);
+  size_t len = 0;
+  ssize_t rc;
+  while ((rc = recv(pipeline->sockfd_, buf.data() + len, buf.size() - len, 0)) != 0) {
+    if (rc == -1) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    len += rc;
+
+    // hand every complete response to its waiter
+    size_t pos = 0;
+    pthread_mutex_lock(&pipeline->mutex_);
+    for (; len - pos >= RSP_MSG_LEN; pos += RSP_MSG_LEN) {
+      reqid_t id;
+      parse_response(buf.data() + pos, &id);
+      auto it = pipeline->slots_.find(id);
+      if (it == pipeline->slots_.end()) {
+        WARNING(log_name, __FILE__, (long)__LINE__, "response to unknown request %d.", id);
+        continue;
+      }
+      memcpy(it->second->response, buf.data() + pos, RSP_MSG_LEN);
+      it->second->done = true;
+      pthread_cond_signal(&it->second->cond);
+      pipeline->slots_.erase(it);
+    }
+    pthread_mutex_unlock(&pipeline->mutex_);
+    // keep a partial response for the next recv()
+    memmove(buf.data(), buf.data() + pos, len - pos);
+    len -= pos;
+  }
+  WARNING(log_name, __FILE__, (long)__LINE__, "connection closed by scheduler. recv() returns %ld.",
+          rc);
+  pipeline->close_pipeline();
+  return nullptr;
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef REQUEST_PIPELINE_H
+#define REQUEST_PIPELINE_H
+
+#include <pthread.h>
+
+#include <map>
+#include <vector>
+
+#include "comm.h"
+
+/**
+ * Requests from the Pod manager to the scheduler over a single connection. Any number of threads
+ * may have requests in flight; each waits in a completion slot keyed by its request id and is
+ * woken alone when its response arrives. Requests queued while the sender is busy are written
+ * with a single sendmmsg().
+ */
+class RequestPipeline {
+ public:
+  RequestPipeline();
+  // start the sender and receiver threads on a connected socket
+  void start(int sockfd);
+  /**
+   * Send a request and wait for its response.
+   * @param request REQ_MSG_LEN bytes from prepare_request()
+   * @param id request id returned by prepare_request()
+   * @param response RSP_MSG_LEN bytes, filled with the response
+   * @return false if the connection to scheduler is lost
+   */
+  bool call(const char *request, reqid_t id, char *response);
+  // send a request scheduler does not respond to, @return false if the connection is lost
+  bool post(const char *request);
+
+ private:
+  struct slot_t {
+    pthread_cond_t cond;
+    char *response;
+    bool done;
+  };
+  static void *send_thread(void *pipeline);
+  static void *recv_thread(void *pipeline);
+  // wake every waiter with a failure and stop the sender, no more requests are accepted
+  void close_pipeline();
+
+  int sockfd_;
+  bool closed_;
+  pthread_mutex_t mutex_;
+  pthread_cond_t outbox_cond_;        // requests were queued
+  std::vector<char> outbox_;          // requests waiting to be sent, REQ_MSG_LEN bytes each
+  std::map<reqid_t, slot_t *> slots_;  // waiters of requests in flight
+};
+
+#endif
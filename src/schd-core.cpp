@@ -0,0 +1,474 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Scheduler core: client settings, usage accounting and token decisions.
+ * It knows nothing about sockets or threads; time comes from schd_clock, and granted tokens are
+ * handed to deliver_token() of the front end (gem-schd, or gem-sim on a virtual clock).
+ */
+
+#include <linux/limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "schd-metrics.h"
+#include "scheduler.h"
+#ifdef RANDOM_QUOTA
+#include <random>
+#endif
+
+using std::string;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+// wall clock, milliseconds since the scheduler started
+class SteadyClock : public Clock {
+ public:
+  SteadyClock() : start_(steady_clock::now()) {}
+  double now() { return duration_cast<microseconds>(steady_clock::now() - start_).count() / 1e3; }
+
+ private:
+  steady_clock::time_point start_;
+};
+SteadyClock steady_clock_source;
+Clock *schd_clock = &steady_clock_source;
+
+// all in milliseconds
+double QUOTA = 250.0;
+double MIN_QUOTA = 100.0;
+double WINDOW_SIZE = 10000.0;
+size_t g_sm_occupied = 0;
+int verbosity = 0;
+bool sm_packing = false;  // choose grants by knapsack over SM partitions instead of first-fit
+#ifdef _DEBUG
+std::list<History> full_history;
+#endif
+
+// milliseconds since scheduler process started
+double ms_since_start() { return schd_clock->now(); }
+
+ClientInfo::ClientInfo(double baseq, double minq, double maxq, double minf, double maxf)
+    : BASE_QUOTA(baseq), MIN_QUOTA(minq), MAX_QUOTA(maxq), MIN_FRAC(minf), MAX_FRAC(maxf) {
+  quota_ = BASE_QUOTA;
+  latest_overuse_ = 0.0;
+  latest_actual_usage_ = 0.0;
+  burst_ = 0.0;
+};
+
+ClientInfo::~ClientInfo(){};
+
+void ClientInfo::set_burst(double estimated_burst) { burst_ = estimated_burst; }
+
+void ClientInfo::update_return_time(double overuse) {
+  double now = ms_since_start();
+  // client may not use up all of the allocated time
+  if (!window.empty()) latest_actual_usage_ = window.amend_last(now, overuse);
+  latest_overuse_ = overuse;
+#ifdef _DEBUG
+  for (auto it = full_history.rbegin(); it != full_history.rend(); it++) {
+    if (it->client == this->id) {
+      it->end = std::min(now, it->end + overuse);
+      break;
+    }
+  }
+#endif
+}
+
+// overuse of a reservation, reported before the latest record ended, is charged in full
+void ClientInfo::charge_overuse(double overuse) {
+  if (!window.empty()) latest_actual_usage_ = window.extend_last(overuse);
+  latest_overuse_ = overuse;
+#ifdef _DEBUG
+  for (auto it = full_history.rbegin(); it != full_history.rend(); it++) {
+    if (it->client == this->id) {
+      it->end += overuse;
+      break;
+    }
+  }
+#endif
+}
+
+void ClientInfo::Record(double quota) {
+  History hist;
+  hist.client = this->id;
+  hist.start = ms_since_start();
+  hist.end = hist.start + quota;
+  window.add(hist.start, hist.end);
+#ifdef _DEBUG
+  full_history.push_back(hist);
+#endif
+}
+
+double ClientInfo::get_min_fraction() { return MIN_FRAC; }
+
+double ClientInfo::get_max_fraction() { return MAX_FRAC; }
+
+// self-adaptive quota algorithm
+double ClientInfo::get_quota() {
+  const double UPDATE_RATE = 0.5;  // how drastically will the quota changes
+
+  if (burst_ < 1e-9) {
+    // special case when no burst data available, just fallback to static quota
+    quota_ = BASE_QUOTA;
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s: fallback to static quota, assign quota: %.3fms", name.c_str(), quota_);
+  } else {
+    quota_ = burst_ * UPDATE_RATE + quota_ * (1 - UPDATE_RATE);
+    quota_ = std::max(quota_, MIN_QUOTA);  // lowerbound
+    quota_ = std::min(quota_, MAX_QUOTA);  // upperbound
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s: burst: %.3fms, assign quota: %.3fms", name.c_str(), burst_, quota_);
+  }
+  return quota_;
+}
+
+// clients indexed by client id, names are only looked up when a connection is identified
+ClientInfo *client_table[MAX_CLIENT_NUM];
+int client_num = 0;
+std::map<string, client_id_t> client_ids;
+
+std::list<candidate_t> candidates;
+/**
+ * Read client settings, clients already known keep their id and usage in current time window.
+ * @param full_path path of the resource configuration file
+ * @return 0 on success, -1 if the file cannot be opened
+ */
+int read_resource_config(const char *full_path) {
+  std::ifstream fin;
+  ClientInfo *client_inf;
+  char client_name[HOST_NAME_MAX];
+  size_t gpu_memory_size, sm_partition;
+  double gpu_min_fraction, gpu_max_fraction;
+  int container_num;
+
+  // Read GPU limit usage
+  fin.open(full_path, std::ios::in);
+  if (!fin.is_open()) {
+    ERROR(log_name, __FILE__, (long)__LINE__, "failed to open file %s: %s", full_path, strerror(errno));
+    return -1;
+  }
+  fin >> container_num;
+  INFO(log_name, __FILE__, (long)__LINE__, "There are %d clients in the system...", container_num);
+  for (int i = 0; i < container_num; i++) {
+    fin >> client_name >> gpu_min_fraction >> gpu_max_fraction >> sm_partition >> gpu_memory_size;
+    client_inf = new ClientInfo(QUOTA, MIN_QUOTA, gpu_min_fraction * WINDOW_SIZE, gpu_min_fraction,
+                                gpu_max_fraction);
+    client_inf->name = client_name;
+    client_inf->gpu_sm_partition = sm_partition;
+    client_inf->gpu_mem_limit = gpu_memory_size;
+    // intern the name
+    auto found = client_ids.find(client_name);
+    if (found != client_ids.end()) {
+      client_inf->id = found->second;
+    } else if (client_num < MAX_CLIENT_NUM) {
+      client_inf->id = client_num;
+      client_ids[client_name] = client_num;
+    } else {
+      ERROR(log_name, __FILE__, (long)__LINE__, "Too many clients, ignore \"%s\".", client_name);
+      delete client_inf;
+      continue;
+    }
+    if (client_table[client_inf->id] != nullptr) {
+      // keep the usage in current time window across configuration updates
+      client_inf->window = client_table[client_inf->id]->window;
+      delete client_table[client_inf->id];
+    }
+    client_table[client_inf->id] = client_inf;
+    if (client_inf->id == client_num) client_num++;
+    metrics_client_config(client_inf->id, client_name, gpu_min_fraction, gpu_max_fraction,
+                          sm_partition);
+    INFO(log_name, __FILE__, (long)__LINE__, "%s request: %.2f, limit: %.2f, memory limit: %lu bytes, sm_partition: %lu\%", client_name, gpu_min_fraction,
+         gpu_max_fraction, gpu_memory_size, sm_partition);
+  }
+  fin.close();
+  return 0;
+}
+
+// time until the content of current time window changes
+double time_to_window_change(double window_start) {
+  double earliest = std::numeric_limits<double>::infinity();
+  for (client_id_t id = 0; id < client_num; id++)
+    earliest = std::min(earliest, client_table[id]->window.earliest_end(window_start));
+  if (std::isinf(earliest)) return WINDOW_SIZE;  // nothing in the window
+  return std::max(0.0, earliest - window_start);
+}
+
+// SM utilization of packing mode compared with first-fit
+struct {
+  unsigned long decisions;
+  unsigned long sm_first_fit;  // sum of SM partitions first-fit would grant
+  unsigned long sm_packed;     // sum of SM partitions actually granted
+} pack_stats;
+const unsigned long PACK_REPORT_INTERVAL = 1000;  // decisions
+
+void report_pack_stats() {
+  if (pack_stats.decisions == 0) return;
+  double first_fit = (double)pack_stats.sm_first_fit / pack_stats.decisions;
+  double packed = (double)pack_stats.sm_packed / pack_stats.decisions;
+  INFO(log_name, __FILE__, (long)__LINE__,
+       "packing: %lu decisions, granted SM %.2f%% per decision (first-fit %.2f%%, gain %+.2f%%)",
+       pack_stats.decisions, packed, first_fit, packed - first_fit);
+}
+
+/**
+ * Select candidates whose current usage is less than their limit, as many as the SM partitions
+ * fit, according to scheduling policy. Selected candidates are removed from the candidate list.
+ * This never blocks; the caller is responsible for serializing access to scheduler state.
+ * @param wait_ms set to the time until the selection result may change, if nothing is selected
+ * @return selected candidates
+ */
+std::vector<candidate_t> select_candidates(double *wait_ms) {
+  /* update history list and get usage in a time interval */
+  double window_size = WINDOW_SIZE;
+  double now = ms_since_start();
+  double window_start = now - WINDOW_SIZE;
+  double current_time;
+  current_time = window_start;
+  if (window_start < 0) {
+    // elapsed time less than a window size
+    window_size = now;
+  }
+
+  if (verbosity > 1) {
+    for (client_id_t id = 0; id < client_num; id++) {
+      for (auto &h : client_table[id]->window.records()) {
+        if (h.end < current_time) continue;
+        printf("{'container': '%s', 'start': %.3f, 'end': %.3f},\n",
+               client_table[id]->name.c_str(), h.start / 1e3, h.end / 1e3);
+      }
+    }
+  }
+
+  /* select the candidate to give token */
+
+  // no need for quick exit if the first one in candidates does not use GPU recently
+  // as it's better to return a valid candidate set directly
+
+  // sort by time
+  /* select the ones to execute */
+  std::vector<valid_candidate_t> vaild_candidates;
+  std::vector<candidate_t> approved_candidates;
+
+  double waittime = 2000; //2s
+  for (auto it = candidates.begin(); it != candidates.end(); it++) {
+    if (it->arrived_time > now) continue;  // a reservation, its client still holds a token
+    ClientInfo *client_inf = client_table[it->client];
+    double limit, require, missing, remaining, usage;
+    usage = client_inf->window.usage(window_start);
+    limit = client_inf->get_max_fraction() * window_size;
+    require = client_inf->get_min_fraction() * window_size;
+    missing = require - usage;
+    remaining = limit - usage;
+    if (window_size > 0) metrics_window_usage(it->client, usage / window_size);
+
+    if (remaining > 0)
+      vaild_candidates.push_back({missing, remaining, usage, it->arrived_time, it});
+    else
+      waittime = std::min(waittime, -remaining);
+  }
+  DEBUG(log_name, __FILE__, (long)__LINE__, "current valid candidates' size:%d", vaild_candidates.size());
+
+  if (vaild_candidates.size() == 0) {
+    // all candidates reach usage limit
+    DEBUG(log_name, __FILE__, (long)__LINE__, "sleep time %.3f ms", waittime);
+    *wait_ms = waittime;
+    return approved_candidates;
+  }
+
+  std::sort(vaild_candidates.begin(), vaild_candidates.end(), schd_priority);
+  /* iterate candidates and sum up all the used sm (first-fit) */
+  size_t sm_selected = 0;
+  std::vector<size_t> sm_partitions;
+  std::vector<bool> chosen;
+  for (auto it = vaild_candidates.begin(); it != vaild_candidates.end(); it++) {
+    size_t sm_partition = client_table[it->iter->client]->gpu_sm_partition;
+    sm_partitions.push_back(sm_partition);
+    chosen.push_back(g_sm_occupied + sm_selected + sm_partition <= SM_GLOBAL_LIMIT);
+    if (chosen.back()) sm_selected += sm_partition;
+  }
+  if (sm_packing && g_sm_occupied < SM_GLOBAL_LIMIT) {
+    // pack the remaining SM capacity instead
+    size_t sm_first_fit = sm_selected;
+    chosen = schd_pack(vaild_candidates, sm_partitions, SM_GLOBAL_LIMIT - g_sm_occupied);
+    sm_selected = 0;
+    for (size_t i = 0; i < chosen.size(); i++)
+      if (chosen[i]) sm_selected += sm_partitions[i];
+    pack_stats.decisions++;
+    pack_stats.sm_first_fit += sm_first_fit;
+    pack_stats.sm_packed += sm_selected;
+    if (sm_selected != sm_first_fit)
+      DEBUG(log_name, __FILE__, (long)__LINE__, "packing grants %lu%% SM, first-fit would grant %lu%%", sm_selected,
+            sm_first_fit);
+    if (pack_stats.decisions % PACK_REPORT_INTERVAL == 0) report_pack_stats();
+  }
+  for (size_t i = 0; i < chosen.size(); i++) {
+    if (!chosen[i]) continue;
+    approved_candidates.push_back(*(vaild_candidates[i].iter));
+    candidates.erase(vaild_candidates[i].iter);
+  }
+  if (approved_candidates.size() == 0) {
+    // all candidates reach usage limit
+    *wait_ms = time_to_window_change(window_start);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "no approved candidates, sleep %.3f ms", *wait_ms);
+  }
+  return approved_candidates;
+}
+
+// find the id of a client by its name, -1 if the client is not configured
+client_id_t find_client(const char *name) {
+  auto found = client_ids.find(name);
+  if (found == client_ids.end()) return -1;
+  return found->second;
+}
+
+// a client asks for a token; its previous token is returned at the next schedule_step()
+void enqueue_request(int socket, client_id_t client, reqid_t req_id, double overuse, double burst) {
+  ClientInfo *client_inf = client_table[client];
+  client_inf->update_return_time(overuse);
+  client_inf->set_burst(burst);
+  metrics_request(client, overuse);
+  double now = ms_since_start();
+  for (auto &c : candidates) {
+    if (c.socket != socket) continue;
+    // the request takes over a reservation of the connection, which is answered without quota;
+    // the token it follows is returned
+    if (c.overuse >= 0) client_inf->charge_overuse(c.overuse);
+    deliver_token(c, 0.0);
+    c.req_id = req_id;
+    c.arrived_time = std::min(c.arrived_time, now);
+    c.overuse = -1;
+    return;
+  }
+  candidates.push_back({socket, client, req_id, now, -1, -1});
+}
+
+/**
+ * A client asks for the token to follow the one it holds, which it keeps until the token expires.
+ * The request is only considered from then on, so the next token may be granted without a gap.
+ * Overuse is charged then as well, past the end of the last record of the client, which is still
+ * in use until then.
+ */
+void reserve_request(int socket, client_id_t client, reqid_t req_id, double overuse, double burst) {
+  client_table[client]->set_burst(burst);
+  metrics_request(client, overuse);
+  double due = std::max(ms_since_start(), tokenTakers.expiry(client));
+  candidates.push_back({socket, client, req_id, due, -1, overuse});
+}
+
+//check and clear expired tokens
+//if a token expired, update info so that another round can be scheduled
+TokenHeap tokenTakers;
+// @return time until the next token expires, infinity if no token is delivered
+double update_tokens(){
+  auto now = ms_since_start();
+  DEBUG(log_name, __FILE__, (long)__LINE__, "tokenTaker with size %d", tokenTakers.size());
+  while (!tokenTakers.empty() && tokenTakers.top().expired_time <= now) {  // expired
+    client_id_t client = tokenTakers.top().client;
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s expired its token, update.", client_table[client]->name.c_str());
+    g_sm_occupied -= client_table[client]->gpu_sm_partition;
+    tokenTakers.pop();
+  }
+  DEBUG(log_name, __FILE__, (long)__LINE__, "Current total partition: %d", g_sm_occupied);
+  if (tokenTakers.empty()) return std::numeric_limits<double>::infinity();
+  return tokenTakers.top().expired_time - now;
+};
+
+bool remove_ifexists(client_id_t client){
+  if (!tokenTakers.remove(client)) return false;
+  DEBUG(log_name, __FILE__, (long)__LINE__, "the candidate %s returns early", client_table[client]->name.c_str());
+  g_sm_occupied -= client_table[client]->gpu_sm_partition;
+  return true;
+}
+
+// give token to a selected candidate
+void grant_token(candidate_t selected) {
+#ifdef RANDOM_QUOTA
+  static std::random_device rd;
+  static std::default_random_engine gen(rd());
+  static std::uniform_real_distribution<double> dis(0.4, 1.0);
+#endif
+  ClientInfo *client_inf = client_table[selected.client];
+  DEBUG(log_name, __FILE__, (long)__LINE__, "select %s, waiting time: %.3f ms", client_inf->name.c_str(),
+        ms_since_start() - selected.arrived_time);
+
+  double quota = client_inf->get_quota();
+#ifdef  RANDOM_QUOTA
+  quota *= dis(gen);
+#endif
+  client_inf->Record(quota);
+  metrics_token_granted(selected.client, ms_since_start() - selected.arrived_time, quota);
+
+  remove_ifexists(selected.client);  // another connection of the same client may hold one
+  selected.expired_time = ms_since_start() + quota;
+  g_sm_occupied += client_inf->gpu_sm_partition;
+  tokenTakers.push(selected);
+
+  // send quota to selected instance
+  deliver_token(selected, quota);
+}
+
+/**
+ * One round of scheduling: take back tokens which are returned or expired, then give tokens to
+ * selected candidates. A client asking for a new token has stopped using its previous one, unless
+ * it reserved the new token, which is due when the previous one expires.
+ * The caller is responsible for serializing access to scheduler state.
+ * @return time until another round is needed, infinity if only new requests can change anything
+ */
+double schedule_step() {
+  auto step_start = steady_clock::now();  // cost is measured in real time even on a virtual clock
+  double now = ms_since_start(), due_wait = std::numeric_limits<double>::infinity();
+  for (auto &conn : candidates) {
+    if (conn.arrived_time > now) {
+      due_wait = std::min(due_wait, conn.arrived_time - now);
+      continue;
+    }
+    if (conn.overuse >= 0) {
+      client_table[conn.client]->charge_overuse(conn.overuse);
+      conn.overuse = -1;
+    }
+    remove_ifexists(conn.client);
+  }
+  double wait_ms = std::min(update_tokens(), due_wait);
+  if (!candidates.empty()) {
+    double select_wait = std::numeric_limits<double>::infinity();
+    auto selects = select_candidates(&select_wait);
+    for (auto &selected : selects) grant_token(selected);
+    if (!selects.empty()) wait_ms = std::min(update_tokens(), due_wait);
+    wait_ms = std::min(wait_ms, select_wait);
+  }
+  auto step_cost = duration_cast<nanoseconds>(steady_clock::now() - step_start);
+  metrics_schedule_step(step_cost.count(), g_sm_occupied);
+  return wait_ms;
+}
+
+// forget pending requests of a closed connection
+void drop_connection(int socket) {
+  candidates.remove_if([=](const candidate_t &c) -> bool { return c.socket == socket; });
+}
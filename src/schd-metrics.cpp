@@ -0,0 +1,224 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "schd-metrics.h"
+
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include <atomic>
+
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+
+// upper bounds of histogram buckets, the last bucket is +Inf
+const double WAIT_BUCKETS_MS[] = {0.1, 0.5, 1, 2, 5, 10, 25, 50, 100, 250, 500, 1000};
+const int WAIT_BUCKET_NUM = sizeof(WAIT_BUCKETS_MS) / sizeof(double);
+const double STEP_BUCKETS_US[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+const int STEP_BUCKET_NUM = sizeof(STEP_BUCKETS_US) / sizeof(double);
+
+// time sums are kept in integer microseconds (ns for step cost) so that fetch_add works on them
+struct client_metrics_t {
+  char name[HOST_NAME_MAX];  // written once before the client is published
+  std::atomic<double> min_frac, max_frac, usage_frac;
+  std::atomic<uint64_t> sm_partition;
+  std::atomic<uint64_t> requests, overuse_us;
+  std::atomic<uint64_t> grants, quota_us;
+  std::atomic<uint64_t> wait_buckets[WAIT_BUCKET_NUM + 1], wait_us;
+};
+
+client_metrics_t client_metrics[MAX_CLIENT_NUM];
+std::atomic<int> metrics_client_num(0);  // clients below this index are published
+
+// quota used by the processes of each Pod, as reported by Pod managers
+const int MAX_PROCESS_NUM = 1024;
+struct process_metrics_t {
+  client_id_t client;
+  int pid;  // written once before the process is published
+  std::atomic<uint64_t> usage_us;
+};
+process_metrics_t process_metrics[MAX_PROCESS_NUM];
+std::atomic<int> metrics_process_num(0);
+
+std::atomic<uint64_t> sm_occupied_gauge(0);
+std::atomic<uint64_t> step_ns(0);
+std::atomic<uint64_t> step_buckets[STEP_BUCKET_NUM + 1];
+
+static int bucket_of(const double *bounds, int num, double value) {
+  int i = 0;
+  while (i < num && value > bounds[i]) i++;
+  return i;
+}
+
+void metrics_client_config(client_id_t id, const char *name, double min_frac, double max_frac,
+                           size_t sm_partition) {
+  client_metrics_t &m = client_metrics[id];
+  if (id >= metrics_client_num.load(memory_order_relaxed))
+    strncpy(m.name, name, HOST_NAME_MAX - 1);  // the name of a client never changes
+  m.min_frac.store(min_frac, memory_order_relaxed);
+  m.max_frac.store(max_frac, memory_order_relaxed);
+  m.sm_partition.store(sm_partition, memory_order_relaxed);
+  if (id >= metrics_client_num.load(memory_order_relaxed))
+    metrics_client_num.store(id + 1, memory_order_release);
+}
+
+void metrics_request(client_id_t id, double overuse_ms) {
+  client_metrics_t &m = client_metrics[id];
+  m.requests.fetch_add(1, memory_order_relaxed);
+  if (overuse_ms > 0) m.overuse_us.fetch_add(overuse_ms * 1e3, memory_order_relaxed);
+}
+
+// GPU time of a client in the current time window over the window size
+void metrics_window_usage(client_id_t id, double usage_frac) {
+  client_metrics[id].usage_frac.store(usage_frac, memory_order_relaxed);
+}
+
+void metrics_token_granted(client_id_t id, double wait_ms, double quota_ms) {
+  client_metrics_t &m = client_metrics[id];
+  m.grants.fetch_add(1, memory_order_relaxed);
+  m.quota_us.fetch_add(quota_ms * 1e3, memory_order_relaxed);
+  int bucket = bucket_of(WAIT_BUCKETS_MS, WAIT_BUCKET_NUM, wait_ms);
+  m.wait_buckets[bucket].fetch_add(1, memory_order_relaxed);
+  m.wait_us.fetch_add(wait_ms * 1e3, memory_order_relaxed);
+}
+
+// called by the scheduler only, which publishes processes in order
+void metrics_process_usage(client_id_t id, int pid, double used_ms) {
+  int num = metrics_process_num.load(memory_order_relaxed), i = 0;
+  while (i < num && (process_metrics[i].client != id || process_metrics[i].pid != pid)) i++;
+  if (i == MAX_PROCESS_NUM) return;  // table full, usage of new processes is not kept
+  if (i == num) {
+    process_metrics[i].client = id;
+    process_metrics[i].pid = pid;
+    metrics_process_num.store(num + 1, memory_order_release);
+  }
+  process_metrics[i].usage_us.fetch_add(used_ms * 1e3, memory_order_relaxed);
+}
+
+void metrics_schedule_step(uint64_t cost_ns, size_t sm_occupied) {
+  step_ns.fetch_add(cost_ns, memory_order_relaxed);
+  int bucket = bucket_of(STEP_BUCKETS_US, STEP_BUCKET_NUM, cost_ns / 1e3);
+  step_buckets[bucket].fetch_add(1, memory_order_relaxed);
+  sm_occupied_gauge.store(sm_occupied, memory_order_relaxed);
+}
+
+static void append(std::string &out, const char *format, ...) {
+  char buf[512];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  out += buf;
+}
+
+static void append_header(std::string &out, const char *name, const char *type, const char *help) {
+  append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// per-client metric with a single value
+template <typename F>
+static void append_client_metric(std::string &out, int num, const char *name, const char *type,
+                                 const char *help, F value) {
+  append_header(out, name, type, help);
+  for (int id = 0; id < num; id++) {
+    client_metrics_t &m = client_metrics[id];
+    append(out, "%s{client=\"%s\"} %.6g\n", name, m.name, value(m));
+  }
+}
+
+// Prometheus text exposition (version 0.0.4) of all metrics
+std::string metrics_format() {
+  std::string out;
+  int num = metrics_client_num.load(memory_order_acquire);
+
+  append_client_metric(out, num, "gemini_window_usage_ratio", "gauge",
+                       "GPU time in the current time window over the window size, as of the last "
+                       "scheduling decision of the client",
+                       [](client_metrics_t &m) { return m.usage_frac.load(memory_order_relaxed); });
+  append_client_metric(out, num, "gemini_min_fraction", "gauge", "Requested share of GPU time",
+                       [](client_metrics_t &m) { return m.min_frac.load(memory_order_relaxed); });
+  append_client_metric(out, num, "gemini_max_fraction", "gauge", "Limit of GPU time share",
+                       [](client_metrics_t &m) { return m.max_frac.load(memory_order_relaxed); });
+  append_client_metric(out, num, "gemini_sm_partition", "gauge", "SM partition (percent)",
+                       [](client_metrics_t &m) {
+                         return (double)m.sm_partition.load(memory_order_relaxed);
+                       });
+  append_client_metric(out, num, "gemini_token_requests_total", "counter", "Token requests",
+                       [](client_metrics_t &m) {
+                         return (double)m.requests.load(memory_order_relaxed);
+                       });
+  append_client_metric(out, num, "gemini_tokens_granted_total", "counter", "Tokens granted",
+                       [](client_metrics_t &m) {
+                         return (double)m.grants.load(memory_order_relaxed);
+                       });
+  append_client_metric(out, num, "gemini_quota_granted_ms_total", "counter", "Quota granted (ms)",
+                       [](client_metrics_t &m) {
+                         return m.quota_us.load(memory_order_relaxed) / 1e3;
+                       });
+  append_client_metric(out, num, "gemini_overuse_ms_total", "counter",
+                       "GPU time used past token expiration (ms)",
+                       [](client_metrics_t &m) {
+                         return m.overuse_us.load(memory_order_relaxed) / 1e3;
+                       });
+
+  append_header(out, "gemini_token_wait_ms", "histogram", "Time from token request to grant (ms)");
+  for (int id = 0; id < num; id++) {
+    client_metrics_t &m = client_metrics[id];
+    uint64_t cumulative = 0;
+    for (int b = 0; b <= WAIT_BUCKET_NUM; b++) {
+      cumulative += m.wait_buckets[b].load(memory_order_relaxed);
+      if (b < WAIT_BUCKET_NUM)
+        append(out, "gemini_token_wait_ms_bucket{client=\"%s\",le=\"%g\"} %lu\n", m.name,
+               WAIT_BUCKETS_MS[b], cumulative);
+      else
+        append(out, "gemini_token_wait_ms_bucket{client=\"%s\",le=\"+Inf\"} %lu\n", m.name,
+               cumulative);
+    }
+    append(out, "gemini_token_wait_ms_sum{client=\"%s\"} %.3f\n", m.name,
+           m.wait_us.load(memory_order_relaxed) / 1e3);
+    append(out, "gemini_token_wait_ms_count{client=\"%s\"} %lu\n", m.name, cumulative);
+  }
+
+  append_header(out, "gemini_process_quota_used_ms_total", "counter",
+                "Quota used by a process of the client, pid 0 for processes not identified (ms)");
+  int process_num = metrics_process_num.load(memory_order_acquire);
+  for (int i = 0; i < process_num; i++) {
+    process_metrics_t &p = process_metrics[i];
+    append(out, "gemini_process_quota_used_ms_total{client=\"%s\",pid=\"%d\"} %.3f\n",
+           client_metrics[p.client].name, p.pid, p.usage_us.load(memory_order_relaxed) / 1e3);
+  }
+
+  append_header(out, "gemini_sm_occupied", "gauge",
+                "SM partitions held by delivered tokens (percent)");
+  append(out, "gemini_sm_occupied %lu\n", sm_occupied_gauge.load(memory_order_relaxed));
+
+  append_header(out, "gemini_schedule_step_us", "histogram", "Cost of one scheduling round (us)");
+  uint64_t cumulative = 0;
+  for (int b = 0; b <= STEP_BUCKET_NUM; b++) {
+    cumulative += step_buckets[b].load(memory_order_relaxed);
+    if (b < STEP_BUCKET_NUM)
+      append(out, "gemini_schedule_step_us_bucket{le=\"%g\"} %lu\n", STEP_BUCKETS_US[b],
+             cumulative);
+    else
+      append(out, "gemini_schedule_step_us_bucket{le=\"+Inf\"} %lu\n", cumulative);
+  }
+  append(out, "gemini_schedule_step_us_sum %.3f\n", step_ns.load(memory_order_relaxed) / 1e3);
+  append(out, "gemini_schedule_step_us_count %lu\n", cumulative);
+  return out;
+}
@@ -0,0 +1,38 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCHD_METRICS_H
+#define SCHD_METRICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "scheduler.h"
+
+// Scheduling statistics in Prometheus text format.
+// Recording is done by the scheduler with relaxed atomics only, so formatting the metrics from
+// another thread never blocks scheduling. A scrape may see counters of slightly different instants.
+void metrics_client_config(client_id_t id, const char *name, double min_frac, double max_frac,
+                           size_t sm_partition);
+void metrics_request(client_id_t id, double overuse_ms);
+void metrics_window_usage(client_id_t id, double usage_frac);
+void metrics_token_granted(client_id_t id, double wait_ms, double quota_ms);
+void metrics_process_usage(client_id_t id, int pid, double used_ms);
+void metrics_schedule_step(uint64_t cost_ns, size_t sm_occupied);
+std::string metrics_format();
+
+#endif
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <vector>
+
 #include "scheduler.h"
 
 bool schd_priority(const valid_candidate_t &a, const valid_candidate_t &b) {
@@ -24,3 +26,52 @@ bool schd_priority(const valid_candidate_t &a, const valid_candidate_t &b) {
   // return a.arrived_time < b.arrived_time; // first-arrival first
   return a.usage < b.usage;  // minimum usage first
 }
+
+// value of granting a candidate in packing mode: its SM partition, weighted by how far it is behind
+// its minimum share in the current window
+double schd_pack_value(const valid_candidate_t &c, size_t sm_partition) {
+  double deficit = c.missing > 0 ? c.missing / (c.missing + c.usage) : 0.0;
+  return sm_partition * (1.0 + deficit);
+}
+
+/**
+ * Choose the candidates to grant so that the total packing value is maximized under the SM
+ * capacity (0/1 knapsack, capacity is at most SM_GLOBAL_LIMIT). Ties keep higher-priority ones.
+ * @param candidates valid candidates sorted by schd_priority
+ * @param sm_partitions SM partition of each candidate
+ * @param capacity SM partition still available
+ * @return whether each candidate is chosen
+ */
+std::vector<bool> schd_pack(const std::vector<valid_candidate_t> &candidates,
+                            const std::vector<size_t> &sm_partitions, size_t capacity) {
+  size_t n = candidates.size();
+  std::vector<bool> chosen(n, false);
+  std::vector<double> best(capacity + 1, 0.0);
+  std::vector<std::vector<bool>> take(n, std::vector<bool>(capacity + 1, false));
+
+  for (size_t i = 0; i < n; i++) {
+    size_t sm = sm_partitions[i];
+    if (sm == 0) {
+      chosen[i] = true;  // takes no SM, always fits
+      continue;
+    }
+    if (sm > capacity) continue;
+    double value = schd_pack_value(candidates[i], sm);
+    for (size_t c = capacity; c >= sm; c--) {
+      if (best[c - sm] + value > best[c] + 1e-9) {
+        best[c] = best[c - sm] + value;
+        take[i][c] = true;
+      }
+    }
+  }
+
+  // walk back from the full capacity
+  size_t c = capacity;
+  for (size_t i = n; i-- > 0;) {
+    if (sm_partitions[i] > 0 && take[i][c]) {
+      chosen[i] = true;
+      c -= sm_partitions[i];
+    }
+  }
+  return chosen;
+}
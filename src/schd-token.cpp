@@ -0,0 +1,95 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Indexed min-heap of delivered tokens, keyed by expiration time.
+ */
+
+#include <limits>
+
+#include "scheduler.h"
+
+TokenHeap::TokenHeap() : pos_(MAX_CLIENT_NUM, -1) {}
+
+// put token at position i and update the index
+void TokenHeap::place(size_t i, const candidate_t &token) {
+  heap_[i] = token;
+  pos_[token.client] = i;
+}
+
+void TokenHeap::sift_up(size_t i) {
+  candidate_t token = heap_[i];
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (heap_[parent].expired_time <= token.expired_time) break;
+    place(i, heap_[parent]);
+    i = parent;
+  }
+  place(i, token);
+}
+
+void TokenHeap::sift_down(size_t i) {
+  candidate_t token = heap_[i];
+  size_t n = heap_.size();
+  while (2 * i + 1 < n) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < n && heap_[child + 1].expired_time < heap_[child].expired_time) child++;
+    if (token.expired_time <= heap_[child].expired_time) break;
+    place(i, heap_[child]);
+    i = child;
+  }
+  place(i, token);
+}
+
+void TokenHeap::erase_at(size_t i) {
+  pos_[heap_[i].client] = -1;
+  candidate_t last = heap_.back();
+  heap_.pop_back();
+  if (i == heap_.size()) return;  // the last one is removed
+  place(i, last);
+  if (i > 0 && heap_[(i - 1) / 2].expired_time > last.expired_time)
+    sift_up(i);
+  else
+    sift_down(i);
+}
+
+// a client holding a token must return it (remove()) before getting another one
+void TokenHeap::push(const candidate_t &token) {
+  heap_.push_back(token);
+  sift_up(heap_.size() - 1);
+}
+
+// cancel the token held by client
+// @return whether the client held a token
+bool TokenHeap::remove(client_id_t client) {
+  if (pos_[client] < 0) return false;
+  erase_at(pos_[client]);
+  return true;
+}
+
+double TokenHeap::expiry(client_id_t client) const {
+  if (pos_[client] < 0) return -std::numeric_limits<double>::infinity();
+  return heap_[pos_[client]].expired_time;
+}
+
+// the token which expires first
+const candidate_t &TokenHeap::top() const { return heap_.front(); }
+
+void TokenHeap::pop() { erase_at(0); }
+
+bool TokenHeap::empty() const { return heap_.empty(); }
+
+size_t TokenHeap::size() const { return heap_.size(); }
@@ -0,0 +1,93 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Incremental sliding-window usage accounting.
+ * A client is granted one token at a time, so its records are appended in time order and overlap
+ * only by overuse charged after a record ended. Outdated records can therefore be dropped from the
+ * front, and only the few records crossing the window start need to be clipped when usage is
+ * queried.
+ */
+
+#include <algorithm>
+#include <limits>
+
+#include "scheduler.h"
+
+WindowUsage::WindowUsage() : sum_(0.0) {}
+
+void WindowUsage::add(double start, double end) {
+  History hist;
+  hist.client = -1;  // implied by the owner
+  hist.start = start;
+  hist.end = end;
+  records_.push_back(hist);
+  sum_ += end - start;
+}
+
+// client may not use up all of the allocated time, or may overuse it
+// @return actual usage of the latest record
+double WindowUsage::amend_last(double now, double overuse) {
+  if (records_.empty()) return 0.0;
+  History &last = records_.back();
+  double end = std::min(now, last.end + overuse);
+  sum_ += end - last.end;
+  last.end = end;
+  return last.end - last.start;
+}
+
+// overuse reported once the latest record has ended, as with a reservation due when it expires;
+// the record then overlaps the next one, whose kernels ran meanwhile
+// @return actual usage of the latest record
+double WindowUsage::extend_last(double overuse) {
+  if (records_.empty()) return 0.0;
+  History &last = records_.back();
+  last.end += overuse;
+  sum_ += overuse;
+  return last.end - last.start;
+}
+
+// drop records which end before window_start
+void WindowUsage::expire(double window_start) {
+  while (!records_.empty() && records_.front().end < window_start) {
+    sum_ -= records_.front().end - records_.front().start;
+    records_.pop_front();
+  }
+  if (records_.empty()) sum_ = 0.0;  // avoid accumulating floating point error
+}
+
+// GPU time used (or granted) since window_start
+double WindowUsage::usage(double window_start) {
+  expire(window_start);
+  double usage = sum_;
+  // clip records crossing the window start
+  for (auto it = records_.begin(); it != records_.end() && it->start < window_start; it++) {
+    double inside = std::max(0.0, it->end - window_start);
+    usage -= (it->end - it->start) - inside;
+  }
+  return usage;
+}
+
+// end time of the oldest record in the window, infinity if there is none
+double WindowUsage::earliest_end(double window_start) {
+  expire(window_start);
+  if (records_.empty()) return std::numeric_limits<double>::infinity();
+  return records_.front().end;
+}
+
+bool WindowUsage::empty() const { return records_.empty(); }
+
+const std::deque<History> &WindowUsage::records() const { return records_; }
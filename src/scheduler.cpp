@@ -28,19 +28,21 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <execinfo.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <linux/limits.h>
 #include <netinet/in.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
-#include <chrono>
 #include <climits>
 #include <cmath>
 #include <cstdio>
@@ -56,15 +58,10 @@
 #include <vector>
 
 #include "debug.h"
+#include "schd-metrics.h"
 #include "util.h"
-#ifdef RANDOM_QUOTA
-#include <random>
-#endif
 
 using std::string;
-using std::chrono::duration_cast;
-using std::chrono::microseconds;
-using std::chrono::steady_clock;
 
 // signal handler
 void sig_handler(int);
@@ -86,144 +83,33 @@ struct timespec get_timespec_after(double ms) {
   return ts;
 }
 
-// all in milliseconds
-double QUOTA = 250.0;
-double MIN_QUOTA = 100.0;
-double WINDOW_SIZE = 10000.0;
-size_t g_sm_occupied = 0;
-int verbosity = 0;
-char* log_name = "/kubeshare/log/gemini-scheduler.log";
+const char* log_name = "/kubeshare/log/gemini-scheduler.log";
 #define EVENT_SIZE sizeof(struct inotify_event)
 #define BUF_LEN (1024 * (EVENT_SIZE + 16))
-auto PROGRESS_START = steady_clock::now();
 char limit_file_name[PATH_MAX] = "resource-config.txt";
 char limit_file_dir[PATH_MAX] = ".";
+char unix_socket_path[PATH_MAX] = "";  // listen on a unix domain socket instead of TCP if set
+char metrics_listen[PATH_MAX] = "";    // [IP:]PORT or unix socket path of the metrics endpoint
 
-std::list<History> history_list;
-#ifdef _DEBUG
-std::list<History> full_history;
-#endif
-
-// milliseconds since scheduler process started
-inline double ms_since_start() {
-  return duration_cast<microseconds>(steady_clock::now() - PROGRESS_START).count() / 1e3;
-}
-
-ClientInfo::ClientInfo(double baseq, double minq, double maxq, double minf, double maxf)
-    : BASE_QUOTA(baseq), MIN_QUOTA(minq), MAX_QUOTA(maxq), MIN_FRAC(minf), MAX_FRAC(maxf) {
-  quota_ = BASE_QUOTA;
-  latest_overuse_ = 0.0;
-  latest_actual_usage_ = 0.0;
-  burst_ = 0.0;
-};
-
-ClientInfo::~ClientInfo(){};
-
-void ClientInfo::set_burst(double estimated_burst) { burst_ = estimated_burst; }
-
-void ClientInfo::update_return_time(double overuse) {
-  double now = ms_since_start();
-  for (auto it = history_list.rbegin(); it != history_list.rend(); it++) {
-    if (it->name == this->name) {
-      // client may not use up all of the allocated time
-      it->end = std::min(now, it->end + overuse);
-      latest_actual_usage_ = it->end - it->start;
-      break;
-    }
-  }
-  latest_overuse_ = overuse;
-#ifdef _DEBUG
-  for (auto it = full_history.rbegin(); it != full_history.rend(); it++) {
-    if (it->name == this->name) {
-      it->end = std::min(now, it->end + overuse);
-      break;
-    }
-  }
-#endif
-}
-
-void ClientInfo::Record(double quota) {
-  History hist;
-  hist.name = this->name;
-  hist.start = ms_since_start();
-  hist.end = hist.start + quota;
-  history_list.push_back(hist);
-#ifdef _DEBUG
-  full_history.push_back(hist);
-#endif
-}
-
-double ClientInfo::get_min_fraction() { return MIN_FRAC; }
-
-double ClientInfo::get_max_fraction() { return MAX_FRAC; }
-
-// self-adaptive quota algorithm
-double ClientInfo::get_quota() {
-  const double UPDATE_RATE = 0.5;  // how drastically will the quota changes
-
-  if (burst_ < 1e-9) {
-    // special case when no burst data available, just fallback to static quota
-    quota_ = BASE_QUOTA;
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s: fallback to static quota, assign quota: %.3fms", name.c_str(), quota_);
-  } else {
-    quota_ = burst_ * UPDATE_RATE + quota_ * (1 - UPDATE_RATE);
-    quota_ = std::max(quota_, MIN_QUOTA);  // lowerbound
-    quota_ = std::min(quota_, MAX_QUOTA);  // upperbound
-    DEBUG(log_name, __FILE__, (long)__LINE__, "%s: burst: %.3fms, assign quota: %.3fms", name.c_str(), burst_, quota_);
-  }
-  return quota_;
-}
-
-// map container name to object
-std::map<string, ClientInfo *> client_info_map;
-
-std::list<candidate_t> candidates;
 pthread_mutex_t candidate_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t candidate_cond;  // initialized with CLOCK_MONOTONIC in main()
 
-void read_resource_config() {
-  std::ifstream fin;
-  ClientInfo *client_inf;
-  char client_name[HOST_NAME_MAX], full_path[PATH_MAX];
-  size_t gpu_memory_size, sm_partition;
-  double gpu_min_fraction, gpu_max_fraction;
-  int container_num;
-
+// (re)load limit_file_name under limit_file_dir, exit if it cannot be read
+void load_resource_config() {
+  char full_path[PATH_MAX];
   bzero(full_path, PATH_MAX);
   strncpy(full_path, limit_file_dir, PATH_MAX);
   if (limit_file_dir[strlen(limit_file_dir) - 1] != '/') full_path[strlen(limit_file_dir)] = '/';
   strncat(full_path, limit_file_name, PATH_MAX - strlen(full_path));
-
-  // Read GPU limit usage
-  fin.open(full_path, std::ios::in);
-  if (!fin.is_open()) {
-    ERROR(log_name, __FILE__, (long)__LINE__, "failed to open file %s: %s", full_path, strerror(errno));
-    exit(1);
-  }
-  fin >> container_num;
-  INFO(log_name, __FILE__, (long)__LINE__, "There are %d clients in the system...", container_num);
-  for (int i = 0; i < container_num; i++) {
-    fin >> client_name >> gpu_min_fraction >> gpu_max_fraction >> sm_partition >> gpu_memory_size;
-    client_inf = new ClientInfo(QUOTA, MIN_QUOTA, gpu_min_fraction * WINDOW_SIZE, gpu_min_fraction,
-                                gpu_max_fraction);
-    client_inf->name = client_name;
-    client_inf->gpu_sm_partition = sm_partition;
-    client_inf->gpu_mem_limit = gpu_memory_size;
-    if (client_info_map.find(client_name) != client_info_map.end())
-      delete client_info_map[client_name];
-    client_info_map[client_name] = client_inf;
-    INFO(log_name, __FILE__, (long)__LINE__, "%s request: %.2f, limit: %.2f, memory limit: %lu bytes, sm_partition: %lu\%", client_name, gpu_min_fraction,
-         gpu_max_fraction, gpu_memory_size, sm_partition);
-  }
-  fin.close();
+  if (read_resource_config(full_path) != 0) exit(1);
 }
 
-void monitor_file(const char *path, const char *filename) {
-  INFO(log_name, __FILE__, (long)__LINE__, "Monitor thread created.");
+// start watching the directory of configuration file, return the inotify file descriptor
+int init_monitor(const char *path, bool nonblock) {
   int fd, wd;
 
   // Initialize Inotify
-  fd = inotify_init();
+  fd = inotify_init1(nonblock ? IN_NONBLOCK : 0);
   if (fd < 0) ERROR(log_name, __FILE__, (long)__LINE__, "Failed to initialize inotify");
 
   // add watch to starting directory
@@ -233,142 +119,180 @@ void monitor_file(const char *path, const char *filename) {
     ERROR(log_name, __FILE__, (long)__LINE__, "Failed to add watch to '%s'.", path);
   else
     INFO(log_name, __FILE__, (long)__LINE__, "Watching '%s'.", path);
+  return fd;
+}
 
-  // start watching
-  while (1) {
-    int i = 0;
-    char buffer[BUF_LEN];
-    bzero(buffer, BUF_LEN);
-    int length = read(fd, buffer, BUF_LEN);
-    if (length < 0) ERROR(log_name, __FILE__, (long)__LINE__, "Read error");
-
-    while (i < length) {
-      struct inotify_event *event = (struct inotify_event *)&buffer[i];
-
-      if (event->len) {
-        if (event->mask & IN_CLOSE_WRITE) {
-          INFO(log_name, __FILE__, (long)__LINE__, "File %s modified with watch descriptor %d.", (const char *)event->name, event->wd);
-          // if event is triggered by target file
-          if (strcmp((const char *)event->name, filename) == 0) {
-            INFO(log_name, __FILE__, (long)__LINE__, "Update containers' settings...");
-            read_resource_config();
-          }
+// read pending inotify events and reload configuration if the target file is written
+void handle_monitor_events(int fd, const char *filename) {
+  int i = 0;
+  char buffer[BUF_LEN];
+  bzero(buffer, BUF_LEN);
+  int length = read(fd, buffer, BUF_LEN);
+  if (length < 0 && errno != EAGAIN) ERROR(log_name, __FILE__, (long)__LINE__, "Read error");
+
+  while (i < length) {
+    struct inotify_event *event = (struct inotify_event *)&buffer[i];
+
+    if (event->len) {
+      if (event->mask & IN_CLOSE_WRITE) {
+        INFO(log_name, __FILE__, (long)__LINE__, "File %s modified with watch descriptor %d.", (const char *)event->name, event->wd);
+        // if event is triggered by target file
+        if (strcmp((const char *)event->name, filename) == 0) {
+          INFO(log_name, __FILE__, (long)__LINE__, "Update containers' settings...");
+          pthread_mutex_lock(&candidate_mutex);
+          load_resource_config();
+          pthread_mutex_unlock(&candidate_mutex);
         }
       }
-      // update index to start of next event
-      i += EVENT_SIZE + event->len;
     }
+    // update index to start of next event
+    i += EVENT_SIZE + event->len;
+  }
+}
+
+void monitor_file(const char *path, const char *filename) {
+  INFO(log_name, __FILE__, (long)__LINE__, "Monitor thread created.");
+  int fd = init_monitor(path, false);
+
+  // start watching
+  while (1) {
+    handle_monitor_events(fd, filename);
   }
 
   // Clean up
   // Supposed to be unreached.
-  inotify_rm_watch(fd, wd);
   close(fd);
 }
 
+// serve Prometheus metrics over HTTP, one connection per scrape
+void metrics_server_func(int listen_fd) {
+  int fd;
+  while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0) {
+    // the request itself does not matter, every path gets the metrics
+    char rbuf[1024];
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    recv(fd, rbuf, sizeof(rbuf), 0);
+
+    std::string body = metrics_format();
+    char header[160];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+             body.size());
+    std::string rsp = header + body;
+    for (size_t sent = 0; sent < rsp.size();) {
+      ssize_t n = send(fd, rsp.data() + sent, rsp.size() - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      sent += n;
+    }
+    close(fd);
+  }
+  ERROR(log_name, __FILE__, (long)__LINE__, "Metrics endpoint stopped: %s", strerror(errno));
+}
+
 /**
- * Select a candidate whose current usage is less than its limit.
- * If no such candidates, calculate the time until time window content changes and sleep until then,
- * or until another candidate comes. If more than one candidate meets the requirement, select one
- * according to scheduling policy.
- * @return selected candidate
+ * Listen for metrics scrapes on a thread of its own.
+ * @param spec unix socket path (starting with '/'), or [IP:]PORT with IP defaulting to 127.0.0.1
+ * @return 0 on success, -1 on failure
  */
-std::vector<candidate_t> select_candidates() {
-  while (true) {
-    /* update history list and get usage in a time interval */
-    double window_size = WINDOW_SIZE;
-    int overlap_cnt = 0, i, j, k;
-    std::map<string, double> usage;
-
-    // instances to check for overlap
-    std::vector<string> overlap_check_vector;
-
-    double now = ms_since_start();
-    double window_start = now - WINDOW_SIZE;
-    double current_time;
-    current_time = window_start;
-    if (window_start < 0) {
-      // elapsed time less than a window size
-      window_size = now;
+int start_metrics_server(const char *spec) {
+  comm_addr_t addr;
+  char ip[INET_ADDRSTRLEN] = "127.0.0.1", addr_str[PATH_MAX + 8];
+  if (spec[0] == '/') {
+    comm_resolve(&addr, spec, nullptr, 0);
+    addr.type = SOCK_STREAM;  // HTTP is a byte stream
+  } else {
+    const char *port = strrchr(spec, ':');
+    if (port != nullptr) {
+      snprintf(ip, sizeof(ip), "%.*s", (int)(port - spec), spec);
+      port++;
+    } else {
+      port = spec;
     }
+    comm_resolve(&addr, nullptr, ip, strtoul(port, nullptr, 10));
+  }
+  int fd = comm_socket(&addr), on = 1;
+  // the server closes scrape connections first, do not let their TIME_WAIT block a restart
+  if (fd != -1) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (fd == -1 || comm_bind(fd, &addr) < 0 || listen(fd, SOMAXCONN) < 0) {
+    ERROR(log_name, __FILE__, (long)__LINE__, "cannot serve metrics on %s: %s",
+          comm_describe(&addr, addr_str, sizeof(addr_str)), strerror(errno));
+    if (fd != -1) close(fd);
+    return -1;
+  }
+  INFO(log_name, __FILE__, (long)__LINE__, "Metrics on %s",
+       comm_describe(&addr, addr_str, sizeof(addr_str)));
+  std::thread(metrics_server_func, fd).detach();
+  return 0;
+}
 
-    auto beyond_window = [=](const History &h) -> bool { return h.end < window_start; };
-    history_list.remove_if(beyond_window);
-    for (auto h : history_list) {
-      usage[h.name] += h.end - std::max(h.start, current_time);
-      if (verbosity > 1) {
-        printf("{'container': '%s', 'start': %.3f, 'end': %.3f},\n", h.name.c_str(), h.start / 1e3,
-               h.end / 1e3);
-      }
+/* event-driven mode: every connection is served by the event loop */
+struct connection_t {
+  int fd;
+  client_id_t client;    // resolved on the first request
+  size_t rlen;           // bytes of the incoming request received so far
+  char rbuf[REQ_MSG_LEN];
+  std::string wbuf;      // responses not yet accepted by the socket
+};
+bool event_driven = false;
+int epoll_fd = -1;
+std::map<int, connection_t *> connections;
+
+// write as much buffered data as the socket accepts, wait for EPOLLOUT if anything is left
+// @return 0 on success, -1 if the connection is broken
+int flush_connection(connection_t *conn) {
+  while (!conn->wbuf.empty()) {
+    // one response per send, so that message boundaries hold on SOCK_SEQPACKET
+    ssize_t n = send(conn->fd, conn->wbuf.data(), std::min(conn->wbuf.size(), RSP_MSG_LEN), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      if (errno == EINTR) continue;
+      return -1;
     }
+    conn->wbuf.erase(0, n);
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP | (conn->wbuf.empty() ? 0 : EPOLLOUT);
+  ev.data.fd = conn->fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+  return 0;
+}
 
-    /* select the candidate to give token */
-
-    // no need for quick exit if the first one in candidates does not use GPU recently
-    // as it's better to return a valid candidate set directly
-
-    // sort by time
-    /* select the ones to execute */
-    std::vector<valid_candidate_t> vaild_candidates;
+// send a response to pod manager
+void send_response(int sockfd, const char *sbuf) {
+  if (event_driven) {
+    auto found = connections.find(sockfd);
+    if (found == connections.end()) return;  // connection already closed
+    found->second->wbuf.append(sbuf, RSP_MSG_LEN);
+    if (flush_connection(found->second) != 0)
+      WARNING(log_name, __FILE__, (long)__LINE__, "failed to send response: %s", strerror(errno));
+    return;
+  }
 
-    pthread_mutex_lock(&candidate_mutex);
-    double waittime = 2000; //2s
-    for (auto it = candidates.begin(); it != candidates.end(); it++) {
-      string name = it->name;
-      double limit, require, missing, remaining;
-      limit = client_info_map[name]->get_max_fraction() * window_size;
-      require = client_info_map[name]->get_min_fraction() * window_size;
-      missing = require - usage[name];
-      remaining = limit - usage[name];
-
-      if (remaining > 0)
-        vaild_candidates.push_back({missing, remaining, usage[it->name], it->arrived_time, it});
-      else
-	waittime = std::min(waittime, -remaining);
-    }
-    pthread_mutex_unlock(&candidate_mutex);
-    DEBUG(log_name, __FILE__, (long)__LINE__, "current valid candidates' size:%d", vaild_candidates.size());
-
-    if (vaild_candidates.size() == 0) {
-      // all candidates reach usage limit
-      auto ts = get_timespec_after(waittime);
-      DEBUG(log_name, __FILE__, (long)__LINE__, "sleep time %d ms", waittime); 
-      // also wakes up if new requests come in
-      pthread_mutex_lock(&candidate_mutex);
-      pthread_cond_timedwait(&candidate_cond, &candidate_mutex, &ts);
-      pthread_mutex_unlock(&candidate_mutex);
-      continue;  // go to begin of loop
-    }
+  const int MAX_RETRY = 5;
+  int rc = multiple_attempt(
+      [&]() -> int {
+        if (send(sockfd, sbuf, RSP_MSG_LEN, MSG_NOSIGNAL) == -1) return -1;
+        return 0;
+      },
+      MAX_RETRY);
+  if (rc != 0) WARNING(log_name, __FILE__, (long)__LINE__, "failed to send response: %s", strerror(rc));
+}
 
-    std::sort(vaild_candidates.begin(), vaild_candidates.end(), schd_priority);
-    /* iterate candidates and sum up all the used sm */
-    std::vector<candidate_t> approved_candidates;
-    for (auto it = vaild_candidates.begin(); it != vaild_candidates.end(); it++) {
-      string name = it->iter->name;
-      size_t sm_partition = client_info_map[name]->gpu_sm_partition;
-      if (g_sm_occupied + sm_partition <= SM_GLOBAL_LIMIT){
-        approved_candidates.push_back(*(it->iter));
-        pthread_mutex_lock(&candidate_mutex);
-	candidates.erase(it->iter);
-        pthread_mutex_unlock(&candidate_mutex);
-      }
-    }
-    if (approved_candidates.size() == 0) {
-      // all candidates reach usage limit
-      auto ts = get_timespec_after(history_list.begin()->end - window_start);
-      DEBUG(log_name, __FILE__, (long)__LINE__, "no approved candidates, sleep until %ld.%03ld", ts.tv_sec, ts.tv_nsec / 1000000);
-      // also wakes up if new requests come in
-      pthread_mutex_lock(&candidate_mutex);
-      pthread_cond_timedwait(&candidate_cond, &candidate_mutex, &ts);
-      pthread_mutex_unlock(&candidate_mutex);
-      continue;  // go to begin of loop
-    }
-    return approved_candidates;
-  }
+// send quota to the connection the token was requested on
+void deliver_token(const candidate_t &token, double quota) {
+  char sbuf[RSP_MSG_LEN];
+  bzero(sbuf, RSP_MSG_LEN);
+  prepare_response(sbuf, REQ_QUOTA, token.req_id, quota);
+  send_response(token.socket, sbuf);
 }
 
 // Get the information from message
-void handle_message(int client_sock, char *message) {
+// Scheduler state is modified here, so the caller is responsible for serializing calls.
+// @param client id of the client on this connection, resolved by name on the first message
+void handle_message(int client_sock, client_id_t *client, char *message) {
   reqid_t req_id;  // simply pass this req_id back to Pod manager
   comm_request_t req;
   size_t hostname_len, offset = 0;
@@ -377,37 +301,32 @@ void handle_message(int client_sock, char *message) {
   ClientInfo *client_inf;
   attached = parse_request(message, &client_name, &hostname_len, &req_id, &req);
 
-  if (client_info_map.find(string(client_name)) == client_info_map.end()) {
+  if (*client < 0 && (*client = find_client(client_name)) < 0) {
     WARNING(log_name, __FILE__, (long)__LINE__, "Unknown client \"%s\". Ignore this request.", client_name);
     return;
   }
-  client_inf = client_info_map[string(client_name)];
+  client_inf = client_table[*client];
   bzero(sbuf, RSP_MSG_LEN);
-  int rc ,  MAX_RETRY = 5;
   if (req == REQ_QUOTA) {
-    double overuse, burst, window;
+    double overuse, burst;
     overuse = get_msg_data<double>(attached, offset);
     burst = get_msg_data<double>(attached, offset);
 
-    client_inf->update_return_time(overuse);
-    client_inf->set_burst(burst);
-    pthread_mutex_lock(&candidate_mutex);
-    candidates.push_back({client_sock, string(client_name), req_id, ms_since_start(), -1});
-    pthread_cond_signal(&candidate_cond);  // wake schedule_daemon_func up
-    pthread_mutex_unlock(&candidate_mutex);
+    enqueue_request(client_sock, *client, req_id, overuse, burst);
     // select_candidate() will give quota later
 
+  } else if (req == REQ_QUOTA_RESERVE) {
+    double overuse = get_msg_data<double>(attached, offset);
+    double burst = get_msg_data<double>(attached, offset);
+    // granted like REQ_QUOTA once the token held by the client expires
+    reserve_request(client_sock, *client, req_id, overuse, burst);
+
   } else if (req == REQ_MEM_LIMIT) {
 
     prepare_response(sbuf, REQ_MEM_LIMIT, req_id, (size_t)client_inf->gpu_mem_used, client_inf->gpu_mem_limit);
-    
-     rc = multiple_attempt(
-        [&]() -> int {
-          if(send(client_sock, sbuf, RSP_MSG_LEN, 0) == -1) return -1;
-          DEBUG(log_name, __FILE__, (long)__LINE__, "%s handle_message: REQ_MEM_LIMIT %d ",client_name, req_id);
-        },
-        MAX_RETRY, 3);
-    
+    send_response(client_sock, sbuf);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s handle_message: REQ_MEM_LIMIT %d ",client_name, req_id);
+
   } else if (req == REQ_MEM_UPDATE) {
     // ***for communication interface compatibility only***
     // memory usage is only tracked on hook library side
@@ -428,195 +347,187 @@ void handle_message(int client_sock, char *message) {
     }
 
     prepare_response(sbuf, REQ_MEM_UPDATE, req_id, verdict);
-    
-    rc = multiple_attempt(
-        [&]() -> int {
-          if(send(client_sock, sbuf, RSP_MSG_LEN, 0) == -1) return -1;
-          DEBUG(log_name, __FILE__, (long)__LINE__, "%s handle_message: REQ_MEM_UPDATE %d ",client_name, req_id);
-        },
-        MAX_RETRY, 3);
-    
+    send_response(client_sock, sbuf);
+    DEBUG(log_name, __FILE__, (long)__LINE__, "%s handle_message: REQ_MEM_UPDATE %d ",client_name, req_id);
+
+  } else if (req == REQ_PROCESS_USAGE) {
+    // quota used by a process of the Pod, no response
+    int pid = get_msg_data<int>(attached, offset);
+    double used_ms = get_msg_data<double>(attached, offset);
+    metrics_process_usage(*client, pid, used_ms);
+
   } else {
     WARNING(log_name, __FILE__, (long)__LINE__, "\"%s\" send an unknown request.", client_name);
   }
 }
 
-//check and clear expired tokens
-//if delivered tokens are zero, then there is no nearest waiting data
-//if a token expired, update info and schedule another round
-//else, we need to wait one of the token expires
-std::list<candidate_t> tokenTakers;
-std::list<candidate_t>::iterator min_tokenp;
-bool operator <(const timespec& lhs, const timespec& rhs)
-{
-    if (lhs.tv_sec == rhs.tv_sec)
-        return lhs.tv_nsec < rhs.tv_nsec;
-    else
-        return lhs.tv_sec < rhs.tv_sec;
-}
-bool update_tokens(){
-  bool should_wait = true;  //by default, the valid candidate are all delivered with its quota
-  auto now = ms_since_start();
-  if (tokenTakers.size()==0) should_wait=false; // should not wait based on the running kernel, but pending directly
-  else {
-    DEBUG(log_name, __FILE__, (long)__LINE__, "tokenTaker not empty with size %d", tokenTakers.size());
-    auto iter = tokenTakers.begin();
-    while(iter!=tokenTakers.end()){
-        if(iter->expired_time <= now){ //expired
-            DEBUG(log_name, __FILE__, (long)__LINE__, "%s expired its token, update.", iter->name);
-            g_sm_occupied -= client_info_map[iter->name]->gpu_sm_partition; 
-            tokenTakers.erase(iter++);
-            should_wait = false; //quick way to schedule another round
-        }else{
-            DEBUG(log_name, __FILE__, (long)__LINE__, "%s is still holding its token with quota %f", iter->name.c_str(), iter->expired_time-now);
-            iter++;
-        }
-    } 
-    min_tokenp = std::min_element(tokenTakers.begin(), tokenTakers.end(), 
-		    [](const candidate_t& pairA, const candidate_t& pairB)->bool{return pairA.expired_time<pairB.expired_time;}
-		    ); 
-  }
-  DEBUG(log_name, __FILE__, (long)__LINE__, "Current total partition: %d", g_sm_occupied);
-  return should_wait;
-};
-
-bool remove_ifexists(string name){
-    auto iter = tokenTakers.begin();
-    while(iter != tokenTakers.end()){
-       if(iter->name == name){
-         DEBUG(log_name, __FILE__, (long)__LINE__, "the candidate %s returns early", iter->name.c_str());
-	 g_sm_occupied -= client_info_map[iter->name]->gpu_sm_partition;
-         tokenTakers.erase(iter); 
-	 return true;
-       }
-       iter++;
-    }
-    return false;
-}
- 
 void *schedule_daemon_func(void *) {
-#ifdef RANDOM_QUOTA
-  std::random_device rd;
-  std::default_random_engine gen(rd());
-  std::uniform_real_distribution<double> dis(0.4, 1.0);
-#endif
-  double quota;
-  size_t sm_partition;
-  //std::unordered_map<string, bool> scheduler_table;//@todo: remove evicted pod
-
+  pthread_mutex_lock(&candidate_mutex);
   while (1) {
-    pthread_mutex_lock(&candidate_mutex);
-    if (candidates.size() != 0) {
-      pthread_mutex_unlock(&candidate_mutex);
-      // remove an entry from candidates
-      update_tokens();//release the token to update sm info
-      auto selects = select_candidates();
-      for (auto selected: selects){
-        DEBUG(log_name, __FILE__, (long)__LINE__, "select %s, waiting time: %.3f ms", selected.name.c_str(),
-              ms_since_start() - selected.arrived_time);
-
-        quota = client_info_map[selected.name]->get_quota();
-        sm_partition = client_info_map[selected.name]->gpu_sm_partition;
-#ifdef  RANDOM_QUOTA
-        quota *= dis(gen);
-#endif 
-        client_info_map[selected.name]->Record(quota);
-
-        // send quota to selected instance
-        char sbuf[RSP_MSG_LEN];
-        bzero(sbuf, RSP_MSG_LEN);
-        prepare_response(sbuf, REQ_QUOTA, selected.req_id, quota);
-
-        int rc, MAX_RETRY=5;
-        rc = multiple_attempt(
-          [&]() -> int {
-            if(send(selected.socket, sbuf, RSP_MSG_LEN, 0) == -1){
-                DEBUG(log_name, __FILE__, (long)__LINE__, "%s schedule_daemon_func - send error %s", selected.name.c_str(), strerror(errno));
-               return -1;
-            }
-          },
-          MAX_RETRY, 3);
-    
-	selected.expired_time = ms_since_start() + quota;
-        g_sm_occupied += client_info_map[selected.name]->gpu_sm_partition;
-	tokenTakers.emplace_back(selected);
-      }
-
-      bool should_wait = update_tokens();
-
-      // wait until the selected one's quota time out
-      pthread_mutex_lock(&candidate_mutex);
-      DEBUG(log_name, __FILE__, (long)__LINE__, "current token lists' size:%d", tokenTakers.size());
-      while (should_wait) {
-	auto now = ms_since_start();
-	double duration_ts = 0.0;
-	if (min_tokenp->expired_time > now)
-          duration_ts = min_tokenp->expired_time - now;
-        auto wakeupTime = get_timespec_after(duration_ts);
-        DEBUG(log_name, __FILE__, (long)__LINE__, "waiting %f ms as we should wait", duration_ts);
-        int rc = pthread_cond_timedwait(&candidate_cond, &candidate_mutex, &(wakeupTime));
-	//just wait at then; in most cases, it's ok
-        if (rc == ETIMEDOUT) {
-          DEBUG(log_name, __FILE__, (long)__LINE__, "the candidate %s didn't return on time with size:%d", min_tokenp->name.c_str(), tokenTakers.size());
-          should_wait = false;
-          g_sm_occupied -= client_info_map[min_tokenp->name]->gpu_sm_partition;
-	  tokenTakers.erase(min_tokenp);
-        } else {
-          //ignore new incoming request except it returns fast or its partition fits current remaining resources 
-	  for (auto conn : candidates) {
-          DEBUG(log_name, __FILE__, (long)__LINE__, "the candidate %s is comming", conn.name.c_str());
-            if (remove_ifexists(conn.name) || client_info_map[conn.name]->gpu_sm_partition + g_sm_occupied <= SM_GLOBAL_LIMIT) {
-               DEBUG(log_name, __FILE__, (long)__LINE__, "quit early");
-              should_wait = false;
-              break;
-            }
-          }
-          DEBUG(log_name, __FILE__, (long)__LINE__, "quit not early");
-        }
-      }
-      DEBUG(log_name, __FILE__, (long)__LINE__, "continue next round");
-      pthread_mutex_unlock(&candidate_mutex);
-    } else {
-      // wait for incoming connections
+    double wait_ms = schedule_step();
+    DEBUG(log_name, __FILE__, (long)__LINE__, "current token lists' size:%d", tokenTakers.size());
+    // also wakes up if new requests come in
+    if (std::isinf(wait_ms)) {
       DEBUG(log_name, __FILE__, (long)__LINE__, "no candidates");
       pthread_cond_wait(&candidate_cond, &candidate_mutex);
-      pthread_mutex_unlock(&candidate_mutex);
+    } else {
+      auto ts = get_timespec_after(wait_ms);
+      DEBUG(log_name, __FILE__, (long)__LINE__, "waiting %f ms", wait_ms);
+      pthread_cond_timedwait(&candidate_cond, &candidate_mutex, &ts);
     }
   }
+  pthread_mutex_unlock(&candidate_mutex);
+  return nullptr;
 }
 
 // daemon function for Pod manager: waiting for incoming request
 void *pod_client_func(void *args) {
   int pod_sockfd = *((int *)args);
+  client_id_t client = -1;  // resolved on the first request
   char *rbuf = new char[REQ_MSG_LEN];
   ssize_t recv_rc;
   bzero(rbuf, REQ_MSG_LEN);
 
-  while ((recv_rc = recv(pod_sockfd, rbuf, REQ_MSG_LEN, 0)) > 0) {
+  while ((recv_rc = recv(pod_sockfd, rbuf, REQ_MSG_LEN, MSG_WAITALL)) > 0) {
     DEBUG(log_name, __FILE__, (long)__LINE__, "pod_client_func recv -> handle message");
-    handle_message(pod_sockfd, rbuf);
+    pthread_mutex_lock(&candidate_mutex);
+    handle_message(pod_sockfd, &client, rbuf);
+    pthread_cond_signal(&candidate_cond);  // wake schedule_daemon_func up
+    pthread_mutex_unlock(&candidate_mutex);
   }
   DEBUG(log_name, __FILE__, (long)__LINE__, "Connection closed by Pod manager. recv() returns %ld.", recv_rc);
+  pthread_mutex_lock(&candidate_mutex);
+  drop_connection(pod_sockfd);
+  pthread_mutex_unlock(&candidate_mutex);
   close(pod_sockfd);
   delete (int *)args;
   delete[] rbuf;
   pthread_exit(NULL);
 }
 
+void close_connection(connection_t *conn) {
+  DEBUG(log_name, __FILE__, (long)__LINE__, "Connection closed by Pod manager.");
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+  drop_connection(conn->fd);
+  connections.erase(conn->fd);
+  close(conn->fd);
+  delete conn;
+}
 
+// receive as many complete requests as available on a non-blocking connection
+// @return 0 if the connection is still alive
+int read_connection(connection_t *conn) {
+  while (true) {
+    ssize_t n = recv(conn->fd, conn->rbuf + conn->rlen, REQ_MSG_LEN - conn->rlen, 0);
+    if (n == 0) return -1;
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    conn->rlen += n;
+    if (conn->rlen == REQ_MSG_LEN) {
+      handle_message(conn->fd, &conn->client, conn->rbuf);
+      conn->rlen = 0;
+    }
+  }
+}
+
+// arm the timer for the next scheduling round, disarm it if not needed
+void arm_schedule_timer(int timer_fd, double wait_ms) {
+  struct itimerspec its;
+  bzero(&its, sizeof(its));
+  if (!std::isinf(wait_ms)) {
+    wait_ms = std::max(wait_ms, 1e-3);  // zero disarms the timer
+    its.it_value.tv_sec = (time_t)(wait_ms / 1e3);
+    its.it_value.tv_nsec = (long)((wait_ms - its.it_value.tv_sec * 1e3) * 1e6);
+  }
+  timerfd_settime(timer_fd, 0, &its, nullptr);
+}
+
+/**
+ * Event-driven server: a single thread serves all connections with epoll, and a timerfd wakes it
+ * up when tokens expire or the time window moves. Every change of scheduler state happens in this
+ * thread, so no locking is needed.
+ */
+void run_event_loop(int listen_fd) {
+  const int MAX_EVENTS = 256;
+  struct epoll_event ev, events[MAX_EVENTS];
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  int monitor_fd = init_monitor(limit_file_dir, true);
+  if (epoll_fd < 0 || timer_fd < 0) {
+    ERROR(log_name, __FILE__, (long)__LINE__, "Fail to initialize event loop: %s", strerror(errno));
+    exit(-1);
+  }
+  fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+  for (int fd : {listen_fd, timer_fd, monitor_fd}) {
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  while (true) {
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ERROR(log_name, __FILE__, (long)__LINE__, "epoll_wait failed: %s", strerror(errno));
+      exit(-1);
+    }
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listen_fd) {
+        int client_fd;
+        while ((client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+          INFO(log_name, __FILE__, (long)__LINE__, "Received an incoming connection.");
+          connection_t *conn = new connection_t();
+          conn->fd = client_fd;
+          conn->client = -1;
+          conn->rlen = 0;
+          connections[client_fd] = conn;
+          ev.events = EPOLLIN | EPOLLRDHUP;
+          ev.data.fd = client_fd;
+          epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev);
+        }
+      } else if (fd == timer_fd) {
+        uint64_t expirations;
+        while (read(timer_fd, &expirations, sizeof(expirations)) > 0) continue;
+      } else if (fd == monitor_fd) {
+        handle_monitor_events(monitor_fd, limit_file_name);
+      } else {
+        auto found = connections.find(fd);
+        if (found == connections.end()) continue;
+        connection_t *conn = found->second;
+        if ((events[i].events & EPOLLOUT) && flush_connection(conn) != 0) {
+          close_connection(conn);
+          continue;
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) &&
+            read_connection(conn) != 0)
+          close_connection(conn);
+      }
+    }
+    arm_schedule_timer(timer_fd, schedule_step());
+  }
+}
 
 int main(int argc, char *argv[]) {
   
   uint16_t schd_port = 50051;
   // parse command line options
-  const char *optstring = "P:q:m:w:f:p:v:h";
+  const char *optstring = "P:q:m:w:f:p:u:M:v:ekh";
   struct option opts[] = {{"port", required_argument, nullptr, 'P'},
                           {"quota", required_argument, nullptr, 'q'},
                           {"min_quota", required_argument, nullptr, 'm'},
                           {"window", required_argument, nullptr, 'w'},
                           {"limit_file", required_argument, nullptr, 'f'},
                           {"limit_file_dir", required_argument, nullptr, 'p'},
+                          {"unix_socket", required_argument, nullptr, 'u'},
+                          {"metrics", required_argument, nullptr, 'M'},
                           {"verbose", required_argument, nullptr, 'v'},
+                          {"event_loop", no_argument, nullptr, 'e'},
+                          {"sm_packing", no_argument, nullptr, 'k'},
                           {"help", no_argument, nullptr, 'h'},
                           {nullptr, 0, nullptr, 0}};
   int opt;
@@ -640,9 +551,21 @@ int main(int argc, char *argv[]) {
       case 'p':
         strncpy(limit_file_dir, optarg, PATH_MAX - 1);
         break;
+      case 'u':
+        strncpy(unix_socket_path, optarg, PATH_MAX - 1);
+        break;
+      case 'M':
+        strncpy(metrics_listen, optarg, PATH_MAX - 1);
+        break;
       case 'v':
         verbosity = atoi(optarg);
         break;
+      case 'e':
+        event_driven = true;
+        break;
+      case 'k':
+        sm_packing = true;
+        break;
       case 'h':
         printf("usage: %s [options]\n", argv[0]);
         puts("Options:");
@@ -652,7 +575,11 @@ int main(int argc, char *argv[]) {
         puts("    -w [WINDOW_SIZE], --window [WINDOW_SIZE]");
         puts("    -f [LIMIT_FILE], --limit_file [LIMIT_FILE]");
         puts("    -p [LIMIT_FILE_DIR], --limit_file_dir [LIMIT_FILE_DIR]");
+        puts("    -u [PATH], --unix_socket [PATH]    listen on a unix domain socket instead of TCP");
+        puts("    -M [[IP:]PORT|PATH], --metrics [[IP:]PORT|PATH]    serve Prometheus metrics over HTTP");
         puts("    -v [LEVEL], --verbose [LEVEL]");
+        puts("    -e, --event_loop    serve all connections from a single epoll thread");
+        puts("    -k, --sm_packing    maximize granted SM partitions weighted by fairness deficit");
         puts("    -h, --help");
         return 0;
       default:
@@ -674,35 +601,40 @@ int main(int argc, char *argv[]) {
 #endif
 
   // read configuration file
-  read_resource_config();
+  load_resource_config();
+  if (metrics_listen[0] != '\0' && start_metrics_server(metrics_listen) != 0) exit(-1);
 
   int rc;
   int sockfd = 0;
   int forClientSockfd = 0;
-  struct sockaddr_in clientInfo;
-  int addrlen = sizeof(clientInfo);
-
-  // create a monitored thread
-  std::thread t1(monitor_file, std::ref(limit_file_dir), std::ref(limit_file_name));
-  t1.detach();
+  comm_addr_t serverInfo;
+  char addr_str[PATH_MAX + 8];
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  comm_resolve(&serverInfo, unix_socket_path, nullptr, schd_port);
+  sockfd = comm_socket(&serverInfo);
   if (sockfd == -1) {
     ERROR(log_name, __FILE__, (long)__LINE__, "Fail to create a socket!");
     exit(-1);
   }
 
-  struct sockaddr_in serverInfo;
-  bzero(&serverInfo, sizeof(serverInfo));
-
-  serverInfo.sin_family = PF_INET;
-  serverInfo.sin_addr.s_addr = INADDR_ANY;
-  serverInfo.sin_port = htons(schd_port);
-  if (bind(sockfd, (struct sockaddr *)&serverInfo, sizeof(serverInfo)) < 0) {
-    ERROR(log_name, __FILE__, (long)__LINE__, "cannot bind port");
+  if (comm_bind(sockfd, &serverInfo) < 0) {
+    ERROR(log_name, __FILE__, (long)__LINE__, "cannot bind %s: %s",
+          comm_describe(&serverInfo, addr_str, sizeof(addr_str)), strerror(errno));
     exit(-1);
   }
   listen(sockfd, SOMAXCONN);
+  INFO(log_name, __FILE__, (long)__LINE__, "Listening on %s",
+       comm_describe(&serverInfo, addr_str, sizeof(addr_str)));
+
+  if (event_driven) {
+    INFO(log_name, __FILE__, (long)__LINE__, "Waiting for incoming connection (event loop)");
+    run_event_loop(sockfd);
+    return 0;
+  }
+
+  // create a monitored thread
+  std::thread t1(monitor_file, std::ref(limit_file_dir), std::ref(limit_file_name));
+  t1.detach();
 
   pthread_t tid;
 
@@ -721,8 +653,7 @@ int main(int argc, char *argv[]) {
   pthread_detach(tid);
   INFO(log_name, __FILE__, (long)__LINE__, "Waiting for incoming connection");
 
-  while (
-      (forClientSockfd = accept(sockfd, (struct sockaddr *)&clientInfo, (socklen_t *)&addrlen))) {
+  while ((forClientSockfd = accept(sockfd, nullptr, nullptr))) {
     INFO(log_name, __FILE__, (long)__LINE__, "Received an incoming connection.");
     pthread_t tid;
     int *pod_sockfd = new int;
@@ -755,7 +686,7 @@ void dump_history(int sig) {
   FILE *f = fopen(filename, "w");
   fputs("[\n", f);
   for (auto it = full_history.begin(); it != full_history.end(); it++) {
-    fprintf(f, "\t{\"container\": \"%s\", \"start\": %.3lf, \"end\" : %.3lf}", it->name.c_str(),
+    fprintf(f, "\t{\"container\": \"%s\", \"start\": %.3lf, \"end\" : %.3lf}", client_table[it->client]->name.c_str(),
             it->start / 1000.0, it->end / 1000.0);
     if (std::next(it) == full_history.end())
       fprintf(f, "\n");
@@ -766,6 +697,7 @@ void dump_history(int sig) {
   fclose(f);
 
   INFO(log_name, __FILE__, (long)__LINE__, "history dumped to %s", filename);
+  if (sm_packing) report_pack_stats();
   exit(0);
 }
 #endif
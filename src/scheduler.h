@@ -17,18 +17,44 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include <deque>
 #include <list>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "comm.h"
 
+// dense index of a client, assigned when the client first appears in configuration
+typedef int client_id_t;
+const int MAX_CLIENT_NUM = 1024;
+
 struct History {
-  std::string name;
+  client_id_t client;
   double start;
   double end;
 };
 
+// Sliding-window GPU time accounting of a single client.
+// Records are appended in time order and expired from the front, and the total length of the
+// records still in the window is kept as a running sum, so admission and expiry are O(1) amortized.
+class WindowUsage {
+ public:
+  WindowUsage();
+  void add(double start, double end);
+  double amend_last(double now, double overuse);
+  double extend_last(double overuse);
+  double usage(double window_start);
+  double earliest_end(double window_start);
+  bool empty() const;
+  const std::deque<History> &records() const;
+
+ private:
+  void expire(double window_start);
+  std::deque<History> records_;
+  double sum_;  // sum of (end - start) of all kept records
+};
+
 // some bias used for self-adaptive quota calculation
 const double EXTRA_QUOTA = 10.0;
 const double SCHD_OVERHEAD = 2.0;
@@ -40,12 +66,15 @@ class ClientInfo {
   ~ClientInfo();
   void set_burst(double burst);
   void update_return_time(double overuse);
+  void charge_overuse(double overuse);
   void Record(double quota);
   double get_min_fraction();
   double get_max_fraction();
   double get_quota();
+  WindowUsage window;  // GPU time granted to this client in the current time window
   std::map<unsigned long long, size_t> memory_map;
   std::string name;
+  client_id_t id;
   size_t gpu_mem_used = 0;
   size_t gpu_mem_limit;
   size_t gpu_sm_partition;
@@ -65,10 +94,35 @@ class ClientInfo {
 // the connection to specific container
 struct candidate_t {
   int socket;
-  std::string name;  // container name
+  client_id_t client;
   reqid_t req_id;
-  double arrived_time;
+  double arrived_time;  // a reservation arrives when the token it follows expires
   double expired_time; 
+  double overuse;       // of a reservation, charged when it arrives; negative once charged
+};
+
+// Delivered tokens ordered by expiration time (binary min-heap).
+// A client holds at most one token; the heap position of each client's token is indexed by client
+// id, so cancelling a returned token is O(log n) instead of a scan.
+class TokenHeap {
+ public:
+  TokenHeap();
+  void push(const candidate_t &token);
+  bool remove(client_id_t client);
+  // when the token held by client expires, -infinity if it holds none
+  double expiry(client_id_t client) const;
+  const candidate_t &top() const;
+  void pop();
+  bool empty() const;
+  size_t size() const;
+
+ private:
+  void sift_up(size_t i);
+  void sift_down(size_t i);
+  void place(size_t i, const candidate_t &token);
+  void erase_at(size_t i);
+  std::vector<candidate_t> heap_;
+  std::vector<int> pos_;  // heap position of the token held by each client, -1 if none
 };
 
 struct valid_candidate_t {
@@ -80,5 +134,44 @@ struct valid_candidate_t {
 };
 
 bool schd_priority(const valid_candidate_t &a, const valid_candidate_t &b);
+double schd_pack_value(const valid_candidate_t &c, size_t sm_partition);
+std::vector<bool> schd_pack(const std::vector<valid_candidate_t> &candidates,
+                            const std::vector<size_t> &sm_partitions, size_t capacity);
+
+// Time source of the scheduling decisions, in milliseconds.
+// gem-schd uses the steady clock; gem-sim replaces it with a virtual clock.
+class Clock {
+ public:
+  virtual ~Clock() {}
+  virtual double now() = 0;
+};
+
+// scheduler core (schd-core.cpp), shared by gem-schd and gem-sim
+extern Clock *schd_clock;
+extern double QUOTA, MIN_QUOTA, WINDOW_SIZE;
+extern size_t g_sm_occupied;
+extern int verbosity;
+extern bool sm_packing;
+extern const char *log_name;  // defined by the front end
+extern ClientInfo *client_table[MAX_CLIENT_NUM];
+extern int client_num;
+extern std::list<candidate_t> candidates;
+extern TokenHeap tokenTakers;
+#ifdef _DEBUG
+extern std::list<History> full_history;
+#endif
+
+double ms_since_start();
+int read_resource_config(const char *full_path);
+client_id_t find_client(const char *name);
+void enqueue_request(int socket, client_id_t client, reqid_t req_id, double overuse, double burst);
+void reserve_request(int socket, client_id_t client, reqid_t req_id, double overuse, double burst);
+double schedule_step();
+void drop_connection(int socket);
+void report_pack_stats();
+
+// implemented by the front end: hand a granted token of quota ms to its holder; a quota of 0
+// answers a reservation taken over by a plain request
+void deliver_token(const candidate_t &token, double quota);
 
 #endif
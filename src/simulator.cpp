@@ -0,0 +1,334 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * gem-sim: replay a workload trace against the scheduler core on a virtual clock.
+ *
+ * Each line of the trace is a GPU job:
+ *     <arrival ms> <client name> <GPU time ms> <kernel burst ms> <overuse ms>
+ * A client runs its jobs one after another. Like the hook library, it asks for a token with the
+ * burst of its next kernels, runs until the job is done or the quota expires, and in the latter
+ * case its last kernel runs <overuse ms> past the quota before it asks again.
+ */
+
+#include <getopt.h>
+#include <linux/limits.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "scheduler.h"
+
+const char *log_name = "gem-sim";
+
+class VirtualClock : public Clock {
+ public:
+  VirtualClock() : now_(0.0) {}
+  double now() { return now_; }
+  void advance(double t) { now_ = std::max(now_, t); }
+
+ private:
+  double now_;
+};
+VirtualClock virtual_clock;
+
+struct job_t {
+  double arrival;
+  double work;  // GPU time needed
+  double burst;
+  double overuse;
+};
+
+struct sim_client_t {
+  std::deque<job_t> jobs;  // arrived, not finished yet
+  double remaining = 0.0;  // GPU time left of the front job
+  double overuse = 0.0;    // overuse of the previous token, reported with the next request
+  double request_time = 0.0;
+  double run_length = 0.0;  // of the current token
+  bool finishing = false;   // the front job completes within the current token
+  double busy = 0.0;        // total GPU time
+  std::vector<double> waits;      // request to grant
+  std::vector<double> latencies;  // job arrival to completion
+};
+
+enum event_type_t { ARRIVAL, RUN_END, WAKEUP };
+
+struct event_t {
+  double time;
+  unsigned long seq;  // keeps events of the same time in insertion order
+  event_type_t type;
+  client_id_t client;
+  job_t job;
+  unsigned long generation;  // a WAKEUP is stale if another one was scheduled after it
+};
+
+struct event_later {
+  bool operator()(const event_t &a, const event_t &b) const {
+    if (a.time != b.time) return a.time > b.time;
+    return a.seq > b.seq;
+  }
+};
+
+std::priority_queue<event_t, std::vector<event_t>, event_later> events;
+unsigned long event_seq = 0;
+unsigned long wakeup_generation = 0;
+sim_client_t sim_clients[MAX_CLIENT_NUM];
+reqid_t next_req_id = 0;
+
+// time-weighted SM partitions, up to the last sample and up to the last job completion
+struct sm_area_t {
+  double granted;  // held by delivered tokens
+  double running;  // held by clients actually running kernels
+};
+sm_area_t sm_area, sm_area_at_end;
+size_t sm_running = 0;
+double last_sample = 0.0, end_time = 0.0;
+
+void push_event(double time, event_type_t type, client_id_t client, const job_t &job = job_t()) {
+  events.push({time, event_seq++, type, client, job, wakeup_generation});
+}
+
+void sample_sm(double now) {
+  sm_area.granted += g_sm_occupied * (now - last_sample);
+  sm_area.running += sm_running * (now - last_sample);
+  last_sample = now;
+}
+
+void send_request(client_id_t id) {
+  sim_client_t &c = sim_clients[id];
+  c.request_time = ms_since_start();
+  enqueue_request(id, id, next_req_id++, c.overuse, c.jobs.front().burst);
+}
+
+// the scheduler gives a token to a client: run the front job until it is done or quota expires
+void deliver_token(const candidate_t &token, double quota) {
+  sim_client_t &c = sim_clients[token.client];
+  double now = ms_since_start();
+  c.waits.push_back(now - c.request_time);
+  c.finishing = c.remaining <= quota;
+  c.run_length = c.finishing ? c.remaining : quota + c.jobs.front().overuse;
+  sm_running += client_table[token.client]->gpu_sm_partition;
+  push_event(now + c.run_length, RUN_END, token.client);
+}
+
+void handle_arrival(client_id_t id, const job_t &job) {
+  sim_client_t &c = sim_clients[id];
+  c.jobs.push_back(job);
+  if (c.jobs.size() > 1) return;  // busy with earlier jobs
+  c.remaining = job.work;
+  c.overuse = 0.0;
+  send_request(id);
+}
+
+void handle_run_end(client_id_t id, double now) {
+  sim_client_t &c = sim_clients[id];
+  c.busy += c.run_length;
+  sm_running -= client_table[id]->gpu_sm_partition;
+  c.remaining -= c.run_length;
+  if (!c.finishing && c.remaining > 0) {
+    c.overuse = c.jobs.front().overuse;
+    send_request(id);
+    return;
+  }
+
+  // the job is done; the token is kept until it expires or the next job asks for another one
+  c.latencies.push_back(now - c.jobs.front().arrival);
+  c.jobs.pop_front();
+  end_time = now;
+  sm_area_at_end = sm_area;
+  if (c.jobs.empty()) return;
+  c.remaining = c.jobs.front().work;
+  c.overuse = 0.0;
+  send_request(id);
+}
+
+/**
+ * Read jobs of a trace into the event queue.
+ * @return 0 on success, -1 on failure
+ */
+int read_trace(const char *path) {
+  std::ifstream fin(path);
+  if (!fin.is_open()) {
+    ERROR(log_name, __FILE__, (long)__LINE__, "failed to open trace %s: %s", path, strerror(errno));
+    return -1;
+  }
+  std::string line;
+  int lineno = 0;
+  while (std::getline(fin, line)) {
+    lineno++;
+    if (line.empty() || line[0] == '#') continue;
+    char name[HOST_NAME_MAX];
+    job_t job;
+    if (sscanf(line.c_str(), "%lf %63s %lf %lf %lf", &job.arrival, name, &job.work, &job.burst,
+               &job.overuse) != 5) {
+      ERROR(log_name, __FILE__, (long)__LINE__, "%s:%d: malformed trace line", path, lineno);
+      return -1;
+    }
+    client_id_t id = find_client(name);
+    if (id < 0) {
+      WARNING(log_name, __FILE__, (long)__LINE__, "%s:%d: unknown client \"%s\", skipped", path,
+              lineno, name);
+      continue;
+    }
+    push_event(job.arrival, ARRIVAL, id, job);
+  }
+  return 0;
+}
+
+// replay until every job is done and every token is returned
+void simulate() {
+  while (!events.empty()) {
+    double now = events.top().time;
+    virtual_clock.advance(now);
+    sample_sm(now);
+
+    bool changed = false;
+    while (!events.empty() && events.top().time <= now) {
+      event_t ev = events.top();
+      events.pop();
+      if (ev.type == ARRIVAL) {
+        handle_arrival(ev.client, ev.job);
+      } else if (ev.type == RUN_END) {
+        handle_run_end(ev.client, now);
+      } else if (ev.generation != wakeup_generation) {
+        continue;  // stale wakeup
+      }
+      changed = true;
+    }
+    if (!changed) continue;
+
+    double wait_ms = schedule_step();
+    if (std::isinf(wait_ms)) continue;
+    wakeup_generation++;
+    // a zero wait would replay the same instant forever, the real daemon always sleeps a little
+    push_event(now + std::max(wait_ms, 1e-3), WAKEUP, -1);
+  }
+}
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0.0;
+  std::sort(v.begin(), v.end());
+  size_t idx = std::min(v.size() - 1, (size_t)std::max(1.0, std::ceil(p * v.size())) - 1);
+  return v[idx];
+}
+
+double mean(const std::vector<double> &v) {
+  if (v.empty()) return 0.0;
+  double sum = 0.0;
+  for (double x : v) sum += x;
+  return sum / v.size();
+}
+
+void report() {
+  double duration = end_time;
+  printf("simulated %.3f ms\n", duration);
+  printf("%-16s %9s %9s %9s %8s %11s %11s %6s %12s\n", "client", "share(%)", "min(%)", "max(%)",
+         "tokens", "wait(ms)", "p99(ms)", "jobs", "latency(ms)");
+  for (client_id_t id = 0; id < client_num; id++) {
+    sim_client_t &c = sim_clients[id];
+    ClientInfo *client_inf = client_table[id];
+    printf("%-16s %9.2f %9.2f %9.2f %8zu %11.3f %11.3f %6zu %12.3f\n", client_inf->name.c_str(),
+           duration > 0 ? c.busy / duration * 100 : 0.0, client_inf->get_min_fraction() * 100,
+           client_inf->get_max_fraction() * 100, c.waits.size(), mean(c.waits),
+           percentile(c.waits, 0.99), c.latencies.size(), mean(c.latencies));
+  }
+  if (duration > 0) {
+    printf("SM utilization: %.2f%% granted, %.2f%% running\n",
+           sm_area_at_end.granted / duration / SM_GLOBAL_LIMIT * 100,
+           sm_area_at_end.running / duration / SM_GLOBAL_LIMIT * 100);
+  }
+  if (sm_packing) report_pack_stats();
+}
+
+int main(int argc, char *argv[]) {
+  char config_path[PATH_MAX] = "resource-config.txt";
+  char trace_path[PATH_MAX] = "";
+
+  const char *optstring = "q:m:w:f:t:v:kh";
+  struct option opts[] = {{"quota", required_argument, nullptr, 'q'},
+                          {"min_quota", required_argument, nullptr, 'm'},
+                          {"window", required_argument, nullptr, 'w'},
+                          {"limit_file", required_argument, nullptr, 'f'},
+                          {"trace", required_argument, nullptr, 't'},
+                          {"verbose", required_argument, nullptr, 'v'},
+                          {"sm_packing", no_argument, nullptr, 'k'},
+                          {"help", no_argument, nullptr, 'h'},
+                          {nullptr, 0, nullptr, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, optstring, opts, NULL)) != -1) {
+    switch (opt) {
+      case 'q':
+        QUOTA = atof(optarg);
+        break;
+      case 'm':
+        MIN_QUOTA = atof(optarg);
+        break;
+      case 'w':
+        WINDOW_SIZE = atof(optarg);
+        break;
+      case 'f':
+        strncpy(config_path, optarg, PATH_MAX - 1);
+        break;
+      case 't':
+        strncpy(trace_path, optarg, PATH_MAX - 1);
+        break;
+      case 'v':
+        verbosity = atoi(optarg);
+        break;
+      case 'k':
+        sm_packing = true;
+        break;
+      case 'h':
+        printf("usage: %s -t TRACE [options]\n", argv[0]);
+        puts("Replay a workload trace against the scheduler on a virtual clock.");
+        puts("Trace lines: <arrival ms> <client> <GPU time ms> <kernel burst ms> <overuse ms>");
+        puts("Options:");
+        puts("    -t [TRACE], --trace [TRACE]");
+        puts("    -f [LIMIT_FILE], --limit_file [LIMIT_FILE]    resource configuration of gem-schd");
+        puts("    -q [QUOTA], --quota [QUOTA]");
+        puts("    -m [MIN_QUOTA], --min_quota [MIN_QUOTA]");
+        puts("    -w [WINDOW_SIZE], --window [WINDOW_SIZE]");
+        puts("    -v [LEVEL], --verbose [LEVEL]");
+        puts("    -k, --sm_packing    maximize granted SM partitions weighted by fairness deficit");
+        puts("    -h, --help");
+        return 0;
+      default:
+        break;
+    }
+  }
+  if (trace_path[0] == '\0') {
+    fprintf(stderr, "%s: a trace is required (-t), see --help\n", argv[0]);
+    return 1;
+  }
+
+  schd_clock = &virtual_clock;
+  if (read_resource_config(config_path) != 0) return 1;
+  if (read_trace(trace_path) != 0) return 1;
+  simulate();
+  report();
+  return 0;
+}
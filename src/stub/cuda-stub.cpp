@@ -0,0 +1,840 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Simulated CUDA driver, built as libcuda.so, see stub/cuda.h. Each stream keeps the time its
+ * queued work completes at; nothing runs, time just passes. Device memory is an address range with
+ * no backing store, limited to STUB_GPU_MEMORY bytes (default 16 GiB).
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+
+#include "cuda.h"
+
+struct CUstream_st {
+  long long busy_until;  // ns, CLOCK_MONOTONIC
+  bool blocking;         // synchronizes with the legacy default stream
+  CUgraph capture;       // graph work is captured into instead of queued, nullptr if none
+};
+
+struct CUgraph_st {
+  unsigned long kernels;
+};
+
+struct CUevent_st {
+  long long complete_at;  // ns, -1 until recorded
+};
+
+struct CUfunc_st {
+  double ms;
+};
+
+struct CUarray_st {
+  size_t size;
+};
+
+struct CUmipmappedArray_st {
+  size_t size;
+};
+
+struct CUctx_st {
+  int device;
+};
+
+struct allocation_t {
+  size_t size;
+  bool managed;
+};
+
+static pthread_mutex_t stub_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CUstream_st legacy_stream = {0, true};
+static std::set<CUstream_st *> streams;
+static std::set<CUfunc_st *> functions;
+static long live_events = 0;
+static unsigned long launches = 0;  // accepted by cuLaunchKernel
+static CUctx_st primary_context = {0};
+static CUcontext current_context = &primary_context;
+
+static std::map<CUdeviceptr, allocation_t> allocations;
+static CUdeviceptr next_address = 0x200000000ULL;
+static size_t mem_used = 0;
+
+static size_t mem_total() {
+  static size_t total = 0;
+  if (total == 0) {
+    char *env = getenv("STUB_GPU_MEMORY");
+    total = env != nullptr ? strtoull(env, nullptr, 10) : 16ULL << 30;
+  }
+  return total;
+}
+
+static double default_kernel_ms() {
+  static double ms = -1.0;
+  if (ms < 0.0) {
+    char *env = getenv("STUB_KERNEL_MS");
+    ms = env != nullptr ? atof(env) : 1.0;
+  }
+  return ms;
+}
+
+static long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(long long ns) {
+  struct timespec ts = {(time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0) {
+  }
+}
+
+// caller holds stub_mutex; @return when the work queued so far on stream completes
+static long long queued_until(CUstream stream) {
+  if (stream != nullptr)
+    return std::max(stream->busy_until, stream->blocking ? legacy_stream.busy_until : 0);
+  long long until = legacy_stream.busy_until;
+  for (CUstream_st *s : streams)
+    if (s->blocking) until = std::max(until, s->busy_until);
+  return until;
+}
+
+// caller holds stub_mutex
+static long long device_idle_at() {
+  long long until = legacy_stream.busy_until;
+  for (CUstream_st *s : streams) until = std::max(until, s->busy_until);
+  return until;
+}
+
+// caller holds stub_mutex
+static bool valid_stream(CUstream stream) { return stream == nullptr || streams.count(stream); }
+
+static CUresult allocate(CUdeviceptr *dptr, size_t bytesize, bool managed) {
+  if (dptr == nullptr || bytesize == 0) return CUDA_ERROR_INVALID_VALUE;
+  pthread_mutex_lock(&stub_mutex);
+  if (mem_used + bytesize > mem_total()) {
+    pthread_mutex_unlock(&stub_mutex);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  *dptr = next_address;
+  next_address += (bytesize + 511) & ~511ULL;
+  allocations[*dptr] = {bytesize, managed};
+  mem_used += bytesize;
+  pthread_mutex_unlock(&stub_mutex);
+  return CUDA_SUCCESS;
+}
+
+// reserve memory for an array; @return false if out of memory
+static bool charge(size_t bytesize) {
+  pthread_mutex_lock(&stub_mutex);
+  bool fits = mem_used + bytesize <= mem_total();
+  if (fits) mem_used += bytesize;
+  pthread_mutex_unlock(&stub_mutex);
+  return fits;
+}
+
+static void uncharge(size_t bytesize) {
+  pthread_mutex_lock(&stub_mutex);
+  mem_used -= bytesize;
+  pthread_mutex_unlock(&stub_mutex);
+}
+
+static size_t array_bytes(size_t width, size_t height, size_t depth, CUarray_format format,
+                          unsigned int channels) {
+  size_t element = format == CU_AD_FORMAT_FLOAT || format == CU_AD_FORMAT_UNSIGNED_INT32 ||
+                           format == CU_AD_FORMAT_SIGNED_INT32
+                       ? 4
+                       : format == CU_AD_FORMAT_UNSIGNED_INT8 || format == CU_AD_FORMAT_SIGNED_INT8
+                             ? 1
+                             : 2;
+  return width * std::max<size_t>(height, 1) * std::max<size_t>(depth, 1) * element * channels;
+}
+
+extern "C" {
+
+CUresult cuInit(unsigned int flags) { return CUDA_SUCCESS; }
+
+CUresult cuDriverGetVersion(int *driverVersion) {
+  if (driverVersion == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  *driverVersion = CUDA_VERSION;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGet(CUdevice *device, int ordinal) {
+  if (device == nullptr || ordinal != 0) return CUDA_ERROR_INVALID_VALUE;
+  *device = 0;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceGetCount(int *count) {
+  if (count == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  *count = 1;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuDeviceTotalMem(size_t *bytes, CUdevice dev) {
+  if (bytes == nullptr || dev != 0) return CUDA_ERROR_INVALID_VALUE;
+  *bytes = mem_total();
+  return CUDA_SUCCESS;
+}
+
+CUresult cuCtxGetCurrent(CUcontext *pctx) {
+  if (pctx == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  *pctx = current_context;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuCtxSetCurrent(CUcontext ctx) {
+  current_context = ctx;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuCtxDestroy(CUcontext ctx) {
+  if (ctx == current_context) current_context = nullptr;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuCtxSynchronize(void) {
+  pthread_mutex_lock(&stub_mutex);
+  long long until = device_idle_at();
+  pthread_mutex_unlock(&stub_mutex);
+  sleep_until(until);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemGetInfo(size_t *free, size_t *total) {
+  if (free == nullptr || total == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  pthread_mutex_lock(&stub_mutex);
+  *total = mem_total();
+  *free = *total - mem_used;
+  pthread_mutex_unlock(&stub_mutex);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemAlloc(CUdeviceptr *dptr, size_t bytesize) { return allocate(dptr, bytesize, false); }
+
+CUresult cuMemAllocManaged(CUdeviceptr *dptr, size_t bytesize, unsigned int flags) {
+  return allocate(dptr, bytesize, true);
+}
+
+CUresult cuMemAllocPitch(CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes, size_t Height,
+                         unsigned int ElementSizeBytes) {
+  if (pPitch == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  *pPitch = (WidthInBytes + 511) & ~(size_t)511;
+  return allocate(dptr, *pPitch * Height, false);
+}
+
+CUresult cuMemFree(CUdeviceptr dptr) {
+  if (dptr == 0) return CUDA_SUCCESS;
+  pthread_mutex_lock(&stub_mutex);
+  auto found = allocations.find(dptr);
+  if (found == allocations.end()) {
+    pthread_mutex_unlock(&stub_mutex);
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  mem_used -= found->second.size;
+  allocations.erase(found);
+  pthread_mutex_unlock(&stub_mutex);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuArrayCreate(CUarray *pHandle, const CUDA_ARRAY_DESCRIPTOR *pAllocateArray) {
+  if (pHandle == nullptr || pAllocateArray == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  size_t size = array_bytes(pAllocateArray->Width, pAllocateArray->Height, 1,
+                            pAllocateArray->Format, pAllocateArray->NumChannels);
+  if (!charge(size)) return CUDA_ERROR_OUT_OF_MEMORY;
+  *pHandle = new CUarray_st{size};
+  return CUDA_SUCCESS;
+}
+
+CUresult cuArray3DCreate(CUarray *pHandle, const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray) {
+  if (pHandle == nullptr || pAllocateArray == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  size_t size = array_bytes(pAllocateArray->Width, pAllocateArray->Height, pAllocateArray->Depth,
+                            pAllocateArray->Format, pAllocateArray->NumChannels);
+  if (!charge(size)) return CUDA_ERROR_OUT_OF_MEMORY;
+  *pHandle = new CUarray_st{size};
+  return CUDA_SUCCESS;
+}
+
+CUresult cuArrayDestroy(CUarray hArray) {
+  if (hArray == nullptr) return CUDA_ERROR_INVALID_HANDLE;
+  uncharge(hArray->size);
+  delete hArray;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMipmappedArrayCreate(CUmipmappedArray *pHandle,
+                                const CUDA_ARRAY3D_DESCRIPTOR *pMipmappedArrayDesc,
+                                unsigned int numMipmapLevels) {
+  if (pHandle == nullptr || pMipmappedArrayDesc == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  // all levels together take at most 4/3 of the first one
+  size_t size = array_bytes(pMipmappedArrayDesc->Width, pMipmappedArrayDesc->Height,
+                            pMipmappedArrayDesc->Depth, pMipmappedArrayDesc->Format,
+                            pMipmappedArrayDesc->NumChannels) *
+                4 / 3;
+  if (!charge(size)) return CUDA_ERROR_OUT_OF_MEMORY;
+  *pHandle = new CUmipmappedArray_st{size};
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMipmappedArrayDestroy(CUmipmappedArray hMipmappedArray) {
+  if (hMipmappedArray == nullptr) return CUDA_ERROR_INVALID_HANDLE;
+  uncharge(hMipmappedArray->size);
+  delete hMipmappedArray;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuPointerGetAttribute(void *data, CUpointer_attribute attribute, CUdeviceptr ptr) {
+  if (data == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  pthread_mutex_lock(&stub_mutex);
+  auto found = allocations.upper_bound(ptr);
+  bool known = found != allocations.begin() && ptr < (--found)->first + found->second.size;
+  bool managed = known && found->second.managed;
+  pthread_mutex_unlock(&stub_mutex);
+  if (!known) return CUDA_ERROR_INVALID_VALUE;
+  if (attribute == CU_POINTER_ATTRIBUTE_MEMORY_TYPE)
+    *(unsigned int *)data = managed ? CU_MEMORYTYPE_UNIFIED : CU_MEMORYTYPE_DEVICE;
+  else if (attribute == CU_POINTER_ATTRIBUTE_CONTEXT)
+    *(CUcontext *)data = &primary_context;
+  else
+    return CUDA_ERROR_INVALID_VALUE;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemPrefetchAsync(CUdeviceptr devPtr, size_t count, CUdevice dstDevice,
+                            CUstream hStream) {
+  return CUDA_SUCCESS;
+}
+
+// synchronous copies wait for the work queued on the legacy default stream
+CUresult cuMemcpyHtoD(CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyDtoH(void *dstHost, CUdeviceptr srcDevice, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyHtoA(CUarray dstArray, size_t dstOffset, const void *srcHost, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyAtoH(void *dstHost, CUarray srcArray, size_t srcOffset, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyHtoDAsync(CUdeviceptr dstDevice, const void *srcHost, size_t ByteCount,
+                           CUstream hStream) {
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemcpyDtoHAsync(void *dstHost, CUdeviceptr srcDevice, size_t ByteCount,
+                           CUstream hStream) {
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemcpyAtoHAsync(void *dstHost, CUarray srcArray, size_t srcOffset, size_t ByteCount,
+                           CUstream hStream) {
+  return CUDA_SUCCESS;
+}
+
+// the other synchronous copies and memsets, which take no time either
+CUresult cuMemcpy(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyPeer(CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice,
+                      CUcontext srcContext, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyDtoD(CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyDtoA(CUarray dstArray, size_t dstOffset, CUdeviceptr srcDevice, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyAtoD(CUdeviceptr dstDevice, CUarray srcArray, size_t srcOffset, size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpyAtoA(CUarray dstArray, size_t dstOffset, CUarray srcArray, size_t srcOffset,
+                      size_t ByteCount) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpy2D(const CUDA_MEMCPY2D *pCopy) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpy2DUnaligned(const CUDA_MEMCPY2D *pCopy) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpy3D(const CUDA_MEMCPY3D *pCopy) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemcpy3DPeer(const CUDA_MEMCPY3D_PEER *pCopy) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemsetD8(CUdeviceptr dstDevice, unsigned char uc, size_t N) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemsetD16(CUdeviceptr dstDevice, unsigned short us, size_t N) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemsetD32(CUdeviceptr dstDevice, unsigned int ui, size_t N) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemsetD2D8(CUdeviceptr dstDevice, size_t dstPitch, unsigned char uc, size_t Width,
+                      size_t Height) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemsetD2D16(CUdeviceptr dstDevice, size_t dstPitch, unsigned short us, size_t Width,
+                       size_t Height) {
+  return cuStreamSynchronize(nullptr);
+}
+
+CUresult cuMemsetD2D32(CUdeviceptr dstDevice, size_t dstPitch, unsigned int ui, size_t Width,
+                       size_t Height) {
+  return cuStreamSynchronize(nullptr);
+}
+
+// asynchronous copies and memsets take no time, only the stream is checked
+static CUresult stream_op(CUstream stream) {
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(stream);
+  pthread_mutex_unlock(&stub_mutex);
+  return valid ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+CUresult cuMemcpyAsync(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemcpyPeerAsync(CUdeviceptr dstDevice, CUcontext dstContext, CUdeviceptr srcDevice,
+                           CUcontext srcContext, size_t ByteCount, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemcpyDtoDAsync(CUdeviceptr dstDevice, CUdeviceptr srcDevice, size_t ByteCount,
+                           CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemcpyHtoAAsync(CUarray dstArray, size_t dstOffset, const void *srcHost,
+                           size_t ByteCount, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemcpy2DAsync(const CUDA_MEMCPY2D *pCopy, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemcpy3DAsync(const CUDA_MEMCPY3D *pCopy, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemcpy3DPeerAsync(const CUDA_MEMCPY3D_PEER *pCopy, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemsetD8Async(CUdeviceptr dstDevice, unsigned char uc, size_t N, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemsetD16Async(CUdeviceptr dstDevice, unsigned short us, size_t N, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemsetD32Async(CUdeviceptr dstDevice, unsigned int ui, size_t N, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemsetD2D8Async(CUdeviceptr dstDevice, size_t dstPitch, unsigned char uc, size_t Width,
+                           size_t Height, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemsetD2D16Async(CUdeviceptr dstDevice, size_t dstPitch, unsigned short us,
+                            size_t Width, size_t Height, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemsetD2D32Async(CUdeviceptr dstDevice, size_t dstPitch, unsigned int ui, size_t Width,
+                            size_t Height, CUstream hStream) {
+  return stream_op(hStream);
+}
+
+CUresult cuMemFreeAsync(CUdeviceptr dptr, CUstream hStream) {
+  CUresult rc = stream_op(hStream);
+  return rc == CUDA_SUCCESS ? cuMemFree(dptr) : rc;
+}
+
+CUresult cuLaunchKernel(CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
+                        unsigned int gridDimZ, unsigned int blockDimX, unsigned int blockDimY,
+                        unsigned int blockDimZ, unsigned int sharedMemBytes, CUstream hStream,
+                        void **kernelParams, void **extra) {
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(hStream);
+  double ms = functions.count(f) ? f->ms : default_kernel_ms();
+  bool captured = valid && hStream != nullptr && hStream->capture != nullptr;
+  if (captured) hStream->capture->kernels++;
+  pthread_mutex_unlock(&stub_mutex);
+  if (!valid) return CUDA_ERROR_INVALID_HANDLE;
+  if (!captured) stub_kernel(hStream, ms);
+  __sync_fetch_and_add(&launches, 1);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuLaunchCooperativeKernel(CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
+                                   unsigned int gridDimZ, unsigned int blockDimX,
+                                   unsigned int blockDimY, unsigned int blockDimZ,
+                                   unsigned int sharedMemBytes, CUstream hStream,
+                                   void **kernelParams) {
+  return cuLaunchKernel(f, gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
+                        sharedMemBytes, hStream, kernelParams, nullptr);
+}
+
+CUresult cuStreamCreate(CUstream *phStream, unsigned int Flags) {
+  if (phStream == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  pthread_mutex_lock(&stub_mutex);
+  *phStream = new CUstream_st{0, !(Flags & CU_STREAM_NON_BLOCKING), nullptr};
+  streams.insert(*phStream);
+  pthread_mutex_unlock(&stub_mutex);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuStreamDestroy(CUstream hStream) {
+  pthread_mutex_lock(&stub_mutex);
+  bool found = streams.erase(hStream) > 0;
+  pthread_mutex_unlock(&stub_mutex);
+  if (!found) return CUDA_ERROR_INVALID_HANDLE;
+  delete hStream;
+  return CUDA_SUCCESS;
+}
+
+CUresult cuStreamSynchronize(CUstream hStream) {
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(hStream);
+  long long until = valid ? queued_until(hStream) : 0;
+  pthread_mutex_unlock(&stub_mutex);
+  if (!valid) return CUDA_ERROR_INVALID_HANDLE;
+  sleep_until(until);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuStreamQuery(CUstream hStream) {
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(hStream);
+  long long until = valid ? queued_until(hStream) : 0;
+  pthread_mutex_unlock(&stub_mutex);
+  if (!valid) return CUDA_ERROR_INVALID_HANDLE;
+  return now_ns() >= until ? CUDA_SUCCESS : CUDA_ERROR_NOT_READY;
+}
+
+CUresult cuStreamWaitEvent(CUstream hStream, CUevent hEvent, unsigned int Flags) {
+  if (hEvent == nullptr) return CUDA_ERROR_INVALID_HANDLE;
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(hStream);
+  CUstream_st *stream = hStream != nullptr ? hStream : &legacy_stream;
+  if (valid) stream->busy_until = std::max(queued_until(hStream), hEvent->complete_at);
+  pthread_mutex_unlock(&stub_mutex);
+  return valid ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+struct host_call_t {
+  long long at;  // when the work queued before it completes
+  CUstream stream;
+  CUhostFn fn;
+  CUstreamCallback callback;
+  void *user_data;
+};
+
+static void *host_call_thread(void *arg) {
+  host_call_t *call = (host_call_t *)arg;
+  sleep_until(call->at);
+  if (call->fn != nullptr)
+    call->fn(call->user_data);
+  else
+    call->callback(call->stream, CUDA_SUCCESS, call->user_data);
+  delete call;
+  return nullptr;
+}
+
+// host functions run on a thread of their own once the work queued before them completes
+static CUresult host_call(CUstream stream, CUhostFn fn, CUstreamCallback callback,
+                          void *user_data) {
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(stream);
+  long long at = valid ? queued_until(stream) : 0;
+  pthread_mutex_unlock(&stub_mutex);
+  if (!valid) return CUDA_ERROR_INVALID_HANDLE;
+  pthread_t tid;
+  pthread_create(&tid, nullptr, host_call_thread,
+                 new host_call_t{at, stream, fn, callback, user_data});
+  pthread_detach(tid);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuStreamAddCallback(CUstream hStream, CUstreamCallback callback, void *userData,
+                             unsigned int flags) {
+  if (callback == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  return host_call(hStream, nullptr, callback, userData);
+}
+
+CUresult cuLaunchHostFunc(CUstream hStream, CUhostFn fn, void *userData) {
+  if (fn == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  return host_call(hStream, fn, nullptr, userData);
+}
+
+// no graph can be instantiated here
+// captured kernels are only counted, the graph cannot be instantiated
+CUresult cuStreamBeginCapture(CUstream hStream, CUstreamCaptureMode mode) {
+  pthread_mutex_lock(&stub_mutex);
+  CUresult rc = CUDA_SUCCESS;
+  if (!valid_stream(hStream))
+    rc = CUDA_ERROR_INVALID_HANDLE;
+  else if (hStream == nullptr)
+    rc = CUDA_ERROR_STREAM_CAPTURE_UNSUPPORTED;
+  else if (hStream->capture != nullptr)
+    rc = CUDA_ERROR_ILLEGAL_STATE;
+  else
+    hStream->capture = new CUgraph_st{0};
+  pthread_mutex_unlock(&stub_mutex);
+  return rc;
+}
+
+CUresult cuStreamEndCapture(CUstream hStream, CUgraph *phGraph) {
+  if (phGraph == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  pthread_mutex_lock(&stub_mutex);
+  CUresult rc = CUDA_SUCCESS;
+  if (!valid_stream(hStream)) {
+    rc = CUDA_ERROR_INVALID_HANDLE;
+  } else if (hStream == nullptr || hStream->capture == nullptr) {
+    rc = CUDA_ERROR_ILLEGAL_STATE;
+  } else {
+    *phGraph = hStream->capture;
+    hStream->capture = nullptr;
+  }
+  pthread_mutex_unlock(&stub_mutex);
+  return rc;
+}
+
+CUresult cuStreamIsCapturing(CUstream hStream, CUstreamCaptureStatus *captureStatus) {
+  if (captureStatus == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(hStream);
+  if (valid)
+    *captureStatus = hStream != nullptr && hStream->capture != nullptr
+                         ? CU_STREAM_CAPTURE_STATUS_ACTIVE
+                         : CU_STREAM_CAPTURE_STATUS_NONE;
+  pthread_mutex_unlock(&stub_mutex);
+  return valid ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+CUresult cuGraphLaunch(CUgraphExec hGraphExec, CUstream hStream) {
+  return CUDA_ERROR_INVALID_HANDLE;
+}
+
+// of CUDA 12.4, not declared in cuda.h; stub kernels take no parameters
+CUresult cuFuncGetParamInfo(CUfunction func, size_t paramIndex, size_t *paramOffset,
+                            size_t *paramSize) {
+  return CUDA_ERROR_INVALID_VALUE;
+}
+
+CUresult cuEventCreate(CUevent *phEvent, unsigned int Flags) {
+  if (phEvent == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  *phEvent = new CUevent_st{-1};
+  __sync_fetch_and_add(&live_events, 1);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuEventDestroy(CUevent hEvent) {
+  if (hEvent == nullptr) return CUDA_ERROR_INVALID_HANDLE;
+  delete hEvent;
+  __sync_fetch_and_sub(&live_events, 1);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuEventRecord(CUevent hEvent, CUstream hStream) {
+  if (hEvent == nullptr) return CUDA_ERROR_INVALID_HANDLE;
+  pthread_mutex_lock(&stub_mutex);
+  bool valid = valid_stream(hStream);
+  if (valid) hEvent->complete_at = std::max(now_ns(), queued_until(hStream));
+  pthread_mutex_unlock(&stub_mutex);
+  return valid ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+CUresult cuEventQuery(CUevent hEvent) {
+  if (hEvent == nullptr) return CUDA_ERROR_INVALID_HANDLE;
+  return now_ns() >= hEvent->complete_at ? CUDA_SUCCESS : CUDA_ERROR_NOT_READY;
+}
+
+CUresult cuEventSynchronize(CUevent hEvent) {
+  if (hEvent == nullptr) return CUDA_ERROR_INVALID_HANDLE;
+  sleep_until(hEvent->complete_at);
+  return CUDA_SUCCESS;
+}
+
+CUresult cuEventElapsedTime(float *pMilliseconds, CUevent hStart, CUevent hEnd) {
+  if (pMilliseconds == nullptr || hStart == nullptr || hEnd == nullptr)
+    return CUDA_ERROR_INVALID_HANDLE;
+  if (hStart->complete_at < 0 || hEnd->complete_at < 0) return CUDA_ERROR_INVALID_HANDLE;
+  long long now = now_ns();
+  if (now < hStart->complete_at || now < hEnd->complete_at) return CUDA_ERROR_NOT_READY;
+  *pMilliseconds = (hEnd->complete_at - hStart->complete_at) / 1e6;
+  return CUDA_SUCCESS;
+}
+
+CUfunction stub_function(double ms) {
+  CUfunction f = new CUfunc_st{ms};
+  pthread_mutex_lock(&stub_mutex);
+  functions.insert(f);
+  pthread_mutex_unlock(&stub_mutex);
+  return f;
+}
+
+long long stub_kernel(CUstream stream, double ms) {
+  pthread_mutex_lock(&stub_mutex);
+  long long start = std::max(now_ns(), queued_until(stream));
+  long long end = start + (long long)(ms * 1e6);
+  if (stream == nullptr)
+    legacy_stream.busy_until = end;
+  else
+    stream->busy_until = end;
+  pthread_mutex_unlock(&stub_mutex);
+  return end;
+}
+
+long stub_live_events(void) { return live_events; }
+
+unsigned long stub_launch_count(void) { return launches; }
+
+// latest version of every entry point by name without version suffix, as returned to the runtime
+#define STUB_PROC(symbol) {#symbol, (void *)&symbol}
+static const struct {
+  const char *name;
+  void *func;
+} procs[] = {
+    STUB_PROC(cuInit),
+    STUB_PROC(cuDriverGetVersion),
+    STUB_PROC(cuGetProcAddress),
+    STUB_PROC(cuDeviceGet),
+    STUB_PROC(cuDeviceGetCount),
+    STUB_PROC(cuDeviceTotalMem),
+    STUB_PROC(cuCtxGetCurrent),
+    STUB_PROC(cuCtxSetCurrent),
+    STUB_PROC(cuCtxDestroy),
+    STUB_PROC(cuCtxSynchronize),
+    STUB_PROC(cuMemGetInfo),
+    STUB_PROC(cuMemAlloc),
+    STUB_PROC(cuMemAllocManaged),
+    STUB_PROC(cuMemAllocPitch),
+    STUB_PROC(cuMemFree),
+    STUB_PROC(cuArrayCreate),
+    STUB_PROC(cuArray3DCreate),
+    STUB_PROC(cuArrayDestroy),
+    STUB_PROC(cuMipmappedArrayCreate),
+    STUB_PROC(cuMipmappedArrayDestroy),
+    STUB_PROC(cuPointerGetAttribute),
+    STUB_PROC(cuMemPrefetchAsync),
+    STUB_PROC(cuMemcpyHtoD),
+    STUB_PROC(cuMemcpyDtoH),
+    STUB_PROC(cuMemcpyHtoA),
+    STUB_PROC(cuMemcpyAtoH),
+    STUB_PROC(cuMemcpyHtoDAsync),
+    STUB_PROC(cuMemcpyDtoHAsync),
+    STUB_PROC(cuMemcpyAtoHAsync),
+    STUB_PROC(cuMemcpy),
+    STUB_PROC(cuMemcpyPeer),
+    STUB_PROC(cuMemcpyDtoD),
+    STUB_PROC(cuMemcpyDtoA),
+    STUB_PROC(cuMemcpyAtoD),
+    STUB_PROC(cuMemcpyAtoA),
+    STUB_PROC(cuMemcpy2D),
+    STUB_PROC(cuMemcpy2DUnaligned),
+    STUB_PROC(cuMemcpy3D),
+    STUB_PROC(cuMemcpy3DPeer),
+    STUB_PROC(cuMemsetD8),
+    STUB_PROC(cuMemsetD16),
+    STUB_PROC(cuMemsetD32),
+    STUB_PROC(cuMemsetD2D8),
+    STUB_PROC(cuMemsetD2D16),
+    STUB_PROC(cuMemsetD2D32),
+    STUB_PROC(cuMemcpyAsync),
+    STUB_PROC(cuMemcpyPeerAsync),
+    STUB_PROC(cuMemcpyDtoDAsync),
+    STUB_PROC(cuMemcpyHtoAAsync),
+    STUB_PROC(cuMemcpy2DAsync),
+    STUB_PROC(cuMemcpy3DAsync),
+    STUB_PROC(cuMemcpy3DPeerAsync),
+    STUB_PROC(cuMemsetD8Async),
+    STUB_PROC(cuMemsetD16Async),
+    STUB_PROC(cuMemsetD32Async),
+    STUB_PROC(cuMemsetD2D8Async),
+    STUB_PROC(cuMemsetD2D16Async),
+    STUB_PROC(cuMemsetD2D32Async),
+    STUB_PROC(cuMemFreeAsync),
+    STUB_PROC(cuLaunchKernel),
+    STUB_PROC(cuLaunchCooperativeKernel),
+    STUB_PROC(cuStreamCreate),
+    STUB_PROC(cuStreamDestroy),
+    STUB_PROC(cuStreamSynchronize),
+    STUB_PROC(cuStreamQuery),
+    STUB_PROC(cuStreamWaitEvent),
+    STUB_PROC(cuStreamAddCallback),
+    STUB_PROC(cuLaunchHostFunc),
+    STUB_PROC(cuStreamBeginCapture),
+    STUB_PROC(cuStreamEndCapture),
+    STUB_PROC(cuStreamIsCapturing),
+    STUB_PROC(cuGraphLaunch),
+    STUB_PROC(cuEventCreate),
+    STUB_PROC(cuEventDestroy),
+    STUB_PROC(cuEventRecord),
+    STUB_PROC(cuEventQuery),
+    STUB_PROC(cuEventSynchronize),
+    STUB_PROC(cuEventElapsedTime),
+};
+#undef STUB_PROC
+
+CUresult cuGetProcAddress(const char *symbol, void **pfn, int cudaVersion, cuuint64_t flags) {
+  if (symbol == nullptr || pfn == nullptr) return CUDA_ERROR_INVALID_VALUE;
+  for (auto &proc : procs) {
+    if (strcmp(proc.name, symbol) == 0) {
+      *pfn = proc.func;
+      return CUDA_SUCCESS;
+    }
+  }
+  *pfn = nullptr;
+  return CUDA_ERROR_NOT_FOUND;
+}
+}
@@ -0,0 +1,190 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Simulated CUDA runtime, built as libcudart.so on top of the stub driver, see
+ * stub/cuda_runtime.h.
+ */
+
+#include <pthread.h>
+
+#include "cuda_runtime.h"
+
+// driver entry points used by the runtime, resolved on first use
+static struct {
+  CUresult (*cuCtxSynchronize)(void);
+  CUresult (*cuMemAlloc)(CUdeviceptr *, size_t);
+  CUresult (*cuMemAllocManaged)(CUdeviceptr *, size_t, unsigned int);
+  CUresult (*cuMemFree)(CUdeviceptr);
+  CUresult (*cuMemGetInfo)(size_t *, size_t *);
+  CUresult (*cuMemcpyHtoD)(CUdeviceptr, const void *, size_t);
+  CUresult (*cuMemcpyDtoH)(void *, CUdeviceptr, size_t);
+  CUresult (*cuLaunchKernel)(CUfunction, unsigned int, unsigned int, unsigned int, unsigned int,
+                             unsigned int, unsigned int, unsigned int, CUstream, void **, void **);
+  CUresult (*cuStreamCreate)(CUstream *, unsigned int);
+  CUresult (*cuStreamDestroy)(CUstream);
+  CUresult (*cuStreamSynchronize)(CUstream);
+  CUresult (*cuEventCreate)(CUevent *, unsigned int);
+  CUresult (*cuEventDestroy)(CUevent);
+  CUresult (*cuEventRecord)(CUevent, CUstream);
+  CUresult (*cuEventQuery)(CUevent);
+  CUresult (*cuEventSynchronize)(CUevent);
+  CUresult (*cuEventElapsedTime)(float *, CUevent, CUevent);
+} driver;
+static pthread_once_t driver_once = PTHREAD_ONCE_INIT;
+
+#define RESOLVE(symbol) cuGetProcAddress(#symbol, (void **)&driver.symbol, CUDART_VERSION, 0)
+
+static void resolve_driver() {
+  RESOLVE(cuCtxSynchronize);
+  RESOLVE(cuMemAlloc);
+  RESOLVE(cuMemAllocManaged);
+  RESOLVE(cuMemFree);
+  RESOLVE(cuMemGetInfo);
+  RESOLVE(cuMemcpyHtoD);
+  RESOLVE(cuMemcpyDtoH);
+  RESOLVE(cuLaunchKernel);
+  RESOLVE(cuStreamCreate);
+  RESOLVE(cuStreamDestroy);
+  RESOLVE(cuStreamSynchronize);
+  RESOLVE(cuEventCreate);
+  RESOLVE(cuEventDestroy);
+  RESOLVE(cuEventRecord);
+  RESOLVE(cuEventQuery);
+  RESOLVE(cuEventSynchronize);
+  RESOLVE(cuEventElapsedTime);
+}
+
+#undef RESOLVE
+
+#define CALL(symbol, ...) \
+  (pthread_once(&driver_once, resolve_driver), to_runtime_error(driver.symbol(__VA_ARGS__)))
+
+static cudaError_t to_runtime_error(CUresult result) {
+  switch (result) {
+    case CUDA_SUCCESS:
+      return cudaSuccess;
+    case CUDA_ERROR_INVALID_VALUE:
+      return cudaErrorInvalidValue;
+    case CUDA_ERROR_OUT_OF_MEMORY:
+      return cudaErrorMemoryAllocation;
+    case CUDA_ERROR_NOT_INITIALIZED:
+      return cudaErrorInitializationError;
+    case CUDA_ERROR_INVALID_HANDLE:
+      return cudaErrorInvalidResourceHandle;
+    case CUDA_ERROR_NOT_READY:
+      return cudaErrorNotReady;
+    default:
+      return cudaErrorUnknown;
+  }
+}
+
+extern "C" {
+
+cudaError_t cudaGetDevice(int *device) {
+  if (device == nullptr) return cudaErrorInvalidValue;
+  *device = 0;
+  return cudaSuccess;
+}
+
+cudaError_t cudaSetDevice(int device) { return device == 0 ? cudaSuccess : cudaErrorInvalidValue; }
+
+cudaError_t cudaGetDeviceCount(int *count) {
+  if (count == nullptr) return cudaErrorInvalidValue;
+  *count = 1;
+  return cudaSuccess;
+}
+
+cudaError_t cudaDeviceSynchronize(void) { return CALL(cuCtxSynchronize); }
+
+cudaError_t cudaMalloc(void **devPtr, size_t size) {
+  return CALL(cuMemAlloc, (CUdeviceptr *)devPtr, size);
+}
+
+cudaError_t cudaMallocManaged(void **devPtr, size_t size, unsigned int flags) {
+  return CALL(cuMemAllocManaged, (CUdeviceptr *)devPtr, size, flags);
+}
+
+cudaError_t cudaFree(void *devPtr) { return CALL(cuMemFree, (CUdeviceptr)devPtr); }
+
+cudaError_t cudaMemGetInfo(size_t *free, size_t *total) {
+  return CALL(cuMemGetInfo, free, total);
+}
+
+cudaError_t cudaMemcpy(void *dst, const void *src, size_t count, enum cudaMemcpyKind kind) {
+  if (kind == cudaMemcpyHostToDevice) return CALL(cuMemcpyHtoD, (CUdeviceptr)dst, src, count);
+  if (kind == cudaMemcpyDeviceToHost) return CALL(cuMemcpyDtoH, dst, (CUdeviceptr)src, count);
+  return CALL(cuStreamSynchronize, nullptr);
+}
+
+cudaError_t cudaLaunchKernel(const void *func, dim3 gridDim, dim3 blockDim, void **args,
+                             size_t sharedMem, cudaStream_t stream) {
+  return CALL(cuLaunchKernel, (CUfunction)func, gridDim.x, gridDim.y, gridDim.z, blockDim.x,
+              blockDim.y, blockDim.z, (unsigned int)sharedMem, stream, args, nullptr);
+}
+
+cudaError_t cudaStreamCreateWithFlags(cudaStream_t *stream, unsigned int flags) {
+  return CALL(cuStreamCreate, stream,
+              flags & cudaStreamNonBlocking ? CU_STREAM_NON_BLOCKING : CU_STREAM_DEFAULT);
+}
+
+cudaError_t cudaStreamCreate(cudaStream_t *stream) {
+  return cudaStreamCreateWithFlags(stream, cudaStreamDefault);
+}
+
+cudaError_t cudaStreamDestroy(cudaStream_t stream) { return CALL(cuStreamDestroy, stream); }
+
+cudaError_t cudaStreamSynchronize(cudaStream_t stream) {
+  return CALL(cuStreamSynchronize, stream);
+}
+
+cudaError_t cudaEventCreate(cudaEvent_t *event) {
+  return CALL(cuEventCreate, event, CU_EVENT_DEFAULT);
+}
+
+cudaError_t cudaEventDestroy(cudaEvent_t event) { return CALL(cuEventDestroy, event); }
+
+cudaError_t cudaEventRecord(cudaEvent_t event, cudaStream_t stream) {
+  return CALL(cuEventRecord, event, stream);
+}
+
+cudaError_t cudaEventQuery(cudaEvent_t event) { return CALL(cuEventQuery, event); }
+
+cudaError_t cudaEventSynchronize(cudaEvent_t event) { return CALL(cuEventSynchronize, event); }
+
+cudaError_t cudaEventElapsedTime(float *ms, cudaEvent_t start, cudaEvent_t end) {
+  return CALL(cuEventElapsedTime, ms, start, end);
+}
+
+const char *cudaGetErrorString(cudaError_t error) {
+  switch (error) {
+    case cudaSuccess:
+      return "no error";
+    case cudaErrorInvalidValue:
+      return "invalid argument";
+    case cudaErrorMemoryAllocation:
+      return "out of memory";
+    case cudaErrorInitializationError:
+      return "initialization error";
+    case cudaErrorInvalidResourceHandle:
+      return "invalid resource handle";
+    case cudaErrorNotReady:
+      return "device not ready";
+    default:
+      return "unknown error";
+  }
+}
+}
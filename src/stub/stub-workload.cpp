@@ -0,0 +1,144 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * GPU application stand-in for hook testing with the stub driver: allocates device memory, then
+ * issues bursts of simulated kernels separated by a host synchronization and an idle gap until
+ * the run time is over. Prints one line of key=value statistics for tools/stub-harness.py.
+ */
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+int main(int argc, char *argv[]) {
+  double kernel_ms = 1.0, gap_ms = 0.0, host_ms = 0.0, seconds = 5.0;
+  int kernels = 10, streams = 1;
+  size_t alloc_mb = 0;
+  bool runtime_api = false, default_stream = true;
+
+  const char *optstring = "k:n:g:c:t:m:s:drh";
+  int opt;
+  while ((opt = getopt(argc, argv, optstring)) != -1) {
+    switch (opt) {
+      case 'k':
+        kernel_ms = atof(optarg);
+        break;
+      case 'n':
+        kernels = atoi(optarg);
+        break;
+      case 'g':
+        gap_ms = atof(optarg);
+        break;
+      case 'c':
+        host_ms = atof(optarg);
+        break;
+      case 't':
+        seconds = atof(optarg);
+        break;
+      case 'm':
+        alloc_mb = strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        streams = std::max(1, atoi(optarg));
+        break;
+      case 'd':
+        default_stream = false;
+        break;
+      case 'r':
+        runtime_api = true;
+        break;
+      default:
+        printf("usage: %s [options]\n", argv[0]);
+        puts("    -k KERNEL_MS    simulated duration of each kernel (default 1)");
+        puts("    -n KERNELS      kernels per burst (default 10)");
+        puts("    -g GAP_MS       idle time between bursts (default 0)");
+        puts("    -c HOST_MS      host work after launching a burst, before its sync (default 0)");
+        puts("    -t SECONDS      run time (default 5)");
+        puts("    -m MIB          device memory to allocate in 1 MiB pieces (default 0)");
+        puts("    -s STREAMS      spread kernels over streams, the first is the default stream");
+        puts("    -d              use non-blocking streams only, no default stream");
+        puts("    -r              launch through the runtime API");
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  std::vector<CUdeviceptr> buffers;
+  for (size_t i = 0; i < alloc_mb; i++) {
+    CUdeviceptr ptr;
+    CUresult rc = cuMemAlloc(&ptr, 1 << 20);
+    if (rc != CUDA_SUCCESS) {
+      fprintf(stderr, "cuMemAlloc failed after %zu MiB: %d\n", i, rc);
+      return 1;
+    }
+    buffers.push_back(ptr);
+  }
+
+  std::vector<CUstream> stream_list(streams, nullptr);
+  for (int s = default_stream ? 1 : 0; s < streams; s++)
+    cuStreamCreate(&stream_list[s], CU_STREAM_NON_BLOCKING);
+  CUfunction kernel = stub_function(kernel_ms);
+
+  // host time per launch call, including waits for tokens
+  std::vector<long long> launch_ns;
+  long long bursts = 0;
+  auto begin = steady_clock::now(), deadline = begin + nanoseconds((long long)(seconds * 1e9));
+  while (steady_clock::now() < deadline) {
+    for (int k = 0; k < kernels; k++) {
+      CUstream stream = stream_list[k % streams];
+      auto call = steady_clock::now();
+      if (runtime_api)
+        cudaLaunchKernel((const void *)kernel, dim3(1), dim3(256), nullptr, 0, stream);
+      else
+        cuLaunchKernel(kernel, 1, 1, 1, 256, 1, 1, 0, stream, nullptr, nullptr);
+      launch_ns.push_back(duration_cast<nanoseconds>(steady_clock::now() - call).count());
+    }
+    // preprocessing of the next batch, say, overlapping the burst
+    auto host_end = steady_clock::now() + nanoseconds((long long)(host_ms * 1e6));
+    while (steady_clock::now() < host_end) {
+    }
+    cuCtxSynchronize();
+    bursts++;
+    if (gap_ms > 0.0) usleep((useconds_t)(gap_ms * 1e3));
+  }
+  double wall_ms = duration_cast<nanoseconds>(steady_clock::now() - begin).count() / 1e6;
+
+  for (CUdeviceptr ptr : buffers) cuMemFree(ptr);
+  for (int s = default_stream ? 1 : 0; s < streams; s++) cuStreamDestroy(stream_list[s]);
+
+  std::vector<long long> sorted = launch_ns;
+  std::sort(sorted.begin(), sorted.end());
+  long long total = 0;
+  for (long long ns : launch_ns) total += ns;
+  size_t n = sorted.size();
+  printf("launches=%zu bursts=%lld gpu_ms=%.3f wall_ms=%.3f launch_p50_ns=%lld "
+         "launch_mean_ns=%.1f launch_p99_ns=%lld launch_max_ns=%lld\n",
+         n, bursts, n * kernel_ms, wall_ms, n ? sorted[n / 2] : 0, n ? (double)total / n : 0.0,
+         n ? sorted[n * 99 / 100] : 0, n ? sorted[n - 1] : 0);
+  return 0;
+}
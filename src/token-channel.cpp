@@ -0,0 +1,211 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Shared-memory token channel between Pod manager and hook libraries.
+ * The control block lives in a POSIX shared memory object created by Pod manager. Checking the
+ * share of the Pod quota granted to a process is a plain atomic load, and asking for the next one
+ * is a futex wake/wait pair, so no socket is involved on either path.
+ */
+
+#include "token-channel.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <new>
+
+static int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+static int futex_wake(std::atomic<uint32_t> *addr, int count) {
+  return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+static void atomic_max(std::atomic<uint64_t> &target, uint64_t value) {
+  uint64_t current = target.load(std::memory_order_relaxed);
+  while (current < value && !target.compare_exchange_weak(current, value)) continue;
+}
+
+uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static token_channel_t *map_channel(const char *name, int oflag) {
+  int fd = shm_open(name, oflag, 0666);
+  if (fd == -1) return nullptr;
+  if ((oflag & O_CREAT) && ftruncate(fd, sizeof(token_channel_t)) == -1) {
+    close(fd);
+    return nullptr;
+  }
+  void *addr = mmap(nullptr, sizeof(token_channel_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return nullptr;
+  return (token_channel_t *)addr;
+}
+
+/**
+ * Create the control block of a Pod, replacing the one left by a previous Pod manager.
+ * @param name name of the shared memory object, e.g. "/gemini-<pod name>"
+ * @return mapped control block, nullptr with errno set on failure
+ */
+token_channel_t *token_channel_create(const char *name) {
+  shm_unlink(name);
+  token_channel_t *ch = map_channel(name, O_RDWR | O_CREAT | O_EXCL);
+  if (ch == nullptr) return nullptr;
+  new (ch) token_channel_t();
+  ch->overuse_ns.store(0);
+  ch->request_seq.store(0);
+  ch->acquire_seq.store(0);
+  for (auto &slot : ch->slots) {
+    slot.pid.store(0);
+    slot.burst_ns.store(0);
+    slot.overuse_ns.store(0);
+    slot.deadline_ns.store(0);
+    slot.request_seq.store(0);
+    slot.grant_seq.store(0);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  ch->magic = TOKEN_CHANNEL_MAGIC;
+  return ch;
+}
+
+// block until some hook asks for its share, return the new request sequence number
+// seen should start from 0, the initial value of request_seq
+uint32_t token_channel_wait_request(token_channel_t *ch, uint32_t seen) {
+  uint32_t seq;
+  while ((seq = ch->request_seq.load(std::memory_order_acquire)) == seen) {
+    futex_wait(&ch->request_seq, seen);
+  }
+  return seq;
+}
+
+// as token_channel_wait_request(), for the hook in slot only
+uint32_t token_channel_wait_slot(token_channel_t *ch, int slot, uint32_t seen) {
+  std::atomic<uint32_t> &request_seq = ch->slots[slot].request_seq;
+  uint32_t seq;
+  while ((seq = request_seq.load(std::memory_order_acquire)) == seen) {
+    futex_wait(&request_seq, seen);
+  }
+  return seq;
+}
+
+// longest kernel burst among living hook processes (ms)
+double token_channel_max_burst(token_channel_t *ch) {
+  uint64_t burst = 0;
+  for (auto &slot : ch->slots) {
+    int32_t pid = slot.pid.load(std::memory_order_relaxed);
+    if (pid == 0) continue;
+    if (kill(pid, 0) == -1 && errno == ESRCH) {
+      // process exited without leaving the channel
+      slot.burst_ns.store(0, std::memory_order_relaxed);
+      slot.pid.compare_exchange_strong(pid, 0);
+      continue;
+    }
+    burst = std::max(burst, slot.burst_ns.load(std::memory_order_relaxed));
+  }
+  return burst / 1e6;
+}
+
+// max overuse reported since last call (ms)
+double token_channel_take_overuse(token_channel_t *ch) {
+  return ch->overuse_ns.exchange(0) / 1e6;
+}
+
+// acquires so far, of any hook
+uint32_t token_channel_acquires(token_channel_t *ch) {
+  return ch->acquire_seq.load(std::memory_order_relaxed);
+}
+
+// grant the hook in slot quota_ms of the Pod quota from now and wake it up
+void token_channel_grant(token_channel_t *ch, int slot, double quota_ms) {
+  token_slot_t &s = ch->slots[slot];
+  s.deadline_ns.store(monotonic_ns() + (uint64_t)(std::max(quota_ms, 0.0) * 1e6),
+                      std::memory_order_release);
+  s.grant_seq.fetch_add(1, std::memory_order_release);
+  futex_wake(&s.grant_seq, INT32_MAX);
+}
+
+/**
+ * Map the control block created by Pod manager.
+ * @return mapped control block, nullptr if it does not exist or is not initialized
+ */
+token_channel_t *token_channel_open(const char *name) {
+  token_channel_t *ch = map_channel(name, O_RDWR);
+  if (ch == nullptr) return nullptr;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (ch->magic != TOKEN_CHANNEL_MAGIC) {
+    munmap(ch, sizeof(token_channel_t));
+    return nullptr;
+  }
+  return ch;
+}
+
+// claim a statistics slot for this process, -1 if all slots are taken
+int token_channel_join(token_channel_t *ch) {
+  int32_t pid = getpid();
+  for (int i = 0; i < TOKEN_CHANNEL_SLOTS; i++) {
+    int32_t expected = 0;
+    if (ch->slots[i].pid.compare_exchange_strong(expected, pid)) {
+      ch->slots[i].deadline_ns.store(0, std::memory_order_release);  // left by a process gone
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Get what is left of the share of this process, asking Pod manager for the next one if the next
+ * burst does not fit.
+ * @param slot slot of this process from token_channel_join()
+ * @param overuse_ms overuse of the previous quota
+ * @param burst_ms predicted duration of the next kernel burst
+ * @return remaining quota (ms)
+ */
+double token_channel_acquire(token_channel_t *ch, int slot, double overuse_ms, double burst_ms) {
+  token_slot_t &s = ch->slots[slot];
+  uint64_t burst_ns = burst_ms * 1e6;
+  s.burst_ns.store(burst_ns, std::memory_order_relaxed);
+  if (overuse_ms > 0) atomic_max(ch->overuse_ns, overuse_ms * 1e6);
+  ch->acquire_seq.fetch_add(1, std::memory_order_relaxed);
+
+  uint32_t grant = s.grant_seq.load(std::memory_order_acquire);
+  uint64_t now = monotonic_ns();
+  uint64_t deadline = s.deadline_ns.load(std::memory_order_acquire);
+  if (now + burst_ns > deadline) {
+    // slow path: Pod manager takes the share from the split of the Pod quota, as for a socket
+    s.overuse_ns.store(std::max(overuse_ms, 0.0) * 1e6, std::memory_order_relaxed);
+    s.request_seq.fetch_add(1, std::memory_order_release);
+    futex_wake(&s.request_seq, 1);
+    ch->request_seq.fetch_add(1, std::memory_order_release);
+    futex_wake(&ch->request_seq, 1);
+    while (s.grant_seq.load(std::memory_order_acquire) == grant) futex_wait(&s.grant_seq, grant);
+    now = monotonic_ns();
+    deadline = s.deadline_ns.load(std::memory_order_acquire);
+  }
+  return ((double)deadline - (double)now) / 1e6;
+}
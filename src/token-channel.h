@@ -0,0 +1,71 @@
+/**
+ * Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CUHOOK_TOKEN_CHANNEL_H_
+#define _CUHOOK_TOKEN_CHANNEL_H_
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "token channel requires lock-free atomics in shared memory");
+
+const uint32_t TOKEN_CHANNEL_MAGIC = 0x544b4348;  // "TKCH"
+const int TOKEN_CHANNEL_SLOTS = 64;               // hook processes per Pod
+
+// statistics and quota of a single hook process
+struct token_slot_t {
+  std::atomic<int32_t> pid;  // 0 if the slot is free
+  std::atomic<uint64_t> burst_ns;
+  std::atomic<uint64_t> overuse_ns;   // overuse reported with the last request
+  std::atomic<uint64_t> deadline_ns;  // expiration of the share granted, CLOCK_MONOTONIC
+  std::atomic<uint32_t> request_seq;  // futex word, bumped by the hook asking for its share
+  std::atomic<uint32_t> grant_seq;    // futex word, bumped by Pod manager after each grant
+};
+
+/**
+ * Pod quota shared between Pod manager and hook libraries of a Pod.
+ * Hooks check the deadline of their share directly; only when it is about to expire they bump
+ * request_seq of their slot and of the channel, and sleep on grant_seq of their slot (futex) until
+ * Pod manager grants them a new share of the Pod quota.
+ */
+struct token_channel_t {
+  uint32_t magic;
+  std::atomic<uint64_t> overuse_ns;   // max overuse reported since the last renewal
+  std::atomic<uint32_t> request_seq;  // futex word, bumped by hooks asking for their share
+  std::atomic<uint32_t> acquire_seq;  // bumped by every acquire, tells Pod manager the Pod is active
+  token_slot_t slots[TOKEN_CHANNEL_SLOTS];
+};
+
+uint64_t monotonic_ns();
+
+// Pod manager side
+token_channel_t *token_channel_create(const char *name);
+uint32_t token_channel_wait_request(token_channel_t *ch, uint32_t seen);
+uint32_t token_channel_wait_slot(token_channel_t *ch, int slot, uint32_t seen);
+double token_channel_max_burst(token_channel_t *ch);
+double token_channel_take_overuse(token_channel_t *ch);
+uint32_t token_channel_acquires(token_channel_t *ch);
+void token_channel_grant(token_channel_t *ch, int slot, double quota_ms);
+
+// hook library side
+token_channel_t *token_channel_open(const char *name);
+int token_channel_join(token_channel_t *ch);
+double token_channel_acquire(token_channel_t *ch, int slot, double overuse_ms, double burst_ms);
+
+#endif
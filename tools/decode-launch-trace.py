@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""
+ Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+"""
+
+# Decode a launch trace ring written by the hook library (CU_HOOK_TRACE, src/launch-trace.h):
+# print per-burst statistics and optionally write Chrome trace JSON (chrome://tracing, Perfetto).
+# A burst runs from the first kernel launch after a sync point to the next sync point.
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = 0x4543415254534c47
+HEADER = struct.Struct('<QIIQQQi20x')
+RECORD = struct.Struct('<QQQQd3I3HHI')
+LAUNCH, SYNC, TOKEN_REQUEST, TOKEN_GRANT = 1, 2, 3, 4
+
+
+def read_trace(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    magic, version, record_size, capacity, written, offset_ns, pid = HEADER.unpack_from(data)
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        sys.exit(f'{path}: not a launch trace (version 1)')
+    records = []
+    for idx in range(max(0, written - capacity), written):
+        pos = HEADER.size + (idx % capacity) * RECORD.size
+        time_ns, seq, func, stream, value, *rest = RECORD.unpack_from(data, pos)
+        if seq != idx + 1:
+            continue  # overwritten or being written
+        grid, block, (rtype, tid) = rest[0:3], rest[3:6], rest[6:8]
+        records.append((time_ns, rtype, tid, func, stream, tuple(grid), tuple(block), value))
+    records.sort(key=lambda r: r[0])
+    return pid, offset_ns, written, capacity, records
+
+
+def bursts_of(records):
+    """@return list of (start ns, end ns, kernel count)"""
+    bursts = []
+    start, kernels = None, 0
+    for time_ns, rtype, *_ in records:
+        if rtype == LAUNCH:
+            if start is None:
+                start = time_ns
+            kernels += 1
+        elif rtype == SYNC and start is not None:
+            bursts.append((start, time_ns, kernels))
+            start, kernels = None, 0
+    return bursts
+
+
+def tokens_of(records):
+    """@return list of (request ns, grant ns, estimated burst ms, quota ms), per requesting thread"""
+    pending, tokens = {}, []
+    for time_ns, rtype, tid, func, stream, grid, block, value in records:
+        if rtype == TOKEN_REQUEST:
+            pending[tid] = (time_ns, value)
+        elif rtype == TOKEN_GRANT and tid in pending:
+            req_ns, burst = pending.pop(tid)
+            tokens.append((req_ns, time_ns, burst, value))
+    return tokens
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, max(0, int(p * len(values) + 0.5) - 1))]
+
+
+def summarize(name, values, unit):
+    if not values:
+        return
+    mean = sum(values) / len(values)
+    print(f'{name:<22} {len(values):>8} {mean:>12.3f} {percentile(values, 0.5):>12.3f} '
+          f'{percentile(values, 0.9):>12.3f} {percentile(values, 0.99):>12.3f} '
+          f'{max(values):>12.3f}  {unit}')
+
+
+def chrome_trace(pid, offset_ns, records, bursts, tokens):
+    us = lambda ns: (ns + offset_ns) / 1e3  # wall-clock microseconds
+    events = [
+        {'name': 'process_name', 'ph': 'M', 'pid': pid, 'args': {'name': f'hook {pid}'}},
+        {'name': 'thread_name', 'ph': 'M', 'pid': pid, 'tid': 0, 'args': {'name': 'bursts'}},
+        {'name': 'thread_name', 'ph': 'M', 'pid': pid, 'tid': 1, 'args': {'name': 'tokens'}},
+    ]
+    for start, end, kernels in bursts:
+        events.append({'name': 'burst', 'ph': 'X', 'pid': pid, 'tid': 0, 'ts': us(start),
+                       'dur': (end - start) / 1e3, 'args': {'kernels': kernels}})
+    for req_ns, grant_ns, burst, quota in tokens:
+        events.append({'name': 'token wait', 'ph': 'X', 'pid': pid, 'tid': 1, 'ts': us(req_ns),
+                       'dur': (grant_ns - req_ns) / 1e3, 'args': {'estimated burst ms': burst}})
+        events.append({'name': 'quota', 'ph': 'X', 'pid': pid, 'tid': 1, 'ts': us(grant_ns),
+                       'dur': quota * 1e3, 'args': {'quota ms': quota}})
+    for time_ns, rtype, tid, func, stream, grid, block, value in records:
+        if rtype == LAUNCH:
+            events.append({'name': f'kernel {func:#x}', 'ph': 'i', 's': 't', 'pid': pid,
+                           'tid': tid, 'ts': us(time_ns),
+                           'args': {'grid': grid, 'block': block, 'stream': f'{stream:#x}'}})
+        elif rtype == SYNC:
+            events.append({'name': 'sync', 'ph': 'i', 's': 't', 'pid': pid, 'tid': tid,
+                           'ts': us(time_ns)})
+    return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('trace', help='ring file, CU_HOOK_TRACE prefix followed by the pid')
+    parser.add_argument('--chrome', metavar='JSON', help='write Chrome trace JSON')
+    args = parser.parse_args()
+
+    pid, offset_ns, written, capacity, records = read_trace(args.trace)
+    bursts = bursts_of(records)
+    tokens = tokens_of(records)
+    launches = sum(1 for r in records if r[1] == LAUNCH)
+    print(f'pid {pid}: {written} records written, {len(records)} decoded '
+          f'(ring of {capacity}), {launches} launches, {len(bursts)} bursts')
+
+    print(f'{"":<22} {"count":>8} {"mean":>12} {"p50":>12} {"p90":>12} {"p99":>12} {"max":>12}')
+    summarize('burst length', [(e - s) / 1e6 for s, e, _ in bursts], 'ms')
+    summarize('kernels per burst', [k for _, _, k in bursts], '')
+    summarize('gap between bursts', [(b[0] - a[1]) / 1e6 for a, b in zip(bursts, bursts[1:])],
+              'ms')
+    summarize('token wait', [(g - r) / 1e6 for r, g, _, _ in tokens], 'ms')
+    summarize('estimated burst', [b for _, _, b, _ in tokens], 'ms')
+    summarize('quota', [q for _, _, _, q in tokens], 'ms')
+
+    if args.chrome:
+        with open(args.chrome, 'w') as f:
+            json.dump(chrome_trace(pid, offset_ns, records, bursts, tokens), f)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,53 @@
+#!/usr/bin/env python3
+"""
+ Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+"""
+
+# Generate a workload trace for gem-sim: Poisson job arrivals per client.
+# Output lines: <arrival ms> <client> <GPU time ms> <kernel burst ms> <overuse ms>
+
+import argparse
+import random
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('clients', nargs='+', help='client names, as in the resource config')
+    parser.add_argument('--duration', type=float, default=60000, help='ms of arrivals')
+    parser.add_argument('--interval', type=float, default=500, help='mean ms between jobs')
+    parser.add_argument('--work', type=float, default=200, help='mean GPU ms per job')
+    parser.add_argument('--burst', type=float, default=5, help='mean kernel burst ms')
+    parser.add_argument('--seed', type=int, default=0)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    jobs = []
+    for client in args.clients:
+        t = rng.expovariate(1 / args.interval)
+        while t < args.duration:
+            work = rng.expovariate(1 / args.work)
+            burst = rng.uniform(0.5, 1.5) * args.burst
+            # the last kernel of a token runs past the quota by part of a burst
+            overuse = rng.uniform(0, burst)
+            jobs.append((t, client, work, burst, overuse))
+            t += rng.expovariate(1 / args.interval)
+
+    jobs.sort()
+    for t, client, work, burst, overuse in jobs:
+        print(f'{t:.3f} {client} {work:.3f} {burst:.3f} {overuse:.3f}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+ Copyright 2020 Hung-Hsin Chen, LSA Lab, National Tsing Hua University
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+"""
+
+# Run workloads on the stub CUDA driver (make stub) under the real hook library, Pod managers and
+# scheduler, on any Linux host. Reports per-client GPU share against the requested share, host
+# time per intercepted launch against an unhooked run, and token waits from the launch trace.
+# Every workload simulates a GPU of its own; the scheduler alone keeps them from overlapping.
+
+import argparse
+import importlib.util
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+SRC = os.path.join(TOOLS, '..', 'src')
+
+spec = importlib.util.spec_from_file_location('decode',
+                                              os.path.join(TOOLS, 'decode-launch-trace.py'))
+decode = importlib.util.module_from_spec(spec)
+spec.loader.exec_module(decode)
+
+
+def parse_client(text):
+    """NAME:REQUEST:LIMIT[:SM[:MEMORY]]"""
+    fields = text.split(':')
+    if len(fields) < 3:
+        raise argparse.ArgumentTypeError(f'{text}: expected NAME:REQUEST:LIMIT[:SM[:MEMORY]]')
+    name, request, limit = fields[0], float(fields[1]), float(fields[2])
+    sm = int(fields[3]) if len(fields) > 3 else 100
+    memory = int(fields[4]) if len(fields) > 4 else 1 << 30
+    return name, request, limit, sm, memory
+
+
+def parse_stats(line):
+    return {k: float(v) for k, v in (field.split('=') for field in line.split())}
+
+
+def wait_for(path, proc, timeout=10.0):
+    deadline = time.time() + timeout
+    while not os.path.exists(path):
+        if proc.poll() is not None or time.time() > deadline:
+            sys.exit(f'{path} did not appear, see logs in {os.path.dirname(path)}')
+        time.sleep(0.05)
+
+
+def run_workload(args, env, log):
+    cmd = [os.path.join(args.stub, 'gem-stub-workload'), '-t', str(args.seconds)] + args.workload
+    return subprocess.Popen(cmd, env=env, stdout=subprocess.PIPE, stderr=log, text=True)
+
+
+def jain(values):
+    return sum(values) ** 2 / (len(values) * sum(v * v for v in values)) if values else 0.0
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('clients', nargs='+', type=parse_client, metavar='NAME:REQUEST:LIMIT',
+                        help='a Pod running one workload, [:SM[:MEMORY]] appended optionally')
+    parser.add_argument('-t', '--seconds', type=float, default=10.0, help='workload run time')
+    parser.add_argument('-w', '--workload', default='-k 1 -n 10',
+                        help='gem-stub-workload options (default "-k 1 -n 10")')
+    parser.add_argument('-P', '--processes', default='1', metavar='WEIGHT[,WEIGHT...]',
+                        help='run a workload per weight in every Pod (CU_HOOK_WEIGHT)')
+    parser.add_argument('-s', '--scheduler-args', default='-e', help='extra gem-schd options')
+    parser.add_argument('--bin', default=SRC, help='directory of gem-schd and gem-pmgr')
+    parser.add_argument('--stub', default=os.path.join(SRC, 'stub'),
+                        help='directory of the stub build')
+    parser.add_argument('--keep', action='store_true', help='keep logs and traces')
+    args = parser.parse_args()
+    args.workload = args.workload.split()
+    weights = [float(w) for w in args.processes.split(',')]
+
+    work = tempfile.mkdtemp(prefix='stub-harness.')
+    procs = []
+    try:
+        with open(os.path.join(work, 'resource-config.txt'), 'w') as f:
+            f.write(f'{len(args.clients)}\n')
+            for name, request, limit, sm, memory in args.clients:
+                f.write(f'{name} {request} {limit} {sm} {memory}\n')
+
+        schd_sock = os.path.join(work, 'schd.sock')
+        schd = subprocess.Popen([os.path.join(args.bin, 'gem-schd'), '-u', schd_sock, '-p', work,
+                                 '-f', 'resource-config.txt'] + args.scheduler_args.split(),
+                                stdout=open(os.path.join(work, 'schd.log'), 'w'),
+                                stderr=subprocess.STDOUT)
+        procs.append(schd)
+        wait_for(schd_sock, schd)
+
+        pod_socks = {}
+        for name, *_ in args.clients:
+            pod_socks[name] = os.path.join(work, f'{name}.sock')
+            env = dict(os.environ, POD_NAME=name, POD_MANAGER_SOCKET=pod_socks[name],
+                       SCHEDULER_SOCKET=schd_sock)
+            pmgr = subprocess.Popen([os.path.join(args.bin, 'gem-pmgr')], env=env,
+                                    stdout=open(os.path.join(work, f'{name}.pmgr.log'), 'w'),
+                                    stderr=subprocess.STDOUT)
+            procs.append(pmgr)
+            wait_for(pod_socks[name], pmgr)
+
+        # interception overhead is the difference to the same workload without the hook
+        base_args = argparse.Namespace(**vars(args))
+        base_args.seconds = min(args.seconds, 2.0)
+        with open(os.path.join(work, 'baseline.log'), 'w') as log:
+            base = run_workload(base_args, dict(os.environ), log)
+            baseline = parse_stats(base.communicate()[0])
+
+        # processes of a Pod are named NAME/INDEX when there are several
+        workloads = {}
+        for name, *_ in args.clients:
+            for i, weight in enumerate(weights):
+                proc_name = name if len(weights) == 1 else f'{name}/{i}'
+                env = dict(os.environ, POD_MANAGER_SOCKET=pod_socks[name],
+                           LD_PRELOAD=os.path.join(args.stub, 'libgemhook.so.1'),
+                           CU_HOOK_TRACE=os.path.join(work, f'{name}.{i}.trace'),
+                           CU_HOOK_WEIGHT=str(weight))
+                log = open(os.path.join(work, f'{name}.{i}.log'), 'w')
+                workloads[proc_name] = (name, i, run_workload(args, env, log))
+        stats = {}
+        for proc_name, (name, i, proc) in workloads.items():
+            out = proc.communicate()[0]
+            if proc.returncode != 0 or not out:
+                sys.exit(f'{proc_name} failed with {proc.returncode}, see {work}/{name}.{i}.log')
+            stats[proc_name] = parse_stats(out)
+            _, _, _, _, records = decode.read_trace(
+                os.path.join(work, f'{name}.{i}.trace.{proc.pid}'))
+            stats[proc_name]['token_wait'] = [(g - r) / 1e6
+                                              for r, g, _, _ in decode.tokens_of(records)]
+
+        print(f'{len(args.clients)} clients, {args.seconds:g} s, '
+              f'workload: {" ".join(args.workload)}')
+        print(f'unhooked launch: p50 {baseline["launch_p50_ns"]:.0f} ns')
+        print(f'{"client":<12} {"request":>8} {"limit":>6} {"share":>6} {"bursts/s":>9} '
+              f'{"launch p50":>11} {"overhead":>9} {"launch max":>11} {"tokens":>7} '
+              f'{"wait mean":>10} {"wait p99":>9}')
+        normalized = []
+        for name, request, limit, _, _ in args.clients:
+            pod_share = 0.0
+            for proc_name, (pod, _, _) in workloads.items():
+                if pod != name:
+                    continue
+                s = stats[proc_name]
+                share = s['gpu_ms'] / s['wall_ms']
+                pod_share += share
+                waits = s['token_wait']
+                mean_wait = sum(waits) / len(waits) if waits else 0.0
+                overhead = s['launch_p50_ns'] - baseline['launch_p50_ns']
+                print(f'{proc_name:<12} {request:>8.2f} {limit:>6.2f} {share:>6.3f} '
+                      f'{s["bursts"] / s["wall_ms"] * 1e3:>9.1f} '
+                      f'{s["launch_p50_ns"]:>8.0f} ns {overhead:>6.0f} ns '
+                      f'{s["launch_max_ns"] / 1e6:>8.2f} ms {len(waits):>7} '
+                      f'{mean_wait:>7.2f} ms {decode.percentile(waits, 0.99):>6.2f} ms')
+            normalized.append(pod_share / request)
+        print(f'Jain fairness of share/request: {jain(normalized):.3f}')
+    finally:
+        for proc in procs:
+            proc.terminate()
+        for proc in procs:
+            proc.wait()
+        if args.keep:
+            print(f'logs and traces in {work}')
+        else:
+            shutil.rmtree(work, ignore_errors=True)
+
+
+if __name__ == '__main__':
+    main()